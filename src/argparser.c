@@ -369,6 +369,26 @@ llist_t* parseCmdLine(int argc, char* argv[], optdef_t options[], int optlen){
 }
 
 
+/**
+ * @brief Joins ALL the arguments in args (as split by splitArgs) back into a
+ * single comma-separated string, e.g. for a list of servers (see openConnection).
+ * @return Heap-allocated string on success, NULL on error (args is NULL or empty, ENOMEM).
+ */
+char* joinArgs(llist_t* args){
+	if (!args || (args->size == 0)){ errno = EINVAL; return NULL; }
+	llistnode_t* node;
+	size_t len = 0;
+	llist_foreach(args, node) len += strlen((char*)node->datum) + 1;
+	char* str = calloc(len, 1); /* Empty string */
+	if (!str){ errno = ENOMEM; return NULL; }
+	llist_foreach(args, node){
+		if (str[0]) strcat(str, ",");
+		strcat(str, (char*)node->datum);
+	}
+	return str;
+}
+
+
 /**
  * @brief Prints out a formatted help message for each option definition provided.
  * @param progname -- Name of the calling program (e.g., argv[0]).
@@ -0,0 +1,583 @@
+/**
+ * @brief Benchmark program: N threads, each one with M connections to the
+ * server (used in round-robin), run for a fixed time a random mix of read
+ * (fetchFile), write (lockFile + removeFile + putFile on an existing file),
+ * append (openFile + appendToFile + closeFile) and lock (lockFile +
+ * unlockFile) operations on a set of files whose popularity follows a Zipf
+ * distribution. Files are created in a local directory with sizes chosen
+ * from a log-uniform distribution and uploaded to the server before the
+ * measurement starts. At the end, it reports throughput and latency
+ * percentiles of each operation, optionally also as a JSON file.
+ *
+ * @author Salvatore Correnti.
+ */
+#include <defines.h>
+#include <util.h>
+#include <dir_utils.h>
+#include <client_server_API.h>
+#include <argparser.h>
+#include <histogram.h>
+#include <math.h>
+#include <time.h>
+
+
+/* Operations of the benchmark */
+#define OP_READ 0
+#define OP_WRITE 1
+#define OP_APPEND 2
+#define OP_LOCK 3
+#define OP_NUM 4
+
+/* Default parameters */
+#define BENCH_DFL_DURATION 10
+#define BENCH_DFL_KEYS 100
+#define BENCH_DFL_MINSIZE 1024
+#define BENCH_DFL_MAXSIZE 65536
+#define BENCH_DFL_APPEND 1024
+#define BENCH_DFL_THETA 0.99
+#define BENCH_DFL_SEED 1
+
+/* Template of the local directory of files (if -D is NOT provided) */
+#define BENCH_TMPDIR "/tmp/solbench.XXXXXX"
+
+/* Parameters for openConnection (as in client.c) */
+#define MSEC_DELAY_OPENCONN 1000
+#define SEC_MAXTIME_OPENCONN 10
+
+/* Size of the buffer for writing local files */
+#define BENCH_WRITEBUF 65536
+
+static char* opNames[] = {"read", "write", "append", "lock"};
+
+
+/**
+ * @brief A benchmark thread (see bench_worker).
+ */
+typedef struct bworker_s {
+	pthread_t tid;
+	int id;
+	clientconn_t** conns; /* Connections of this thread */
+	uint64_t rng; /* State of the random number generator */
+	hist_t* hists[OP_NUM]; /* Latencies (in ns) of successful operations */
+	long errors[OP_NUM]; /* Operations failed on server (e.g. file evicted) */
+	int ret; /* Result of the worker */
+} bworker_t;
+
+
+/**
+ * @brief Parameters and shared state of the benchmark.
+ */
+typedef struct bench_s {
+	char* sockname; /* Joined by joinArgs */
+	long threads;
+	long conns; /* Connections per thread */
+	long duration; /* Seconds */
+	long nkeys;
+	long mix[OP_NUM]; /* Ratios of operations */
+	long minsize;
+	long maxsize;
+	long appendSize;
+	float theta; /* Exponent of the Zipf distribution (0 for uniform) */
+	long seed;
+	char* dirname; /* Local directory of files (NULL for a temporary one) */
+	char* outpath; /* JSON output file (NULL if none) */
+
+	char** keys; /* Absolute paths of files */
+	double* cdf; /* Cumulative distribution of key popularity */
+	void* appendBuf;
+	pthread_barrier_t start; /* Threads start together once connected */
+	int stop;
+} bench_t;
+
+static bench_t bench;
+
+
+/* Checks that args contains a single non-negative floating-point number */
+static bool oneFPNumber(llist_t* args){
+	float f;
+	if (!args || (args->size != 1)) return false;
+	return (getFloat(args->head->datum, &f) == 0) && (f >= 0.0);
+}
+
+
+/**
+ * @brief Global array that contains all accepted options.
+ */
+optdef_t options[] = {
+	{"-h", 0, 0, allNumbers, true, NULL, "Shows this help message and exits"},
+
+	{"-f", 1, -1, allPaths, true, "filename[,filename]", "name of the socket to connect with (or list of servers among which files are sharded, see openConnection)"},
+
+	{"-t", 1, 1, allNumbers, true, "num", "number of threads (default 1)"},
+
+	{"-c", 1, 1, allNumbers, true, "num", "number of connections opened by each thread and used in round-robin (default 1)"},
+
+	{"-d", 1, 1, allNumbers, true, "sec", "duration (in seconds) of the measurement (default 10)"},
+
+	{"-k", 1, 1, allNumbers, true, "num", "number of files (default 100)"},
+
+	{"-m", 4, 4, allNumbers, true, "read,write,append,lock",
+		"ratios of read/write/append/lock operations (default 70,10,10,10): a write replaces the file (lock + remove + put), a lock is a lock + unlock"},
+
+	{"-s", 1, 2, allNumbers, true, "min[,max]", "minimum and maximum size (in bytes) of files, chosen with a log-uniform distribution (default 1024,65536)"},
+
+	{"-a", 1, 1, allNumbers, true, "num", "bytes written by each append operation (default 1024)"},
+
+	{"-z", 1, 1, oneFPNumber, true, "theta", "exponent of the Zipf distribution of file popularity, 0 for uniform (default 0.99)"},
+
+	{"-D", 1, 1, allPaths, true, "dirname", "existing directory in which files are created (default: a temporary directory, removed at the end)"},
+
+	{"-o", 1, 1, allPaths, true, "filename", "file in which to write the results in JSON format"},
+
+	{"-S", 1, 1, allNumbers, true, "num", "seed of the random number generators (default 1)"},
+};
+
+/* Length of options array */
+int optlen = 13;
+
+
+/* ********************** STATIC OPERATIONS ********************** */
+
+/* xorshift64* generator */
+static uint64_t bench_rand(uint64_t* state){
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+/* Uniform random number in [0, 1) */
+static double bench_uniform(uint64_t* state){
+	return (double)(bench_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/* Nanoseconds of the monotonic clock */
+static uint64_t bench_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/* Index of a key chosen with the Zipf distribution (binary search on cdf) */
+static long bench_key(uint64_t* state){
+	double u = bench_uniform(state);
+	long lo = 0, hi = bench.nkeys - 1;
+	while (lo < hi){
+		long mid = lo + (hi - lo) / 2;
+		if (bench.cdf[mid] < u) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+
+/* An operation chosen with the ratios of bench.mix */
+static int bench_op(uint64_t* state){
+	long total = 0;
+	for (int i = 0; i < OP_NUM; i++) total += bench.mix[i];
+	long r = (long)(bench_rand(state) % (uint64_t)total);
+	for (int i = 0; i < OP_NUM; i++){
+		if (r < bench.mix[i]) return i;
+		r -= bench.mix[i];
+	}
+	return OP_READ;
+}
+
+
+/**
+ * @brief Creates the local file #pathname with #size pseudo-random bytes.
+ * @return 0 on success, -1 on error (errno set by open/writen/close).
+ */
+static int bench_mkfile(char* pathname, size_t size, uint64_t* state){
+	uint64_t buf[BENCH_WRITEBUF / sizeof(uint64_t)];
+	int fd = open(pathname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) return -1;
+	while (size > 0){
+		size_t n = (size < sizeof(buf) ? size : sizeof(buf));
+		for (size_t i = 0; i < sizeof(buf) / sizeof(uint64_t); i++) buf[i] = bench_rand(state);
+		if (writen(fd, buf, n) == -1){
+			close(fd);
+			return -1;
+		}
+		size -= n;
+	}
+	return close(fd);
+}
+
+
+/**
+ * @brief Creates the local directory (if needed) and files, the Zipf
+ * distribution and the buffer for appends.
+ * @return 0 on success, -1 on error.
+ */
+static int bench_prepare(void){
+	static char tmpdir[] = BENCH_TMPDIR;
+	char* dir = bench.dirname;
+	if (!dir){
+		if (!(dir = mkdtemp(tmpdir))){ perror("mkdtemp"); return -1; }
+	}
+	char realdir[MAXPATHSIZE];
+	if (realpath(dir, realdir) == NULL){ perror("realpath"); return -1; }
+	bench.dirname = (bench.dirname ? bench.dirname : dir);
+
+	bench.keys = calloc(bench.nkeys, sizeof(char*));
+	bench.cdf = calloc(bench.nkeys, sizeof(double));
+	bench.appendBuf = malloc(bench.appendSize > 0 ? bench.appendSize : 1);
+	if (!bench.keys || !bench.cdf || !bench.appendBuf){ errno = ENOMEM; perror("bench_prepare"); return -1; }
+	memset(bench.appendBuf, 'a', (bench.appendSize > 0 ? bench.appendSize : 1));
+
+	uint64_t state = (uint64_t)bench.seed * 0x9E3779B97F4A7C15ULL + 1;
+	double lmin = log((double)bench.minsize + 1.0);
+	double lmax = log((double)bench.maxsize + 1.0);
+	double sum = 0.0;
+	for (long i = 0; i < bench.nkeys; i++){
+		size_t len = strlen(realdir) + 32;
+		bench.keys[i] = malloc(len);
+		if (!bench.keys[i]){ errno = ENOMEM; perror("bench_prepare"); return -1; }
+		snprintf(bench.keys[i], len, "%s/file%ld", realdir, i);
+		size_t size = (size_t)(exp(lmin + bench_uniform(&state) * (lmax - lmin)) - 1.0);
+		if (bench_mkfile(bench.keys[i], size, &state) == -1){ perror("bench_prepare: while creating file"); return -1; }
+		sum += 1.0 / pow((double)(i + 1), (double)bench.theta);
+		bench.cdf[i] = sum;
+	}
+	for (long i = 0; i < bench.nkeys; i++) bench.cdf[i] /= sum;
+	bench.cdf[bench.nkeys - 1] = 1.0;
+	return 0;
+}
+
+
+/* Removes local files (and the directory, if temporary) */
+static void bench_cleanup(bool tmpdir){
+	if (bench.keys){
+		for (long i = 0; i < bench.nkeys; i++){
+			if (bench.keys[i]){
+				unlink(bench.keys[i]);
+				free(bench.keys[i]);
+			}
+		}
+		free(bench.keys);
+	}
+	if (tmpdir && bench.dirname) rmdir(bench.dirname);
+	free(bench.cdf);
+	free(bench.appendBuf);
+}
+
+
+/**
+ * @brief Executes operation #op on file #pathname with the current connection.
+ * @return 0 on success, -1 on error (errno == EBADE for an error on server).
+ */
+static int bench_exec(int op, char* pathname){
+	switch (op){
+		case OP_READ: {
+			void* buf = NULL;
+			size_t size;
+			int res = fetchFile(pathname, &buf, &size);
+			free(buf);
+			return res;
+		}
+		case OP_WRITE: {
+			if (lockFile(pathname) == 0){
+				if ((removeFile(pathname) == -1) && (errno != EBADE)) return -1;
+			} else if (errno != EBADE) return -1; /* File does NOT exist */
+			return putFile(pathname, NULL);
+		}
+		case OP_APPEND: {
+			if (openFile(pathname, 0) == -1) return -1;
+			int res = appendToFile(pathname, bench.appendBuf, bench.appendSize, NULL);
+			int error = errno;
+			if ((closeFile(pathname) == -1) && (errno != EBADE)) return -1;
+			errno = error;
+			return res;
+		}
+		case OP_LOCK: {
+			if (lockFile(pathname) == -1) return -1;
+			return unlockFile(pathname);
+		}
+		default: { errno = EINVAL; return -1; }
+	}
+}
+
+
+/**
+ * @brief Benchmark thread: opens its connections, waits for the other
+ * threads and executes random operations until bench.stop is set.
+ * @note A worker that fails still waits on the starting barrier, so that
+ * the other ones are NOT blocked.
+ */
+static void* bench_worker(void* arg){
+	bworker_t* w = arg;
+	struct timespec abstime = {.tv_sec = SEC_MAXTIME_OPENCONN, .tv_nsec = 0};
+	long opened = 0;
+	w->ret = 0;
+	for (; opened < bench.conns; opened++){
+		if (!(w->conns[opened] = connCreate())){ w->ret = -1; break; }
+		connSelect(w->conns[opened]);
+		if (openConnection(bench.sockname, MSEC_DELAY_OPENCONN, abstime) == -1){
+			connSelect(NULL);
+			connDestroy(w->conns[opened]);
+			w->ret = -1;
+			break;
+		}
+	}
+	pthread_barrier_wait(&bench.start);
+	long next = 0;
+	while ((w->ret == 0) && !ATOMIC_GET(&bench.stop)){
+		int op = bench_op(&w->rng);
+		char* pathname = bench.keys[bench_key(&w->rng)];
+		connSelect(w->conns[next]);
+		next = (next + 1) % bench.conns;
+		uint64_t start = bench_now();
+		if (bench_exec(op, pathname) == 0) hist_record(w->hists[op], bench_now() - start);
+		else if (errno == EBADE) w->errors[op]++;
+		else {
+			fprintf(stderr, "bench_worker #%d: while executing %s on %s: %s\n", w->id, opNames[op], pathname, strerror(errno));
+			w->ret = -1;
+		}
+	}
+	for (long i = 0; i < opened; i++){
+		connSelect(w->conns[i]);
+		closeConnection(bench.sockname);
+		connSelect(NULL);
+		connDestroy(w->conns[i]);
+	}
+	return NULL;
+}
+
+
+/**
+ * @brief Uploads ALL the files to the server with a single pipelined
+ * sequence of compound requests (files already in the server are kept).
+ * @return 0 on success, -1 on error.
+ */
+static int bench_upload(void){
+	struct timespec abstime = {.tv_sec = SEC_MAXTIME_OPENCONN, .tv_nsec = 0};
+	if (openConnection(bench.sockname, MSEC_DELAY_OPENCONN, abstime) == -1){ perror("openConnection"); return -1; }
+	int res = 0;
+	for (long i = 0; i < bench.nkeys; i++){
+		if (asyncPutFile(bench.keys[i], NULL) == -1){ perror("asyncPutFile"); res = -1; break; }
+	}
+	if (asyncWaitAll() == -1){ perror("asyncWaitAll"); res = -1; }
+	closeConnection(bench.sockname);
+	return res;
+}
+
+
+/**
+ * @brief Reads the options into bench.
+ * @return 0 on success, -1 on error (with a message on stderr).
+ */
+static int bench_options(llist_t* optvals, bool* help){
+	llistnode_t* node;
+	optval_t* optval;
+	long val;
+	*help = false;
+	llist_foreach(optvals, node){
+		optval = (optval_t*)node->datum;
+		char* arg = (optval->args && optval->args->head ? optval->args->head->datum : NULL);
+		switch (optval->def->name[1]){
+			case 'h': { *help = true; break; }
+			case 'f': {
+				if (!(bench.sockname = joinArgs(optval->args))){ perror("bench_options: while reading socket name"); return -1; }
+				break;
+			}
+			case 'D': { bench.dirname = arg; break; }
+			case 'o': { bench.outpath = arg; break; }
+			case 'z': { getFloat(arg, &bench.theta); break; }
+			case 'm': {
+				int i = 0;
+				llistnode_t* anode;
+				llist_foreach(optval->args, anode){ getInt(anode->datum, &bench.mix[i++]); }
+				break;
+			}
+			case 's': {
+				getInt(arg, &bench.minsize);
+				bench.maxsize = bench.minsize;
+				if (optval->args->size == 2) getInt(optval->args->tail->datum, &bench.maxsize);
+				break;
+			}
+			default: {
+				getInt(arg, &val);
+				switch (optval->def->name[1]){
+					case 't': { bench.threads = val; break; }
+					case 'c': { bench.conns = val; break; }
+					case 'd': { bench.duration = val; break; }
+					case 'k': { bench.nkeys = val; break; }
+					case 'a': { bench.appendSize = val; break; }
+					case 'S': { bench.seed = val; break; }
+				}
+			}
+		}
+	}
+	if (*help) return 0;
+	long total = 0;
+	for (int i = 0; i < OP_NUM; i++){
+		if (bench.mix[i] < 0){ fprintf(stderr, "Operation ratios must be non-negative\n"); return -1; }
+		total += bench.mix[i];
+	}
+	if (!bench.sockname){ fprintf(stderr, "You must provide a socket file path to connect with\n"); return -1; }
+	if ((bench.threads <= 0) || (bench.threads > INT_MAX) || (bench.conns <= 0) || (bench.duration <= 0) || (bench.nkeys <= 0)){
+		fprintf(stderr, "Threads, connections, duration and files must be positive\n");
+		return -1;
+	}
+	if (total <= 0){ fprintf(stderr, "At least one operation ratio must be positive\n"); return -1; }
+	if ((bench.minsize < 0) || (bench.maxsize < bench.minsize) || (bench.appendSize <= 0)){
+		fprintf(stderr, "Invalid file sizes or append size\n");
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Prints results on stdout and (if bench.outpath != NULL) as JSON.
+ * @return 0 on success, -1 on error (unable to write JSON file).
+ */
+static int bench_report(bworker_t* workers, double elapsed){
+	hist_t* hists[OP_NUM];
+	long errors[OP_NUM];
+	uint64_t total = 0;
+	for (int i = 0; i < OP_NUM; i++){
+		if (!(hists[i] = hist_init())){
+			for (int j = 0; j < i; j++) hist_destroy(hists[j]);
+			return -1;
+		}
+		errors[i] = 0;
+		for (long k = 0; k < bench.threads; k++){
+			hist_merge(hists[i], workers[k].hists[i]);
+			errors[i] += workers[k].errors[i];
+		}
+		total += hists[i]->count;
+	}
+	printf("%-8s %10s %8s %12s %10s %10s %10s %10s\n", "op", "ops", "errors", "ops/sec", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+	for (int i = 0; i < OP_NUM; i++){
+		printf("%-8s %10lu %8ld %12.1f %10.1f %10.1f %10.1f %10.1f\n", opNames[i], (unsigned long)hists[i]->count, errors[i],
+			(double)hists[i]->count / elapsed, hist_percentile(hists[i], 50.0) / 1000.0, hist_percentile(hists[i], 99.0) / 1000.0,
+			hist_percentile(hists[i], 99.9) / 1000.0, hists[i]->max / 1000.0);
+	}
+	printf("total: %lu ops in %.3f s (%.1f ops/sec)\n", (unsigned long)total, elapsed, (double)total / elapsed);
+
+	int res = 0;
+	if (bench.outpath){
+		FILE* out = fopen(bench.outpath, "w");
+		if (!out){
+			perror("fopen");
+			res = -1;
+		} else {
+			fprintf(out, "{\n\t\"config\": {\"threads\": %ld, \"conns\": %ld, \"duration\": %ld, \"files\": %ld, \"minsize\": %ld, \"maxsize\": %ld, "
+				"\"append\": %ld, \"theta\": %.3f, \"seed\": %ld, \"mix\": {", bench.threads, bench.conns, bench.duration, bench.nkeys,
+				bench.minsize, bench.maxsize, bench.appendSize, bench.theta, bench.seed);
+			for (int i = 0; i < OP_NUM; i++) fprintf(out, "%s\"%s\": %ld", (i ? ", " : ""), opNames[i], bench.mix[i]);
+			fprintf(out, "}},\n\t\"elapsed\": %.3f,\n\t\"ops\": %lu,\n\t\"ops_per_sec\": %.1f,\n\t\"latency_unit\": \"us\",\n\t\"operations\": {\n",
+				elapsed, (unsigned long)total, (double)total / elapsed);
+			for (int i = 0; i < OP_NUM; i++){
+				fprintf(out, "\t\t\"%s\": {\"errors\": %ld, \"ops_per_sec\": %.1f, \"latency\": ", opNames[i], errors[i],
+					(double)hists[i]->count / elapsed);
+				hist_printJSON(hists[i], out, 1000.0);
+				fprintf(out, "}%s\n", (i < OP_NUM - 1 ? "," : ""));
+			}
+			fprintf(out, "\t}\n}\n");
+			if (fclose(out) == EOF){ perror("fclose"); res = -1; }
+		}
+	}
+	for (int i = 0; i < OP_NUM; i++) hist_destroy(hists[i]);
+	return res;
+}
+
+
+/* ********************** MAIN ********************** */
+
+int main(int argc, char* argv[]){
+	bench.threads = 1;
+	bench.conns = 1;
+	bench.duration = BENCH_DFL_DURATION;
+	bench.nkeys = BENCH_DFL_KEYS;
+	bench.mix[OP_READ] = 70;
+	bench.mix[OP_WRITE] = 10;
+	bench.mix[OP_APPEND] = 10;
+	bench.mix[OP_LOCK] = 10;
+	bench.minsize = BENCH_DFL_MINSIZE;
+	bench.maxsize = BENCH_DFL_MAXSIZE;
+	bench.appendSize = BENCH_DFL_APPEND;
+	bench.theta = BENCH_DFL_THETA;
+	bench.seed = BENCH_DFL_SEED;
+
+	if (argc < 2){
+		fprintf(stderr, "You must provide at least one command-line argument\n");
+		exit(EXIT_FAILURE);
+	}
+	llist_t* optvals = parseCmdLine(argc, argv, options, optlen);
+	if (!optvals){
+		fprintf(stderr, "Error while parsing command-line arguments\n");
+		exit(EXIT_FAILURE);
+	}
+	bool help;
+	if (bench_options(optvals, &help) == -1){
+		llist_destroy(optvals, (void(*)(void*))optval_destroy);
+		exit(EXIT_FAILURE);
+	}
+	if (help){
+		print_help(argv[0], options, optlen);
+		llist_destroy(optvals, (void(*)(void*))optval_destroy);
+		return 0;
+	}
+
+	bool tmpdir = (bench.dirname == NULL);
+	int ret = EXIT_FAILURE;
+	bworker_t* workers = NULL;
+	long started = 0;
+	if (bench_prepare() == -1) goto cleanup;
+	if (bench_upload() == -1) goto cleanup;
+	workers = calloc(bench.threads, sizeof(bworker_t));
+	if (!workers){ perror("calloc"); goto cleanup; }
+	for (long i = 0; i < bench.threads; i++){
+		workers[i].id = (int)i;
+		workers[i].rng = ((uint64_t)bench.seed + (uint64_t)i + 1) * 0x9E3779B97F4A7C15ULL;
+		if (!(workers[i].conns = calloc(bench.conns, sizeof(clientconn_t*)))){ perror("calloc"); goto cleanup; }
+		for (int j = 0; j < OP_NUM; j++){
+			if (!(workers[i].hists[j] = hist_init())){ perror("hist_init"); goto cleanup; }
+		}
+	}
+	if (pthread_barrier_init(&bench.start, NULL, bench.threads + 1) != 0){ perror("pthread_barrier_init"); goto cleanup; }
+	for (; started < bench.threads; started++){
+		if (pthread_create(&workers[started].tid, NULL, bench_worker, &workers[started]) != 0){
+			perror("pthread_create");
+			break;
+		}
+	}
+	if (started == bench.threads){
+		pthread_barrier_wait(&bench.start);
+		uint64_t start = bench_now();
+		sleep(bench.duration);
+		ATOMIC_SET(&bench.stop, 1);
+		for (long i = 0; i < started; i++) pthread_join(workers[i].tid, NULL);
+		double elapsed = (double)(bench_now() - start) / 1e9;
+		ret = EXIT_SUCCESS;
+		for (long i = 0; i < started; i++){
+			if (workers[i].ret == -1) ret = EXIT_FAILURE;
+		}
+		if (bench_report(workers, elapsed) == -1) ret = EXIT_FAILURE;
+	} else { /* Threads already started are stuck on the barrier */
+		fprintf(stderr, "Unable to start ALL the threads\n");
+		exit(EXIT_FAILURE);
+	}
+	pthread_barrier_destroy(&bench.start);
+
+	cleanup:
+	if (workers){
+		for (long i = 0; i < bench.threads; i++){
+			free(workers[i].conns);
+			for (int j = 0; j < OP_NUM; j++){ if (workers[i].hists[j]) hist_destroy(workers[i].hists[j]); }
+		}
+		free(workers);
+	}
+	bench_cleanup(tmpdir);
+	free(bench.sockname);
+	llist_destroy(optvals, (void(*)(void*))optval_destroy);
+	return ret;
+}
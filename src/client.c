@@ -8,6 +8,7 @@
 #include <dir_utils.h>
 #include <client_server_API.h>
 #include <argparser.h>
+#include <tsqueue.h>
 
 
 /* Some cmdline parsing and option-checking error messages */
@@ -16,6 +17,8 @@
 #define ATLEAST_ONE_MESSAGE "You must provide at least one command-line argument"
 #define F_NOTGIVEN_MESSAGE "You must provide a socket file path to connect with"
 #define T_NEGATIVE_MESSAGE "You must provide a non-negative request-delay time"
+#define J_NEGATIVE_MESSAGE "You must provide a positive number of upload threads"
+#define L_NEGATIVE_MESSAGE "You must provide a non-negative lock waiting time"
 /* Message to print on error in client_run while executing an option */
 #define EXEC_OPT_ERRMSG(x) fprintf(stderr, "client_run: while executing option '%s'\n", x);
 #define OPENCONN_FAILMSG "Failed to open connection with server"
@@ -126,6 +129,31 @@ do {\
 } while(0);
 
 
+/**
+ * @brief Batched version of MULTIARG_TRANSACTION_HANDLER for writeFile (used
+ * when there is NO delay between requests): ALL the {openFile(O_CREATE | O_LOCK),
+ * writeFile, closeFile, unlockFile} transactions are sent as batched compound
+ * requests (writeFiles), i.e. a single request for each server (at most
+ * MSG_BATCH_MAXFILES files), each one replied by a single response.
+ */
+#define BATCH_TRANSACTION_HANDLER(args, dirname, ret) \
+do {\
+	llistnode_t* node;\
+	int nfiles = 0;\
+	const char** filenames = malloc(((args)->size > 0 ? (args)->size : 1) * sizeof(char*));\
+	*ret = 0; \
+	if (!filenames){\
+		perror("batch transaction");\
+		*ret = -1;\
+		break;\
+	}\
+	llist_foreach(args, node){ filenames[nfiles++] = (const char*)(node->datum); }\
+	if ((writeFiles(filenames, nfiles, dirname, NULL) == -1) && (errno != EBADE)){\
+		perror("writeFiles");\
+		*ret = -1;\
+	}\
+	free(filenames);\
+} while(0);
 
 
 /**
@@ -144,7 +172,7 @@ do {\
 optdef_t options[] = {
 	{"-h", 0, 0, allNumbers, true, NULL, "Shows this help message and exits"},
 
-	{"-f", 1, 1, allPaths, true, "filename", "name of the socket to connect with"},
+	{"-f", 1, -1, allPaths, true, "filename[,filename]", "name of the socket to connect with (or list of servers among which files are sharded, see openConnection)"},
 
 	{"-w", 1, 2, pathAndNumber,false, "dirname[,num]",
 		"scans recursively at most #num files from directory #dirname (or ALL files if #num <= 0 or it is not provided), and sends all found files to server"},
@@ -174,10 +202,19 @@ otherwise an error is raised; if this option is not specified at least once, all
 
 	{"-p", 0, 0, allNumbers, true, NULL,
 		"Enables printing on stdout all relevant information for each request: operation type, associated file, success/error and read/written bytes (if any)"},
+
+	{"-j", 1, 1, allNumbers, true, "num",
+		"Number of threads, each one with its own connection, that upload the files found by -w while the directory is being scanned; if this option is NOT specified, files are uploaded by a single thread after the scan"},
+
+	{"-s", 0, 0, allNumbers, false, NULL,
+		"Prints on stdout the live statistics of the server (latency histograms of requests and waiting times, as a JSON object)"},
+
+	{"-L", 1, 1, allNumbers, true, "num",
+		"Maximum waiting time (in ms) for each lock acquired with -l: if it expires, the lock is NOT acquired and the client goes on; if this option is NOT specified (or num == 0), lock waits never expire"},
 };
 
 /* Length of options array */
-int optlen = 13;
+int optlen = 16;
 
 /**
  * @brief Global variables for saving whether unique options 
@@ -186,14 +223,16 @@ int optlen = 13;
 bool h_val = false;
 char* f_path = NULL;
 long t_val = 0;
+long j_val = 1;
+long L_val = 0;
 
 
 /**
- * @brief Checks if options -h/-p/-f/-t are provided and sets
+ * @brief Checks if options -h/-p/-f/-t/-j/-L are provided and sets
  * corresponding parameters passed. 
  * @return 0 on success, -1 on error (optvals == NULL).
  */
-int check_phft(llist_t* optvals, bool* h_val, char** f_path, long* t_val){
+int check_phft(llist_t* optvals, bool* h_val, char** f_path, long* t_val, long* j_val, long* L_val){
 	if (!optvals) return -1;
 	llistnode_t* node;
 	optval_t* optval;
@@ -201,21 +240,36 @@ int check_phft(llist_t* optvals, bool* h_val, char** f_path, long* t_val){
 	*h_val = false;
 	*f_path = NULL;
 	*t_val = 0;
+	*j_val = 1;
+	*L_val = 0;
 	char* t_str = NULL;
+	char* j_str = NULL;
+	char* L_str = NULL;
 	llist_foreach(optvals, node){
 		optval = ((optval_t*)node->datum);
 		optname = (char*)(optval->def->name);
 		switch(optname[1]){
 			case 'h': { *h_val = true; break; }
 			case 'p' : { prints_enabled = true; break; }
-			case 'f' : {*f_path = (char*)(optval->args->head->datum); break; }
+			case 'f' : {
+				if (!(*f_path = joinArgs(optval->args))) return -1;
+				break;
+			}
 			case 't' : {t_str = (char*)(optval->args->head->datum); break; }
+			case 'j' : {j_str = (char*)(optval->args->head->datum); break; }
+			case 'L' : {L_str = (char*)(optval->args->head->datum); break; }
 			default : continue;
 		}
 	}
 	if (t_str && getInt(t_str, t_val) != 0){
 		return -1;
 	}
+	if (j_str && getInt(j_str, j_val) != 0){
+		return -1;
+	}
+	if (L_str && getInt(L_str, L_val) != 0){
+		return -1;
+	}
 	return 0;
 }
 
@@ -259,6 +313,132 @@ int check_rwConsistency(llist_t* optvals){
 	return 0;
 }
 
+/**
+ * @brief Shared state of a parallel upload (see w_handler_parallel).
+ */
+typedef struct wjob_s {
+	tsqueue_t* files; /* Paths found by dirwalk and not yet taken by any worker */
+	char* dirname; /* Directory in which to save expelled files */
+	long msec_delay;
+} wjob_t;
+
+
+/**
+ * @brief An upload thread (see w_worker).
+ */
+typedef struct wworker_s {
+	pthread_t tid;
+	wjob_t* job;
+	int ret; /* Result of the worker */
+} wworker_t;
+
+
+/* Callback of dirwalk for parallel uploads */
+static int w_enqueue(char* pathname, void* files){
+	return (tsqueue_push((tsqueue_t*)files, pathname) == 0 ? 0 : -1);
+}
+
+
+/**
+ * @brief Upload thread: opens its own connection and uploads the files
+ * taken from job->files until it is closed and empty. Each file is sent
+ * as in w_handler (pipelined iff there is NO delay between requests).
+ * @note A worker that fails stops taking files, which are uploaded by
+ * the other ones.
+ */
+static void* w_worker(void* arg){
+	wworker_t* w = arg;
+	wjob_t* job = w->job;
+	struct timespec abstime;
+	memset(&abstime, 0, sizeof(abstime));
+	abstime.tv_sec = SEC_MAXTIME_OPENCONN;
+	abstime.tv_nsec = NSEC_MAXTIME_OPENCONN;
+	w->ret = -1;
+	clientconn_t* conn = connCreate();
+	if (!conn || (connSelect(conn) == -1)){
+		perror("w_worker: while creating connection");
+		free(conn);
+		return NULL;
+	}
+	if (openConnection(f_path, MSEC_DELAY_OPENCONN, abstime) == -1){
+		fprintf(stderr, "w_worker: %s\n", OPENCONN_FAILMSG);
+		connSelect(NULL);
+		connDestroy(conn);
+		return NULL;
+	}
+	w->ret = 0;
+	char* pathname;
+	while ((w->ret == 0) && (tsqueue_pop(job->files, (void**)&pathname, false) == 0)){
+		if (job->msec_delay == 0){
+			if (asyncPutFile(pathname, job->dirname) == -1){
+				perror("async transaction");
+				w->ret = -1;
+			}
+			free(pathname);
+		} else {
+			llist_t* filelist = llist_init(); /* A single transaction */
+			if (!filelist || (llist_push(filelist, pathname) == -1)){
+				free(pathname);
+				w->ret = -1;
+			} else { MULTIARG_TRANSACTION_HANDLER(writeFile, filelist, job->dirname, (O_CREATE | O_LOCK), &w->ret, job->msec_delay); }
+			llist_destroy(filelist, free);
+		}
+	}
+	if ((job->msec_delay == 0) && (asyncWaitAll() == -1)){
+		perror("asyncWaitAll");
+		w->ret = -1;
+	}
+	if (closeConnection(f_path) == -1) w->ret = -1;
+	connSelect(NULL);
+	connDestroy(conn);
+	return NULL;
+}
+
+
+/**
+ * @brief Parallel version of w_handler (option '-j'): the directory is scanned
+ * by the calling thread while #nthreads workers, each one with its own
+ * connection, upload the files found meanwhile.
+ * @return 0 on success, -1 on error.
+ */
+int w_handler_parallel(char* nomedir, long n, char* dirname, long msec_delay, int nthreads){
+	wjob_t job;
+	job.dirname = dirname;
+	job.msec_delay = msec_delay;
+	job.files = tsqueue_init();
+	if (!job.files) return -1;
+	wworker_t* workers = calloc(nthreads, sizeof(wworker_t));
+	if (!workers){
+		tsqueue_destroy(job.files, dummy);
+		return -1;
+	}
+	int ret = 0, started = 0;
+	for (; started < nthreads; started++){
+		workers[started].job = &job;
+		int r = pthread_create(&workers[started].tid, NULL, w_worker, &workers[started]);
+		if (r != 0){
+			errno = r;
+			perror("w_handler_parallel: while creating worker");
+			ret = -1;
+			break;
+		}
+	}
+	/* On success, ALL files have been passed to workers */
+	if ((started > 0) && (dirwalk(nomedir, n, w_enqueue, job.files) == -1)){
+		perror("w_handler_parallel: while scanning directory");
+		ret = -1;
+	}
+	tsqueue_close(job.files); /* Workers terminate when the queue is empty */
+	for (int i = 0; i < started; i++){
+		pthread_join(workers[i].tid, NULL);
+		if (workers[i].ret == -1) ret = -1;
+	}
+	tsqueue_destroy(job.files, free); /* Files NOT uploaded because of errors */
+	free(workers);
+	return ret;
+}
+
+
 /**
  * @brief Handler of a '-w' option: scans directory
  * to get files and then for each argument makes a
@@ -281,14 +461,64 @@ int w_handler(optval_t* wopt, char* dirname, long msec_delay){
 	llist_t* filelist;
 	char* nomedir = (char*)(wopt->args->head->datum);
 	int ret = 0;
+	if (j_val > 1) return w_handler_parallel(nomedir, n, dirname, msec_delay, (int)j_val);
 	/* On success, filelist shall contain HEAP-allocated ABSOLUTE paths. */
 	SYSCALL_RETURN(dirscan(nomedir, n, &filelist), -1, "w_handler: while scanning directory");
-	MULTIARG_TRANSACTION_HANDLER(writeFile, filelist, dirname, (O_CREATE | O_LOCK), &ret, msec_delay);
+	if (msec_delay == 0){ BATCH_TRANSACTION_HANDLER(filelist, dirname, &ret); }
+	else { MULTIARG_TRANSACTION_HANDLER(writeFile, filelist, dirname, (O_CREATE | O_LOCK), &ret, msec_delay); }
 	llist_destroy(filelist, free);
 	return ret;
 }
 
 
+/**
+ * @brief Batched version of r_handler (used when there is NO delay between
+ * requests): ALL the {openFile, readFile, closeFile} transactions are sent as
+ * batched compound requests (readFiles), i.e. a single request for each server
+ * (at most MSG_BATCH_MAXFILES files), each one replied by a single response;
+ * files read are then saved in order.
+ * @return 0 on success, -1 on error.
+ */
+int r_handler_batch(optval_t* ropt, char* dirname){
+	int ret = 0;
+	llistnode_t* node;
+	llist_t* files = ropt->args;
+	int n = 0;
+	size_t len = (files->size > 0 ? files->size : 1);
+	const char** pathnames = malloc(len * sizeof(char*));
+	void** bufs = malloc(len * sizeof(void*));
+	size_t* sizes = malloc(len * sizeof(size_t));
+	int* errs = malloc(len * sizeof(int));
+	if (!pathnames || !bufs || !sizes || !errs){
+		perror("r_handler");
+		ret = -1;
+	} else {
+		llist_foreach(files, node){
+			pathnames[n] = (const char*)(node->datum);
+			if ( !isAbsPath(pathnames[n]) ){
+				perror("r_handler: while getting absolute path of file");
+				ret = -1;
+				break;
+			}
+			n++;
+		}
+	}
+	int res = (ret == 0 ? readFiles(pathnames, n, bufs, sizes, errs) : -1);
+	if ((ret == 0) && (res == -1) && (errno != EBADE)){ perror("r_handler: readFiles"); ret = -1; }
+	for (int i = 0; (res >= 0) && (i < n); i++){
+		if ((errs[i] == 0) && (saveFile(pathnames[i], dirname, bufs[i], sizes[i]) == -1)){ /* File successfully read */
+			fprintf(stderr, "Error while saving file '%s' to disk\n", pathnames[i]);
+		}
+		free(bufs[i]);
+	}
+	free(errs);
+	free(sizes);
+	free(bufs);
+	free(pathnames);
+	return ret;
+}
+
+
 /**
  * @brief Handler of the '-r' option: for each file
  * in ropt->args, it makes the following requests:
@@ -308,6 +538,7 @@ int w_handler(optval_t* wopt, char* dirname, long msec_delay){
  */
 int r_handler(optval_t* ropt, char* dirname, long msec_delay){
 	if (!ropt) return -1;
+	if (msec_delay == 0) return r_handler_batch(ropt, dirname);
 	int ret;
 	char* pathname;
 	llistnode_t* node;
@@ -360,6 +591,19 @@ int r_handler(optval_t* ropt, char* dirname, long msec_delay){
 }
 
 
+/**
+ * @brief As lockFile, but waits for the lock at most L_val milliseconds (-L):
+ * an expired wait is NOT fatal (as any other error on server).
+ * @return As lockFileTimed.
+ */
+int lockFile_L(const char* pathname){
+	struct timespec wait = {L_val / 1000, (L_val % 1000) * 1000000L};
+	int ret = lockFileTimed(pathname, wait);
+	if ((ret == -1) && (errno == ETIMEDOUT)) errno = EBADE;
+	return ret;
+}
+
+
 /**
  * @brief Command-line arguments execution after parsing and validation.
  * @param optvals -- A linkedlist of optval_t objects pointers containing
@@ -386,6 +630,8 @@ int client_run(llist_t* optvals, long msec_delay){
 			case 'p':
 			case 'f':
 			case 't':
+			case 'j':
+			case 'L':
 			case 'd':
 			case 'D':
 			{
@@ -400,7 +646,9 @@ int client_run(llist_t* optvals, long msec_delay){
 					if ( strequal(nextOpt->def->name, "-D") ) dirname = (char*)(nextOpt->args->head->datum); /* -D dirname */
 				}
 				if (optname[1] == 'w') ret = w_handler(opt, dirname, msec_delay);
-				else {
+				else if (msec_delay == 0){
+					BATCH_TRANSACTION_HANDLER(opt->args, dirname, &ret);
+				} else {
 					MULTIARG_TRANSACTION_HANDLER(writeFile, opt->args, dirname, (O_CREATE | O_LOCK), &ret, msec_delay);
 				}
 				break;
@@ -436,7 +684,11 @@ int client_run(llist_t* optvals, long msec_delay){
 			
 			case 'l':
 			{
-				MULTIARG_SIMPLE_HANDLER(lockFile, opt->args, &ret, msec_delay);
+				if (L_val > 0){
+					MULTIARG_SIMPLE_HANDLER(lockFile_L, opt->args, &ret, msec_delay);
+				} else {
+					MULTIARG_SIMPLE_HANDLER(lockFile, opt->args, &ret, msec_delay);
+				}
 				break;
 			}
 			
@@ -452,6 +704,19 @@ int client_run(llist_t* optvals, long msec_delay){
 				break;
 			}
 			
+			case 's':
+			{
+				void* stats;
+				size_t size;
+				ret = getStats(&stats, &size);
+				if (ret == 0){
+					printf("%s", (char*)stats);
+					free(stats);
+				}
+				usleep(1000 * msec_delay);
+				break;
+			}
+			
 			default: /* Theoretically impossible, but we consider it however */
 			{
 				fprintf(stderr, "Error while running command, unknown option got '%s'\n", optname);
@@ -486,15 +751,18 @@ int main(int argc, char* argv[]){
 		exit(EXIT_FAILURE);
 	}
 	printf("cmdline parsing successfully completed!\n");
-	CHECK_COND_DEALLOC_EXIT( (check_phft(optvals, &h_val, &f_path, &t_val) == 0), optvals, "Error while checking unique options");
+	CHECK_COND_DEALLOC_EXIT( (check_phft(optvals, &h_val, &f_path, &t_val, &j_val, &L_val) == 0), optvals, "Error while checking unique options");
 	CHECK_COND_DEALLOC_EXIT( (check_rwConsistency(optvals) == 0), optvals, "Error: options r/R/d or w/W/D are not provided correctly")
 	if (h_val){ /* Help option provided */
+		free(f_path);
 		llist_destroy(optvals, (void(*)(void*))optval_destroy);
 		print_help(argv[0], options, optlen);
 		return 0;		
 	}
 	CHECK_COND_DEALLOC_EXIT( (f_path), optvals, F_NOTGIVEN_MESSAGE);
 	CHECK_COND_DEALLOC_EXIT( (t_val >= 0), optvals, T_NEGATIVE_MESSAGE);
+	CHECK_COND_DEALLOC_EXIT( (j_val > 0) && (j_val <= INT_MAX), optvals, J_NEGATIVE_MESSAGE);
+	CHECK_COND_DEALLOC_EXIT( (L_val >= 0), optvals, L_NEGATIVE_MESSAGE);
 	CHECK_COND_DEALLOC_EXIT( (openConnection(f_path, MSEC_DELAY_OPENCONN, abstime) == 0), optvals, OPENCONN_FAILMSG);
 	printf("Command execution is now starting\n"); /* Command validation completed */
 	int runResult = client_run(optvals, t_val);
@@ -502,6 +770,7 @@ int main(int argc, char* argv[]){
 	CHECK_COND_DEALLOC_EXIT( (runResult == 0), optvals, "Error while running commands");
 	CHECK_COND_DEALLOC_EXIT( (closeConnection(f_path) == 0), optvals, CLOSECONN_FAILMSG);
 	/* Dealloc and exit but with success */
+	free(f_path);
 	llist_destroy(optvals, (void(*)(void*))optval_destroy);
 	printf("Client successfully terminated\n");
 	return 0;
@@ -11,6 +11,10 @@
 #include <client_server_API.h>
 #include <poll.h>
 #include <sys/timerfd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
 #include <dir_utils.h>
 
 /**
@@ -25,18 +29,151 @@
  */
 
 
-/** 
- * @brief Static global data for the current connection:
+/* Prefix of the socket name of a TCP server, i.e. "tcp://<host>:<port>" (or "tcp://[<IPv6 host>]:<port>") */
+#define CONN_TCP_PREFIX "tcp://"
+
+/* Separator of the servers in the socket name of a cluster (see openConnection) */
+#define CONN_SEP ','
+
+/* Points of each server on the hash ring of a cluster */
+#define CONN_VNODES 64
+
+
+/**
+ * @brief A point of the hash ring of a cluster.
+ */
+typedef struct ringpt_s {
+	uint64_t point;
+	int node; /* Index of the server in nodes */
+} ringpt_t;
+
+
+/**
+ * @brief An asynchronous request on a cluster, i.e. its handle on the
+ * connection of the server it has been sent to (node == -1 if collected).
+ */
+typedef struct careq_s {
+	int node;
+	int handle;
+} careq_t;
+
+
+/* States of an asynchronous request */
+#define AREQ_PENDING 0 /* Sent, reply not yet (completely) received */
+#define AREQ_DONE 1 /* Reply received, result not yet collected */
+#define AREQ_COLLECTED 2 /* Result collected (by asyncWait) or discarded */
+
+/**
+ * @brief An asynchronous request.
+ */
+typedef struct areq_s {
+	msg_t type;
+	int state; /* One of AREQ_* */
+	int error; /* 0 on success, error code of the server (M_ERR) */
+	size_t reqbytes; /* Bytes of request content */
+	char* pathname; /* Copy of file path (for printing), NULL for readNFiles */
+	const char* dirname; /* Directory for saving expelled files (NOT copied) */
+	void* buf; /* Content of the read file (readFile) */
+	size_t size; /* Read/written bytes */
+} areq_t;
+
+/**
+ * @brief State of a connection to the server (see connCreate):
  *	- serverAddr is the server address;
- *	- addrLen is max server address length (UNIX_PATH_MAX is defined in defines.h);
- *	- serverfd is the file descriptor of the current open socket for connection
- *	to the server, or is -1 iff there is no active connection, i.e. it is set to be
+ *	- serverfd is the file descriptor of the open socket for connection to the
+ *	server, or is -1 iff there is no active connection, i.e. it is set to be
  * 	>= 0 if and only if there is an open connection to the server (in which case it
- *	is the corresponding fd), and -1 otherwise.
+ *	is the corresponding fd), and -1 otherwise;
+ *	- areqs[i] is the asynchronous request with ID (areqBase + i), where IDs
+ *	start from 1 since 0 means "no ID";
+ *	- areqs[0 .. acompleted-1] are ALL NOT pending (replies come in order);
+ *	- ainflight is the number of bytes of pending requests;
+ *	- for a cluster (a list of servers passed to openConnection), nodes are the
+ *	connections to each server and ring is the hash ring (nnodes * CONN_VNODES
+ *	points sorted in ascending order) by which pathnames are routed, while
+ *	serverfd is ALWAYS -1; asynchronous requests are delegated to the nodes,
+ *	and careqs[i] is the one with ID (areqBase + i) of the cluster, where
+ *	clive is the number of NOT collected ones.
  */
-static struct sockaddr_un serverAddr;
+struct clientconn_s {
+	struct sockaddr_storage serverAddr; /* sockaddr_un, or sockaddr_in/sockaddr_in6 for a TCP server */
+	socklen_t serverAddrLen;
+	char* sockname; /* Copy of the name passed to openConnection */
+	int serverfd;
+	areq_t* areqs;
+	int nareqs;
+	int capareqs;
+	int areqBase;
+	int acompleted;
+	size_t ainflight;
+	struct clientconn_s** nodes;
+	int nnodes;
+	ringpt_t* ring;
+	careq_t* careqs;
+	int ncareqs;
+	int capcareqs;
+	int clive;
+};
+
+/* Max server address length (UNIX_PATH_MAX is defined in defines.h) */
 static const socklen_t addrLen = UNIX_PATH_MAX;
-static int serverfd = -1;
+
+/* Connection used by threads that have NOT selected any other one (see connSelect) */
+static clientconn_t defaultConn = { .serverfd = -1, .areqBase = 1 };
+
+/* Current connection of each thread (NULL for defaultConn) */
+static pthread_key_t connKey;
+static pthread_once_t connOnce = PTHREAD_ONCE_INIT;
+
+static void conn_keyinit(void){ pthread_key_create(&connKey, NULL); }
+
+
+/* @return Current connection of the calling thread */
+static clientconn_t* conn_current(void){
+	pthread_once(&connOnce, conn_keyinit);
+	clientconn_t* conn = pthread_getspecific(connKey);
+	return (conn ? conn : &defaultConn);
+}
+
+/* Discards ALL asynchronous requests of the current connection (see below) */
+static void async_reset(void);
+
+/* Marks an asynchronous request as collected, freeing its content (see below) */
+static void async_collect(areq_t* r);
+
+
+/* 64-bit FNV-1a hash of a string, with a final mixing of the bits (ring points of a server differ in the last bytes) */
+static uint64_t conn_hash(const char* str){
+	uint64_t h = 14695981039346656037ULL;
+	for (; *str; str++){
+		h ^= (unsigned char)*str;
+		h *= 1099511628211ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+
+/**
+ * @return Connection to which requests on #pathname are sent, i.e. the current
+ * one of the calling thread or, for a cluster, the first server whose point on
+ * the ring follows the hash of pathname. For a NULL pathname, current connection.
+ */
+static clientconn_t* conn_route(const char* pathname){
+	clientconn_t* conn = conn_current();
+	if (!conn->nodes || !pathname) return conn;
+	uint64_t h = conn_hash(pathname);
+	int lo = 0, hi = conn->nnodes * CONN_VNODES; /* First point >= h in [lo, hi) */
+	while (lo < hi){
+		int mid = lo + (hi - lo) / 2;
+		if (conn->ring[mid].point < h) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == conn->nnodes * CONN_VNODES) lo = 0; /* Wraps around */
+	return conn->nodes[conn->ring[lo].node];
+}
 
 
 /**
@@ -94,6 +231,11 @@ static int result_msg(int result, char* msg, size_t size){
 		}
 		case EFBIG: {
 			strncpy(msg, "File content is bigger than storage capacity", size);
+			break;
+		}
+		case ETIMEDOUT: {
+			strncpy(msg, "Lock waiting time expired", size);
+			break;
 		}
 		default: {
 			strncpy(msg, "Unknown result code", size);
@@ -188,30 +330,58 @@ do { \
 
 
 /**
- * @brief Tries to open a connection to the socket whose address is sockname.
- * This function opens a non-blocking socket file (saved in serverfd), such that
- * if an attempt to connect fails with error 'EAGAIN', this function waits for
- * #msec milliseconds before retrying, until the timeout specified in #abstime
- * expires.
- * @return 0 on success, -1 on error (errno set).
+ * @brief Resolves the socket name #sockname into the address of conn, i.e. a
+ * TCP address if sockname is "tcp://<host>:<port>" (IPv6 hosts in brackets),
+ * otherwise the path of an AF_UNIX socket.
+ * @return Address family on success, -1 on error.
  * Possible errors are:
- *	- EINVAL: invalid arguments (NULL sockname or negative sleep time);
- *	- EISCONN: there is already an active connection;
- *	- any error returned by 'socket', 'connect', 'poll', 'clock_gettime', 
- *	'timerfd_create' and 'timerfd_settime' system calls;
- *	- ETIMEDOUT if timeout has expired and a connection has not yet successfully
- *	established.
+ *	- EINVAL: malformed TCP address;
+ *	- EHOSTUNREACH: unable to resolve host;
+ *	- ENOMEM: unable to allocate memory.
  */
-int openConnection(const char* sockname, int msec, const struct timespec abstime){
-	if (!sockname || msec < 0){ errno = EINVAL; return -1; }
-	if (serverfd >= 0){
-		errno = EISCONN;
-		perror("openConnection");
+static int conn_resolve(clientconn_t* conn, const char* sockname){
+	memset(&conn->serverAddr, 0, sizeof(conn->serverAddr));
+	if (strncmp(sockname, CONN_TCP_PREFIX, strlen(CONN_TCP_PREFIX)) != 0){
+		struct sockaddr_un* sa = (struct sockaddr_un*)&conn->serverAddr;
+		sa->sun_family = AF_UNIX;
+		strncpy(sa->sun_path, sockname, addrLen - 1);
+		conn->serverAddrLen = addrLen;
+		return AF_UNIX;
+	}
+	char* host = strdup(sockname + strlen(CONN_TCP_PREFIX));
+	if (!host){ errno = ENOMEM; return -1; }
+	char* port = strrchr(host, ':');
+	if (!port || (port == host) || (port[1] == '\0')){ free(host); errno = EINVAL; return -1; }
+	*port++ = '\0';
+	char* name = host;
+	size_t len = strlen(host);
+	if ((host[0] == '[') && (host[len-1] == ']')){ host[len-1] = '\0'; name++; } /* IPv6 */
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int err = getaddrinfo(name, port, &hints, &res);
+	free(host);
+	if (err != 0){
+		errno = (err == EAI_MEMORY ? ENOMEM : EHOSTUNREACH);
 		return -1;
 	}
-	memset(&serverAddr, 0, sizeof(serverAddr));
-	serverAddr.sun_family = AF_UNIX;
-	strncpy(serverAddr.sun_path, sockname, addrLen);
+	memcpy(&conn->serverAddr, res->ai_addr, res->ai_addrlen);
+	conn->serverAddrLen = res->ai_addrlen;
+	int family = res->ai_family;
+	freeaddrinfo(res);
+	return family;
+}
+
+
+/**
+ * @brief Opens a connection of conn to the single server #sockname as
+ * described in openConnection.
+ * @return 0 on success, -1 on error (errno set).
+ */
+static int conn_open(clientconn_t* conn, const char* sockname, int msec, const struct timespec abstime){
+	int family = conn_resolve(conn, sockname);
+	if (family == -1){ perror("openConnection: while resolving server address"); return -1; }
 	/* Struct for (one-shot) timer */
 	struct itimerspec itsp;
 	memset(&itsp, 0, sizeof(itsp));
@@ -225,46 +395,55 @@ int openConnection(const char* sockname, int msec, const struct timespec abstime
 	struct pollfd pfd[1];
 	memset(pfd, 0, sizeof(pfd));
 	
-	/* An error in socket guarantees to write '-1' in serverfd and to maintain the semantics of "-1 == unexisting socket" */
-	SYSCALL_RETURN((serverfd = socket(AF_UNIX, SOCK_STREAM, 0)), -1, "openConnection: while creating socket");
+	/* An error in socket guarantees to write '-1' in conn->serverfd and to maintain the semantics of "-1 == unexisting socket" */
+	SYSCALL_RETURN((conn->serverfd = socket(family, SOCK_STREAM, 0)), -1, "openConnection: while creating socket");
 	
-	/* Set serverfd to nonblocking mode */
-	int sockflags = fcntl(serverfd, F_GETFL, 0);
-	fcntl(serverfd, F_SETFL, sockflags | O_NONBLOCK);
+	/* Set conn->serverfd to nonblocking mode */
+	int sockflags = fcntl(conn->serverfd, F_GETFL, 0);
+	fcntl(conn->serverfd, F_SETFL, sockflags | O_NONBLOCK);
 	
 	/* Creates and arms timer */
 	tfd = timerfd_create(CLOCK_REALTIME, 0);
 	if (tfd == -1){
 		perror("openConnection: while creating timer");
-		close(serverfd);
-		serverfd = -1;
+		close(conn->serverfd);
+		conn->serverfd = -1;
 		return -1;
 	}
 	pfd[0].fd = tfd;
 	pfd[0].events = POLLIN;
 	pfd[0].revents = 0;
 	res = timerfd_settime(tfd, TFD_TIMER_ABSTIME, &itsp, NULL);
+	if ((res == 0) && !(conn->sockname = strdup(sockname))){ errno = ENOMEM; res = -1; }
 	if (res == 0){
 		while (true){
 			pfd[0].revents = 0;
-			res = connect(serverfd, (const struct sockaddr*)&serverAddr, UNIX_PATH_MAX);
+			res = connect(conn->serverfd, (const struct sockaddr*)&conn->serverAddr, conn->serverAddrLen);
 			if ((res == -1) && prints_enabled) { fprintf(stderr, "[process %d] openConnection: ", getpid()); perror(NULL); }
 			/* SUCCESS */
-			if (res == 0){
+			if ((res == 0) || (errno == EISCONN)){
 				close(tfd);
-				fcntl(serverfd, F_SETFL, sockflags); /* Resets to blocking socket */
+				fcntl(conn->serverfd, F_SETFL, sockflags); /* Resets to blocking socket */
+				if (family != AF_UNIX){ /* Requests are small and sent by a single write */
+					int one = 1;
+					setsockopt(conn->serverfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				}
+				msg_setformat(conn->serverfd, MSG_FRAMED); /* Server detects format by the first message */
 				return 0;
 			/* ERROR */
-			} else if (errno == EISCONN){
-				close(tfd);
-				fcntl(serverfd, F_SETFL, sockflags);
-				return 0;
 			/*
 				1. Connection request cannot be completed immediately but is ongoing.
 				2. Another connection request is being processed.
-				3. There is no listening socket with that address (e.g. server has not started yet). 
+				3. There is no listening socket with that address (e.g. server has not started yet).
+				4. (TCP ONLY) server has not started yet: a new socket is needed for retrying.
 			*/
-			} else if ((errno == EAGAIN) || (errno == EALREADY) || (errno == ENOENT)){
+			} else if ((errno == EAGAIN) || (errno == EALREADY) || (errno == ENOENT) || (errno == EINPROGRESS)
+				|| ((errno == ECONNREFUSED) && (family != AF_UNIX))){
+				if (errno == ECONNREFUSED){
+					close(conn->serverfd);
+					if ((conn->serverfd = socket(family, SOCK_STREAM, 0)) == -1){ perror("openConnection: while creating socket"); break; }
+					fcntl(conn->serverfd, F_SETFL, sockflags | O_NONBLOCK);
+				}
 				res = poll(pfd, 1, msec);
 				if (res == 1){ /* Timeout expired , pfd.revents & POLLIN*/
 					errno = ETIMEDOUT;
@@ -272,20 +451,141 @@ int openConnection(const char* sockname, int msec, const struct timespec abstime
 					break;
 				} else if (res == 0) continue; /* No notification by timer */
 				else perror("openConnection: poll");
-				/* Now we are exiting and closing serverfd, so if connection has been established in the middle of timeout it will be reset */
+				/* Now we are exiting and closing conn->serverfd, so if connection has been established in the middle of timeout it will be reset */
 			} else {
 				perror("openConnection: while trying to connect");
 				break;
 			}
 		}
-	} else perror("openConnection: while arming timer");
+	} else perror("openConnection: while arming timer or copying socket name");
+	int errno_copy = errno;
 	close(tfd);
-	close(serverfd);
-	serverfd = -1;
+	if (conn->serverfd >= 0) close(conn->serverfd);
+	conn->serverfd = -1;
+	free(conn->sockname);
+	conn->sockname = NULL;
+	errno = errno_copy;
 	return -1;
 }
 
 
+/* Closes the connection(s) of conn, discarding ALL its state */
+static void conn_close(clientconn_t* conn){
+	if (conn->serverfd >= 0) close(conn->serverfd);
+	conn->serverfd = -1;
+	for (int i = 0; i < conn->nnodes; i++){
+		clientconn_t* node = conn->nodes[i];
+		conn_close(node);
+		for (int j = 0; j < node->nareqs; j++) async_collect(&node->areqs[j]); /* Replies to pending requests are lost */
+		free(node->areqs);
+		free(node);
+	}
+	free(conn->nodes);
+	conn->nodes = NULL;
+	conn->nnodes = 0;
+	free(conn->ring);
+	conn->ring = NULL;
+	free(conn->careqs);
+	conn->careqs = NULL;
+	conn->ncareqs = 0;
+	conn->capcareqs = 0;
+	conn->clive = 0;
+	free(conn->sockname);
+	conn->sockname = NULL;
+}
+
+
+/* Orders ring points by value */
+static int ringpt_cmp(const void* p1, const void* p2){
+	uint64_t a = ((const ringpt_t*)p1)->point, b = ((const ringpt_t*)p2)->point;
+	return (a < b ? -1 : (a > b ? 1 : 0));
+}
+
+
+/**
+ * @brief Opens a connection of conn to each server in the list #socknames
+ * (separated by CONN_SEP) and builds the hash ring for routing pathnames.
+ * @return 0 on success, -1 on error (errno set, NO connection is left open).
+ */
+static int conn_openCluster(clientconn_t* conn, const char* socknames, int msec, const struct timespec abstime){
+	char* list = strdup(socknames);
+	int n = 1;
+	for (const char* c = socknames; *c; c++) if (*c == CONN_SEP) n++;
+	conn->nodes = calloc(n, sizeof(clientconn_t*));
+	conn->ring = malloc(n * CONN_VNODES * sizeof(ringpt_t));
+	conn->sockname = strdup(socknames);
+	if (!list || !conn->nodes || !conn->ring || !conn->sockname){
+		free(list);
+		conn_close(conn);
+		errno = ENOMEM;
+		return -1;
+	}
+	char* saveptr = NULL;
+	char* name = strtok_r(list, ",", &saveptr);
+	char vnode[UNIX_PATH_MAX + 16];
+	while (name){
+		clientconn_t* node = connCreate();
+		if (!node || (conn_open(node, name, msec, abstime) == -1)){
+			int errno_copy = errno;
+			free(node);
+			free(list);
+			conn_close(conn);
+			errno = errno_copy;
+			return -1;
+		}
+		for (int i = 0; i < CONN_VNODES; i++){
+			snprintf(vnode, sizeof(vnode), "%s#%d", name, i);
+			conn->ring[conn->nnodes * CONN_VNODES + i].point = conn_hash(vnode);
+			conn->ring[conn->nnodes * CONN_VNODES + i].node = conn->nnodes;
+		}
+		conn->nodes[conn->nnodes++] = node;
+		name = strtok_r(NULL, ",", &saveptr);
+	}
+	free(list);
+	if (conn->nnodes == 0){ conn_close(conn); errno = EINVAL; return -1; }
+	qsort(conn->ring, conn->nnodes * CONN_VNODES, sizeof(ringpt_t), ringpt_cmp);
+	return 0;
+}
+
+
+/**
+ * @brief Tries to open a connection to the socket whose address is sockname.
+ * This function opens a non-blocking socket file (saved in serverfd), such that
+ * if an attempt to connect fails with error 'EAGAIN', this function waits for
+ * #msec milliseconds before retrying, until the timeout specified in #abstime
+ * expires.
+ * @note sockname can be either the path of an AF_UNIX socket or the address
+ * of a TCP server ("tcp://<host>:<port>", with IPv6 hosts in brackets), or a
+ * comma-separated list of them: in the latter case a connection is opened to
+ * EACH server and the requests on a pathname are routed to the server that
+ * owns it by consistent hashing (see conn_route), such that pathnames are
+ * sharded among servers WITHOUT any coordination among them. Asynchronous
+ * requests are sent on the connection of the server that owns the pathname
+ * (see ASYNC_CLUSTER), while getStats is NOT supported on such a connection.
+ * @return 0 on success, -1 on error (errno set).
+ * Possible errors are:
+ *	- EINVAL: invalid arguments (NULL sockname or negative sleep time) or
+ *	malformed TCP address;
+ *	- EISCONN: there is already an active connection;
+ *	- EHOSTUNREACH: unable to resolve the host of a TCP server;
+ *	- any error returned by 'socket', 'connect', 'poll', 'clock_gettime', 
+ *	'timerfd_create' and 'timerfd_settime' system calls;
+ *	- ETIMEDOUT if timeout has expired and a connection has not yet successfully
+ *	established.
+ */
+int openConnection(const char* sockname, int msec, const struct timespec abstime){
+	clientconn_t* conn = conn_current();
+	if (!sockname || msec < 0){ errno = EINVAL; return -1; }
+	if ((conn->serverfd >= 0) || conn->nodes){
+		errno = EISCONN;
+		perror("openConnection");
+		return -1;
+	}
+	if (strchr(sockname, CONN_SEP)) return conn_openCluster(conn, sockname, msec, abstime);
+	return conn_open(conn, sockname, msec, abstime);
+}
+
+
 /**
  * @brief Closes connection to the server whose address is #sockname and sets
  * serverfd to -1 (i.e., no active connections).
@@ -295,23 +595,72 @@ int openConnection(const char* sockname, int msec, const struct timespec abstime
  *	- EINVAL: sockname is NULL or it is a different socket address.
  */
 int closeConnection(const char* sockname){
-	if (serverfd < 0){ /* Not connected */
+	clientconn_t* conn = conn_current();
+	if ((conn->serverfd < 0) && !conn->nodes){ /* Not connected */
 		errno = ENOTCONN;
 		perror("closeConnection");
 		return -1;
 	}
-	if (!sockname || (strncmp(sockname, serverAddr.sun_path, addrLen) != 0)){
+	if (!sockname || (strcmp(sockname, conn->sockname) != 0)){
 		errno = EINVAL;
 		perror("closeConnection");
 		return -1;
 	}
-	close(serverfd);
-	serverfd = -1; /* Available for new connections */
+	async_reset(); /* Replies to pending requests (if any) are lost */
+	conn_close(conn); /* Available for new connections */
 	if (prints_enabled) printf("[process %d] closeConnection succeeded\n", getpid());
 	return 0;
 }
 
 
+/**
+ * @brief Creates a new (NOT connected) connection handle. ALL the functions
+ * of this API act on the current connection of the calling thread, which is
+ * selected by connSelect: hence different threads can use different connections
+ * (even to different servers) concurrently.
+ * @return Pointer to the new handle on success, NULL on error (ENOMEM).
+ */
+clientconn_t* connCreate(void){
+	clientconn_t* conn = malloc(sizeof(clientconn_t));
+	if (!conn){ errno = ENOMEM; return NULL; }
+	memset(conn, 0, sizeof(clientconn_t));
+	conn->serverfd = -1;
+	conn->areqBase = 1;
+	return conn;
+}
+
+
+/**
+ * @brief Makes #conn the current connection of the calling thread, or the
+ * default one (shared by ALL the threads that do NOT select any other one)
+ * if conn == NULL.
+ * @return 0 on success, -1 on error (by pthread_setspecific).
+ */
+int connSelect(clientconn_t* conn){
+	pthread_once(&connOnce, conn_keyinit);
+	int res = pthread_setspecific(connKey, conn);
+	if (res != 0){ errno = res; return -1; }
+	return 0;
+}
+
+
+/**
+ * @brief Destroys a connection handle made by connCreate, which MUST NOT be
+ * the current connection of any thread.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: conn is NULL;
+ *	- EISCONN: conn is still connected (see closeConnection).
+ */
+int connDestroy(clientconn_t* conn){
+	if (!conn || (conn == &defaultConn)){ errno = EINVAL; return -1; }
+	if ((conn->serverfd >= 0) || conn->nodes){ errno = EISCONN; return -1; }
+	free(conn->areqs);
+	free(conn);
+	return 0;
+}
+
+
 /**
  * @brief Tries to open a file in the server with the absolute path #pathname.
  * @param pathname -- Path of the file to open.
@@ -330,6 +679,7 @@ int closeConnection(const char* sockname){
  *	- any error returned by msend/mrecv.
   */
 int openFile(const char* pathname, int flags){
+	clientconn_t* conn = conn_route(pathname);
 	if (!pathname || (flags && !(flags & O_CREATE) && !(flags & O_LOCK))){ /* NULL pathname or invalid flags */
 		errno = EINVAL;
 		perror("openFile");
@@ -338,7 +688,7 @@ int openFile(const char* pathname, int flags){
 	int res = 0;
 	message_t* msg;
 	
-	if (serverfd < 0){ /* Not connected */
+	if (conn->serverfd < 0){ /* Not connected */
 		errno = ENOTCONN;
 		perror("openFile");		
 		return -1;
@@ -348,13 +698,13 @@ int openFile(const char* pathname, int flags){
 	IS_ABS_PATH(openFile, pathname);
 	
 	/* Creates message and sends to server; if there is an error, we would be able to free any other resource before exiting the client */
-	SYSCALL_RETURN(msend(serverfd, &msg, M_OPENF, "openFile: while creating message to send", 
+	SYSCALL_RETURN(msend(conn->serverfd, &msg, M_OPENF, "openFile: while creating message to send", 
 		"openFile: while creating message to send", strlen(pathname) + 1, pathname, sizeof(int), &flags), -1, NULL);
 
 	/* Decodes message */
 	while (true){
 		/* Receives message(s) from server; if there is an error, we would be able to free any other resource before exiting the client */
-		SYSCALL_RETURN(mrecv(serverfd, &msg, "openFile: while creating data to receive message", 
+		SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "openFile: while creating data to receive message", 
 			"openFile: while receiving message from server"), -1, NULL);
 		if (msg->type == M_ERR){
 			int error = *((int*)msg->args[0].content); /* Error on server */
@@ -390,6 +740,7 @@ int openFile(const char* pathname, int flags){
  *	- any error returned by msend/mrecv.
   */
 int closeFile(const char* pathname){
+	clientconn_t* conn = conn_route(pathname);
 	if (!pathname){
 		errno = EINVAL;
 		perror("closeFile");
@@ -398,7 +749,7 @@ int closeFile(const char* pathname){
 	int res = 0;
 	message_t* msg;
 	
-	if (serverfd < 0){ /* Not connected */
+	if (conn->serverfd < 0){ /* Not connected */
 		errno = EBADF;
 		perror("closeFile");		
 		return -1;
@@ -408,13 +759,13 @@ int closeFile(const char* pathname){
 	IS_ABS_PATH(openFile, pathname);		
 
 	/* Creates message and sends to server */
-	SYSCALL_RETURN(msend(serverfd, &msg, M_CLOSEF, "closeFile: while creating message to send", 
+	SYSCALL_RETURN(msend(conn->serverfd, &msg, M_CLOSEF, "closeFile: while creating message to send", 
 		"closeFile: while creating message to send", strlen(pathname) + 1, pathname), -1, NULL);
 
 	/* Decodes message */
 	while (true){
 		/* Receives message(s) from server */
-		SYSCALL_RETURN(mrecv(serverfd, &msg, "closeFile: while creating data to receive message",
+		SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "closeFile: while creating data to receive message",
 			"closeFile: while receiving message from server"), -1, NULL);
 		if (msg->type == M_ERR){
 			int error = *((int*)msg->args[0].content); /* Error on server */
@@ -452,12 +803,13 @@ int closeFile(const char* pathname){
  *	- any error returned by msend/mrecv.
   */
 int readFile(const char* pathname, void** buf, size_t* size){
+	clientconn_t* conn = conn_route(pathname);
 	if (!pathname || !buf || !size){ errno = EINVAL; return -1; }
 	int res;
 	message_t* msg;
 	bool frecv = false; /* File received */
 
-	if (serverfd < 0){ /* Not connected */
+	if (conn->serverfd < 0){ /* Not connected */
 		errno = EBADF;
 		perror("readFile");		
 		return -1;
@@ -466,12 +818,12 @@ int readFile(const char* pathname, void** buf, size_t* size){
 	/* Checking absolute path */
 	IS_ABS_PATH(openFile, pathname);		
 
-	SYSCALL_RETURN(msend(serverfd, &msg, M_READF, "readFile: while creating message to send",
+	SYSCALL_RETURN(msend(conn->serverfd, &msg, M_READF, "readFile: while creating message to send",
 		"readFile: while sending message to server", strlen(pathname) + 1, pathname), -1, "readFile: msend");
 	
 	size_t rbytes = 0; /* For stats printing */
 	while (true){
-		SYSCALL_RETURN(mrecv(serverfd, &msg, "readFile: while creating data to receive message",
+		SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "readFile: while creating data to receive message",
 			"readFile: while receiving message from server"), -1, "readFile: mrecv");
 		if (msg->type == M_ERR){
 			int error = *((int*)msg->args[0].content); /* Error on server */
@@ -511,7 +863,7 @@ int readFile(const char* pathname, void** buf, size_t* size){
  * by server is discarded.
  * @return 0 on success, -1 on error (errno set).
  * Possible errors are:
- * 	- EINVAL: at least one or pathname, buf or dirname is NULL;
+ * 	- EINVAL: at least one of pathname or buf is NULL;
  *	- ENOMEM: unable to allocate memory to send request to server;
  *	- EBADMSG: wrong message received by server or EOF read by a mrecv before
  *		having received all current message content;
@@ -520,11 +872,12 @@ int readFile(const char* pathname, void** buf, size_t* size){
  *	- any error returned by msend/mrecv.
  */
 int appendToFile(const char* pathname, void* buf, size_t size, const char* dirname){
-	if (!pathname || !buf || !dirname){ errno = EINVAL; return -1; }
+	clientconn_t* conn = conn_route(pathname);
+	if (!pathname || !buf){ errno = EINVAL; return -1; }
 	int res;
 	message_t* msg;
 
-	if (serverfd < 0){ /* Not connected */
+	if (conn->serverfd < 0){ /* Not connected */
 		errno = EBADF;
 		perror("appendToFile");		
 		return -1;
@@ -533,11 +886,11 @@ int appendToFile(const char* pathname, void* buf, size_t size, const char* dirna
 	/* Checking absolute path */
 	IS_ABS_PATH(openFile, pathname);		
 
-	SYSCALL_RETURN(msend(serverfd, &msg, M_APPENDF, "appendToFile: while creating message to send", 
+	SYSCALL_RETURN(msend(conn->serverfd, &msg, M_APPENDF, "appendToFile: while creating message to send", 
 		"appendToFile: while sending message to server", strlen(pathname)+1, pathname, size, buf), -1, NULL);
 	
 	while (true){
-		SYSCALL_RETURN(mrecv(serverfd, &msg, "appendToFile: while creating data to receive message",
+		SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "appendToFile: while creating data to receive message",
 			"appendToFile: while receiving message from server"), -1, NULL);
 		if (msg->type == M_ERR){
 			int error = *((int*)msg->args[0].content); /* Error on server */
@@ -569,54 +922,23 @@ int appendToFile(const char* pathname, void* buf, size_t size, const char* dirna
 
 
 /**
- * @brief Loads file identified by #pathname from disk and writes all its 
- * content to the file storage server. This operations succeeds iff the 
- * preceeding (succeeding) one on the same file by the same client has been:
- *	openFile(pathname, O_CREATE | O_LOCK).
- * @note Any received file from server (M_GETF) with (modified == true) is
- * saved on disk in the folder dirname by replicating the ENTIRE absolute path.
- * @return 0 on success, -1 on error.
- * Possible errors are:
- *	- EINVAL: invalid arguments (pathname == NULL);
- *	- ENOMEM: unable to allocate memory for sending request to the server;
- *	- EBADMSG: bad message received from server (i.e., bad message type or incomplete one);
- *	- EBADF: there is no active connection;
- *	- EBADE: (not fatal) error on server;
- *	- any error returned by msend/mrecv.
+ * @brief Receives the reply to a write/append request on #pathname, saving
+ * in #dirname (if NOT NULL) ANY expelled file (M_GETF) with (modified == true)
+ * sent back by server before it.
+ * @return 0 on M_OK, 1 on M_ERR (*error is set to the error on server), -1 on
+ * error (errno set by mrecv or EBADMSG for a wrong message).
  */
-int writeFile(const char* pathname, const char* dirname){
-	if (!pathname){ errno = EINVAL; return -1; }
-	void* content;
-	size_t size;
-	SYSCALL_RETURN(loadFile(pathname, &content, &size), -1, "writeFile: while loading file");
-	int res;
+static int recvWriteReply(clientconn_t* conn, const char* dirname, int* error){
 	message_t* msg;
-
-	if (serverfd < 0){ /* Not connected */
-		errno = EBADF;
-		perror("writeFile");		
-		return -1;
-	}
-
-	/* Getting absolute path */
-	char realFilePath[MAXPATHSIZE];
-	GET_ABS_PATH(writeFile, pathname, &realFilePath);		
-
-	SYSCALL_RETURN(msend(serverfd, &msg, M_WRITEF, "writeFile: while creating message to send", 
-		"writeFile: while sending message to server", strlen(realFilePath)+1, realFilePath, size, content), -1, NULL);
-
-	free(content); /* Loaded on heap by loadFile */
+	int res;
 	while (true){
-		SYSCALL_RETURN(mrecv(serverfd, &msg, "writeFile: while creating data to receive message",
+		SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "writeFile: while creating data to receive message",
 			"writeFile: while receiving message from server"), -1, NULL);
 		if (msg->type == M_ERR){
-			int error = *((int*)msg->args[0].content); /* Error on server */
-			PRINT_OP_WR(writeFile, realFilePath, error, 0); /* No data written */
-			errno = EBADE;
-			res = -1;
+			*error = *((int*)msg->args[0].content); /* Error on server */
+			res = 1;
 			break;
 		} else if (msg->type == M_OK){
-			PRINT_OP_WR(writeFile, realFilePath, 0, size); /* All data written */
 			res = 0;
 			break;
 		} else if (msg->type == M_GETF){
@@ -639,9 +961,73 @@ int writeFile(const char* pathname, const char* dirname){
 
 
 /**
- * @brief Reads #N "random" files from server - or ALL files if N <= 0 -
- * and saves them into the directory #dirname if not NULL, otherwise it
- * discards all read files.
+ * @brief Loads file identified by #pathname from disk and writes all its 
+ * content to the file storage server. This operations succeeds iff the 
+ * preceeding (succeeding) one on the same file by the same client has been:
+ *	openFile(pathname, O_CREATE | O_LOCK).
+ * File is mapped in memory (see mapFile) and sent straight from the mapping
+ * in chunks of at most WRITE_CHUNK bytes: the first one by a write request
+ * and the others by append requests, such that neither client nor server
+ * need the whole file in memory.
+ * @note Any received file from server (M_GETF) with (modified == true) is
+ * saved on disk in the folder dirname by replicating the ENTIRE absolute path.
+ * @note If a chunk after the first one fails, the bytes already written are
+ * left in the file (which is still locked by the calling client).
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments (pathname == NULL);
+ *	- ENOMEM: unable to allocate memory for sending request to the server;
+ *	- EBADMSG: bad message received from server (i.e., bad message type or incomplete one);
+ *	- EBADF: there is no active connection;
+ *	- EBADE: (not fatal) error on server;
+ *	- any error returned by mapFile, msend/mrecv.
+ */
+int writeFile(const char* pathname, const char* dirname){
+	if (!pathname){ errno = EINVAL; return -1; }
+
+	/* Getting absolute path */
+	char realFilePath[MAXPATHSIZE];
+	GET_ABS_PATH(writeFile, pathname, &realFilePath);
+	clientconn_t* conn = conn_route(realFilePath); /* Server sees the absolute path */
+
+	if (conn->serverfd < 0){ /* Not connected */
+		errno = EBADF;
+		perror("writeFile");		
+		return -1;
+	}
+
+	void* content;
+	size_t size;
+	SYSCALL_RETURN(mapFile(pathname, &content, &size), -1, "writeFile: while mapping file");
+	message_t* msg;
+	msg_t type = M_WRITEF; /* First chunk */
+	size_t written = 0;
+	int res, error = 0;
+	do {
+		size_t len = size - written;
+		if (len > WRITE_CHUNK) len = WRITE_CHUNK;
+		res = msend(conn->serverfd, &msg, type, "writeFile: while creating message to send", "writeFile: while sending message to server",
+			strlen(realFilePath)+1, realFilePath, len, (content ? (char*)content + written : "")); /* Empty file: NOT NULL */
+		if (res == 0) res = recvWriteReply(conn, dirname, &error);
+		if (res == 0) written += len;
+		type = M_APPENDF;
+	} while ((res == 0) && (written < size));
+	int errno_copy = errno;
+	unmapFile(content, size);
+	errno = errno_copy;
+	if (res == 1){
+		PRINT_OP_WR(writeFile, realFilePath, error, written);
+		errno = EBADE;
+		return -1;
+	} else if (res == 0) PRINT_OP_WR(writeFile, realFilePath, 0, size); /* All data written */
+	return res;
+}
+
+
+/**
+ * @brief Reads #N "random" files from the server of #conn - or ALL files if
+ * N <= 0 - and saves them into the directory #dirname if not NULL, otherwise
+ * it discards all read files.
  * @return a non-negative integer on success (i.e., number of successfully
  * read file(s)), -1 on error (errno set).
  * Possible errors are:
@@ -653,22 +1039,22 @@ int writeFile(const char* pathname, const char* dirname){
  *	- EBADE: (not fatal) error on server;
  *	- all errors returned by msend/mrecv.
  */
-int	readNFiles(int N, const char* dirname){
+static int readn_request(clientconn_t* conn, int N, const char* dirname){
 	int res = 0;
 	message_t* msg;
 
-	if (serverfd < 0){ /* Not connected */
+	if (conn->serverfd < 0){ /* Not connected */
 		errno = EBADF;
 		perror("readNFiles");		
 		return -1;
 	}
 
-	SYSCALL_RETURN(msend(serverfd, &msg, M_READNF, "readNFiles: while creating message to send", 
+	SYSCALL_RETURN(msend(conn->serverfd, &msg, M_READNF, "readNFiles: while creating message to send", 
 		"readNFiles: while sending message to server", sizeof(int), &N), -1, NULL);
 		
 	size_t rbytes = 0; /* Total bytes read */
 	while (true){
-		SYSCALL_RETURN(mrecv(serverfd, &msg, "readNFiles: while creating data to receive message",
+		SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "readNFiles: while creating data to receive message",
 			"readNFiles: while receiving message from server"), -1, NULL);
 		if (msg->type == M_OK){
 			PRINT_OP_RDNF(readNFiles, res, 0, rbytes);
@@ -709,24 +1095,34 @@ int	readNFiles(int N, const char* dirname){
 
 
 /**
- * @brief Sets O_LOCK flag to the file identified by
- * #pathname in the file storage server. This operation
- * succeeds immediately if O_LOCK flag is not set or has
- * been already set by the same client, otherwise it
- * blocks until the flag is reset by the owner or the file
- * is removed from server.
- * @return 0 on success, -1 on error.
- * Possible errors are:
- *	- EINVAL: invalid arguments (pathname == NULL);
- *	- ENOMEM: unable to allocate memory for sending
- *	request to the server;
- *	- EBADMSG: bad message received from server (i.e.,
- *	bad message type or incomplete one);
- *	- EBADF: there is no active connection;
- *	- EBADE: (not fatal) error on server;
- *	- any error returned by msend/mrecv.
+ * @brief Reads #N "random" files from server - or ALL files if N <= 0 -
+ * and saves them into the directory #dirname if not NULL, otherwise it
+ * discards all read files. For a cluster, files are read from each server
+ * in turn until N files have been read.
+ * @return a non-negative integer on success (i.e., number of successfully
+ * read file(s)), -1 on error (errno set, see readn_request).
+ */
+int readNFiles(int N, const char* dirname){
+	clientconn_t* conn = conn_current();
+	if (!conn->nodes) return readn_request(conn, N, dirname);
+	int total = 0;
+	for (int i = 0; i < conn->nnodes; i++){
+		int res = readn_request(conn->nodes[i], (N > 0 ? N - total : N), dirname);
+		if (res == -1) return -1;
+		total += res;
+		if ((N > 0) && (total >= N)) break;
+	}
+	return total;
+}
+
+
+/**
+ * @brief Sends a M_LOCKF request with a maximum waiting time of #msec
+ * milliseconds (0 for waiting indefinitely) and waits for the reply.
+ * @return As lockFile.
  */
-int lockFile(const char* pathname){
+static int lock_request(const char* pathname, int msec){
+	clientconn_t* conn = conn_route(pathname);
 	if (!pathname){
 		errno = EINVAL;
 		perror("lockFile");
@@ -736,7 +1132,7 @@ int lockFile(const char* pathname){
 	message_t* msg;
 	
 	/* Creates message and sends to server */
-	if (serverfd < 0){ /* Not connected */
+	if (conn->serverfd < 0){ /* Not connected */
 		errno = EBADF;
 		perror("lockFile");		
 		return -1;
@@ -745,18 +1141,18 @@ int lockFile(const char* pathname){
 	/* Checking absolute path */
 	IS_ABS_PATH(openFile, pathname);
 
-	SYSCALL_RETURN(msend(serverfd, &msg, M_LOCKF, "lockFile: while creating message to send", 
-		"lockFile: while creating message to send", strlen(pathname)+1, pathname), -1, NULL);
+	SYSCALL_RETURN(msend(conn->serverfd, &msg, M_LOCKF, "lockFile: while creating message to send", 
+		"lockFile: while creating message to send", strlen(pathname)+1, pathname, sizeof(int), &msec), -1, NULL);
 
 	/* Decodes message */
 	while (true){
 		/* Receives message(s) from server */
-		SYSCALL_RETURN(mrecv(serverfd, &msg, "lockFile: while creating data to receive message",
+		SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "lockFile: while creating data to receive message",
 			"lockFile: while receiving message from server"), -1, NULL);
 		if (msg->type == M_ERR){
 			int error = *((int*)msg->args[0].content); /* Error on server */
 			PRINT_OP_SIMPLE(lockFile, pathname, error);
-			errno = EBADE;
+			errno = (error == ETIMEDOUT ? ETIMEDOUT : EBADE); /* Maximum waiting time expired */
 			res = -1;
 			break;
 		} else if (msg->type == M_OK){
@@ -775,6 +1171,50 @@ int lockFile(const char* pathname){
 }
 
 
+/**
+ * @brief Sets O_LOCK flag to the file identified by
+ * #pathname in the file storage server. This operation
+ * succeeds immediately if O_LOCK flag is not set or has
+ * been already set by the same client, otherwise it
+ * blocks until the flag is reset by the owner or the file
+ * is removed from server.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments (pathname == NULL);
+ *	- ENOMEM: unable to allocate memory for sending
+ *	request to the server;
+ *	- EBADMSG: bad message received from server (i.e.,
+ *	bad message type or incomplete one);
+ *	- EBADF: there is no active connection;
+ *	- EBADE: (not fatal) error on server;
+ *	- any error returned by msend/mrecv.
+ */
+int lockFile(const char* pathname){ return lock_request(pathname, 0); }
+
+
+/**
+ * @brief As lockFile, but waits for the lock at most for the time specified
+ * in #abstime, relative to the call as in openConnection (rounded up to
+ * milliseconds).
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments (pathname == NULL or negative/null timeout);
+ *	- ETIMEDOUT: timeout has expired and the lock has NOT been acquired;
+ *	- any other error by lockFile.
+ */
+int lockFileTimed(const char* pathname, const struct timespec abstime){
+	if ((abstime.tv_sec < 0) || (abstime.tv_nsec < 0) || (abstime.tv_nsec >= 1000000000L)
+		|| ((abstime.tv_sec == 0) && (abstime.tv_nsec == 0))){
+		errno = EINVAL;
+		perror("lockFileTimed");
+		return -1;
+	}
+	long long msec = (long long)abstime.tv_sec * 1000LL + (abstime.tv_nsec + 999999L) / 1000000L;
+	if (msec > INT_MAX) msec = INT_MAX;
+	return lock_request(pathname, (int)msec);
+}
+
+
 /**
  * @brief Resets the O_LOCK flag to the file identified
  * by pathname in the file storage server. This operation
@@ -791,6 +1231,7 @@ int lockFile(const char* pathname){
  *	- any error returned by msend/mrecv.
  */
 int unlockFile(const char* pathname){
+	clientconn_t* conn = conn_route(pathname);
 	if (!pathname){
 		errno = EINVAL;
 		perror("unlockFile");
@@ -799,7 +1240,7 @@ int unlockFile(const char* pathname){
 	int res = 0;
 	message_t* msg;
 	
-	if (serverfd < 0){ /* Not connected */
+	if (conn->serverfd < 0){ /* Not connected */
 		errno = EBADF;
 		perror("unlockFile");		
 		return -1;
@@ -809,13 +1250,13 @@ int unlockFile(const char* pathname){
 	IS_ABS_PATH(openFile, pathname);		
 
 	/* Creates message and sends to server */
-	SYSCALL_RETURN(msend(serverfd, &msg, M_UNLOCKF, "unlockFile: while creating message to send", 
+	SYSCALL_RETURN(msend(conn->serverfd, &msg, M_UNLOCKF, "unlockFile: while creating message to send", 
 		"unlockFile: while creating message to send", strlen(pathname)+1, pathname), -1, NULL);
 
 	/* Decodes message */
 	while (true){
 		/* Receives message(s) from server */
-		SYSCALL_RETURN(mrecv(serverfd, &msg, "unlockFile: while creating data to receive message",
+		SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "unlockFile: while creating data to receive message",
 			"unlockFile: while receiving message from server"), -1, NULL);
 		if (msg->type == M_ERR){
 			int error = *((int*)msg->args[0].content); /* Error on server */
@@ -852,6 +1293,7 @@ int unlockFile(const char* pathname){
  *	- any error returned by msend/mrecv.
  */
 int removeFile(const char* pathname){
+	clientconn_t* conn = conn_route(pathname);
 	if (!pathname){
 		errno = EINVAL;
 		perror("removeFile");
@@ -860,7 +1302,7 @@ int removeFile(const char* pathname){
 	int res = 0;
 	message_t* msg;
 	
-	if (serverfd < 0){ /* Not connected */
+	if (conn->serverfd < 0){ /* Not connected */
 		errno = EBADF;
 		perror("removeFile");		
 		return -1;
@@ -870,13 +1312,13 @@ int removeFile(const char* pathname){
 	IS_ABS_PATH(openFile, pathname);		
 
 	/* Creates message and sends to server */
-	SYSCALL_RETURN(msend(serverfd, &msg, M_REMOVEF, "removeFile: while creating message to send", 
+	SYSCALL_RETURN(msend(conn->serverfd, &msg, M_REMOVEF, "removeFile: while creating message to send", 
 		"removeFile: while creating message to send", strlen(pathname)+1, pathname), -1, NULL);
 
 	/* Decodes message */
 	while (true){
 		/* Receives message(s) from server */
-		SYSCALL_RETURN(mrecv(serverfd, &msg, "removeFile: while creating data to receive message",
+		SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "removeFile: while creating data to receive message",
 			"removeFile: while receiving message from server"), -1, NULL);
 		if (msg->type == M_ERR){
 			int error = *((int*)msg->args[0].content); /* Error on server */
@@ -897,3 +1339,1053 @@ int removeFile(const char* pathname){
 	msg_destroy(msg, free, free);	
 	return res;
 }
+
+
+/**
+ * @brief Loads file identified by #pathname from disk and stores it on the
+ * server as a NEW file by a single compound request, equivalent to the sequence
+ * {openFile(O_CREATE | O_LOCK), writeFile, closeFile, unlockFile} but atomic
+ * and handled by server with a single lookup.
+ * @note Any received file from server (M_GETF) with (modified == true) is
+ * saved on disk in the folder dirname by replicating the ENTIRE absolute path.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments (pathname == NULL);
+ *	- ENOMEM: unable to allocate memory for sending request to the server;
+ *	- EBADMSG: bad message received from server (i.e., bad message type or incomplete one);
+ *	- EBADF: there is no active connection;
+ *	- EBADE: (not fatal) error on server (e.g. file already existing);
+ *	- any error returned by mapFile, msend/mrecv.
+ */
+int putFile(const char* pathname, const char* dirname){
+	if (!pathname){ errno = EINVAL; return -1; }
+
+	/* Getting absolute path */
+	char realFilePath[MAXPATHSIZE];
+	GET_ABS_PATH(putFile, pathname, &realFilePath);
+	clientconn_t* conn = conn_route(realFilePath); /* Server sees the absolute path */
+	int res;
+	message_t* msg;
+
+	if (conn->serverfd < 0){ /* Not connected */
+		errno = EBADF;
+		perror("putFile");
+		return -1;
+	}
+
+	void* content;
+	size_t size;
+	SYSCALL_RETURN(mapFile(pathname, &content, &size), -1, "putFile: while mapping file");
+	/* Sent by a single request (the compound operation is atomic), straight from the mapping */
+	res = msend(conn->serverfd, &msg, M_PUTF, "putFile: while creating message to send", 
+		"putFile: while sending message to server", strlen(realFilePath)+1, realFilePath, size, (content ? content : ""));
+	int errno_copy = errno;
+	unmapFile(content, size);
+	errno = errno_copy;
+	if (res == -1) return -1;
+
+	while (true){
+		SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "putFile: while creating data to receive message",
+			"putFile: while receiving message from server"), -1, NULL);
+		if (msg->type == M_ERR){
+			int error = *((int*)msg->args[0].content); /* Error on server */
+			PRINT_OP_WR(putFile, realFilePath, error, 0); /* No data written */
+			errno = EBADE;
+			res = -1;
+			break;
+		} else if (msg->type == M_OK){
+			PRINT_OP_WR(putFile, realFilePath, 0, size); /* All data written */
+			res = 0;
+			break;
+		} else if (msg->type == M_GETF){
+			if (*((bool*)msg->args[2].content) == true){ /* File had O_DIRTY bit set and so it needs to be saved */
+				if (saveFile((const char*)msg->args[0].content, dirname, msg->args[1].content, msg->args[1].len) == -1){
+					perror("putFile: while saving received file");
+				}
+			}
+			msg_destroy(msg, free, free);
+			continue; /* Continues loop */
+		} else { /* Wrong message received */
+			errno = EBADMSG;
+			res = -1;
+			break;
+		}
+	}
+	msg_destroy(msg, free, free); /* M_OK / M_ERR */
+	return res;
+}
+
+
+/**
+ * @brief Reads file identified by #pathname from server by a single compound
+ * request, equivalent to the sequence {openFile(0), readFile, closeFile}.
+ * @return 0 on success, -1 on error (errno set, as readFile).
+ */
+int fetchFile(const char* pathname, void** buf, size_t* size){
+	clientconn_t* conn = conn_route(pathname);
+	if (!pathname || !buf || !size){ errno = EINVAL; return -1; }
+	int res;
+	message_t* msg;
+	bool frecv = false; /* File received */
+
+	if (conn->serverfd < 0){ /* Not connected */
+		errno = EBADF;
+		perror("fetchFile");
+		return -1;
+	}
+
+	/* Checking absolute path */
+	IS_ABS_PATH(fetchFile, pathname);
+
+	SYSCALL_RETURN(msend(conn->serverfd, &msg, M_FETCHF, "fetchFile: while creating message to send",
+		"fetchFile: while sending message to server", strlen(pathname) + 1, pathname), -1, "fetchFile: msend");
+
+	size_t rbytes = 0; /* For stats printing */
+	while (true){
+		SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "fetchFile: while creating data to receive message",
+			"fetchFile: while receiving message from server"), -1, "fetchFile: mrecv");
+		if (msg->type == M_ERR){
+			int error = *((int*)msg->args[0].content); /* Error on server */
+			PRINT_OP_RD(fetchFile, pathname, error, rbytes);
+			errno = EBADE;
+			res = -1;
+			break;
+		} else if (msg->type == M_OK){
+			PRINT_OP_RD(fetchFile, pathname, 0, rbytes);
+			res = 0;
+			break;
+		} else if ((msg->type == M_GETF) && !frecv){
+			*buf = msg->args[1].content; /* First is path */
+			*size = msg->args[1].len;
+			msg->args[1].content = NULL; /* To destroy message */
+			frecv = true;
+			rbytes += *size;
+			msg_destroy(msg, free, free);
+			continue;
+		} else { /* Wrong message received */
+			if (frecv){ free(*buf); *buf = NULL; }
+			errno = EBADMSG;
+			res = -1;
+			break;
+		}
+	}
+	msg_destroy(msg, free, free);
+	return res;
+}
+
+
+/* Arguments of a batched request (see readFiles, writeFiles) */
+typedef struct batch_s {
+	const char** pathnames; /* Absolute paths of files */
+	void** bufs; /* Contents of files */
+	size_t* sizes; /* Sizes of files */
+	int* errs; /* Results on server (NULL if NOT requested) */
+	const char* dirname; /* Directory in which expelled files are saved (writeFiles) */
+} batch_t;
+
+
+/**
+ * @brief Splits the n files of a batch among the servers that own them (see
+ * conn_route) and in requests of at most MSG_BATCH_MAXFILES files, by calling
+ * request(node, batch, idx, m) for each group of m files, whose indices in the
+ * batch are idx[0..m-1].
+ * @return Sum of the results of the requests on success, -1 on error (the
+ * first one of a request, or ENOMEM).
+ */
+static int batch_split(batch_t* batch, int n, int (*request)(clientconn_t* conn, batch_t* batch, int* idx, int m)){
+	clientconn_t* conn = conn_current();
+	int nnodes = (conn->nodes ? conn->nnodes : 1);
+	int* idx = malloc((n > 0 ? n : 1) * sizeof(int));
+	if (!idx){ errno = ENOMEM; return -1; }
+	int total = 0;
+	for (int j = 0; (j < nnodes) && (total >= 0); j++){
+		clientconn_t* node = (conn->nodes ? conn->nodes[j] : conn);
+		int m = 0;
+		for (int i = 0; i < n; i++){
+			if (conn_route(batch->pathnames[i]) == node) idx[m++] = i;
+		}
+		for (int k = 0; k < m; k += MSG_BATCH_MAXFILES){
+			int res = request(node, batch, idx + k, (m - k > MSG_BATCH_MAXFILES ? MSG_BATCH_MAXFILES : m - k));
+			if (res == -1){ total = -1; break; }
+			total += res;
+		}
+	}
+	int errno_copy = errno;
+	free(idx);
+	errno = errno_copy;
+	return total;
+}
+
+
+/**
+ * @brief Sends a single batched request of type #type (M_FETCHNF, M_PUTNF) for
+ * the m files idx[0..m-1] of batch, with their contents iff type == M_PUTNF.
+ * @return 0 on success, -1 on error.
+ */
+static int batch_send(clientconn_t* conn, msg_t type, batch_t* batch, int* idx, int m){
+	int step = (type == M_PUTNF ? 2 : 1);
+	packet_t* args = malloc(step * m * sizeof(packet_t));
+	if (!args){ errno = ENOMEM; return -1; }
+	for (int k = 0; k < m; k++){
+		const char* pathname = batch->pathnames[idx[k]];
+		args[step * k] = (packet_t){strlen(pathname) + 1, (void*)pathname, 0};
+		if (step == 2) args[step * k + 1] = (packet_t){batch->sizes[idx[k]], (batch->bufs[idx[k]] ? batch->bufs[idx[k]] : ""), 0};
+	}
+	message_t req;
+	req.type = type;
+	req.argn = step * m;
+	req.args = args;
+	req.reqid = 0; /* Current request ID of serverfd */
+	int res = (msg_send(&req, conn->serverfd) < 1 ? -1 : 0);
+	int errno_copy = errno;
+	free(args);
+	errno = errno_copy;
+	return res;
+}
+
+
+/**
+ * @brief Sends a M_FETCHNF request for the m files idx[0..m-1] of batch to the
+ * server of #conn and receives its reply (see readFiles).
+ * @return Number of files read on success, -1 on error (NO buffer of these
+ * files is allocated).
+ */
+static int fetchn_request(clientconn_t* conn, batch_t* batch, int* idx, int m){
+	if (conn->serverfd < 0){ /* Not connected */
+		errno = EBADF;
+		perror("readFiles");
+		return -1;
+	}
+	SYSCALL_RETURN(batch_send(conn, M_FETCHNF, batch, idx, m), -1, "readFiles: while sending message to server");
+	int res = 0;
+	int next = 0; /* Files are sent back in order of request */
+	message_t* msg = NULL;
+	while (true){
+		if (mrecv(conn->serverfd, &msg, "readFiles: while creating data to receive message",
+			"readFiles: while receiving message from server") == -1){ res = -1; break; }
+		if (msg->type == M_GETF){
+			while ((next < m) && !strequal((char*)batch->pathnames[idx[next]], msg->args[0].content)) next++;
+			if (next == m){ errno = EBADMSG; res = -1; break; } /* NOT requested or out of order */
+			batch->bufs[idx[next]] = msg->args[1].content;
+			batch->sizes[idx[next]] = msg->args[1].len;
+			msg->args[1].content = NULL; /* To destroy message */
+			next++;
+			msg_destroy(msg, free, free);
+			continue;
+		} else if ((msg->type == M_FETCHNF) && (msg->args[0].len == m * sizeof(int))){
+			int* results = msg->args[0].content;
+			for (int k = 0; k < m; k++){
+				if (batch->errs) batch->errs[idx[k]] = results[k];
+				if (results[k] == 0) res++;
+				PRINT_OP_RD(readFiles, batch->pathnames[idx[k]], results[k], batch->sizes[idx[k]]);
+			}
+			break;
+		} else if (msg->type == M_ERR){
+			int error = *((int*)msg->args[0].content); /* Error on server */
+			for (int k = 0; k < m; k++) PRINT_OP_RD(readFiles, batch->pathnames[idx[k]], error, (size_t)0);
+			errno = EBADE;
+			res = -1;
+			break;
+		} else { /* Wrong message received */
+			errno = EBADMSG;
+			res = -1;
+			break;
+		}
+	}
+	msg_destroy(msg, free, free);
+	if (res == -1){
+		int errno_copy = errno;
+		for (int k = 0; k < m; k++){
+			free(batch->bufs[idx[k]]);
+			batch->bufs[idx[k]] = NULL;
+			batch->sizes[idx[k]] = 0;
+		}
+		errno = errno_copy;
+	}
+	return res;
+}
+
+
+/**
+ * @brief Reads the n files #pathnames from server by batched requests
+ * (M_FETCHNF), equivalent to a fetchFile on each file but handled by server
+ * within a single acquisition of the storage and replied by a single vectored
+ * response. For a cluster, files are grouped by server.
+ * @param bufs, sizes -- Arrays of n elements that shall contain content
+ * (heap-allocated) and size of each file read (NULL and 0 for the other ones).
+ * @param errs -- If NOT NULL, array of n elements that shall contain 0 for
+ * each file read and the error on server for the other ones.
+ * @return Number of files read on success, -1 on error (NO buffer is allocated).
+ * Possible errors are:
+ *	- EINVAL: invalid arguments (NULL arrays or pathname, n < 0);
+ *	- ENOMEM: unable to allocate memory for sending request to the server;
+ *	- EBADMSG: bad message received from server (i.e., bad message type or incomplete one);
+ *	- EBADF: there is no active connection;
+ *	- EBADE: (not fatal) error on server for the whole batch;
+ *	- any error returned by msg_send/mrecv.
+ */
+int readFiles(const char* pathnames[], int n, void* bufs[], size_t sizes[], int errs[]){
+	if (!pathnames || (n < 0) || !bufs || !sizes){ errno = EINVAL; return -1; }
+	for (int i = 0; i < n; i++){
+		if (!pathnames[i]){ errno = EINVAL; return -1; }
+		IS_ABS_PATH(readFiles, pathnames[i]);
+		bufs[i] = NULL;
+		sizes[i] = 0;
+		if (errs) errs[i] = 0;
+	}
+	batch_t batch = {pathnames, bufs, sizes, errs, NULL};
+	int res = batch_split(&batch, n, fetchn_request);
+	if (res == -1){
+		int errno_copy = errno;
+		for (int i = 0; i < n; i++){
+			free(bufs[i]);
+			bufs[i] = NULL;
+			sizes[i] = 0;
+		}
+		errno = errno_copy;
+	}
+	return res;
+}
+
+
+/**
+ * @brief Sends a M_PUTNF request for the m files idx[0..m-1] of batch to the
+ * server of #conn and receives its reply (see writeFiles).
+ * @return Number of files stored on success, -1 on error.
+ */
+static int putn_request(clientconn_t* conn, batch_t* batch, int* idx, int m){
+	if (conn->serverfd < 0){ /* Not connected */
+		errno = EBADF;
+		perror("writeFiles");
+		return -1;
+	}
+	SYSCALL_RETURN(batch_send(conn, M_PUTNF, batch, idx, m), -1, "writeFiles: while sending message to server");
+	int res = 0;
+	message_t* msg = NULL;
+	while (true){
+		if (mrecv(conn->serverfd, &msg, "writeFiles: while creating data to receive message",
+			"writeFiles: while receiving message from server") == -1){ res = -1; break; }
+		if (msg->type == M_GETF){
+			if (*((bool*)msg->args[2].content) == true){ /* File had O_DIRTY bit set and so it needs to be saved */
+				if (saveFile((const char*)msg->args[0].content, batch->dirname, msg->args[1].content, msg->args[1].len) == -1){
+					perror("writeFiles: while saving received file");
+				}
+			}
+			msg_destroy(msg, free, free);
+			continue; /* Continues loop */
+		} else if ((msg->type == M_PUTNF) && (msg->args[0].len == m * sizeof(int))){
+			int* results = msg->args[0].content;
+			for (int k = 0; k < m; k++){
+				if (batch->errs) batch->errs[idx[k]] = results[k];
+				if (results[k] == 0) res++;
+				PRINT_OP_WR(writeFiles, batch->pathnames[idx[k]], results[k], (results[k] ? 0 : batch->sizes[idx[k]]));
+			}
+			break;
+		} else if (msg->type == M_ERR){
+			int error = *((int*)msg->args[0].content); /* Error on server */
+			for (int k = 0; k < m; k++) PRINT_OP_WR(writeFiles, batch->pathnames[idx[k]], error, (size_t)0);
+			errno = EBADE;
+			res = -1;
+			break;
+		} else { /* Wrong message received */
+			errno = EBADMSG;
+			res = -1;
+			break;
+		}
+	}
+	msg_destroy(msg, free, free);
+	return res;
+}
+
+
+/**
+ * @brief Loads the n files #pathnames from disk and stores them on the server
+ * as NEW files by batched requests (M_PUTNF), equivalent to a putFile on each
+ * file but handled by server within a single acquisition of the storage. For
+ * a cluster, files are grouped by server.
+ * @note Any received file from server (M_GETF) with (modified == true) is
+ * saved on disk in the folder dirname by replicating the ENTIRE absolute path.
+ * @param errs -- If NOT NULL, array of n elements that shall contain 0 for
+ * each file stored and the error on server for the other ones.
+ * @return Number of files stored on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments (pathnames == NULL or n < 0);
+ *	- ENOMEM: unable to allocate memory for sending request to the server;
+ *	- EBADMSG: bad message received from server (i.e., bad message type or incomplete one);
+ *	- EBADF: there is no active connection;
+ *	- EBADE: (not fatal) error on server for the whole batch;
+ *	- any error returned by realpath, mapFile, msg_send/mrecv.
+ */
+int writeFiles(const char* pathnames[], int n, const char* dirname, int errs[]){
+	if (!pathnames || (n < 0)){ errno = EINVAL; return -1; }
+	char** realpaths = calloc((n > 0 ? n : 1), sizeof(char*));
+	void** contents = calloc((n > 0 ? n : 1), sizeof(void*));
+	size_t* sizes = calloc((n > 0 ? n : 1), sizeof(size_t));
+	int res = 0;
+	int nmapped = 0;
+	if (!realpaths || !contents || !sizes){ errno = ENOMEM; res = -1; }
+	for (; (res == 0) && (nmapped < n); nmapped++){
+		if (!pathnames[nmapped]){ errno = EINVAL; res = -1; break; }
+		if (errs) errs[nmapped] = 0;
+		/* Server sees the absolute path */
+		if (!(realpaths[nmapped] = malloc(MAXPATHSIZE)) || !realpath(pathnames[nmapped], realpaths[nmapped])){
+			int errno_copy = (realpaths[nmapped] ? errno : ENOMEM);
+			fprintf(stderr, "writeFiles: while getting absolute path:");
+			errno = errno_copy;
+			perror(NULL);
+			res = -1;
+			break;
+		}
+		if (mapFile(pathnames[nmapped], &contents[nmapped], &sizes[nmapped]) == -1){
+			perror("writeFiles: while mapping file");
+			res = -1;
+			break;
+		}
+	}
+	if (res == 0){
+		batch_t batch = {(const char**)realpaths, contents, sizes, errs, dirname};
+		res = batch_split(&batch, n, putn_request);
+	}
+	int errno_copy = errno;
+	for (int i = 0; i < nmapped; i++) unmapFile(contents[i], sizes[i]);
+	for (int i = 0; realpaths && (i < n); i++) free(realpaths[i]);
+	free(realpaths);
+	free(contents);
+	free(sizes);
+	errno = errno_copy;
+	return res;
+}
+
+
+/**
+ * @brief Gets the live statistics of the server (see M_STATS) as a JSON object
+ * ('\0'-terminated), written in a heap-allocated buffer #*buf of *size bytes.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments (buf == NULL or size == NULL);
+ *	- ENOMEM: unable to allocate memory for sending request to the server;
+ *	- EBADMSG: bad message received from server (i.e., bad message type or incomplete one);
+ *	- EBADF: there is no active connection;
+ *	- ENOTSUP: current connection is a cluster (see openConnection);
+ *	- EBADE: (not fatal) error on server;
+ *	- any error returned by msend/mrecv.
+ */
+int getStats(void** buf, size_t* size){
+	clientconn_t* conn = conn_current();
+	if (!buf || !size){ errno = EINVAL; return -1; }
+	if (conn->nodes){ /* Each server has its own statistics */
+		errno = ENOTSUP;
+		perror("getStats");
+		return -1;
+	}
+	int res;
+	int flags = 0;
+	message_t* msg;
+
+	if (conn->serverfd < 0){ /* Not connected */
+		errno = EBADF;
+		perror("getStats");
+		return -1;
+	}
+
+	SYSCALL_RETURN(msend(conn->serverfd, &msg, M_STATS, "getStats: while creating message to send",
+		"getStats: while sending message to server", sizeof(flags), &flags), -1, NULL);
+	SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "getStats: while creating data to receive message",
+		"getStats: while receiving message from server"), -1, NULL);
+	if (msg->type == M_STATS){
+		*buf = msg->args[0].content;
+		*size = msg->args[0].len;
+		msg->args[0].content = NULL; /* To destroy message */
+		res = 0;
+	} else if (msg->type == M_ERR){
+		errno = EBADE;
+		res = -1;
+	} else { /* Wrong message received */
+		errno = EBADMSG;
+		res = -1;
+	}
+	msg_destroy(msg, free, free);
+	return res;
+}
+
+
+/* ************************************ ASYNCHRONOUS API ************************************ */
+
+/**
+ * The asynchronous API does NOT wait for the reply to a request before
+ * returning: each request is tagged with an ID (see msg_setreqid) and the
+ * caller gets it as a handle for retrieving the result later (asyncWait,
+ * asyncPoll, asyncWaitAll). Since the server handles the requests of a
+ * connection in order, replies are received in the same order as requests,
+ * and their IDs are only checked.
+ * For NOT deadlocking with the server (both blocked on writing), the request
+ * bytes sent but not yet replied are at most ASYNC_MAXINFLIGHT, i.e. less than
+ * a socket buffer, apart from a single request sent when there is no other
+ * pending one: when this limit would be exceeded, the oldest replies are
+ * received (and buffered) before sending.
+ * @note Synchronous functions MUST NOT be called while there are pending
+ * asynchronous requests (e.g., call asyncWaitAll before).
+ * @note Pending requests belong to the current connection of the calling thread.
+ * @note On a cluster, replies are ordered ONLY among the requests routed to
+ * the same server.
+ */
+
+
+/* Prints result of a completed request as the corresponding synchronous function */
+static void async_print(areq_t* r){
+	switch(r->type){
+		case M_OPENF: { PRINT_OP_SIMPLE(openFile, r->pathname, r->error); break; }
+		case M_CLOSEF: { PRINT_OP_SIMPLE(closeFile, r->pathname, r->error); break; }
+		case M_LOCKF: { PRINT_OP_SIMPLE(lockFile, r->pathname, r->error); break; }
+		case M_UNLOCKF: { PRINT_OP_SIMPLE(unlockFile, r->pathname, r->error); break; }
+		case M_REMOVEF: { PRINT_OP_SIMPLE(removeFile, r->pathname, r->error); break; }
+		case M_READF: { PRINT_OP_RD(readFile, r->pathname, r->error, r->size); break; }
+		case M_WRITEF: { PRINT_OP_WR(writeFile, r->pathname, r->error, (r->error ? 0 : r->size)); break; }
+		case M_APPENDF: { PRINT_OP_WR(appendToFile, r->pathname, r->error, (r->error ? 0 : r->size)); break; }
+		case M_PUTF: { PRINT_OP_WR(putFile, r->pathname, r->error, (r->error ? 0 : r->size)); break; }
+		case M_FETCHF: { PRINT_OP_RD(fetchFile, r->pathname, r->error, r->size); break; }
+		default: break;
+	}
+}
+
+
+/**
+ * @brief Receives the (whole) reply to the oldest pending request.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EBADMSG: wrong message or wrong request ID received from server;
+ *	- any error by mrecv.
+ */
+static int async_recvNext(void){
+	clientconn_t* conn = conn_current();
+	areq_t* r = &conn->areqs[conn->acompleted];
+	message_t* msg;
+	int res = 0;
+	while (true){
+		SYSCALL_RETURN(mrecv(conn->serverfd, &msg, "async: while creating data to receive message",
+			"async: while receiving message from server"), -1, NULL);
+		if (msg->reqid != (uint32_t)(conn->areqBase + conn->acompleted)){ /* Server does NOT support pipelining */
+			errno = EBADMSG;
+			res = -1;
+			break;
+		}
+		if ((msg->type == M_OK) || (msg->type == M_ERR)){
+			r->error = (msg->type == M_ERR ? *((int*)msg->args[0].content) : 0);
+			r->state = AREQ_DONE;
+			conn->ainflight -= r->reqbytes;
+			conn->acompleted++;
+			async_print(r);
+			break;
+		} else if ((msg->type == M_GETF) && ((r->type == M_READF) || (r->type == M_FETCHF)) && !r->buf){
+			r->buf = msg->args[1].content;
+			r->size = msg->args[1].len;
+			msg->args[1].content = NULL; /* To destroy message */
+		} else if ((msg->type == M_GETF) && ((r->type == M_WRITEF) || (r->type == M_APPENDF) || (r->type == M_PUTF))){
+			if (*((bool*)msg->args[2].content) == true){ /* File had O_DIRTY bit set and so it needs to be saved */
+				if (saveFile((const char*)msg->args[0].content, r->dirname, msg->args[1].content, msg->args[1].len) == -1){
+					perror("async: while saving received file");
+				}
+			}
+		} else { /* Wrong message received */
+			errno = EBADMSG;
+			res = -1;
+			break;
+		}
+		msg_destroy(msg, free, free);
+	}
+	msg_destroy(msg, free, free);
+	return res;
+}
+
+
+/* Frees collected requests at the beginning of areqs */
+static void async_compact(void){
+	clientconn_t* conn = conn_current();
+	int n = 0;
+	while ((n < conn->nareqs) && (conn->areqs[n].state == AREQ_COLLECTED)) n++;
+	if (n == 0) return;
+	memmove(conn->areqs, conn->areqs + n, (conn->nareqs - n) * sizeof(areq_t));
+	conn->nareqs -= n;
+	conn->acompleted -= n;
+	conn->areqBase += n;
+}
+
+
+/* Marks request r as collected, freeing its content */
+static void async_collect(areq_t* r){
+	free(r->pathname);
+	free(r->buf);
+	r->pathname = NULL;
+	r->buf = NULL;
+	r->state = AREQ_COLLECTED;
+}
+
+
+/**
+ * @brief Registers a new pending request, after having received as many
+ * replies as needed for respecting the ASYNC_MAXINFLIGHT/ASYNC_MAXPENDING limits.
+ * @return Pointer to the new request on success, NULL on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory;
+ *	- any error by async_recvNext.
+ */
+static areq_t* async_new(msg_t type, const char* pathname, size_t reqbytes){
+	clientconn_t* conn = conn_current();
+	while ((conn->acompleted < conn->nareqs) && ((conn->ainflight + reqbytes > ASYNC_MAXINFLIGHT) || (conn->nareqs - conn->acompleted >= ASYNC_MAXPENDING))){
+		if (async_recvNext() == -1) return NULL;
+	}
+	if (conn->nareqs == conn->capareqs){
+		int newcap = (conn->capareqs > 0 ? 2 * conn->capareqs : ASYNC_MAXPENDING);
+		areq_t* p = realloc(conn->areqs, newcap * sizeof(areq_t));
+		if (!p){ errno = ENOMEM; return NULL; }
+		conn->areqs = p;
+		conn->capareqs = newcap;
+	}
+	areq_t* r = &conn->areqs[conn->nareqs];
+	memset(r, 0, sizeof(areq_t));
+	if (pathname && !(r->pathname = strdup(pathname))){ errno = ENOMEM; return NULL; }
+	r->type = type;
+	r->state = AREQ_PENDING;
+	r->reqbytes = reqbytes;
+	conn->nareqs++;
+	conn->ainflight += reqbytes;
+	return r;
+}
+
+
+/* Discards ALL requests (e.g. when closing connection) */
+static void async_reset(void){
+	clientconn_t* conn = conn_current();
+	for (int i = 0; i < conn->nareqs; i++) async_collect(&conn->areqs[i]);
+	free(conn->areqs);
+	conn->areqs = NULL;
+	conn->nareqs = 0;
+	conn->capareqs = 0;
+	conn->areqBase = 1;
+	conn->acompleted = 0;
+	conn->ainflight = 0;
+}
+
+
+/* Removes the last registered request (that has NOT been sent) */
+static void async_cancel(void){
+	clientconn_t* conn = conn_current();
+	areq_t* r = &conn->areqs[--conn->nareqs];
+	conn->ainflight -= r->reqbytes;
+	async_collect(r);
+}
+
+
+/**
+ * @brief Utility macro for the ending of asynchronous functions: sends request
+ * with ID of r on serverfd (msend is given by the caller), cancelling it on error.
+ */
+#define ASYNC_SEND(sendcall)\
+do {\
+	int id = conn->areqBase + conn->nareqs - 1;\
+	if ((msg_setreqid(conn->serverfd, (uint32_t)id) == -1) || ((sendcall) == -1)){\
+		async_cancel();\
+		return -1;\
+	}\
+	return id;\
+} while(0);
+
+
+/**
+ * @brief Utility macro for checking connection in asynchronous functions.
+ */
+#define ASYNC_CHECK_CONN(apiFunc)\
+do {\
+	if (conn->serverfd < 0){\
+		errno = EBADF;\
+		perror(#apiFunc);\
+		return -1;\
+	}\
+} while(0);
+
+
+/**
+ * @brief Registers the request #handle sent by the connection #node of the
+ * cluster conn (see ASYNC_CLUSTER).
+ * @return Handle of the request for the cluster on success, -1 on error
+ * (ENOMEM: request has been sent, but its result is discarded).
+ */
+static int async_clusterNew(clientconn_t* conn, clientconn_t* node, int handle){
+	if (conn->clive == 0){ /* ALL the previous requests have been collected */
+		conn->areqBase += conn->ncareqs;
+		conn->ncareqs = 0;
+	}
+	if (conn->ncareqs == conn->capcareqs){
+		int newcap = (conn->capcareqs > 0 ? 2 * conn->capcareqs : ASYNC_MAXPENDING);
+		careq_t* p = realloc(conn->careqs, newcap * sizeof(careq_t));
+		if (!p){ errno = ENOMEM; return -1; }
+		conn->careqs = p;
+		conn->capcareqs = newcap;
+	}
+	int index = 0;
+	while (conn->nodes[index] != node) index++;
+	conn->careqs[conn->ncareqs].node = index;
+	conn->careqs[conn->ncareqs].handle = handle;
+	conn->ncareqs++;
+	conn->clive++;
+	return conn->areqBase + conn->ncareqs - 1;
+}
+
+
+/* @return Request #handle of the cluster conn, NULL if it is invalid or already collected (EINVAL) */
+static careq_t* async_clusterGet(clientconn_t* conn, int handle){
+	if ((handle < conn->areqBase) || (handle >= conn->areqBase + conn->ncareqs) || (conn->careqs[handle - conn->areqBase].node == -1)){
+		errno = EINVAL;
+		return NULL;
+	}
+	return &conn->careqs[handle - conn->areqBase];
+}
+
+
+/**
+ * @brief Utility macro for asynchronous functions on a cluster: makes the
+ * call (the same function) on the connection of the server that owns
+ * #pathname, and returns the handle of the cluster for it.
+ */
+#define ASYNC_CLUSTER(conn, pathname, call)\
+do {\
+	if (conn->nodes){\
+		clientconn_t* node = conn_route(pathname);\
+		pthread_setspecific(connKey, node);\
+		int nodeHandle = (call);\
+		int errno_copy = errno;\
+		pthread_setspecific(connKey, (conn == &defaultConn ? NULL : conn));\
+		errno = errno_copy;\
+		return (nodeHandle == -1 ? -1 : async_clusterNew(conn, node, nodeHandle));\
+	}\
+} while(0);
+
+
+/**
+ * @brief Sends a request with a single pathname argument (M_CLOSEF,
+ * M_UNLOCKF, M_REMOVEF, M_READF, M_FETCHF) WITHOUT waiting for the reply.
+ * @return Handle of the request on success, -1 on error.
+ */
+static int async_pathreq(msg_t type, const char* pathname){
+	clientconn_t* conn = conn_current();
+	message_t* msg;
+	if (!async_new(type, pathname, strlen(pathname) + 1)) return -1;
+	ASYNC_SEND(msend(conn->serverfd, &msg, type, "async: while creating message to send", 
+		"async: while sending message to server", strlen(pathname) + 1, pathname));
+}
+
+
+/**
+ * @brief As openFile, but does NOT wait for the reply.
+ * @return Handle of the request (> 0) on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid pathname or unknown flags specified;
+ *	- EBADF: there is no active connection;
+ *	- ENOMEM: unable to allocate memory;
+ *	- any error by msend or by receiving previous replies.
+ */
+int asyncOpenFile(const char* pathname, int flags){
+	clientconn_t* conn = conn_current();
+	if (!pathname || (flags && !(flags & O_CREATE) && !(flags & O_LOCK))){ errno = EINVAL; return -1; }
+	ASYNC_CLUSTER(conn, pathname, asyncOpenFile(pathname, flags));
+	ASYNC_CHECK_CONN(asyncOpenFile);
+	IS_ABS_PATH(asyncOpenFile, pathname);
+	message_t* msg;
+	if (!async_new(M_OPENF, pathname, strlen(pathname) + 1 + sizeof(int))) return -1;
+	ASYNC_SEND(msend(conn->serverfd, &msg, M_OPENF, "asyncOpenFile: while creating message to send", 
+		"asyncOpenFile: while sending message to server", strlen(pathname) + 1, pathname, sizeof(int), &flags));
+}
+
+
+/**
+ * @brief As readFile, but does NOT wait for the reply: file content is
+ * retrieved by asyncWait.
+ * @return Handle of the request (> 0) on success, -1 on error (as asyncOpenFile).
+ */
+int asyncReadFile(const char* pathname){
+	clientconn_t* conn = conn_current();
+	if (!pathname){ errno = EINVAL; return -1; }
+	ASYNC_CLUSTER(conn, pathname, asyncReadFile(pathname));
+	ASYNC_CHECK_CONN(asyncReadFile);
+	IS_ABS_PATH(asyncReadFile, pathname);
+	return async_pathreq(M_READF, pathname);
+}
+
+
+/**
+ * @brief Maps file #pathname (see mapFile) and sends it by a request of type
+ * #type (M_WRITEF, M_PUTF) WITHOUT waiting for the reply.
+ * @return Handle of the request on success, -1 on error.
+ */
+static int async_writereq(msg_t type, const char* pathname, const char* dirname){
+	clientconn_t* conn = conn_current();
+	void* content;
+	size_t size;
+	SYSCALL_RETURN(mapFile(pathname, &content, &size), -1, "async: while mapping file");
+	char realFilePath[MAXPATHSIZE];
+	memset(realFilePath, 0, sizeof(realFilePath));
+	if (!realpath(pathname, realFilePath)){
+		perror("async: while getting absolute path");
+		unmapFile(content, size);
+		return -1;
+	}
+	message_t* msg;
+	areq_t* r = async_new(type, realFilePath, strlen(realFilePath) + 1 + size);
+	if (!r){
+		unmapFile(content, size);
+		return -1;
+	}
+	r->dirname = dirname;
+	r->size = size;
+	int id = conn->areqBase + conn->nareqs - 1;
+	int res = msg_setreqid(conn->serverfd, (uint32_t)id);
+	if (res == 0) res = msend(conn->serverfd, &msg, type, "async: while creating message to send", 
+		"async: while sending message to server", strlen(realFilePath) + 1, realFilePath, size, (content ? content : ""));
+	int errno_copy = errno;
+	unmapFile(content, size);
+	errno = errno_copy;
+	if (res == -1){
+		async_cancel();
+		return -1;
+	}
+	return id;
+}
+
+
+/**
+ * @brief As writeFile, but does NOT wait for the reply: expelled files sent
+ * back by server are saved in dirname when the reply is received, so dirname
+ * MUST stay valid until then.
+ * @return Handle of the request (> 0) on success, -1 on error (as asyncOpenFile,
+ * or any error by mapFile).
+ */
+int asyncWriteFile(const char* pathname, const char* dirname){
+	clientconn_t* conn = conn_current();
+	if (!pathname){ errno = EINVAL; return -1; }
+	if (conn->nodes){ /* Server sees the absolute path */
+		char realFilePath[MAXPATHSIZE];
+		GET_ABS_PATH(asyncWriteFile, pathname, &realFilePath);
+		ASYNC_CLUSTER(conn, realFilePath, asyncWriteFile(realFilePath, dirname));
+	}
+	ASYNC_CHECK_CONN(asyncWriteFile);
+	return async_writereq(M_WRITEF, pathname, dirname);
+}
+
+
+/**
+ * @brief As putFile, but does NOT wait for the reply (dirname as in asyncWriteFile).
+ * @return Handle of the request (> 0) on success, -1 on error (as asyncWriteFile).
+ */
+int asyncPutFile(const char* pathname, const char* dirname){
+	clientconn_t* conn = conn_current();
+	if (!pathname){ errno = EINVAL; return -1; }
+	if (conn->nodes){ /* Server sees the absolute path */
+		char realFilePath[MAXPATHSIZE];
+		GET_ABS_PATH(asyncPutFile, pathname, &realFilePath);
+		ASYNC_CLUSTER(conn, realFilePath, asyncPutFile(realFilePath, dirname));
+	}
+	ASYNC_CHECK_CONN(asyncPutFile);
+	return async_writereq(M_PUTF, pathname, dirname);
+}
+
+
+/**
+ * @brief As fetchFile, but does NOT wait for the reply: file content is
+ * retrieved by asyncWait.
+ * @return Handle of the request (> 0) on success, -1 on error (as asyncOpenFile).
+ */
+int asyncFetchFile(const char* pathname){
+	clientconn_t* conn = conn_current();
+	if (!pathname){ errno = EINVAL; return -1; }
+	ASYNC_CLUSTER(conn, pathname, asyncFetchFile(pathname));
+	ASYNC_CHECK_CONN(asyncFetchFile);
+	IS_ABS_PATH(asyncFetchFile, pathname);
+	return async_pathreq(M_FETCHF, pathname);
+}
+
+
+/**
+ * @brief As closeFile, but does NOT wait for the reply.
+ * @return Handle of the request (> 0) on success, -1 on error (as asyncOpenFile).
+ */
+int asyncCloseFile(const char* pathname){
+	clientconn_t* conn = conn_current();
+	if (!pathname){ errno = EINVAL; return -1; }
+	ASYNC_CLUSTER(conn, pathname, asyncCloseFile(pathname));
+	ASYNC_CHECK_CONN(asyncCloseFile);
+	IS_ABS_PATH(asyncCloseFile, pathname);
+	return async_pathreq(M_CLOSEF, pathname);
+}
+
+
+/**
+ * @brief As lockFile, but does NOT wait for the reply.
+ * @note Any subsequent request shall be handled by server ONLY after the
+ * lock has been acquired.
+ * @return Handle of the request (> 0) on success, -1 on error (as asyncOpenFile).
+ */
+int asyncLockFile(const char* pathname){
+	clientconn_t* conn = conn_current();
+	if (!pathname){ errno = EINVAL; return -1; }
+	ASYNC_CLUSTER(conn, pathname, asyncLockFile(pathname));
+	ASYNC_CHECK_CONN(asyncLockFile);
+	IS_ABS_PATH(asyncLockFile, pathname);
+	message_t* msg;
+	int msec = 0; /* Waits indefinitely */
+	if (!async_new(M_LOCKF, pathname, strlen(pathname) + 1 + sizeof(int))) return -1;
+	ASYNC_SEND(msend(conn->serverfd, &msg, M_LOCKF, "asyncLockFile: while creating message to send", 
+		"asyncLockFile: while sending message to server", strlen(pathname) + 1, pathname, sizeof(int), &msec));
+}
+
+
+/**
+ * @brief As unlockFile, but does NOT wait for the reply.
+ * @return Handle of the request (> 0) on success, -1 on error (as asyncOpenFile).
+ */
+int asyncUnlockFile(const char* pathname){
+	clientconn_t* conn = conn_current();
+	if (!pathname){ errno = EINVAL; return -1; }
+	ASYNC_CLUSTER(conn, pathname, asyncUnlockFile(pathname));
+	ASYNC_CHECK_CONN(asyncUnlockFile);
+	IS_ABS_PATH(asyncUnlockFile, pathname);
+	return async_pathreq(M_UNLOCKF, pathname);
+}
+
+
+/**
+ * @brief As removeFile, but does NOT wait for the reply.
+ * @return Handle of the request (> 0) on success, -1 on error (as asyncOpenFile).
+ */
+int asyncRemoveFile(const char* pathname){
+	clientconn_t* conn = conn_current();
+	if (!pathname){ errno = EINVAL; return -1; }
+	ASYNC_CLUSTER(conn, pathname, asyncRemoveFile(pathname));
+	ASYNC_CHECK_CONN(asyncRemoveFile);
+	IS_ABS_PATH(asyncRemoveFile, pathname);
+	return async_pathreq(M_REMOVEF, pathname);
+}
+
+
+/**
+ * @brief Waits for the completion of request #handle (receiving replies to
+ * ALL previous ones) and collects its result, such that handle is NOT valid
+ * anymore. If buf and size are NOT NULL and request is a readFile/fetchFile, file
+ * content is returned in *buf (to be freed by caller) and its size in *size.
+ * @return 0 on success, -1 on error (errno set).
+ * Possible errors are:
+ *	- EINVAL: invalid (or already collected) handle;
+ *	- EBADE: (not fatal) error on server;
+ *	- any error by receiving replies.
+ */
+int asyncWait(int handle, void** buf, size_t* size){
+	clientconn_t* conn = conn_current();
+	if (conn->nodes){
+		careq_t* cr = async_clusterGet(conn, handle);
+		if (!cr) return -1;
+		pthread_setspecific(connKey, conn->nodes[cr->node]);
+		int res = asyncWait(cr->handle, buf, size);
+		int errno_copy = errno;
+		pthread_setspecific(connKey, (conn == &defaultConn ? NULL : conn));
+		if ((res == 0) || (errno_copy == EBADE)){ /* Collected */
+			cr->node = -1;
+			conn->clive--;
+		}
+		errno = errno_copy;
+		return res;
+	}
+	if ((handle < conn->areqBase) || (handle >= conn->areqBase + conn->nareqs) || (conn->areqs[handle - conn->areqBase].state == AREQ_COLLECTED)){
+		errno = EINVAL;
+		return -1;
+	}
+	while (conn->areqs[handle - conn->areqBase].state == AREQ_PENDING){
+		if (async_recvNext() == -1) return -1;
+	}
+	areq_t* r = &conn->areqs[handle - conn->areqBase];
+	int error = r->error;
+	if (buf && size && ((r->type == M_READF) || (r->type == M_FETCHF))){
+		*buf = r->buf;
+		*size = r->size;
+		r->buf = NULL;
+	}
+	async_collect(r);
+	async_compact();
+	if (error != 0){ errno = EBADE; return -1; }
+	return 0;
+}
+
+
+/**
+ * @brief Checks WITHOUT blocking whether request #handle has completed,
+ * receiving all the replies that have already arrived.
+ * @return 1 if request has completed (its result can be collected by
+ * asyncWait without blocking), 0 if it is still pending, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid (or already collected) handle;
+ *	- any error by poll or by receiving replies.
+ */
+int asyncPoll(int handle){
+	clientconn_t* conn = conn_current();
+	if (conn->nodes){
+		careq_t* cr = async_clusterGet(conn, handle);
+		if (!cr) return -1;
+		pthread_setspecific(connKey, conn->nodes[cr->node]);
+		int res = asyncPoll(cr->handle);
+		int errno_copy = errno;
+		pthread_setspecific(connKey, (conn == &defaultConn ? NULL : conn));
+		errno = errno_copy;
+		return res;
+	}
+	if ((handle < conn->areqBase) || (handle >= conn->areqBase + conn->nareqs) || (conn->areqs[handle - conn->areqBase].state == AREQ_COLLECTED)){
+		errno = EINVAL;
+		return -1;
+	}
+	struct pollfd pfd;
+	while (conn->areqs[handle - conn->areqBase].state == AREQ_PENDING){
+		pfd.fd = conn->serverfd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int res = poll(&pfd, 1, 0);
+		if (res == -1) return -1;
+		if (res == 0) return 0; /* No (other) reply available */
+		if (async_recvNext() == -1) return -1;
+	}
+	return 1;
+}
+
+
+/**
+ * @brief Waits for the completion of ALL pending requests, and discards the
+ * results of ALL NOT collected ones (e.g. content of read files).
+ * @return Number of discarded requests that have failed on server on success,
+ * -1 on error.
+ * Possible errors are:
+ *	- any error by receiving replies.
+ */
+int asyncWaitAll(void){
+	clientconn_t* conn = conn_current();
+	int failed = 0;
+	if (conn->nodes){
+		for (int i = 0; (i < conn->nnodes) && (failed != -1); i++){
+			pthread_setspecific(connKey, conn->nodes[i]);
+			int res = asyncWaitAll();
+			failed = (res == -1 ? -1 : failed + res);
+		}
+		int errno_copy = errno;
+		pthread_setspecific(connKey, (conn == &defaultConn ? NULL : conn));
+		if (failed != -1){ /* ALL collected */
+			for (int i = 0; i < conn->ncareqs; i++) conn->careqs[i].node = -1;
+			conn->clive = 0;
+		}
+		errno = errno_copy;
+		return failed;
+	}
+	while (conn->acompleted < conn->nareqs){
+		if (async_recvNext() == -1) return -1;
+	}
+	for (int i = 0; i < conn->nareqs; i++){
+		if ((conn->areqs[i].state == AREQ_DONE) && (conn->areqs[i].error != 0)) failed++;
+		async_collect(&conn->areqs[i]);
+	}
+	async_compact();
+	return failed;
+}
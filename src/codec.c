@@ -0,0 +1,204 @@
+#include <codec.h>
+#include <util.h>
+
+/* Codec names (indexed by CODEC_*) */
+static char* codecNames[] = {"none", "lz4"};
+
+/* LZ4 block format constants */
+#define LZ4_MINMATCH 4
+#define LZ4_MFLIMIT 12 /* Last match MUST start at least 12 bytes before the end */
+#define LZ4_LASTLITERALS 5 /* Last 5 bytes are ALWAYS literals */
+#define LZ4_MAXOFFSET 65535
+
+
+/* ********************** STATIC OPERATIONS ********************** */
+
+static uint32_t lz4_read32(const uint8_t* p){
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+static uint32_t lz4_hash(uint32_t v){ return (v * 2654435761u) >> (32 - LZ4_HASHLOG); }
+
+
+/* Writes the extension bytes of a length >= 15 and returns the next output position */
+static uint8_t* lz4_putlen(uint8_t* op, size_t len){
+	for (len -= 15; len >= 255; len -= 255) *op++ = 255;
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+
+/**
+ * @brief Reads the extension bytes of a length (whose token nibble is 15).
+ * @return 0 on success, -1 if input is truncated.
+ */
+static int lz4_getlen(const uint8_t** ip, const uint8_t* iend, size_t* len){
+	uint8_t b;
+	do {
+		if (*ip >= iend) return -1;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return 0;
+}
+
+
+/**
+ * @brief Emits a sequence of litlen literals (from anchor) followed by a
+ * match of mlen bytes (mlen == 0 for the last sequence) at distance off.
+ * @return Next output position, NULL if output would exceed oend.
+ */
+static uint8_t* lz4_sequence(uint8_t* op, uint8_t* oend, const uint8_t* anchor, size_t litlen, size_t off, size_t mlen){
+	size_t need = 1 + litlen + litlen/255 + 1 + (mlen ? 2 + mlen/255 + 1 : 0);
+	if (need > (size_t)(oend - op)) return NULL;
+	uint8_t* token = op++;
+	*token = (uint8_t)((litlen >= 15 ? 15 : litlen) << 4);
+	if (litlen >= 15) op = lz4_putlen(op, litlen);
+	memcpy(op, anchor, litlen);
+	op += litlen;
+	if (mlen){
+		mlen -= LZ4_MINMATCH;
+		*op++ = (uint8_t)(off & 0xff);
+		*op++ = (uint8_t)(off >> 8);
+		*token |= (uint8_t)(mlen >= 15 ? 15 : mlen);
+		if (mlen >= 15) op = lz4_putlen(op, mlen);
+	}
+	return op;
+}
+
+
+/**
+ * @brief LZ4 block compression of n bytes from src into at most cap bytes.
+ * @return Compressed size on success, 0 if output does NOT fit in cap.
+ */
+static size_t lz4_compress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap){
+	uint32_t table[1 << LZ4_HASHLOG]; /* Last position of each hashed 4-bytes sequence */
+	const uint8_t* ip = src;
+	const uint8_t* anchor = src; /* First literal not yet emitted */
+	const uint8_t* end = src + n;
+	uint8_t* op = dst;
+	uint8_t* oend = dst + cap;
+	memset(table, 0, sizeof(table));
+	if (n > LZ4_MFLIMIT){
+		const uint8_t* mflimit = end - LZ4_MFLIMIT;
+		const uint8_t* matchlimit = end - LZ4_LASTLITERALS;
+		while (ip < mflimit){
+			uint32_t seq = lz4_read32(ip);
+			uint32_t h = lz4_hash(seq);
+			const uint8_t* ref = src + table[h];
+			table[h] = (uint32_t)(ip - src);
+			if ((ref >= ip) || (ip - ref > LZ4_MAXOFFSET) || (lz4_read32(ref) != seq)){
+				ip++;
+				continue;
+			}
+			while ((ip > anchor) && (ref > src) && (ip[-1] == ref[-1])){ ip--; ref--; } /* Extends backwards */
+			const uint8_t* mp = ip + LZ4_MINMATCH;
+			const uint8_t* rp = ref + LZ4_MINMATCH;
+			while ((mp < matchlimit) && (*mp == *rp)){ mp++; rp++; } /* Extends forward */
+			op = lz4_sequence(op, oend, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), (size_t)(mp - ip));
+			if (!op) return 0;
+			ip = mp;
+			anchor = ip;
+			table[lz4_hash(lz4_read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+		}
+	}
+	op = lz4_sequence(op, oend, anchor, (size_t)(end - anchor), 0, 0); /* Last literals */
+	return (op ? (size_t)(op - dst) : 0);
+}
+
+
+/**
+ * @brief LZ4 block decompression of n bytes from src into EXACTLY rawlen bytes.
+ * @return 0 on success, -1 if src is NOT a valid block of rawlen bytes.
+ */
+static int lz4_decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t rawlen){
+	const uint8_t* ip = src;
+	const uint8_t* iend = src + n;
+	uint8_t* op = dst;
+	uint8_t* oend = dst + rawlen;
+	while (ip < iend){
+		uint8_t token = *ip++;
+		size_t len = token >> 4;
+		if ((len == 15) && (lz4_getlen(&ip, iend, &len) == -1)) return -1;
+		if ((len > (size_t)(iend - ip)) || (len > (size_t)(oend - op))) return -1;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+		if (ip == iend) break; /* Last sequence (literals only) */
+		if (iend - ip < 2) return -1;
+		size_t off = ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+		if ((off == 0) || (off > (size_t)(op - dst))) return -1;
+		len = token & 15;
+		if ((len == 15) && (lz4_getlen(&ip, iend, &len) == -1)) return -1;
+		len += LZ4_MINMATCH;
+		if (len > (size_t)(oend - op)) return -1;
+		const uint8_t* mp = op - off;
+		while (len-- > 0) *op++ = *mp++; /* Byte copy: match can overlap output */
+	}
+	return (op == oend ? 0 : -1);
+}
+
+
+/* ********************** MAIN OPERATIONS ********************** */
+
+/**
+ * @brief Gets the codec identified by #name (case-sensitive).
+ * @return One of CODEC_* on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: name is NULL or does not identify any codec.
+ */
+int codec_id(char* name){
+	if (name){
+		for (int i = 0; i < CODEC_NUM; i++){
+			if (strequal(name, codecNames[i])) return i;
+		}
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+
+/**
+ * @return Name of codec, NULL if codec is NOT valid.
+ */
+char* codec_name(int codec){
+	return ((codec >= 0) && (codec < CODEC_NUM) ? codecNames[codec] : NULL);
+}
+
+
+/**
+ * @brief Compresses #srclen bytes from src into at most #dstcap bytes of dst.
+ * @note Passing dstcap < srclen makes compression succeed ONLY if it saves space.
+ * @return Compressed size on success, 0 if it does NOT fit in dstcap or codec
+ * does NOT compress (CODEC_NONE or invalid codec).
+ */
+size_t codec_compress(int codec, const void* src, size_t srclen, void* dst, size_t dstcap){
+	if (!src || !dst) return 0;
+	switch (codec){
+		case CODEC_LZ4: return lz4_compress(src, srclen, dst, dstcap);
+		default: return 0;
+	}
+}
+
+
+/**
+ * @brief Decompresses #srclen bytes from src into EXACTLY #rawlen bytes of dst.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments or codec;
+ *	- EBADMSG: src is NOT a valid compressed block of rawlen bytes.
+ */
+int codec_decompress(int codec, const void* src, size_t srclen, void* dst, size_t rawlen){
+	if (!src || !dst){ errno = EINVAL; return -1; }
+	switch (codec){
+		case CODEC_LZ4: {
+			if (lz4_decompress(src, srclen, dst, rawlen) == -1){ errno = EBADMSG; return -1; }
+			return 0;
+		}
+		default: { errno = EINVAL; return -1; }
+	}
+}
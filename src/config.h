@@ -21,7 +21,27 @@ typedef struct config_s {
 	long storageSize; /* In KB, default = 0 */
 	int maxFileNo; /* default = 0 */
 	int fileStorageBuckets; /* default = 0 */
+	int fileStorageShards; /* default = 0 (i.e. 1) */
 	int sockBacklog; /* default = 0 */
+	char* eventEngine; /* "select" or "epoll", default = NULL (i.e. "select") */
+	char* replacementPolicy; /* "FIFO", "LRU", "LFU" or "CLOCK", default = NULL (i.e. "FIFO") */
+	char* fileStorageTable; /* "chained" or "robinhood", default = NULL (i.e. "chained") */
+	char* dispatchQueue; /* "tsqueue" or "mpmc", default = NULL (i.e. "tsqueue") */
+	int reactorThreads; /* default = 0 (i.e. manager + workers) */
+	char* compression; /* "none" or "lz4", default = NULL (i.e. "none") */
+	char* deduplication; /* "none" or "extent", default = NULL (i.e. "none") */
+	char* persistDir; /* Directory for journal and snapshot, default = NULL (i.e. no persistence) */
+	int journalSyncMs; /* Milliseconds between two journal commits, default = 0 (i.e. 10) */
+	int snapshotInterval; /* Seconds between two snapshots, default = 0 (i.e. only at termination) */
+	char* tcpAddress; /* Address of the TCP listener, default = NULL (i.e. any) */
+	int tcpPort; /* Port of the TCP listener, default = 0 (i.e. AF_UNIX listener on socketPath) */
+	int tcpBufferKB; /* Size of TCP socket buffers in KB, default = 0 (i.e. system default) */
+	int maxObjectKB; /* Maximum size of a file in KB, default = 0 (i.e. no limit) */
+	int largeObjectKB; /* Minimum size of a large file in KB, default = 0 (i.e. no large files) */
+	int largeBudgetKB; /* Maximum space for large files in KB, default = 0 (i.e. storage capacity) */
+	int bulkWorkers; /* Workers dedicated to bulk data requests, default = 0 (i.e. a single dispatch queue) */
+	int clientRate; /* Requests per second admitted for each client, default = 0 (i.e. no limit) */
+	int clientBurst; /* Size of the token bucket of each client, default = 0 (i.e. ClientRate) */
 
 } config_t;
 
@@ -39,6 +59,14 @@ bool isUnspecified(char* value){
 int config_init(config_t* config){
 	memset(config, 0, sizeof(*config));
 	config->socketPath = NULL;
+	config->eventEngine = NULL;
+	config->replacementPolicy = NULL;
+	config->fileStorageTable = NULL;
+	config->dispatchQueue = NULL;
+	config->compression = NULL;
+	config->deduplication = NULL;
+	config->persistDir = NULL;
+	config->tcpAddress = NULL;
 	return 0;
 }
 
@@ -49,6 +77,22 @@ int config_init(config_t* config){
 void config_reset(config_t* config){
 	free(config->socketPath);
 	config->socketPath = NULL;
+	free(config->eventEngine);
+	config->eventEngine = NULL;
+	free(config->replacementPolicy);
+	config->replacementPolicy = NULL;
+	free(config->fileStorageTable);
+	config->fileStorageTable = NULL;
+	free(config->dispatchQueue);
+	config->dispatchQueue = NULL;
+	free(config->compression);
+	config->compression = NULL;
+	free(config->deduplication);
+	config->deduplication = NULL;
+	free(config->persistDir);
+	config->persistDir = NULL;
+	free(config->tcpAddress);
+	config->tcpAddress = NULL;
 }
 
 
@@ -121,10 +165,38 @@ int config_parsedict(config_t* config, icl_hash_t* dict){
 		STORAGE_SETATTR(name, "StorageKBSize", datum, config->storageSize, 1);
 		NUM_SETATTR(name, "MaxFileNo", datum, config->maxFileNo);
 		NUM_SETATTR(name, "FileStorageBuckets", datum, config->fileStorageBuckets);
+		NUM_SETATTR(name, "FileStorageShards", datum, config->fileStorageShards);
 		NUM_SETATTR(name, "SockBacklog", datum, config->sockBacklog);
+		STR_SETATTR(name, "EventEngine", datum, config->eventEngine);
+		STR_SETATTR(name, "ReplacementPolicy", datum, config->replacementPolicy);
+		STR_SETATTR(name, "FileStorageTable", datum, config->fileStorageTable);
+		STR_SETATTR(name, "DispatchQueue", datum, config->dispatchQueue);
+		NUM_SETATTR(name, "ReactorThreads", datum, config->reactorThreads);
+		STR_SETATTR(name, "Compression", datum, config->compression);
+		STR_SETATTR(name, "Deduplication", datum, config->deduplication);
+		STR_SETATTR(name, "PersistDir", datum, config->persistDir);
+		NUM_SETATTR(name, "JournalSyncMs", datum, config->journalSyncMs);
+		NUM_SETATTR(name, "SnapshotInterval", datum, config->snapshotInterval);
+		STR_SETATTR(name, "TCPAddress", datum, config->tcpAddress);
+		NUM_SETATTR(name, "TCPPort", datum, config->tcpPort);
+		NUM_SETATTR(name, "TCPBufferKB", datum, config->tcpBufferKB);
+		NUM_SETATTR(name, "MaxObjectKB", datum, config->maxObjectKB);
+		NUM_SETATTR(name, "LargeObjectKB", datum, config->largeObjectKB);
+		NUM_SETATTR(name, "LargeBudgetKB", datum, config->largeBudgetKB);
+		NUM_SETATTR(name, "BulkWorkers", datum, config->bulkWorkers);
+		NUM_SETATTR(name, "ClientRate", datum, config->clientRate);
+		NUM_SETATTR(name, "ClientBurst", datum, config->clientBurst);
 	}
 	/* Extract string values from the hashtable before destroying it*/
 	if (config->socketPath) { SYSCALL_NOTREC(icl_hash_delete(dict, "SocketPath", free, dummy), -1, "config_parsedict: while extracting socket path"); }
+	if (config->eventEngine) { SYSCALL_NOTREC(icl_hash_delete(dict, "EventEngine", free, dummy), -1, "config_parsedict: while extracting event engine"); }
+	if (config->replacementPolicy) { SYSCALL_NOTREC(icl_hash_delete(dict, "ReplacementPolicy", free, dummy), -1, "config_parsedict: while extracting replacement policy"); }
+	if (config->fileStorageTable) { SYSCALL_NOTREC(icl_hash_delete(dict, "FileStorageTable", free, dummy), -1, "config_parsedict: while extracting file storage table"); }
+	if (config->dispatchQueue) { SYSCALL_NOTREC(icl_hash_delete(dict, "DispatchQueue", free, dummy), -1, "config_parsedict: while extracting dispatch queue"); }
+	if (config->compression) { SYSCALL_NOTREC(icl_hash_delete(dict, "Compression", free, dummy), -1, "config_parsedict: while extracting compression codec"); }
+	if (config->deduplication) { SYSCALL_NOTREC(icl_hash_delete(dict, "Deduplication", free, dummy), -1, "config_parsedict: while extracting deduplication mode"); }
+	if (config->persistDir) { SYSCALL_NOTREC(icl_hash_delete(dict, "PersistDir", free, dummy), -1, "config_parsedict: while extracting persistence directory"); }
+	if (config->tcpAddress) { SYSCALL_NOTREC(icl_hash_delete(dict, "TCPAddress", free, dummy), -1, "config_parsedict: while extracting TCP address"); }
 	
 	return 0;
 }
@@ -140,6 +212,27 @@ void config_printout(config_t* config){
 	printf("MaxFileNo = %d\n", config->maxFileNo);	
 	printf("SockBacklog = %d\n", config->sockBacklog);
 	printf("FileStorageBuckets = %d\n", config->fileStorageBuckets);
+	printf("FileStorageShards = %d\n", config->fileStorageShards);
+	printf("EventEngine = %s\n", (config->eventEngine ? config->eventEngine : "select"));
+	printf("ReplacementPolicy = %s\n", (config->replacementPolicy ? config->replacementPolicy : "FIFO"));
+	printf("FileStorageTable = %s\n", (config->fileStorageTable ? config->fileStorageTable : "chained"));
+	printf("DispatchQueue = %s\n", (config->dispatchQueue ? config->dispatchQueue : "tsqueue"));
+	printf("ReactorThreads = %d\n", config->reactorThreads);
+	printf("Compression = %s\n", (config->compression ? config->compression : "none"));
+	printf("Deduplication = %s\n", (config->deduplication ? config->deduplication : "none"));
+	if (config->persistDir) printf("PersistDir = %s\n", config->persistDir);
+	else printf("Unspecified PersistDir\n");
+	printf("JournalSyncMs = %d\n", config->journalSyncMs);
+	printf("SnapshotInterval = %d\n", config->snapshotInterval);
+	printf("TCPAddress = %s\n", (config->tcpAddress ? config->tcpAddress : "*"));
+	printf("TCPPort = %d\n", config->tcpPort);
+	printf("TCPBufferKB = %d\n", config->tcpBufferKB);
+	printf("MaxObjectKB = %d\n", config->maxObjectKB);
+	printf("LargeObjectKB = %d\n", config->largeObjectKB);
+	printf("LargeBudgetKB = %d\n", config->largeBudgetKB);
+	printf("BulkWorkers = %d\n", config->bulkWorkers);
+	printf("ClientRate = %d\n", config->clientRate);
+	printf("ClientBurst = %d\n", config->clientBurst);
 	printf("No more attributes\n");
 }
 
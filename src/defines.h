@@ -435,4 +435,33 @@ int usleep(useconds_t usec);
 	} while(0);
 
 
+/* ********** ATOMIC OPERATIONS (GCC builtins) ********** */
+
+/* ALL these macros are sequentially consistent and work on integral types and pointers */
+
+/* Atomically loads *ptr */
+#define ATOMIC_GET(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+
+/* Atomically stores val into *ptr */
+#define ATOMIC_SET(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_SEQ_CST)
+
+/* Atomically adds val to *ptr and returns the NEW value */
+#define ATOMIC_ADD(ptr, val) __atomic_add_fetch((ptr), (val), __ATOMIC_SEQ_CST)
+
+/* Atomically subtracts val from *ptr and returns the NEW value */
+#define ATOMIC_SUB(ptr, val) __atomic_sub_fetch((ptr), (val), __ATOMIC_SEQ_CST)
+
+/* Atomically sets *ptr to (*ptr | val) and returns the NEW value */
+#define ATOMIC_OR(ptr, val) __atomic_or_fetch((ptr), (val), __ATOMIC_SEQ_CST)
+
+/* Atomically sets *ptr to (*ptr & val) and returns the NEW value */
+#define ATOMIC_AND(ptr, val) __atomic_and_fetch((ptr), (val), __ATOMIC_SEQ_CST)
+
+/**
+ * @brief If *ptr == *expected, atomically sets *ptr to val and returns true,
+ * otherwise it copies *ptr into *expected and returns false.
+ */
+#define ATOMIC_CAS(ptr, expected, val) __atomic_compare_exchange_n((ptr), (expected), (val), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+
 #endif /* _DEFINES_H */
@@ -4,6 +4,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <sys/mman.h>
 #include <util.h>
 
 
@@ -18,7 +19,7 @@ static int mkdirtree(const char* dirtree){
 	size_t n = strlen(dirtree) + 1;
 	char command[n + strlen(cmdstr)];
 	strncpy(command, cmdstr, strlen(cmdstr)+1);
-	strncat(command, dirtree, n);
+	strcat(command, dirtree);
 	system(command); /* Creates all subdirs */
 	return 0;
 }
@@ -54,6 +55,48 @@ int loadFile(const char* pathname, void** buf, size_t* size){
 }
 
 
+/**
+ * @brief Maps the content of file pointed by #pathname in memory (read-only)
+ * into #*buf and file size into #*size, such that pages are read from disk
+ * only when they are sent (by sequential readahead) and the content is NEVER
+ * copied on the heap. The mapping MUST be released by unmapFile.
+ * @note For an empty file, *buf is set to NULL.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- any error by stat/open/mmap.
+ */
+int mapFile(const char* pathname, void** buf, size_t* size){
+	struct stat statbuf;
+	SYSCALL_RETURN(stat(pathname, &statbuf), -1, "mapFile:stat");
+	int fd;
+	SYSCALL_RETURN((fd = open(pathname, O_RDONLY)), -1, "mapFile:open");
+	*size = statbuf.st_size;
+	*buf = NULL;
+	int ret = 0;
+	if (*size > 0){
+		void* map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) ret = -1;
+		else {
+			posix_madvise(map, *size, POSIX_MADV_SEQUENTIAL); /* Only a hint */
+			*buf = map;
+		}
+	}
+	int errno_copy = errno;
+	close(fd);
+	errno = errno_copy;
+	return ret;
+}
+
+
+/**
+ * @brief Releases a mapping made by mapFile.
+ * @return 0 on success, -1 on error (by munmap).
+ */
+int unmapFile(void* buf, size_t size){
+	return (buf && (size > 0) ? munmap(buf, size) : 0);
+}
+
+
 /**
  * @brief Saves a file with (absolute) path pathname into the
  * directory dirname, or does nothing if any of basedir or
@@ -79,7 +122,7 @@ int saveFile(const char* pathname, const char* basedir, void* content, size_t si
 	memset(newpath, 0, n);
 	strncpy(newpath, basedir, strlen(basedir)+1);
 	strncat(newpath, "/", 2);
-	strncat(newpath, pathdir, strlen(pathdir) + 1);
+	strcat(newpath, pathdir);
 	if (mkdirtree(newpath) == -1){
 		free(pathcopy);
 		return -1;
@@ -88,35 +131,37 @@ int saveFile(const char* pathname, const char* basedir, void* content, size_t si
 	strncpy(pathcopy, pathname, strlen(pathname) + 1);
 	memset(newpath, 0, n);
 	strncpy(newpath, basedir, strlen(basedir)+1);
-	strncat(newpath, pathname, strlen(pathname) + 1);
+	strcat(newpath, pathname);
 	free(pathcopy);
 	int fd;
-	SYSCALL_RETURN((fd = open(newpath, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR)), -1, "While creating file");
-	SYSCALL_RETURN(write(fd, content, size), -1, "While writing content to file");
+	SYSCALL_RETURN((fd = open(newpath, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)), -1, "While creating file");
+	/* Straight from the received buffer to the file (NO stdio buffering), even on partial writes */
+	int ret = ((size > 0) && (writen(fd, content, size) == -1) ? -1 : 0);
+	int errno_copy = errno;
 	close(fd);
-	return 0;
+	errno = errno_copy;
+	return ret;
 }
 
 
 /**
  * @brief Scans the directory #nomedir and all its subdirectories for
- * retrieving at most n files from all contained ones and returns them
- * as a linkedlist of absolute paths. If n <= 0, then it scans ALL
- * contained files.
+ * retrieving at most n files from all contained ones, and passes the
+ * absolute path of each one to fileFn AS SOON AS it is found (such that
+ * the caller can process files while the scan is going on). If n <= 0,
+ * then it scans ALL contained files.
  * @param nomedir -- Name of directory to scan.
  * @param n -- Number of files to retrieve (all if n <= 0).
- * @param filelist -- Address of a llist_t* variable in which to "write"
- * all found files.
- * @note filelist MUST NOT refer to already allocated memory,
- * otherwise it will be lost.
+ * @param fileFn -- Function called with a HEAP-allocated absolute path,
+ * of which it takes ownership on success (returning 0); on error (returning
+ * -1), path is freed and the scan is stopped.
  * @note In is assumed that "nomedir" refers to an ALREADY existing
  * directory, otherwise it makes no sense to create an empty directory
  * and scan it.
- * @return 0 on success and *filelist will be a linkedlist of all
- * (regular) files found, -1 on error.
+ * @return 0 on success, -1 on error (also by fileFn).
  */
-int dirscan(const char nomedir[], long n, llist_t** filelist) {
-	if (!nomedir || !filelist){
+int dirwalk(const char nomedir[], long n, int (*fileFn)(char* pathname, void* arg), void* arg) {
+	if (!nomedir || !fileFn){
 		errno = EINVAL;
 		return -1;
 	}
@@ -126,13 +171,10 @@ int dirscan(const char nomedir[], long n, llist_t** filelist) {
     
     llist_t* dlist = llist_init();
     if (!dlist) return -1;
-    llist_t* flist = llist_init();
-    if (!flist){ llist_destroy(dlist, dummy); return -1; }
     
     char* currentdir = realpath(nomedir, NULL);
     if (!currentdir){
     	llist_destroy(dlist, dummy);
-    	llist_destroy(flist, dummy);
     	return -1;
 	}
    	
@@ -197,7 +239,14 @@ int dirscan(const char nomedir[], long n, llist_t** filelist) {
 					
 					if (S_ISDIR(statbuf2.st_mode)) llist_push(dlist, filename); /* A subdir */
 					else if (S_ISREG(statbuf2.st_mode)){
-						if ((n <= 0) || (i < n)){ i++; llist_push(flist, filename); }/* A (real) file */
+						if ((n <= 0) || (i < n)){ /* A (real) file */
+							i++;
+							if (fileFn(filename, arg) == -1){
+								free(filename);
+								ret = -1;
+								break; /* dir shall be closed after while loop */
+							}
+						}
 						else { free(filename); break; } /* We have already read n files */
 					} else free(filename); /* All non-regular files are not interesting */
 				}
@@ -212,9 +261,39 @@ int dirscan(const char nomedir[], long n, llist_t** filelist) {
 			break;
 		}
 	}
-	/* Here currentdir and filename are ALWAYS already freed (or put into dlist/flist) */
+	/* Here currentdir and filename are ALWAYS already freed (or put into dlist/passed to fileFn) */
 	llist_destroy(dlist, free);
-	if (ret == -1) llist_destroy(flist, free); /* Wrong filename list */
-	else *filelist = flist; /* Backed up to caller */
 	return ret;
 }
+
+
+/* Callback of dirwalk for dirscan */
+static int dirscan_push(char* pathname, void* flist){
+	return (llist_push((llist_t*)flist, pathname) == 0 ? 0 : -1);
+}
+
+
+/**
+ * @brief As dirwalk, but ALL the found files are returned as a linkedlist
+ * of absolute paths.
+ * @param filelist -- Address of a llist_t* variable in which to "write"
+ * all found files.
+ * @note filelist MUST NOT refer to already allocated memory,
+ * otherwise it will be lost.
+ * @return 0 on success and *filelist will be a linkedlist of all
+ * (regular) files found, -1 on error.
+ */
+int dirscan(const char nomedir[], long n, llist_t** filelist) {
+	if (!nomedir || !filelist){
+		errno = EINVAL;
+		return -1;
+	}
+	llist_t* flist = llist_init();
+	if (!flist) return -1;
+	if (dirwalk(nomedir, n, dirscan_push, flist) == -1){
+		llist_destroy(flist, free); /* Wrong filename list */
+		return -1;
+	}
+	*filelist = flist; /* Backed up to caller */
+	return 0;
+}
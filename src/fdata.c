@@ -1,31 +1,21 @@
 #include <fdata.h>
+#include <stats.h>
 
-/**
- * @brief Utility macro for all-in-one rdlocking
- * and resizing client array if needed.
- */
-#define RD_CLIENT_RESIZE(fdata, client, retval) \
-	do { \
-		RWL_RDLOCK(&fdata->lock);\
-		if (client > fdata->maxclient){ \
-			RWL_UNLOCK(&fdata->lock);\
-			*retval = fdata_resize(fdata, client);\
-			RWL_RDLOCK(&fdata->lock);\
-		} \
-	} while (0);
-
+/* Hash of a client id for the overflow table of client entries */
+#define FD_CLHASH(client) ((unsigned int)(client) * 2654435761U)
 
 /**
- * @brief Utility macro for all-in-one wrlocking
- * and resizing client array if needed.
+ * @brief Utility macro for all-in-one rdlocking and getting the entry
+ * (flagsptr) of client, that is inserted by switching to writing mode
+ * if missing: on failure, *retval is set to -1 (the lock is held anyway).
  */
-#define WR_CLIENT_RESIZE(fdata, client, retval) \
+#define RD_CLIENT_ENTRY(fdata, client, flagsptr, retval) \
 	do { \
-		RWL_WRLOCK(&fdata->lock);\
-		if (client > fdata->maxclient){ \
+		RWL_RDLOCK(&fdata->lock);\
+		if (!(flagsptr = fdata_cfind(fdata, client))){ \
 			RWL_UNLOCK(&fdata->lock);\
-			*retval = fdata_resize(fdata, client);\
 			RWL_WRLOCK(&fdata->lock);\
+			if (!(flagsptr = fdata_cinsert(fdata, client))) *retval = -1;\
 		} \
 	} while (0);
 
@@ -45,92 +35,582 @@ do { \
 } while(0);
 
 
+/* Appends data to a file content according to the codec of fdata */
+#define FBODY_PUT(fdata, body, buf, size) \
+	((fdata)->codec == CODEC_NONE ? fbody_append(body, buf, size) : fbody_encode(body, buf, size, (fdata)->codec))
+
+
+/* true <=> extent MUST NOT be modified (shared by deduplication or mapped) */
+#define FEXTENT_FROZEN(ext) ((ext)->mapped || ATOMIC_GET(&(ext)->shared))
+
+
+/* ********************** FBODY OPERATIONS ********************** */
+
+/**
+ * Table of deduplicated extents (by fingerprint of their content), shared
+ * among ALL files. An extent is removed from the table by its last holder,
+ * and lookups take a reference ONLY to extents with refs > 0, such that a
+ * "dying" extent is NEVER resurrected.
+ */
+static struct {
+	pthread_mutex_t lock;
+	fextent_t* buckets[FD_DEDUP_BUCKETS];
+	size_t bytes; /* Bytes of data of ALL the extents in the table, atomically updated */
+	int nexts; /* Number of extents in the table */
+	size_t saved; /* Bytes NOT allocated thanks to a lookup hit (cumulative) */
+} dedupTable = {PTHREAD_MUTEX_INITIALIZER, {NULL}, 0, 0, 0};
+
+
 /**
- * @brief Resizes the current array of clients such that client can be
- * inserted in.
- * @return 0 on success (client is suitable for current length, or 
- * fdata->clients has been correctly reallocated), -1 on error.
+ * @brief Allocates a new extent (header and data, see slab.h: data is bigger
+ * than SLAB_MAXSIZE, hence it is given back to the system when freed) with a
+ * single reference.
+ * @return Pointer to extent on success, NULL on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+static fextent_t* fextent_get(void){
+	fextent_t* ext = slab_alloc(sizeof(fextent_t));
+	if (!ext){ errno = ENOMEM; return NULL; }
+	if (!(ext->data = slab_alloc(FD_EXTENT_SIZE))){
+		slab_free(ext, sizeof(fextent_t));
+		errno = ENOMEM;
+		return NULL;
+	}
+	ext->refs = 1;
+	ext->next = NULL;
+	ext->shared = 0;
+	ext->mapped = false;
+	return ext;
+}
+
+
+/**
+ * @brief Releases a reference to an extent, which is freed by its last
+ * holder (data included, unless it is mapped).
+ */
+static void fextent_release(fextent_t* ext){
+	if (ATOMIC_SUB(&ext->refs, 1) > 0) return;
+	if (ATOMIC_GET(&ext->shared)){ /* Last holder: removes it from the table */
+		LOCK(&dedupTable.lock);
+		fextent_t** p = &dedupTable.buckets[ext->fp % FD_DEDUP_BUCKETS];
+		while (*p != ext) p = &(*p)->next;
+		*p = ext->next;
+		dedupTable.nexts--;
+		ATOMIC_SUB(&dedupTable.bytes, ext->dlen);
+		UNLOCK(&dedupTable.lock);
+	}
+	if (!ext->mapped) slab_free(ext->data, FD_EXTENT_SIZE); /* Mapping is NOT owned */
+	slab_free(ext, sizeof(fextent_t));
+}
+
+
+/* 64-bit fingerprint of len bytes of data (8 bytes at a time, multiply-xorshift mixing) */
+static uint64_t fextent_fingerprint(const char* data, size_t len){
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+	uint64_t w;
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8){
+		memcpy(&w, data + i, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	w = 0;
+	memcpy(&w, data + i, len - i);
+	h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+	return h ^ (h >> 29);
+}
+
+
+/**
+ * @brief Deduplicates the first #len bytes of an extent held by the caller:
+ * if the table contains an extent with the same content, a reference to it
+ * is taken and ext is released, otherwise ext is inserted in the table (and
+ * from now on it is NEVER modified).
+ * @return The (shared) extent that replaces ext for the caller.
+ */
+static fextent_t* fextent_dedup(fextent_t* ext, size_t len){
+	if (ATOMIC_GET(&ext->shared)) return ext;
+	uint64_t fp = fextent_fingerprint(ext->data, len);
+	fextent_t* found = NULL;
+	LOCK(&dedupTable.lock);
+	for (fextent_t* e = dedupTable.buckets[fp % FD_DEDUP_BUCKETS]; e && !found; e = e->next){
+		if ((e->fp != fp) || (e->dlen != len) || (memcmp(e->data, ext->data, len) != 0)) continue;
+		int refs = ATOMIC_GET(&e->refs);
+		do {
+			if (refs == 0) break; /* Being released by its last holder */
+		} while (!ATOMIC_CAS(&e->refs, &refs, refs + 1));
+		if (refs > 0) found = e;
+	}
+	if (found) dedupTable.saved += len;
+	else {
+		ext->fp = fp;
+		ext->dlen = len;
+		ATOMIC_SET(&ext->shared, 1);
+		ext->next = dedupTable.buckets[fp % FD_DEDUP_BUCKETS];
+		dedupTable.buckets[fp % FD_DEDUP_BUCKETS] = ext;
+		dedupTable.nexts++;
+		ATOMIC_ADD(&dedupTable.bytes, len);
+	}
+	UNLOCK(&dedupTable.lock);
+	if (!found) return ext;
+	fextent_release(ext);
+	return found;
+}
+
+
+/**
+ * @brief Creates a new empty file content with a single reference (the one
+ * of the file). If #from is NOT NULL, the new content shares ALL the extents
+ * of #from and has its same size.
+ * @return Pointer to fbody_t object on success, NULL on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+static fbody_t* fbody_create(fbody_t* from){
+	fbody_t* body = slab_alloc(sizeof(fbody_t));
+	if (!body){ errno = ENOMEM; return NULL; }
+	memset(body, 0, sizeof(fbody_t));
+	if (from && (from->nexts > 0)){
+		body->exts = malloc(from->nexts * sizeof(fextent_t*));
+		if (!body->exts){
+			slab_free(body, sizeof(fbody_t));
+			errno = ENOMEM;
+			return NULL;
+		}
+		for (int i = 0; i < from->nexts; i++){
+			ATOMIC_ADD(&from->exts[i]->refs, 1);
+			body->exts[i] = from->exts[i];
+		}
+		body->nexts = from->nexts;
+		body->cap = from->nexts;
+		body->size = from->size;
+	}
+	body->refs = 1;
+	return body;
+}
+
+
+/**
+ * @brief Appends #size bytes from buf to a file content which is NOT held
+ * by any reader. The free tail of the last extent is filled at first, then
+ * new extents are allocated (see slab.h), so the cost is O(size). If the last
+ * extent is shared by deduplication or mapped, it is copied into a new one at first.
+ * @note On error, content is untouched.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+static int fbody_append(fbody_t* body, void* buf, size_t size){
+	size_t tail = body->size % FD_EXTENT_SIZE;
+	if ((size > 0) && (tail > 0) && FEXTENT_FROZEN(body->exts[body->nexts - 1])){ /* Copy-on-append */
+		fextent_t* ext = fextent_get();
+		if (!ext) return -1;
+		memcpy(ext->data, body->exts[body->nexts - 1]->data, tail);
+		fextent_release(body->exts[body->nexts - 1]);
+		body->exts[body->nexts - 1] = ext;
+	}
+	int needed = (int)FD_NEXTENTS(body->size + size) - body->nexts;
+	if (body->nexts + needed > body->cap){
+		int newcap = MAX(2 * body->cap, body->nexts + needed);
+		fextent_t** exts = realloc(body->exts, newcap * sizeof(fextent_t*));
+		if (!exts){ errno = ENOMEM; return -1; }
+		body->exts = exts;
+		body->cap = newcap;
+	}
+	for (int i = 0; i < needed; i++){
+		body->exts[body->nexts + i] = fextent_get();
+		if (!body->exts[body->nexts + i]){
+			for (int j = 0; j < i; j++) fextent_release(body->exts[body->nexts + j]);
+			return -1;
+		}
+	}
+	body->nexts += needed;
+	size_t off = body->size;
+	char* src = buf;
+	while (size > 0){
+		size_t n = MIN(size, FD_EXTENT_SIZE - off % FD_EXTENT_SIZE);
+		memmove(body->exts[off / FD_EXTENT_SIZE]->data + off % FD_EXTENT_SIZE, src, n);
+		off += n;
+		src += n;
+		size -= n;
+	}
+	body->size = off;
+	return 0;
+}
+
+
+/**
+ * @brief Releases a reference to a file content, which is freed when
+ * its last holder releases it.
+ */
+void fbody_release(fbody_t* body){
+	if (!body) return;
+	if (ATOMIC_SUB(&body->refs, 1) == 0){
+		for (int i = 0; i < body->nexts; i++) fextent_release(body->exts[i]);
+		free(body->exts);
+		slab_free(body, sizeof(fbody_t));
+	}
+}
+
+
+/**
+ * @brief Builds the scatter-gather description of the first #size bytes of
+ * a file content (size is the one returned together with the reference).
+ * @param iov -- Address of a (struct iovec*) variable that shall contain a
+ * heap-allocated array to be freed by the caller (NULL if size == 0).
+ * @return Number of elements of *iov on success, -1 on error.
  * Possible errors are:
  *	- EINVAL: invalid arguments;
- *	- ENOMEM (system out of memory, set by malloc).
+ *	- ENOMEM: unable to allocate memory.
  */
-int fdata_resize(FileData_t* fdata, int client){
-	if (client < 0){ errno = EINVAL; return -1; }
-	int ret = 0; /* return value */
-	
-	RWL_WRLOCK(&fdata->lock);	
-	if (client > fdata->maxclient){
-		unsigned char* ptr = realloc(fdata->clients, (client + 1) * sizeof(unsigned char));
-		if (!ptr){
+int fbody_iov(fbody_t* body, size_t size, struct iovec** iov){
+	if (!iov || (!body && (size > 0)) || (body && (size > body->size))){ errno = EINVAL; return -1; }
+	int n = (int)FD_NEXTENTS(size);
+	*iov = NULL;
+	if (n == 0) return 0;
+	*iov = malloc(n * sizeof(struct iovec));
+	if (!*iov){ errno = ENOMEM; return -1; }
+	for (int i = 0; i < n; i++){
+		(*iov)[i].iov_base = body->exts[i]->data;
+		(*iov)[i].iov_len = MIN(FD_EXTENT_SIZE, size - (size_t)i * FD_EXTENT_SIZE);
+	}
+	return n;
+}
+
+
+/* Copies len bytes of a file content starting from offset off into dst */
+static void fbody_copyout(fbody_t* body, size_t off, void* dst, size_t len){
+	char* p = dst;
+	while (len > 0){
+		size_t n = MIN(len, FD_EXTENT_SIZE - off % FD_EXTENT_SIZE);
+		memcpy(p, body->exts[off / FD_EXTENT_SIZE]->data + off % FD_EXTENT_SIZE, n);
+		off += n;
+		p += n;
+		len -= n;
+	}
+}
+
+
+/* Bytes of a file content in NOT shared extents, starting from extent first */
+static size_t fbody_private(fbody_t* body, int first){
+	size_t n = 0;
+	for (int i = first; i < body->nexts; i++){
+		if (!ATOMIC_GET(&body->exts[i]->shared)) n += MIN(FD_EXTENT_SIZE, body->size - (size_t)i * FD_EXTENT_SIZE);
+	}
+	return n;
+}
+
+
+/**
+ * @brief Deduplicates the extents of a file content which is NOT held by any
+ * reader, starting from extent first and up to the first #limit bytes.
+ */
+static void fbody_dedup(fbody_t* body, int first, size_t limit){
+	for (int i = first; i < (int)FD_NEXTENTS(limit); i++){
+		size_t len = MIN(FD_EXTENT_SIZE, limit - (size_t)i * FD_EXTENT_SIZE);
+		body->exts[i] = fextent_dedup(body->exts[i], len);
+	}
+}
+
+
+/* Shrinks a file content which is NOT held by any reader to its first size bytes */
+static void fbody_truncate(fbody_t* body, size_t size){
+	int n = (int)FD_NEXTENTS(size);
+	for (int i = n; i < body->nexts; i++) fextent_release(body->exts[i]);
+	body->nexts = MIN(n, body->nexts);
+	body->size = size;
+}
+
+
+/**
+ * @brief Appends #size bytes from buf to a file content which is NOT held by
+ * any reader, as frames of (at most) FD_EXTENT_SIZE bytes compressed by #codec
+ * (a frame is stored raw if compression does NOT save space).
+ * @note On error, content is untouched.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+static int fbody_encode(fbody_t* body, void* buf, size_t size, int codec){
+	char zbuf[FD_EXTENT_SIZE];
+	size_t oldsize = body->size;
+	char* src = buf;
+	while (size > 0){
+		fd_frame_t frame;
+		frame.rawlen = MIN(size, FD_EXTENT_SIZE);
+		frame.zlen = (frame.rawlen >= FD_ZMIN ? codec_compress(codec, src, frame.rawlen, zbuf, frame.rawlen - 1) : 0);
+		if ((fbody_append(body, &frame, sizeof(frame)) == -1) ||
+			(fbody_append(body, (frame.zlen ? zbuf : src), (frame.zlen ? frame.zlen : frame.rawlen)) == -1)){
+			fbody_truncate(body, oldsize);
+			return -1;
+		}
+		src += frame.rawlen;
+		size -= frame.rawlen;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Creates a new file content with a single reference whose extents
+ * refer to #len bytes of (mapped) memory starting from data, WITHOUT copying.
+ * @note Memory MUST remain valid until ALL the extents have been released.
+ * @return Pointer to fbody_t object on success, NULL on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+static fbody_t* fbody_map(char* data, size_t len){
+	fbody_t* body = fbody_create(NULL);
+	if (!body) return NULL;
+	int n = (int)FD_NEXTENTS(len);
+	if ((n > 0) && !(body->exts = malloc(n * sizeof(fextent_t*)))){
+		fbody_release(body);
+		errno = ENOMEM;
+		return NULL;
+	}
+	body->cap = n;
+	for (int i = 0; i < n; i++){
+		fextent_t* ext = slab_alloc(sizeof(fextent_t));
+		if (!ext){
+			fbody_release(body);
 			errno = ENOMEM;
-			ret = -1;
-		} else {
-			fdata->clients = ptr;
-			memset(fdata->clients + fdata->maxclient + 1, 0, (client - fdata->maxclient)*sizeof(unsigned char)); /* NEVER fails */
-			fdata->maxclient = client;
-			ret = 0;
+			return NULL;
 		}
+		memset(ext, 0, sizeof(fextent_t));
+		ext->refs = 1;
+		ext->mapped = true;
+		ext->data = data + (size_t)i * FD_EXTENT_SIZE;
+		body->exts[body->nexts++] = ext;
 	}
-	RWL_UNLOCK(&fdata->lock);
-	return ret;
+	body->size = len;
+	return body;
+}
+
+
+/**
+ * @brief Decompresses ALL the frames of a file content into a new (raw) one
+ * of #rawsize bytes, with a single reference.
+ * @return Pointer to fbody_t object on success, NULL on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory;
+ *	- EBADMSG: corrupted content.
+ */
+static fbody_t* fbody_decode(fbody_t* zbody, int codec, size_t rawsize){
+	char zbuf[FD_EXTENT_SIZE];
+	char raw[FD_EXTENT_SIZE];
+	fbody_t* body = fbody_create(NULL);
+	if (!body) return NULL;
+	size_t off = 0;
+	while (off < zbody->size){
+		fd_frame_t frame;
+		if (zbody->size - off < sizeof(frame)){ errno = EBADMSG; break; }
+		fbody_copyout(zbody, off, &frame, sizeof(frame));
+		off += sizeof(frame);
+		if ((frame.rawlen > FD_EXTENT_SIZE) || (frame.zlen >= frame.rawlen) ||
+			(zbody->size - off < (frame.zlen ? frame.zlen : frame.rawlen))){ errno = EBADMSG; break; }
+		if (frame.zlen == 0) fbody_copyout(zbody, off, raw, frame.rawlen);
+		else {
+			fbody_copyout(zbody, off, zbuf, frame.zlen);
+			if (codec_decompress(codec, zbuf, frame.zlen, raw, frame.rawlen) == -1) break;
+		}
+		off += (frame.zlen ? frame.zlen : frame.rawlen);
+		if (fbody_append(body, raw, frame.rawlen) == -1) break;
+	}
+	if ((off != zbody->size) || (body->size != rawsize)){
+		if ((off == zbody->size) && (body->size != rawsize)) errno = EBADMSG;
+		fbody_release(body);
+		return NULL;
+	}
+	return body;
+}
+
+
+/**
+ * @brief Gets a (raw) reference to the content of fdata, decompressing it into
+ * a new private one if fdata has a codec.
+ * @note This function requires (at least) read lock on fdata.
+ * @return 0 on success, -1 on error (as fbody_decode).
+ */
+static int fdata_getbody(FileData_t* fdata, fbody_t** body, size_t* size){
+	if ((fdata->codec == CODEC_NONE) || !fdata->body){
+		if (fdata->body) ATOMIC_ADD(&fdata->body->refs, 1); /* Content cannot be freed until released */
+		*body = fdata->body;
+	} else if (!(*body = fbody_decode(fdata->body, fdata->codec, fdata->size))) return -1;
+	*size = fdata->size;
+	return 0;
+}
+
+
+/**
+ * @brief Gets the entry of client in the client set of fdata.
+ * @note fdata->lock MUST be held (in any mode).
+ * @return Pointer to the flags of client, NULL if client has no entry.
+ */
+static unsigned char* fdata_cfind(FileData_t* fdata, int client){
+	fd_clients_t* cs = &fdata->clients;
+	for (int i = 0; i < FD_INLINE_CLIENTS; i++){
+		if (cs->inl[i].client == client) return &cs->inl[i].flags;
+	}
+	if (!cs->table) return NULL;
+	unsigned int mask = (unsigned int)cs->cap - 1;
+	/* The table is NEVER full, so there is always an empty slot */
+	for (unsigned int i = FD_CLHASH(client) & mask; cs->table[i].client != -1; i = (i + 1) & mask){
+		if (cs->table[i].client == client) return &cs->table[i].flags;
+	}
+	return NULL;
+}
+
+
+/*
+ * Flags of an existing entry are modified also with fdata->lock in reading
+ * mode (see fd_clients_t), hence ALL the accesses made in reading mode are
+ * atomic byte operations: concurrent updates of the same entry (that are
+ * NOT excluded by the rwlock) cannot lose bits, and the entries of different
+ * clients are different bytes. Accesses made in writing mode are exclusive.
+ */
+
+/* Flags of client in fdata (0 if client has no entry), fdata->lock MUST be held */
+static unsigned char fdata_cget(FileData_t* fdata, int client){
+	unsigned char* flags = fdata_cfind(fdata, client);
+	return (flags ? ATOMIC_GET(flags) : 0);
+}
+
+
+/* Sets flags of client in an existing entry, fdata->lock MUST be held */
+static void fdata_cset(unsigned char* cflags, unsigned char flags){
+	ATOMIC_OR(cflags, flags);
+}
+
+
+/* Resets flags of client in fdata (if any), fdata->lock MUST be held */
+static void fdata_cunset(FileData_t* fdata, int client, unsigned char flags){
+	unsigned char* cflags = fdata_cfind(fdata, client);
+	if (cflags) ATOMIC_AND(cflags, (unsigned char)~flags);
+}
+
+
+/**
+ * @brief Rebuilds the overflow table of client entries with a capacity of at
+ * least twice the number of NOT stale entries plus one, dropping stale ones.
+ * @note fdata->lock MUST be held in writing mode.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate the new table.
+ */
+static int fdata_crehash(FileData_t* fdata){
+	fd_clients_t* cs = &fdata->clients;
+	int live = 0;
+	for (int i = 0; i < cs->cap; i++){
+		if ((cs->table[i].client != -1) && (cs->table[i].flags != 0)) live++;
+	}
+	int cap = FD_CLTABLE_MINCAP;
+	while ((live + 1) * 2 > cap) cap *= 2;
+	fd_client_t* table = malloc(cap * sizeof(fd_client_t));
+	if (!table){ errno = ENOMEM; return -1; }
+	for (int i = 0; i < cap; i++){ table[i].client = -1; table[i].flags = 0; }
+	unsigned int mask = (unsigned int)cap - 1;
+	for (int i = 0; i < cs->cap; i++){
+		if ((cs->table[i].client == -1) || (cs->table[i].flags == 0)) continue;
+		unsigned int j = FD_CLHASH(cs->table[i].client) & mask;
+		while (table[j].client != -1) j = (j + 1) & mask;
+		table[j] = cs->table[i];
+	}
+	free(cs->table);
+	cs->table = table;
+	cs->cap = cap;
+	cs->used = live;
+	return 0;
+}
+
+
+/**
+ * @brief Gets the entry of client in the client set of fdata, inserting
+ * it (with NO flags set) if missing.
+ * @note fdata->lock MUST be held in writing mode.
+ * @return Pointer to the flags of client on success, NULL on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate the overflow table.
+ */
+static unsigned char* fdata_cinsert(FileData_t* fdata, int client){
+	unsigned char* flags = fdata_cfind(fdata, client);
+	if (flags) return flags;
+	fd_clients_t* cs = &fdata->clients;
+	for (int i = 0; i < FD_INLINE_CLIENTS; i++){
+		if ((cs->inl[i].client == -1) || (cs->inl[i].flags == 0)){ /* Empty or stale */
+			cs->inl[i].client = client;
+			cs->inl[i].flags = 0;
+			return &cs->inl[i].flags;
+		}
+	}
+	if ((cs->used + 1) * 4 > cs->cap * 3){ /* Load factor would exceed 3/4 (or table NOT allocated) */
+		if (fdata_crehash(fdata) == -1) return NULL;
+	}
+	unsigned int mask = (unsigned int)cs->cap - 1;
+	unsigned int i = FD_CLHASH(client) & mask;
+	/* Since client is NOT in the table, the first stale slot of its probe sequence can be reused */
+	while ((cs->table[i].client != -1) && (cs->table[i].flags != 0)) i = (i + 1) & mask;
+	if (cs->table[i].client == -1) cs->used++;
+	cs->table[i].client = client;
+	cs->table[i].flags = 0;
+	return &cs->table[i].flags;
+}
+
+
+/* Resets flags of ALL the clients of fdata, fdata->lock MUST be held */
+static void fdata_cunsetAll(FileData_t* fdata, unsigned char flags){
+	fd_clients_t* cs = &fdata->clients;
+	for (int i = 0; i < FD_INLINE_CLIENTS; i++) cs->inl[i].flags &= ~flags;
+	for (int i = 0; i < cs->cap; i++) cs->table[i].flags &= ~flags;
 }
 
 
 /**
- * @brief Initializes a FileData_t object to contain an empty (closed) file and a 
- *(current) number of possible opening clients of (maxclient + 1).
+ * @brief Initializes a FileData_t object to contain an empty file opened
+ * (and locked if requested) by creator.
  * @return Pointer to FileData_t object on success, NULL on error.
  * Possible errors are:
  *	- EINVAL: invalid arguments;
- *	- ENOMEM (system out of memory, set by malloc / calloc);
+ *	- ENOMEM (system out of memory, set by malloc);
  *	- any error generated by rwlock_init.
  */
-FileData_t* fdata_create(int maxclient, int creator, bool locking){ /* -> fs_create */
+FileData_t* fdata_create(int creator, bool locking){ /* -> fs_create */
 
-	if ((creator > maxclient) || (creator < 0) || (maxclient < 0)){
+	if (creator < 0){
 		errno = EINVAL;
 		return NULL;
 	}
 	
-	FileData_t* fdata = malloc(sizeof(FileData_t));
+	FileData_t* fdata = slab_alloc(sizeof(FileData_t));
 	if (!fdata){
 		errno = ENOMEM;
 		return NULL;
 	}
 	memset(fdata, 0, sizeof(FileData_t));
-	fdata->data = NULL;
+	fdata->body = NULL;
 	fdata->size = 0;
-	fdata->waiting = tsqueue_init();	
-	if (!fdata->waiting){
-		free(fdata);
-		errno = ENOMEM;
-		return NULL;
-	}
-	fdata->clients = calloc(maxclient + 1, sizeof(unsigned char)); /* Already zeroed */
-	if (!fdata->clients){
-		/* If queue CANNOT be destroyed, we CANNOT avoid (at least) a memory leak */
-		SYSCALL_NOTREC(tsqueue_destroy(fdata->waiting, dummy), NULL, "fdata_create: while destroying waiting queue");
-		free(fdata);
-		errno = ENOMEM;
-		return NULL;
-	}
-	fdata->maxclient = maxclient;
+	fdata->codec = CODEC_NONE; /* Set by the file storage before first write */
+	fdata->dedup = false; /* As above */
+	fdata->stored = 0;
+	for (int i = 0; i < FD_INLINE_CLIENTS; i++) fdata->clients.inl[i].client = -1; /* Overflow table is NOT allocated */
 	
 	RWL_INIT(&fdata->lock, NULL);
 	
-	/* Gives access to creator */
-	fdata->clients[creator] |= LF_OPEN;	
+	/* Gives access to creator (NEVER fails, since inline entries are empty) */
+	unsigned char* cflags = fdata_cinsert(fdata, creator);
+	*cflags |= LF_OPEN;
 	/* Gives ownership to creator if requested */
 	if (locking){
 		fdata->flags |= O_LOCK;
-		fdata->clients[creator] |= (LF_OWNER | LF_WRITE);
+		*cflags |= (LF_OWNER | LF_WRITE);
+		fdata->lstats.acquired++;
 	}
 	return fdata;
 }
 
 
 /**
- * @brief Open fdata->data for client identified by client.
+ * @brief Open fdata->body for client identified by client.
  * @return 0 on success, -1 on error, 1 if client has been suspended waiting
  * for lock.
  * @note Operation is done in a "transactional" manner, i.e.:
@@ -139,19 +619,21 @@ FileData_t* fdata_create(int maxclient, int creator, bool locking){ /* -> fs_cre
  *	- or the client has not yet opened that file and function fails with file
  *	not opened and lock not acquired.
  * Possible errors are:
- *	- EINVAL: invalid arguments.
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to insert client in the client set.
  */
 int fdata_open(FileData_t* fdata, int client, bool locking){ /* -> fs_open */
 
 	if (client < 0){ errno = EINVAL; return -1; }
 	
 	int ret = 0;
+	unsigned char* cflags;
 	
-	RD_CLIENT_RESIZE(fdata, client, &ret);
+	RD_CLIENT_ENTRY(fdata, client, cflags, &ret);
 	
-	if (ret == 0){
-		fdata->clients[client] |= LF_OPEN;
-		fdata->clients[client] &= ~LF_WRITE;
+	if (ret == 0){ /* Possibly in reading mode */
+		fdata_cset(cflags, LF_OPEN);
+		ATOMIC_AND(cflags, (unsigned char)~LF_WRITE);
 	}
 	RWL_UNLOCK(&fdata->lock);
 	/*
@@ -160,10 +642,10 @@ int fdata_open(FileData_t* fdata, int client, bool locking){ /* -> fs_open */
 		- or fail because of connection closing or fatal error (=> LF_WRITE becomes "useless").
 	*/
 	if ((ret == 0) && locking){
-		ret = fdata_lock(fdata, client);
+		ret = fdata_lock(fdata, client, 0);
 		if (ret == -1){
 			RWL_RDLOCK(&fdata->lock);
-			fdata->clients[client] &= ~LF_OPEN; /* Operation failed */
+			fdata_cunset(fdata, client, LF_OPEN); /* Operation failed */
 			RWL_UNLOCK(&fdata->lock);
 		}
 	}
@@ -179,24 +661,22 @@ int fdata_open(FileData_t* fdata, int client, bool locking){ /* -> fs_open */
  */
 int fdata_close(FileData_t* fdata, int client){ /* -> fs_close */
 	if (client < 0){ errno = EINVAL; return -1; }
-	int ret = 0;
-	
-	RD_CLIENT_RESIZE(fdata, client, &ret);
-	
-	if (ret == 0){
-		fdata->clients[client] &= ~LF_OPEN; /* file closed */
-		fdata->clients[client] &= ~LF_WRITE; /* A writeFile will fail */
-	}
 	
+	RWL_RDLOCK(&fdata->lock);
+	/* file closed and a writeFile will fail (a client with no entry has NOT opened the file) */
+	fdata_cunset(fdata, client, LF_OPEN | LF_WRITE);
 	RWL_UNLOCK(&fdata->lock);
-	return ret;
+	return 0;
 }
 
 
 /**
- * @brief Copies file data (if any) into a buffer and writes size in #size.
- * @param buf -- Address of a void* variable which does NOT references any
- * heap-allocated memory, that shall contain copied data.
+ * @brief Gets a reference to file content (if any) WITHOUT copying it and
+ * writes its size in #size. If file has a codec, the reference is to a new
+ * decompressed copy, such that content at rest is NEVER expanded.
+ * @param body -- Address of a fbody_t* variable that shall contain the
+ * reference (NULL if file is empty), which MUST be released by the caller
+ * with fbody_release after having used it.
  * @param size -- Address of a size_t variable that shall contain data size.
  * @param ign_open -- If true, then it is ignored whether the file is open or 
  * not (this is needed to implement readNFiles); otherwise, it is checked 
@@ -205,39 +685,31 @@ int fdata_close(FileData_t* fdata, int client){ /* -> fs_close */
  * Possible errors are:
  *	- EINVAL: invalid arguments;
  *	- EBADF: (ign_open == false) and file not open;
- *	- ENOMEM: unable to allocate needed memory;
- *	- EBUSY: (ign_open == false) and file is locked by another client.
+ *	- EBUSY: (ign_open == false) and file is locked by another client;
+ *	- any error by fbody_decode.
  */
-int fdata_read(FileData_t* fdata, void** buf, size_t* size, int client, bool ign_open){ /* -> fs_read */
-	if (!buf || !size || (client < 0)){ errno = EINVAL; return -1; }
+int fdata_read(FileData_t* fdata, fbody_t** body, size_t* size, int client, bool ign_open){ /* -> fs_read */
+	if (!body || !size || (client < 0)){ errno = EINVAL; return -1; }
 	int ret = 0; /* return value */
 	
-	RD_CLIENT_RESIZE(fdata, client, &ret);
+	RWL_RDLOCK(&fdata->lock);
+	unsigned char cflags = fdata_cget(fdata, client);
 	/* If ign_open == true, this check shall be skipped */
-	if ( (ret == 0) && !ign_open && (fdata->flags & O_LOCK) && !(fdata->clients[client] & LF_OWNER) ){
+	if ( !ign_open && (fdata->flags & O_LOCK) && !(cflags & LF_OWNER) ){
 		errno = EBUSY;
 		ret = -1;
 	}
 	
 	/* If ign_open == true, check on LF_OPEN shall be skipped */
-	if ( (ret == 0) && ( ign_open || (fdata->clients[client] & LF_OPEN) ) ) { /* file open */
-		*buf = malloc(fdata->size);
-		if (*buf == NULL){
-			errno = ENOMEM;
-			ret = -1;
-		} else {
-			memset(*buf, 0, fdata->size);
-			memmove(*buf, fdata->data, fdata->size);
-			*size = fdata->size;
-			ret = 0;
-		}
+	if ( (ret == 0) && ( ign_open || (cflags & LF_OPEN) ) ) { /* file open */
+		ret = fdata_getbody(fdata, body, size);
 	} else if (ret == 0){ /* !ign_open && !(LF_OPEN set) */
 		errno = EBADF;
 		ret = -1; /* file NOT open */
 	}
 
 	/* This is ok also for readNFiles: LF_WRITE is reset iff this file is chosen */
-	if (ret == 0) fdata->clients[client] &= ~LF_WRITE; /* A writeFile will fail */
+	if (ret == 0) fdata_cunset(fdata, client, LF_WRITE); /* A writeFile will fail */
 
 	RWL_UNLOCK(&fdata->lock);
 	return ret;
@@ -252,6 +724,13 @@ int fdata_read(FileData_t* fdata, void** buf, size_t* size, int client, bool ign
  * functions provided in client API. If true, the function behaves as if a 
  * writeFile has been called by the calling thread, otherwise it behaves as an
  * appendToFile has been called by the calling thread.
+ * @param charged -- Address of a (ssize_t) variable that shall contain the
+ * variation of the bytes charged to the storage for the file (fdata->stored):
+ * it is less than size if content has been compressed (see fbody_encode) and
+ * it can be negative if deduplication has shared extents already charged.
+ * @note If fdata->dedup, ALL the extents filled by buf are deduplicated, and
+ * so is the last (partial) one if the file was empty (i.e. its content has
+ * been written at once), since an append would copy it.
  * @return 0 on success, -1 on error.
  * Possible errors are:
  *	- EINVAL: invalid arguments;
@@ -260,128 +739,260 @@ int fdata_read(FileData_t* fdata, void** buf, size_t* size, int client, bool ign
  *	- EBUSY: file is locked by another client;
  *	- ENOMEM: by malloc/realloc.
  */
-int	fdata_write(FileData_t* fdata, void* buf, size_t size, int client, bool wr){
-	if (!buf || (size < 0) || (client < 0)){ errno = EINVAL; return -1; }
+int	fdata_write(FileData_t* fdata, void* buf, size_t size, int client, bool wr, ssize_t* charged){
+	if (!buf || (size < 0) || (client < 0) || !charged){ errno = EINVAL; return -1; }
 	int ret = 0; /* return value */
 	
-	WR_CLIENT_RESIZE(fdata, client, &ret);
-	if (ret == 0){
-		if ((fdata->flags & O_LOCK) && !(fdata->clients[client] & LF_OWNER)){ /* File is locked by another client */
-			errno = EBUSY;
-			ret = -1;
-		} else if (!(fdata->clients[client] & LF_OPEN)) {
-			errno = EBADF;
-			ret = -1;
-		} else if (wr && !(fdata->clients[client] & LF_WRITE)){
-			errno = EPERM;
-			ret = -1;
-		}
+	RWL_WRLOCK(&fdata->lock);
+	unsigned char cflags = fdata_cget(fdata, client);
+	if ((fdata->flags & O_LOCK) && !(cflags & LF_OWNER)){ /* File is locked by another client */
+		errno = EBUSY;
+		ret = -1;
+	} else if (!(cflags & LF_OPEN)) {
+		errno = EBADF;
+		ret = -1;
+	} else if (wr && !(cflags & LF_WRITE)){
+		errno = EPERM;
+		ret = -1;
 	}
-	if (!fdata->data && (ret == 0)){
-		fdata->data = malloc(size);
-		if (!fdata->data){
-			errno = ENOMEM;
-			ret = -1;
-		} else {
-			fdata->size = size;
-			memmove(fdata->data, buf, size);
-			ret = 0;
+	if (ret == 0){
+		fbody_t* body = fdata->body;
+		size_t oldsize = (body ? body->size : 0);
+		int first = (int)(oldsize / FD_EXTENT_SIZE); /* First extent modified by buf */
+		size_t oldpriv = (body ? fbody_private(body, first) : 0);
+		if (body && (ATOMIC_GET(&body->refs) == 1)){ /* No reader holds content: it can be modified in place */
+			ret = FBODY_PUT(fdata, body, buf, size);
+		} else { /* New version, the old one (if any) is freed by its last reader */
+			fbody_t* newbody = fbody_create(body);
+			if (!newbody) ret = -1;
+			else if (FBODY_PUT(fdata, newbody, buf, size) == -1){
+				fbody_release(newbody);
+				ret = -1;
+			} else {
+				fdata->body = newbody;
+				fbody_release(body);
+			}
 		}
-	} else if (ret == 0){
-		size_t newsize = fdata->size + size;
-		void* ptr = realloc(fdata->data, newsize);
-		if (!ptr){
-			errno = ENOMEM;
-			ret = -1;
-		} else {
-			fdata->data = ptr;
-			memmove(((char*)fdata->data) + fdata->size, (char*)buf, size);
-			fdata->size = newsize;
-			ret = 0;
+		if (ret == 0){
+			body = fdata->body;
+			if (fdata->dedup) fbody_dedup(body, first, (oldsize == 0 ? body->size : body->size - body->size % FD_EXTENT_SIZE));
+			*charged = (ssize_t)fbody_private(body, first) - (ssize_t)oldpriv;
+			fdata->size += size;
+			fdata->stored += *charged;
 		}
 	}
 	if (ret == 0){
 		/* Modified (writing operation) */
 		fdata->flags |= O_DIRTY;
-		fdata->clients[client] &= ~LF_WRITE; /* A writeFile will fail */
+		fdata_cunset(fdata, client, LF_WRITE); /* A writeFile will fail */
+	}
+	RWL_UNLOCK(&fdata->lock);
+	return ret;
+}
+
+
+/**
+ * @brief Gets a reference to the raw content of fdata (as fdata_read) WITHOUT
+ * any check on clients (e.g., for sending back an expelled file).
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- any error by fbody_decode.
+ */
+int fdata_content(FileData_t* fdata, fbody_t** body, size_t* size){
+	if (!fdata || !body || !size){ errno = EINVAL; return -1; }
+	RWL_RDLOCK(&fdata->lock);
+	int ret = fdata_getbody(fdata, body, size);
+	RWL_UNLOCK(&fdata->lock);
+	return ret;
+}
+
+
+/**
+ * @brief Gets a reference to the content of fdata as it is stored (i.e.,
+ * compressed if *codec != CODEC_NONE, with body->size stored bytes) WITHOUT
+ * any check on clients (e.g., for taking a snapshot).
+ * @param size -- Address of a (size_t) variable that shall contain the
+ * (decompressed) file size.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments.
+ */
+int fdata_stored(FileData_t* fdata, fbody_t** body, size_t* size, int* codec){
+	if (!fdata || !body || !size || !codec){ errno = EINVAL; return -1; }
+	RWL_RDLOCK(&fdata->lock);
+	if (fdata->body) ATOMIC_ADD(&fdata->body->refs, 1);
+	*body = fdata->body;
+	*size = fdata->size;
+	*codec = fdata->codec;
+	RWL_UNLOCK(&fdata->lock);
+	return 0;
+}
+
+
+/**
+ * @brief Sets the content of an EMPTY file to #len bytes of (mapped) memory
+ * starting from data, stored with #codec and whose decompressed size is #size.
+ * Content is NOT copied and it is served directly from memory until the file
+ * is removed, while only its last extent is copied if the file is appended.
+ * @note Memory MUST remain valid until the file has been destroyed and ALL
+ * readers have released its content.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments or file NOT empty;
+ *	- ENOMEM: unable to allocate memory.
+ */
+int fdata_map(FileData_t* fdata, int codec, void* data, size_t len, size_t size){
+	if (!fdata || (!data && (len > 0)) || !codec_name(codec) || ((codec == CODEC_NONE) && (len != size))){ errno = EINVAL; return -1; }
+	if (len == 0) return 0;
+	int ret = 0;
+	RWL_WRLOCK(&fdata->lock);
+	if (fdata->size > 0){ errno = EINVAL; ret = -1; }
+	else {
+		fbody_t* body = fbody_map(data, len);
+		if (!body) ret = -1;
+		else {
+			fbody_release(fdata->body);
+			fdata->body = body;
+			fdata->codec = codec;
+			fdata->size = size;
+			fdata->stored = len;
+		}
 	}
 	RWL_UNLOCK(&fdata->lock);
 	return ret;
 }
 
 
+/**
+ * @brief Removes the first waiter of fdata that is client (and whose deadline
+ * is *deadline if deadline != NULL), fdata->lock MUST be held in writing mode.
+ * @return true if a waiter has been removed, false otherwise.
+ */
+static bool fdata_wremove(FileData_t* fdata, int client, uint64_t* deadline){
+	fd_waiter_t* prev = NULL;
+	for (fd_waiter_t* w = fdata->whead; w; prev = w, w = w->next){
+		if ((w->client != client) || (deadline && (w->deadline != *deadline))) continue;
+		if (prev) prev->next = w->next;
+		else fdata->whead = w->next;
+		if (fdata->wtail == w) fdata->wtail = prev;
+		slab_free(w, sizeof(fd_waiter_t));
+		return true;
+	}
+	return false;
+}
+
+
 /**
  * @brief Sets O_LOCK flag to the current file. If O_LOCK is not set or it is
- * already owned by the calling client, it returns 0 immediately, otherwise 1.
+ * already owned by the calling client, it returns 0 immediately, otherwise 1
+ * and client is appended to the waiters of the file.
+ * @param deadline -- When the wait shall expire (see stats_now), 0 if never:
+ * it is NOT enforced by this function, but it identifies the wait for
+ * fdata_cancelWait.
  * @return 0 on success, -1 on error, 1 if file is already locked by another client.
  * Possible errors are:
  *	- EINVAL: invalid arguments;
- *	- ENOMEM: by malloc.
+ *	- ENOMEM: by malloc or unable to insert client in the client set.
  */
-int fdata_lock(FileData_t* fdata, int client){
+int fdata_lock(FileData_t* fdata, int client, uint64_t deadline){
 	if (client < 0){ errno = EINVAL; return -1; }
 	int ret = 0; /* return value */
 	
-	WR_CLIENT_RESIZE(fdata, client, &ret);	
-	if ((ret == 0) && (fdata->flags & O_LOCK) && !(fdata->clients[client] & LF_OWNER)){
-		int* wfd = malloc(sizeof(int));
-		if (!wfd){
+	RWL_WRLOCK(&fdata->lock);
+	unsigned char* cflags = fdata_cinsert(fdata, client);
+	if (!cflags) ret = -1;
+	if ((ret == 0) && (fdata->flags & O_LOCK) && !(*cflags & LF_OWNER)){
+		fd_waiter_t* w = slab_alloc(sizeof(fd_waiter_t));
+		/* Operation fails but error is recoverable! */
+		if (!w){
 			errno = ENOMEM;
 			ret = -1;
 		} else {
-			*wfd = client;
-			int w = tsqueue_push(fdata->waiting, wfd);
-			if (w == 0){
-				fdata->clients[client] |= LF_WAIT;
-				ret = 1;
-			/* Operation fails but error is recoverable! */
-			} else {
-				perror("fdata_lock: while pushing new client on waiting queue");
-				free(wfd);
-				ret = -1;
-			}
+			w->client = client;
+			w->since = stats_now();
+			w->deadline = deadline;
+			w->next = NULL;
+			if (fdata->wtail) fdata->wtail->next = w;
+			else fdata->whead = w;
+			fdata->wtail = w;
+			*cflags |= LF_WAIT;
+			ret = 1;
 		}
 	} else if (ret == 0){
+		if (!(*cflags & LF_OWNER)) fdata->lstats.acquired++;
 		fdata->flags |= O_LOCK;
-		fdata->clients[client] |= LF_OWNER;
+		*cflags |= LF_OWNER;
 	}	
-	if (ret == 0) fdata->clients[client] &= ~LF_WRITE; /* A writeFile will fail */
+	if (ret == 0) *cflags &= ~LF_WRITE; /* A writeFile will fail */
 	RWL_UNLOCK(&fdata->lock);
 	return ret;
 }
 
 
 /**
- * @brief Resets O_LOCK flag to the current file. If file was not locked by
- * the calling client, it returns 1 immediately.
- * @param newowner -- Pointer to an ALREADY initialized linkedlist where new
- * lock owner will be stored (if any).
+ * @brief Resets O_LOCK flag to the current file and hands it to the first
+ * waiter (if any). If file was not locked by the calling client, it returns
+ * 1 immediately.
+ * @param newowner -- Pointer to an int where the id of the new lock owner
+ * will be stored, or -1 if there is none.
  * @return 0 on success, -1 on (general) error, 1 if file was not already
  * locked by the calling client.
  * Possible errors are:
  *	- EINVAL: invalid arguments.
  */
-int fdata_unlock(FileData_t* fdata, int client, llist_t** newowner){
+int fdata_unlock(FileData_t* fdata, int client, int* newowner){
 	if ((client < 0) || !newowner){ errno = EINVAL; return -1; }
 
 	int ret = 0;	
-	int* n_own = NULL;
+	*newowner = -1;
 	
-	WR_CLIENT_RESIZE(fdata, client, &ret);
-	if ((ret == 0) && (fdata->clients[client] & LF_OWNER)){
-		fdata->clients[client] &= ~LF_OWNER;
-		int w;
-		/* nonblocking, unrecoverable error (file-lock CANNOT be reassigned) */
-		FD_NOTREC_UNLOCK(fdata, (w = tsqueue_pop(fdata->waiting, (void**)&n_own, true)) , "fdata_unlock: while extracting new owner from waiting queue");
-		if (w > 0) fdata->flags &= ~O_LOCK; /* No one is waiting or queue is closed */
-		else if (w == 0){
-			fdata->clients[*n_own] &= ~LF_WAIT;
-			fdata->clients[*n_own] |= LF_OWNER;
-			/* On failure, we could NOT know who is new owner and send it a success message! */
-			FD_NOTREC_UNLOCK(fdata, llist_push(*newowner, n_own), "fdata_unlock: while adding new owner to list");
+	RWL_WRLOCK(&fdata->lock);
+	unsigned char* cflags = fdata_cfind(fdata, client);
+	if (cflags && (*cflags & LF_OWNER)){
+		*cflags &= ~LF_OWNER;
+		fd_waiter_t* w = fdata->whead;
+		if (!w) fdata->flags &= ~O_LOCK; /* No one is waiting */
+		else {
+			*newowner = w->client;
+			fdata->whead = w->next;
+			if (!fdata->whead) fdata->wtail = NULL;
+			unsigned char* oflags = fdata_cfind(fdata, w->client); /* NEVER NULL, since LF_WAIT is set */
+			*oflags &= ~LF_WAIT;
+			*oflags |= LF_OWNER;
+			uint64_t waited = stats_now() - w->since;
+			fdata->lstats.acquired++;
+			fdata->lstats.contended++;
+			fdata->lstats.waitTime += waited;
+			if (waited > fdata->lstats.maxWait) fdata->lstats.maxWait = waited;
+			stats_wait(ST_LOCKWAIT, w->since);
+			slab_free(w, sizeof(fd_waiter_t));
 		}
-	} else ret = (ret ? ret : 1); /* Switches to 1 if there has been no error on CHECK_MAXCLIENT */	
-	if (ret == 0) fdata->clients[client] &= ~LF_WRITE; /* A writeFile will fail */	
+	} else ret = 1; /* NOT locked by client */
+	if (ret == 0) *cflags &= ~LF_WRITE; /* A writeFile will fail */
+	RWL_UNLOCK(&fdata->lock);
+	return ret;
+}
+
+
+/**
+ * @brief Removes client from the waiters of fdata iff it is still waiting
+ * for the lock with the given deadline (as passed to fdata_lock), i.e. when
+ * its wait has expired.
+ * @return 0 if client has been removed, 1 if it is NOT waiting anymore (e.g.,
+ * it has already acquired the lock), -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments.
+ */
+int fdata_cancelWait(FileData_t* fdata, int client, uint64_t deadline){
+	if (!fdata || (client < 0)){ errno = EINVAL; return -1; }
+	int ret = 1;
+	RWL_WRLOCK(&fdata->lock);
+	if (fdata_wremove(fdata, client, &deadline)){
+		fdata_cunset(fdata, client, LF_WAIT);
+		fdata->lstats.timeouts++;
+		ret = 0;
+	}
 	RWL_UNLOCK(&fdata->lock);
 	return ret;
 }
@@ -393,61 +1004,64 @@ int fdata_unlock(FileData_t* fdata, int client, llist_t** newowner){
  *	- if it is owning lock on file, unlocks it and assigns lock to the next
  *	waiter if any, otherwise it releases it;
  *	- if it is waiting on file lock, removes it from waiting queue.
+ * @param newowner -- As for fdata_unlock.
  * @return 0 on success, -1 on error.
  * Possible errors are:
  *	- EINVAL: invalid arguments.
  */
-int fdata_removeClient(FileData_t* fdata, int client, llist_t** newowner){
+int fdata_removeClient(FileData_t* fdata, int client, int* newowner){
 	if ((client < 0) || !newowner){ errno = EINVAL; return -1; }
 	int ret = 0;
+	*newowner = -1;
 	
-	WR_CLIENT_RESIZE(fdata, client, &ret);
-	if (ret == 0) fdata->clients[client] &= ~(LF_OPEN | LF_WRITE); /* These can be safely eliminated here */
-	/*
-	All FD_NOTREC_UNLOCK below are done because an incorrect client-cleanup CANNOT guarantee a future consistent state of what any client
-	is doing (i.e., if client id can be recycled after a connection has been closed, there could be an inconsistent state).
-	*/
-	if ((ret == 0) && (fdata->clients[client] & LF_WAIT)){
-		/* On failure, there could be aliasing between disconnected client and a new one */
-		FD_NOTREC_UNLOCK(fdata, tsqueue_iter_init(fdata->waiting), "fdata_removeClient: while initializing iteration on waiting queue");
-		int* r;
-		int res1, res2;
-		while (true){
-			FD_NOTREC_UNLOCK(fdata, (res1 = tsqueue_iter_next(fdata->waiting, (void**)&r)), "fdata_removeClient: while iterating on waiting queue");
-			if (res1 == 1) break; /* Iteration ended */
-			if (*r == client){
-				FD_NOTREC_UNLOCK(fdata, (res2 = tsqueue_iter_remove(fdata->waiting, (void**)&r)), "fdata_removeClient: while removing waiting client id");
-				free(r);
-				break;
-			}
-		}
-		FD_NOTREC_UNLOCK(fdata, tsqueue_iter_end(fdata->waiting), "fdata_removeClient: while ending iteration on waiting queue");
-		/* If (res1 == 1), iteration has ended without finding client in the waiting queue */
-		fdata->clients[client] &= ~LF_WAIT;
+	RWL_WRLOCK(&fdata->lock);
+	unsigned char* cflags = fdata_cfind(fdata, client);
+	if (!cflags){ /* Client has NO state on this file */
+		RWL_UNLOCK(&fdata->lock);
+		return 0;
+	}
+	*cflags &= ~(LF_OPEN | LF_WRITE); /* These can be safely eliminated here */
+	if (*cflags & LF_WAIT){
+		fdata_wremove(fdata, client, NULL);
+		*cflags &= ~LF_WAIT;
 		RWL_UNLOCK(&fdata->lock);
-	} else if ((ret == 0) && (fdata->clients[client] & LF_OWNER)){
+	} else if (*cflags & LF_OWNER){
 		RWL_UNLOCK(&fdata->lock);
 		ret = fdata_unlock(fdata, client, newowner); /* ret will NEVER be 1 */
-	} else RWL_UNLOCK(&fdata->lock); /* ret == -1 is included */
+	} else RWL_UNLOCK(&fdata->lock);
 	return ret;
 }
 
 
 /**
- * @brief Extracts waiters queue from FileData_t object passed and makes it
- * available to calling thread and unreachable from FileData_t object, to which it
- * creates a new empty waiting queue.
+ * @brief Detaches ALL the waiters of the FileData_t object passed (in FIFO
+ * order) WITHOUT any allocation, such that the file has NO waiter anymore.
  * @note This method should be used only when destroying a file, as it can lead
  * to inconsistency between clients and server.
- * @return Ex-waiting queue of fdata on success, exits on error.
+ * @note The returned chain MUST be released by fdata_waitersFree.
+ * @return Ex-waiters of fdata as a chain of fd_waiter_t (by next), NULL if
+ * there is none.
  */
-tsqueue_t* fdata_waiters(FileData_t* fdata){
+fd_waiter_t* fdata_waiters(FileData_t* fdata){
 	RWL_WRLOCK(&fdata->lock);
-	tsqueue_t* waitQueue = fdata->waiting;
-	fdata->waiting = NULL;
-	for (int i = 0; i < fdata->maxclient; i++) fdata->clients[i] &= ~LF_WAIT;
+	fd_waiter_t* waiters = fdata->whead;
+	fdata->whead = NULL;
+	fdata->wtail = NULL;
+	fdata_cunsetAll(fdata, LF_WAIT);
 	RWL_UNLOCK(&fdata->lock);
-	return waitQueue;
+	return waiters;
+}
+
+
+/**
+ * @brief Releases a chain of waiters returned by fdata_waiters.
+ */
+void fdata_waitersFree(fd_waiter_t* waiters){
+	while (waiters){
+		fd_waiter_t* w = waiters;
+		waiters = w->next;
+		slab_free(w, sizeof(fd_waiter_t));
+	}
 }
 
 
@@ -457,44 +1071,90 @@ tsqueue_t* fdata_waiters(FileData_t* fdata){
  */
 int fdata_destroy(FileData_t* fdata){	
 	RWL_WRLOCK(&fdata->lock);
-	if (fdata->clients){
-		free(fdata->clients);
-		fdata->clients = NULL;
-	}
+	free(fdata->clients.table);
+	memset(&fdata->clients, 0, sizeof(fd_clients_t));
 	fdata->size = 0;
-	fdata->maxclient = 0;
-	if (fdata->data){
-		free(fdata->data);
-		fdata->data = NULL;	
+	if (fdata->body){
+		fbody_release(fdata->body); /* Readers could still hold it */
+		fdata->body = NULL;
 	}
-	if (fdata->waiting){
-		FD_NOTREC_UNLOCK(fdata, tsqueue_destroy(fdata->waiting, free), "fdata_destroy: while destroying waiting queue");
-		fdata->waiting = NULL;
+	while (fdata->whead){
+		fd_waiter_t* w = fdata->whead;
+		fdata->whead = w->next;
+		slab_free(w, sizeof(fd_waiter_t));
 	}
+	fdata->wtail = NULL;
 	RWL_UNLOCK(&fdata->lock);
 	RWL_DESTROY(&fdata->lock);
-	free(fdata);
+	slab_free(fdata, sizeof(FileData_t));
 	return 0;
 }
 
 
+/**
+ * @return Client-local flags of client on fdata (0 if it has NO entry).
+ */
+unsigned char fdata_clientFlags(FileData_t* fdata, int client){
+	RWL_RDLOCK(&fdata->lock);
+	unsigned char flags = fdata_cget(fdata, client);
+	RWL_UNLOCK(&fdata->lock);
+	return flags;
+}
+
+
+/**
+ * @return Bytes of data of ALL the extents shared by deduplication (they are
+ * NOT charged to any file).
+ */
+size_t fdata_sharedBytes(void){ return ATOMIC_GET(&dedupTable.bytes); }
+
+
+/**
+ * @brief Gets statistics of deduplication: bytes and number of shared
+ * extents, and total bytes whose allocation has been avoided so far.
+ */
+void fdata_dedupStats(size_t* sharedBytes, int* sharedExts, size_t* savedBytes){
+	LOCK(&dedupTable.lock);
+	if (sharedBytes) *sharedBytes = dedupTable.bytes;
+	if (sharedExts) *sharedExts = dedupTable.nexts;
+	if (savedBytes) *savedBytes = dedupTable.saved;
+	UNLOCK(&dedupTable.lock);
+}
+
+
 /**
  * @brief Prints out all metadata and file content of the file.
  */
 void fdata_printout(FileData_t* fdata){
 	RWL_RDLOCK(&fdata->lock);
 	printf("fdata->size = %lu\n", fdata->size);
+	printf("fdata->stored = %lu (codec = %s, dedup = %s)\n", fdata->stored, codec_name(fdata->codec), (fdata->dedup ? "true" : "false"));
 	printf("fdata->flags = %d\n", fdata->flags);
 	printf("locked(fdata) = ");
 	printf(fdata->flags & O_LOCK ? "true\n" : "false\n");
-	printf("fdata->maxclient = %d\n", fdata->maxclient);
-	printf("fdata->clients = ");
-	for (int i = 0; i <= fdata->maxclient; i++){
-		if (fdata->clients[i] & LF_OPEN) printf("1");
-		else printf("0");
+	printf("fdata->clients (open) = ");
+	for (int i = 0; i < FD_INLINE_CLIENTS; i++){
+		if (fdata->clients.inl[i].flags & LF_OPEN) printf("%d ", fdata->clients.inl[i].client);
 	}
+	for (int i = 0; i < fdata->clients.cap; i++){
+		if (fdata->clients.table[i].flags & LF_OPEN) printf("%d ", fdata->clients.table[i].client);
+	}
+	printf("\nfdata->waiters = ");
+	for (fd_waiter_t* w = fdata->whead; w; w = w->next) printf("%d ", w->client);
+	fd_lockstats_t* ls = &fdata->lstats;
+	printf("\nlock acquisitions = %lu (contended = %lu, expired waits = %lu)\n", ls->acquired, ls->contended, ls->timeouts);
+	printf("lock waiting time = %.3f ms (mean = %.3f ms, max = %.3f ms)",
+		(double)ls->waitTime / 1e6, (ls->contended > 0 ? (double)ls->waitTime / ls->contended / 1e6 : 0.0), (double)ls->maxWait / 1e6);
 	printf("\nfile content: \n");
-	write(1, fdata->data, fdata->size); /* Avoid invalid reads in absence of '\0' character */
+	fbody_t* body = NULL;
+	size_t size = 0;
+	if (fdata_getbody(fdata, &body, &size) == -1) perror("fdata_printout: while getting content");
+	/* Avoid invalid reads in absence of '\0' character */
+	for (int i = 0; body && (i < body->nexts); i++){
+		size_t n = MIN(FD_EXTENT_SIZE, size - (size_t)i * FD_EXTENT_SIZE);
+		write(1, body->exts[i]->data, n);
+	}
+	fbody_release(body);
 	printf("\n");
 	RWL_UNLOCK(&fdata->lock);		
 }
@@ -1,4 +1,6 @@
 #include <fs.h>
+#include <stats.h>
+#include <sched.h>
 
 /**
  * @brief Utility macro for when there is an unrecoverable error
@@ -14,23 +16,63 @@ do { \
 	} \
 } while(0);
 
+/* Equivalent of FS_NOTREC_UNLOCK for operations that use a single shard */
+#define SHARD_NOTREC_UNLOCK(shard, sc, msg) \
+do { \
+	if ((sc) == -1){ \
+		perror(msg); \
+		fs_shard_op_end(shard); \
+		errno = ENOTRECOVERABLE; \
+		return -1; \
+	} \
+} while(0);
+
+/* Terminates either a global or a single-shard operation */
+#define FS_OP_END(fs, shard, global) \
+do { \
+	if (global) fs_op_end(fs); \
+	else fs_shard_op_end(shard); \
+} while(0);
+
+/* Logs a record in the journal (ONLY if persistence is active): failures are reported but NOT fatal */
+#define FS_LOG(fs, type, pathname, data, len) \
+do { \
+	if ((fs)->persist && (fs)->persist->started && (persist_log((fs)->persist, type, pathname, data, len) == -1)) \
+		perror("While logging operation in the journal"); \
+} while(0);
+
+/* Prefetches the bucket of the item FS_PREFETCH_DIST positions after the k-th one of a batch (see fs_batch_begin) */
+#define FS_BATCH_PREFETCH(fs, items, k, n) \
+do { \
+	if ((k) + FS_PREFETCH_DIST < (n)) \
+		fmap_prefetch(&(fs)->shards[(items)[(k) + FS_PREFETCH_DIST].shard], (items)[(k) + FS_PREFETCH_DIST].bucket); \
+} while(0);
+
 /* Utility macro for freeing resources on failure in fs_create */
-#define	DELRET_FSCREATE(file, pathcopy1, pathcopy2, errmsg)\
+#define	DELRET_FSCREATE(file, pathcopy, errmsg)\
 do {\
-	free(pathcopy1);\
-	free(pathcopy2);\
+	slab_strfree(pathcopy);\
 	SYSCALL_NOTREC(fdata_destroy(file), -1, errmsg);\
 	return -1;\
 } while(0);\
 
+/* Equivalent of DELRET_FSCREATE for functions returning a file */
+#define	DELNULL_FSPUT(file, pathcopy, errmsg)\
+do {\
+	slab_strfree(pathcopy);\
+	SYSCALL_NOTREC(fdata_destroy(file), NULL, errmsg);\
+	return NULL;\
+} while(0);\
+
 /* ************************ FCONTENT OPERATIONS ********************** */
 
 /**
- * @brief Creates a fcontent_t object with content space already allocated.
+ * @brief Creates a fcontent_t object that takes ownership of a reference
+ * to file content (content == NULL for empty files).
  * @return The fcontent_t object created on success, NULL on error.
  */
-fcontent_t* fcontent_init(char* pathname, size_t size, void* content){
-	if (!pathname || !content){ errno = EINVAL; return NULL; }
+fcontent_t* fcontent_init(char* pathname, size_t size, fbody_t* content){
+	if (!pathname){ errno = EINVAL; return NULL; }
 	fcontent_t* fc = malloc(sizeof(fcontent_t));
 	if (!fc) return NULL;
 	memset(fc, 0, sizeof(*fc));
@@ -52,7 +94,7 @@ fcontent_t* fcontent_init(char* pathname, size_t size, void* content){
 void fcontent_destroy(fcontent_t* fc){
 	if (!fc) return;
 	free(fc->filename);
-	free(fc->content);
+	fbody_release(fc->content);
 	free(fc);
 	return;
 }
@@ -61,8 +103,100 @@ void fcontent_destroy(fcontent_t* fc){
 /* ********************** STATIC OPERATIONS ********************** */
 
 /**
- * @brief Creates a copy of #pathname for a new entry in the hashtable or 
- * in the replQueue.
+ * The following operations make shard hashtable implementation (icl_hash or
+ * rhtable, see FS_TABLE_*) transparent to the rest of the file storage.
+ */
+
+/* Creates the hashtable of a shard */
+static int fmap_create(fs_shard_t* shard, int tableType, int nbuckets){
+	if (tableType == FS_TABLE_RH) shard->rmap = rht_create(nbuckets);
+	else shard->fmap = icl_hash_create(nbuckets, NULL, NULL);
+	return ((shard->fmap || shard->rmap) ? 0 : -1);
+}
+
+
+/* Searches key in the hashtable of a shard */
+static FileData_t* fmap_find(fs_shard_t* shard, char* key){
+	if (shard->rmap) return rht_find(shard->rmap, key);
+	return icl_hash_find(shard->fmap, key);
+}
+
+
+/* Home bucket (slot of the current table for rhtable) of key in the hashtable of a shard */
+static size_t fmap_bucket(fs_shard_t* shard, char* key){
+	if (shard->rmap) return (size_t)(rht_hash(key) & (shard->rmap->cur.cap - 1));
+	return (size_t)(shard->fmap->hash_function(key) % shard->fmap->nbuckets);
+}
+
+
+/* Prefetches the home bucket of a key (see fmap_bucket) in the cache */
+static void fmap_prefetch(fs_shard_t* shard, size_t bucket){
+	if (shard->rmap) __builtin_prefetch(&shard->rmap->cur.slots[bucket]);
+	else __builtin_prefetch(&shard->fmap->buckets[bucket]);
+}
+
+
+/* Inserts key -> file in the hashtable of a shard, returns 0 on success, -1 on error */
+static int fmap_insert(fs_shard_t* shard, char* key, FileData_t* file){
+	if (shard->rmap) return (rht_insert(shard->rmap, key, file) == 0 ? 0 : -1);
+	return (icl_hash_insert(shard->fmap, key, file) ? 0 : -1);
+}
+
+
+/* Removes key from the hashtable of a shard */
+static int fmap_delete(fs_shard_t* shard, char* key, void (*free_key)(void*), void (*free_data)(void*)){
+	if (shard->rmap) return rht_delete(shard->rmap, key, free_key, free_data);
+	return icl_hash_delete(shard->fmap, key, free_key, free_data);
+}
+
+
+/* Destroys the hashtable of a shard */
+static int fmap_destroy(fs_shard_t* shard, void (*free_key)(void*), void (*free_data)(void*)){
+	int ret = 0;
+	if (shard->rmap) ret = rht_destroy(shard->rmap, free_key, free_data);
+	else if (shard->fmap) ret = icl_hash_destroy(shard->fmap, free_key, free_data);
+	shard->rmap = NULL;
+	shard->fmap = NULL;
+	return ret;
+}
+
+
+/* Initializes an iteration on the hashtable of a shard */
+static void fmap_iter_init(fs_shard_t* shard, fmap_iter_t* it){
+	memset(it, 0, sizeof(*it));
+	it->shard = shard;
+	if (shard->rmap) rht_iter_init(shard->rmap, &it->rit);
+}
+
+
+/* Gets next couple (key, file), returns false when iteration is terminated */
+static bool fmap_iter_next(fmap_iter_t* it, char** key, FileData_t** file){
+	if (it->shard->rmap) return rht_iter_next(&it->rit, key, (void**)file);
+	icl_hash_t* fmap = it->shard->fmap;
+	while (true){
+		if (it->ent){
+			icl_entry_t* curr = it->ent;
+			it->ent = curr->next;
+			if (!curr->key || !curr->data) continue;
+			*key = curr->key;
+			*file = curr->data;
+			return true;
+		}
+		/* Buckets of the new array, then those of the old one NOT moved yet by a resize (if any) */
+		if (it->bucket >= fmap->nbuckets + fmap->oldnbuckets) return false;
+		if (it->bucket < fmap->nbuckets) it->ent = fmap->buckets[it->bucket++];
+		else it->ent = fmap->oldbuckets[it->bucket++ - fmap->nbuckets];
+	}
+}
+
+
+/* Iterates over ALL (key, file) couples of a shard */
+#define fmap_foreach(shard, it, kp, dp) \
+	for (fmap_iter_init(shard, &it); fmap_iter_next(&it, &kp, &dp); )
+
+
+/**
+ * @brief Creates a copy of #pathname for a new entry in the hashtable.
  * @return 0 on success, -1 on error.
  * @note On error, pathcopy and *pathcopy are unmodified.
  * Possible errors are:
@@ -78,145 +212,558 @@ static int make_entry(char* pathname, char** pathcopy){
 
 
 /**
- * @brief Searches in the hash table for the key 'pathname'.
+ * @brief Creates a copy of #pathname for a new key of the file hashtable
+ * (and pathname of the file), allocated by slab_strdup such that it MUST
+ * be freed by slab_strfree.
  * @return 0 on success, -1 on error.
+ * @note On error, pathcopy and *pathcopy are unmodified.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+static int make_key(char* pathname, char** pathcopy){
+	char* p = slab_strdup(pathname);
+	if (!p){ errno = ENOMEM; return -1; }
+	*pathcopy = p;
+	return 0;
+}
+
+
+/**
+ * @brief Gets the shard that contains (or shall contain) #pathname.
+ * @note hash_pjw is "mixed" before taking the modulus, otherwise shard
+ * index and bucket index in the shard hashtable would be correlated.
+ */
+static fs_shard_t* fs_getshard(FileStorage_t* fs, char* pathname){
+	unsigned int h = hash_pjw(pathname) * 2654435761u;
+	return &fs->shards[(h >> 16) % fs->nshards];
+}
+
+
+/**
+ * @brief Searches in the hash table for the key 'pathname'.
+ * @note This function requires (at least) read lock on the shard of pathname.
+ * @return Pointer to file on success, NULL if not found.
  */
 static FileData_t* fs_search(FileStorage_t* fs, char* pathname){
-	return icl_hash_find(fs->fmap, pathname);
+	return fmap_find(fs_getshard(fs, pathname), pathname);
+}
+
+
+/**
+ * @brief Atomically reserves a slot for a new file iff current number of
+ * files is below fs->maxFileNo.
+ * @return true on success, false if file capacity has been reached.
+ */
+static bool fs_reserve_file(FileStorage_t* fs){
+	int n = ATOMIC_GET(&fs->fileno);
+	do {
+		if (n >= fs->maxFileNo) return false;
+	} while (!ATOMIC_CAS(&fs->fileno, &n, n + 1));
+	return true;
+}
+
+
+/**
+ * @return Current occupied space, i.e. the space charged to files plus the
+ * one of the extents shared by deduplication.
+ */
+static size_t fs_used(FileStorage_t* fs){
+	return ATOMIC_GET(&fs->spaceSize) + fdata_sharedBytes();
+}
+
+
+/**
+ * @brief Atomically reserves #size bytes in the storage iff the occupied
+ * space plus size does not exceed fs->storageCap.
+ * @return true on success, false if storage capacity would be exceeded.
+ */
+static bool fs_reserve_space(FileStorage_t* fs, size_t size){
+	size_t s = ATOMIC_GET(&fs->spaceSize);
+	size_t shared = fdata_sharedBytes(); /* Approximated if other files are being deduplicated */
+	do {
+		if (s + shared + size > fs->storageCap) return false;
+	} while (!ATOMIC_CAS(&fs->spaceSize, &s, s + size));
+	return true;
+}
+
+
+/* Atomically updates a statistics maximum */
+static void fs_update_max(int* max, int value){
+	int m = ATOMIC_GET(max);
+	while ((value > m) && !ATOMIC_CAS(max, &m, value));
+}
+
+
+/* As fs_update_max, for a maximum size in bytes */
+static void fs_update_maxsize(size_t* max, size_t value){
+	size_t m = ATOMIC_GET(max);
+	while ((value > m) && !ATOMIC_CAS(max, &m, value));
+}
+
+
+/**
+ * @brief Gets the slot of the per-client index for client, allocating its
+ * page if create == true.
+ * @return Pointer to the slot on success, NULL if client is out of range, or
+ * its page is not allocated and create == false, or on error (ENOMEM).
+ */
+static fs_cfiles_t** fs_cidx_slot(FileStorage_t* fs, int client, bool create){
+	if ((client < 0) || (client >= FS_CIDX_PAGESIZE * FS_CIDX_NPAGES)) return NULL;
+	fs_cfiles_t*** slot = &fs->cidx[client / FS_CIDX_PAGESIZE];
+	fs_cfiles_t** page = ATOMIC_GET(slot);
+	if (!page && create){
+		fs_cfiles_t** newpage = calloc(FS_CIDX_PAGESIZE, sizeof(fs_cfiles_t*));
+		if (!newpage){ errno = ENOMEM; return NULL; }
+		if (ATOMIC_CAS(slot, &page, newpage)) page = newpage;
+		else free(newpage); /* Installed by another thread, page is now set to it */
+	}
+	return (page ? &page[client % FS_CIDX_PAGESIZE] : NULL);
+}
+
+
+/* Marks in the per-client index a client that is being cleaned up (see fs_clientCleanup) */
+static fs_cfiles_t fsDeadMark;
+#define FS_CIDX_DEAD (&fsDeadMark)
+
+
+/* Inserts a copy of pathname in *table (created if NULL) if not already there */
+static int fs_cidx_insert(rhtable_t** table, char* pathname){
+	if (!*table && !(*table = rht_create(RHT_MINCAP))) return -1;
+	if (rht_find(*table, pathname)) return 0;
+	char* key = NULL;
+	if (make_entry(pathname, &key) == -1) return -1;
+	if (rht_insert(*table, key, key) == -1){ free(key); return -1; } /* Data is key itself (NOT NULL for rht_find) */
+	return 0;
+}
+
+
+/* Destroys the files of a client */
+static void fs_cfiles_destroy(fs_cfiles_t* cf){
+	if (cf->files) rht_destroy(cf->files, free, NULL);
+	if (cf->locks) rht_destroy(cf->locks, free, NULL);
+	free(cf);
+}
+
+
+/**
+ * @brief Adds pathname to the files of client in the per-client index (and
+ * to the ones it is locking/waiting for if lock == true).
+ * @note This function MUST be called BEFORE giving any state on the file
+ * to client, such that fs_clientCleanup can NEVER miss it.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: client is out of range;
+ *	- ENOTCONN: client is being cleaned up;
+ *	- ENOMEM: unable to allocate memory.
+ */
+static int fs_cidx_add(FileStorage_t* fs, int client, char* pathname, bool lock){
+	fs_cfiles_t** slot = fs_cidx_slot(fs, client, true);
+	if (!slot){
+		if (errno != ENOMEM) errno = EINVAL;
+		return -1;
+	}
+	int ret = 0;
+	pthread_mutex_t* mtx = &fs->cidxLocks[client % FS_CIDX_LOCKS];
+	LOCK(mtx);
+	if (*slot == FS_CIDX_DEAD){ errno = ENOTCONN; ret = -1; } /* Client is being cleaned up */
+	else if (!*slot && !(*slot = calloc(1, sizeof(fs_cfiles_t)))){ errno = ENOMEM; ret = -1; }
+	if ((ret == 0) && (fs_cidx_insert(&(*slot)->files, pathname) == -1)) ret = -1;
+	if ((ret == 0) && lock && (fs_cidx_insert(&(*slot)->locks, pathname) == -1)) ret = -1;
+	UNLOCK(mtx);
+	return ret;
+}
+
+
+/**
+ * @brief Removes pathname from the files that client is locking/waiting for
+ * in the per-client index, and from ALL its files if all == true.
+ */
+static void fs_cidx_drop(FileStorage_t* fs, int client, char* pathname, bool all){
+	fs_cfiles_t** slot = fs_cidx_slot(fs, client, false);
+	if (!slot) return;
+	pthread_mutex_t* mtx = &fs->cidxLocks[client % FS_CIDX_LOCKS];
+	LOCK(mtx);
+	fs_cfiles_t* cf = *slot;
+	if (cf && (cf != FS_CIDX_DEAD)){
+		if (cf->locks) rht_delete(cf->locks, pathname, free, NULL);
+		if (all && cf->files) rht_delete(cf->files, pathname, free, NULL);
+	}
+	UNLOCK(mtx);
+}
+
+
+/**
+ * @brief Updates the per-client index according to the current state of
+ * client on file, e.g. after it has closed or unlocked it.
+ * @note This function requires (at least) read lock on the shard of pathname.
+ */
+static void fs_cidx_check(FileStorage_t* fs, FileData_t* file, char* pathname, int client){
+	unsigned char flags = fdata_clientFlags(file, client);
+	if (!(flags & (LF_OWNER | LF_WAIT))) fs_cidx_drop(fs, client, pathname, (flags == 0));
+}
+
+
+/**
+ * @brief Detaches the files of client from the per-client index and marks
+ * client as dead until fs_cidx_revive.
+ * @return The files of client (NULL if none) to be destroyed by the caller,
+ * FS_CIDX_DEAD if client is already marked as dead.
+ */
+static fs_cfiles_t* fs_cidx_detach(FileStorage_t* fs, int client){
+	fs_cfiles_t** slot = fs_cidx_slot(fs, client, true);
+	if (!slot) return NULL; /* Out of range (or out of memory): client has NO file */
+	pthread_mutex_t* mtx = &fs->cidxLocks[client % FS_CIDX_LOCKS];
+	LOCK(mtx);
+	fs_cfiles_t* cf = *slot;
+	*slot = FS_CIDX_DEAD;
+	UNLOCK(mtx);
+	return cf;
+}
+
+
+/**
+ * @brief Unmarks client as dead, such that its id can be reused by a new
+ * connection, i.e. when ALL its state has been reclaimed.
+ */
+static void fs_cidx_revive(FileStorage_t* fs, int client){
+	fs_cfiles_t** slot = fs_cidx_slot(fs, client, false);
+	if (!slot) return;
+	pthread_mutex_t* mtx = &fs->cidxLocks[client % FS_CIDX_LOCKS];
+	LOCK(mtx);
+	if (*slot == FS_CIDX_DEAD) *slot = NULL;
+	UNLOCK(mtx);
 }
 
 
 /**
  * @brief Destroys current file and updates storage size of fs.
  * @param fdata -- Pointer to file object to destroy.
- * @param filename -- Absolute path of fdata as contained in fs->fmap.
+ * @param filename -- Absolute path of fdata as contained in its shard hashtable.
  * @note This function requires write lock on fs (this guarantees safe access
- * to fdata->size).
+ * to fdata->stored).
  * @return 0 on success, exits program otherwise (to not delete file is a fatal
  * error that could lead to an inconsistent state).
  */
 static int fs_trash(FileStorage_t* fs, FileData_t* fdata, char* filename){	
-	size_t fsize = fdata->size;
+	FS_LOG(fs, PR_REMOVE, filename, NULL, 0); /* Before filename is freed */
+	size_t fsize = fdata->stored; /* Bytes charged to the storage */
+	bool large = fdata->large;
+	repl_remove(fs->repl, fdata); /* O(1) */
 	 /* Removes mapping from hash table: failure here means that there will be a "phantom" file in fs */
-	SYSCALL_NOTREC(icl_hash_delete(fs->fmap, filename, free, dummy), -1, "fs_trash: while eliminating file from hashtable");
+	SYSCALL_NOTREC(fmap_delete(fs_getshard(fs, filename), filename, slab_strfree, dummy), -1, "fs_trash: while eliminating file from hashtable");
 	SYSCALL_NOTREC(fdata_destroy(fdata), -1, "fs_trash: while eliminating file");
-	fs->spaceSize = fs->spaceSize - fsize;
+	ATOMIC_SUB(&fs->spaceSize, fsize);
+	if (large) ATOMIC_SUB(&fs->largeSpace, fsize);
+	ATOMIC_SUB(&fs->fileno, 1);
 	return 0;
 }
 
 
+/**
+ * @brief Inserts in fs a restored file (NOT existing) named #pathname,
+ * WITHOUT checking file and storage capacities.
+ * @note This function is called ONLY at startup, such that NO lock is needed.
+ * @return 0 on success, -1 on error (by make_key, icl_hash_insert/rht_insert).
+ */
+static int fs_restore_insert(FileStorage_t* fs, char* pathname, FileData_t* file){
+	char* pathcopy = NULL;
+	if (make_key(pathname, &pathcopy) == -1) return -1;
+	if (fmap_insert(fs_getshard(fs, pathname), pathcopy, file) == -1){
+		slab_strfree(pathcopy);
+		return -1;
+	}
+	file->pathname = pathcopy;
+	repl_insert(fs->repl, file);
+	ATOMIC_ADD(&fs->fileno, 1);
+	ATOMIC_ADD(&fs->spaceSize, file->stored);
+	fs_update_max(&fs->maxFileHosted, ATOMIC_GET(&fs->fileno));
+	fs_update_maxsize(&fs->maxSpaceSize, fs_used(fs));
+	return 0;
+}
+
+
+/**
+ * @brief Creates a new (closed and empty) file for restoring the storage.
+ * @return Pointer to file on success, NULL on error (by fdata_create).
+ */
+static FileData_t* fs_restore_create(FileStorage_t* fs, int codec){
+	FileData_t* file = fdata_create(0, false);
+	if (!file) return NULL;
+	file->codec = codec;
+	file->dedup = fs->dedup;
+	fdata_close(file, 0); /* NEVER fails */
+	return file;
+}
+
+
+/**
+ * @brief Callback for persist_load: restores a file of the snapshot, whose
+ * content is served directly from the mapping (see fdata_map).
+ * @return 0 on success, -1 on error.
+ */
+static int fs_restore_file(void* arg, char* pathname, int codec, size_t size, void* data, size_t len){
+	FileStorage_t* fs = arg;
+	if (fs_search(fs, pathname) != NULL){ errno = EBADMSG; return -1; } /* Duplicated file */
+	FileData_t* file = fs_restore_create(fs, codec);
+	if (!file) return -1;
+	if ((fdata_map(file, codec, data, len, size) == -1) || (fs_restore_insert(fs, pathname, file) == -1)){
+		int errno_copy = errno;
+		fdata_destroy(file);
+		errno = errno_copy;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Callback for persist_load: replays a journal record. Records that
+ * do NOT apply to the current state (e.g. an append to a file NOT existing)
+ * are ignored.
+ * @return 0 on success, -1 on error.
+ */
+static int fs_replay(void* arg, int type, char* pathname, void* data, size_t len){
+	FileStorage_t* fs = arg;
+	FileData_t* file = fs_search(fs, pathname);
+	switch (type){
+		case PR_CREATE: {
+			if (file) return 0;
+			if (!(file = fs_restore_create(fs, fs->codec))) return -1;
+			if (fs_restore_insert(fs, pathname, file) == -1){
+				int errno_copy = errno;
+				fdata_destroy(file);
+				errno = errno_copy;
+				return -1;
+			}
+			return 0;
+		}
+		case PR_APPEND: {
+			if (!file || (len == 0)) return 0;
+			ssize_t charged;
+			if (fdata_open(file, 0, false) == -1) return -1;
+			int ret = fdata_write(file, data, len, 0, false, &charged);
+			fdata_close(file, 0);
+			if (ret == -1) return -1;
+			if (charged >= 0) ATOMIC_ADD(&fs->spaceSize, (size_t)charged);
+			else ATOMIC_SUB(&fs->spaceSize, (size_t)(-charged));
+			return 0;
+		}
+		case PR_REMOVE: {
+			if (file) fs_trash(fs, file, file->pathname);
+			return 0;
+		}
+		default: return 0;
+	}
+}
+
+
+/* Callback for the periodic snapshots */
+static int fs_snapshotFn(void* arg){ return fs_snapshot((FileStorage_t*)arg); }
+
+
+/**
+ * @return true <=> the condition for expelling files in #mode (see fs_expel)
+ * still holds after expelling #nfiles files that free #freed bytes.
+ */
+static bool fs_overflow(FileStorage_t* fs, int mode, size_t size, size_t freed, int nfiles){
+	if (mode == R_CREATE) return (ATOMIC_GET(&fs->fileno) - nfiles >= fs->maxFileNo);
+	else if (mode == R_WRITE) return (fs_used(fs) + size > fs->storageCap + freed);
+	else return (ATOMIC_GET(&fs->largeSpace) + size > fs->largeBudget + freed); /* R_LARGE: ALL victims are large */
+}
+
+
 /**
  * @brief Cache replacement algorithm.
- * @note This function requires write-lock on fs parameter.
+ * @note This function requires (global) write-lock on fs parameter.
  * @param client -- Calling client identifier.
  * @param mode -- What to do: if (mode == R_CREATE), the algorithm will expel
  * file(s) until the total number goes below fs fileno capacity; otherwise,
  * if (mode == R_WRITE), the algorithm will expel file(s) until the total
- * space occupied by the remaining + size goes below fs storage capacity.
- * @param size -- Size of the file to write when using R_WRITE mode; it is ignored in R_CREATE mode.
- * @param waitHandler -- Pointer to function that handles files waiting queues
- * by sending back the right messages to corresponding clients.
+ * space occupied by the remaining + size goes below fs storage capacity;
+ * if (mode == R_LARGE), the algorithm will expel ONLY large file(s) until the
+ * space charged to them + size goes below their budget.
+ * @param size -- Size of the file to write when using R_WRITE/R_LARGE mode; it is ignored in R_CREATE mode.
+ * @param largeFirst -- If true, large files are expelled before any other one.
+ * @param exclude -- File that MUST NOT be expelled (e.g. the one being written), can be NULL.
+ * @param waitHandler -- Pointer to function that handles the waiters of files
+ * (see fdata_waiters) by sending back the right messages to corresponding clients.
  * @note waitHandler must be NOT NULL.
- * @param sendBackHandler -- Pointer to function that handles sending back
- * content of a file to the calling client using its connection file descriptor
- * (cfd) and a boolean indicating whether the file has been modified or not 
- * from its last creation in the filesystem.
+ * @param sendBackHandler -- Pointer to function that handles sending back to
+ * the calling client, using its connection file descriptor (cfd), ALL the
+ * expelled files at once (with their content and a boolean indicating whether
+ * each one has been modified or not from its last creation in the filesystem).
  * @note sendBackHandler can be NULL and if so content is rejected.
- * @note waitHandler MUST NOT modify the queue and sendBackHandler MUST NOT 
+ * @note waitHandler MUST NOT modify the waiters and sendBackHandler MUST NOT 
  * modify file content and file size (they will be destroyed after). Analogous
  * requirement applies for sendBackHandler.
- * @return 0 on success, -1 on error, 1 if there is no element in the queue or
- * it is closed.
+ * @note Victims are chosen by fs->repl according to the configured policy:
+ * the whole set of victims is computed at once by the space charged to each
+ * one before expelling any of them, and it is extended ONLY if expelling has
+ * freed less space than expected (i.e. with deduplication).
+ * @return 0 on success, -1 on error, 1 if there is no file to expel.
  * Possible errors are:
- *	- EINVAL: invalid arguments;
- *	- any error by llist_pop.
+ *	- EINVAL: invalid arguments.
  */
-static int fs_replace(FileStorage_t* fs, int client, int mode, size_t size, int (*waitHandler)(int chan, tsqueue_t* waitQueue), 
-	int (*sendBackHandler)(char* pathname, void* content, size_t size, int cfd, bool modified), int chan){
-	if (!waitHandler || (mode != R_CREATE && mode != R_WRITE)){ errno = EINVAL; return -1; }
+static int fs_expel(FileStorage_t* fs, int client, int mode, size_t size, bool largeFirst, FileData_t* exclude,
+	int (*waitHandler)(int chan, fd_waiter_t* waiters), int (*sendBackHandler)(fcontent_t** files, int n, int cfd), int chan){
+	if (!waitHandler || ((mode != R_CREATE) && (mode != R_WRITE) && (mode != R_LARGE))){ errno = EINVAL; return -1; }
 	int ret = 0;
-	char* next;
-	FileData_t* file;
-	bool bcreate = false;
-	bool bwrite = false;
-	tsqueue_t* waitQueue;
-	do {
-		waitQueue = NULL;
-		int pop = tsqueue_pop(fs->replQueue, (void**)&next, true);
-		 /* Either an error occurred and waiting queue is untouched or queue is empty/closed (this error is NOT fatal!) */
-		if (pop != 0) return (pop > 0 ? 1 : -1);
-		/* Filename successfully extracted */
-		printf("\033[1;31mfs_replace:\033[0m filename successfully extracted (type = \033[1;31m%s\033[0m), it is: \033[1;31m%s\033[0m\n",
-			(mode == R_CREATE ? "filecap_overflow" : "storagecap_overflow"), next);
-		file = icl_hash_find(fs->fmap, next);
-		if (!file) return -1; /* File not existing anymore */
-		waitQueue = fdata_waiters(file);
-		if (!waitQueue) return -1; /* An error occurred, waiting queue is untouched (this error is NOT fatal!) */
-		if (sendBackHandler){ /* Passed an handler to send back file content (NULL for fs_create!) */
-			void* file_content = file->data;
-			size_t file_size = file->size;
-			sendBackHandler(next, file_content, file_size, client, (file->flags & O_DIRTY ? true : false) ); /* Errors are ignored (file content and size are untouched) */ //FIXME Sure??
-		}
-		SYSCALL_NOTREC(fs_trash(fs, file, next), -1, NULL); /* Updates automatically spaceSize */
-		free(next); /* Frees key extracted from replQueue */
-		SYSCALL_NOTREC(waitHandler(chan, waitQueue), -1, "fs_replace: waitHandler");
-		/* We CANNOT avoid (at least a) memory leak */
-		SYSCALL_NOTREC(tsqueue_destroy(waitQueue, free), -1, "fs_replace: while destroying waiting queue");
-		fs->evictedFiles++; /* Updates statistics */
-		bcreate = (fs->fmap->nentries >= fs->maxFileNo) && (mode == R_CREATE); /* Conditions to expel a file for creating a new one */
-		bwrite = (fs->spaceSize + size > fs->storageCap) && (mode == R_WRITE); /* Conditions to expel a file for writing into an existing one */
-	} while (bcreate || bwrite);
+	int cls = ((largeFirst || (mode == R_LARGE)) ? RC_LARGE : RC_ANY); /* Class of victims */
+	FileData_t** victims = NULL;
+	int nvictims = 0, capvictims = 0;
+	fcontent_t** expelled = NULL; /* Files to send back */
+	int nexpelled = 0, capexpelled = 0;
+	fd_waiter_t* waiters;
+	while ((ret == 0) && fs_overflow(fs, mode, size, 0, 0)){
+		/* Computes the set of victims */
+		size_t freed = 0;
+		nvictims = 0;
+		while (fs_overflow(fs, mode, size, freed, nvictims)){
+			FileData_t* file = repl_victimOf(fs->repl, cls, exclude);
+			if (!file && (cls == RC_LARGE) && (mode != R_LARGE)){ cls = RC_ANY; continue; } /* No more large files */
+			if (!file) break;
+			if (nvictims == capvictims){
+				int newcap = (capvictims > 0 ? 2 * capvictims : 16);
+				FileData_t** p = realloc(victims, newcap * sizeof(FileData_t*));
+				if (!p) break; /* Expels the victims found so far */
+				victims = p;
+				capvictims = newcap;
+			}
+			repl_remove(fs->repl, file); /* Such that next victim is a different file */
+			victims[nvictims++] = file;
+			freed += file->stored;
+		}
+		if (nvictims == 0){ ret = 1; break; } /* No file to expel (this error is NOT fatal!) */
+		if (sendBackHandler && (nexpelled + nvictims > capexpelled)){
+			fcontent_t** p = realloc(expelled, (nexpelled + nvictims) * sizeof(fcontent_t*));
+			if (p){ expelled = p; capexpelled = nexpelled + nvictims; }
+		}
+		/* Expels ALL the victims */
+		for (int i = 0; i < nvictims; i++){
+			FileData_t* file = victims[i];
+			char* next = file->pathname; /* Key in the hashtable, it is freed by fs_trash */
+			printf("\033[1;31mfs_replace:\033[0m filename successfully extracted (type = \033[1;31m%s\033[0m), it is: \033[1;31m%s\033[0m\n",
+				(mode == R_CREATE ? "filecap_overflow" : (mode == R_WRITE ? "storagecap_overflow" : "largecap_overflow")), next);
+			waiters = fdata_waiters(file);
+			if (sendBackHandler && (nexpelled < capexpelled)){ /* Passed an handler to send back file content (NULL for fs_create!) */
+				fbody_t* file_content;
+				size_t file_size;
+				if (fdata_content(file, &file_content, &file_size) == 0){ /* Decompressed if needed (on error, file is NOT sent back) */
+					fcontent_t* fc = fcontent_init(next, file_size, file_content);
+					if (fc){
+						fc->modified = (file->flags & O_DIRTY ? true : false);
+						expelled[nexpelled++] = fc;
+					} else {
+						perror("fs_replace: while saving expelled file");
+						fbody_release(file_content);
+					}
+				} else perror("fs_replace: while getting content of expelled file");
+			}
+			SYSCALL_NOTREC(fs_trash(fs, file, next), -1, NULL); /* Updates automatically spaceSize and replacement list */
+			SYSCALL_NOTREC(waitHandler(chan, waiters), -1, "fs_replace: waitHandler");
+			fdata_waitersFree(waiters);
+			fs->evictedFiles++; /* Updates statistics */
+		}
+	}
+	int errno_copy = errno;
+	/* Sends back ALL the expelled files in a single batch (errors are ignored) */
+	if (nexpelled > 0) sendBackHandler(expelled, nexpelled, client);
+	for (int i = 0; i < nexpelled; i++) fcontent_destroy(expelled[i]);
+	free(expelled);
+	free(victims);
+	errno = errno_copy;
+	return ret;
+}
+
+
+/**
+ * @brief Executes cache replacement as fs_expel, recording its duration in
+ * the statistics of the calling thread (ST_REPLACE).
+ * @return As fs_expel.
+ */
+static int fs_replace(FileStorage_t* fs, int client, int mode, size_t size, bool largeFirst, FileData_t* exclude,
+	int (*waitHandler)(int chan, fd_waiter_t* waiters), int (*sendBackHandler)(fcontent_t** files, int n, int cfd), int chan){
+	uint64_t start = stats_now();
+	int ret = fs_expel(fs, client, mode, size, largeFirst, exclude, waitHandler, sendBackHandler, chan);
+	int errno_copy = errno;
+	stats_wait(ST_REPLACE, start);
+	errno = errno_copy;
 	return ret;
 }
 
 
+/**
+ * @return true <=> a file that will be #size bytes long (and that is already
+ * large if large == true) belongs to the class of large files.
+ */
+static bool fs_islarge(FileStorage_t* fs, bool large, size_t size){
+	return (fs->largeSize > 0) && (large || (size >= fs->largeSize));
+}
+
+
+/**
+ * @return true <=> a file that will be #size bytes long (and that is already
+ * large if large == true) is rejected, i.e. it is bigger than the maximum
+ * size of a file or (if large) than the budget of large files.
+ */
+static bool fs_rejected(FileStorage_t* fs, bool large, size_t size){
+	bool rejected = ((fs->maxObjSize > 0) && (size > fs->maxObjSize)) || (fs_islarge(fs, large, size) && (size > fs->largeBudget));
+	if (rejected) ATOMIC_ADD(&fs->rejectedFiles, 1);
+	return rejected;
+}
+
+
 /* *********************************** REGISTRATION OPERATIONS ************************************* */
 
 
 /**
- * @brief Initializes a reading operation on the filesystem.
+ * @brief Initializes a reading operation on a shard of the filesystem.
  * @return 0 on success, exits on error.
  * @note This function does NOT change errno value. 
  */
-int fs_rop_init(FileStorage_t* fs){
+static int fs_shard_rop_init(fs_shard_t* fs){
+	uint64_t start = stats_now();
 	LOCK(&fs->gblock);
 	int errno_copy = errno;
 	fs->waiters[0]++;
 	while ((fs->state < 0) || (fs->waiters[1] > 0)){ WAIT(&fs->conds[0], &fs->gblock); }
 	fs->waiters[0]--;
 	fs->state++;
-	errno = errno_copy;
 	UNLOCK(&fs->gblock);
+	stats_wait(ST_ROPWAIT, start);
+	errno = errno_copy;
 	return 0;
 }
 
 
 /**
- * @brief Initializes a writing operation on the filesystem (i.e., it can 
+ * @brief Initializes a writing operation on a shard of the filesystem (i.e., it can 
  * modify which files are stored inside).
  * @return 0 on success, exits on error.
  * @note This function does NOT change errno value. 
  */
-int fs_wop_init(FileStorage_t* fs){
+static int fs_shard_wop_init(fs_shard_t* fs){
+	uint64_t start = stats_now();
 	LOCK(&fs->gblock);
 	int errno_copy = errno;
 	fs->waiters[1]++;
 	while (fs->state != 0){ WAIT(&fs->conds[1], &fs->gblock); }
 	fs->waiters[1]--;
 	fs->state--;
-	errno = errno_copy;
 	UNLOCK(&fs->gblock);
+	stats_wait(ST_WOPWAIT, start);
+	errno = errno_copy;
 	return 0;
 }
 
 
 /**
- * @brief Terminates a writing operation on the filesystem.
+ * @brief Terminates a writing operation on a shard of the filesystem.
  * @return 0 on success, -1 on error (invalid request),
  * exits on fatal error during mutex/condvar handling.
  * @note This function does NOT change errno value. 
  */
-int fs_op_end(FileStorage_t* fs){
+static int fs_shard_op_end(fs_shard_t* fs){
 	int ret = 0;
 	LOCK(&fs->gblock);
 	if (fs->state == -1){
@@ -230,7 +777,7 @@ int fs_op_end(FileStorage_t* fs){
 		else if (fs->waiters[0] > 0){ BCAST(&fs->conds[0]); } /* At least one reader waiting */
 	}
 	UNLOCK(&fs->gblock);
-	return 0;
+	return ret;
 }
 
 
@@ -241,7 +788,7 @@ int fs_op_end(FileStorage_t* fs){
  * mutex or condition variable.
  * @note This function does NOT change errno value. 
  */
-int fs_op_downgrade(FileStorage_t* fs){
+static int fs_shard_op_downgrade(fs_shard_t* fs){
 	LOCK(&fs->gblock);
 	/* Not writer */
 	if (fs->state >= 0){
@@ -255,124 +802,700 @@ int fs_op_downgrade(FileStorage_t* fs){
 }
 
 
+/**
+ * @brief Initializes a reading operation on the WHOLE filesystem by
+ * acquiring all shards in increasing order.
+ * @return 0 on success, exits on error.
+ * @note This function does NOT change errno value.
+ */
+int fs_rop_init(FileStorage_t* fs){
+	for (int i = 0; i < fs->nshards; i++) fs_shard_rop_init(&fs->shards[i]);
+	return 0;
+}
+
+
+/**
+ * @brief Initializes a writing operation on the WHOLE filesystem (e.g. cache
+ * replacement) by acquiring all shards in increasing order.
+ * @return 0 on success, exits on error.
+ * @note This function does NOT change errno value.
+ */
+int fs_wop_init(FileStorage_t* fs){
+	for (int i = 0; i < fs->nshards; i++) fs_shard_wop_init(&fs->shards[i]);
+	return 0;
+}
+
+
+/**
+ * @brief Terminates a global operation on the filesystem.
+ * @return 0 on success, -1 on error (invalid request on any shard).
+ * @note This function does NOT change errno value.
+ */
+int fs_op_end(FileStorage_t* fs){
+	int ret = 0;
+	for (int i = fs->nshards - 1; i >= 0; i--){
+		if (fs_shard_op_end(&fs->shards[i]) == -1) ret = -1;
+	}
+	return ret;
+}
+
+
+/**
+ * @brief Switches the current thread permissions from writing to reading
+ * on ALL shards.
+ * @return 0 on success, -1 on error (request made when there is no active
+ * global writer).
+ * @note This function does NOT change errno value.
+ */
+int fs_op_downgrade(FileStorage_t* fs){
+	int ret = 0;
+	for (int i = 0; i < fs->nshards; i++){
+		if (fs_shard_op_downgrade(&fs->shards[i]) == -1) ret = -1;
+	}
+	return ret;
+}
+
+
+/**
+ * @brief Item of a batched operation (fs_fetchN, fs_putN) on the file #idx of
+ * the batch, with its shard (and NO bucket yet).
+ */
+static fs_bitem_t fs_bitem(FileStorage_t* fs, char* pathname, int idx){
+	fs_bitem_t item = {idx, (int)(fs_getshard(fs, pathname) - fs->shards), 0};
+	return item;
+}
+
+
+/* Orders items by shard, then by bucket and then by position in the batch */
+static int fs_bitem_cmp(const void* p1, const void* p2){
+	const fs_bitem_t* b1 = p1;
+	const fs_bitem_t* b2 = p2;
+	if (b1->shard != b2->shard) return (b1->shard < b2->shard ? -1 : 1);
+	if (b1->bucket != b2->bucket) return (b1->bucket < b2->bucket ? -1 : 1);
+	return (b1->idx < b2->idx ? -1 : (b1->idx > b2->idx ? 1 : 0));
+}
+
+
+/**
+ * @brief Starts a batched operation on the n items of a batch, by acquiring
+ * ONCE the gates of ALL their shards in increasing order (as fs_rop_init and
+ * fs_wop_init, but ONLY for the shards involved) in reading (wop == false) or
+ * writing mode: then home buckets of pathnames are computed (they can change
+ * only while NO gate is held) and items are sorted by them.
+ */
+static void fs_batch_begin(FileStorage_t* fs, char** pathnames, fs_bitem_t* items, int n, bool wop){
+	qsort(items, n, sizeof(fs_bitem_t), fs_bitem_cmp);
+	for (int k = 0; k < n; k++){
+		if ((k > 0) && (items[k].shard == items[k-1].shard)) continue;
+		if (wop) fs_shard_wop_init(&fs->shards[items[k].shard]);
+		else fs_shard_rop_init(&fs->shards[items[k].shard]);
+	}
+	for (int k = 0; k < n; k++) items[k].bucket = fmap_bucket(&fs->shards[items[k].shard], pathnames[items[k].idx]);
+	qsort(items, n, sizeof(fs_bitem_t), fs_bitem_cmp); /* Shards order is unchanged */
+}
+
+
+/* Terminates a batched operation started by fs_batch_begin (gates are released in decreasing order) */
+static void fs_batch_end(FileStorage_t* fs, fs_bitem_t* items, int n){
+	for (int k = n - 1; k >= 0; k--){
+		if ((k < n - 1) && (items[k].shard == items[k+1].shard)) continue;
+		fs_shard_op_end(&fs->shards[items[k].shard]);
+	}
+}
+
+
+/**
+ * @brief Removes ALL data of client from the file identified by pathname
+ * (if it still exists), holding the gate of its shard in reading mode.
+ * The new lock owner (if any) is appended to newowners_list.
+ * @return 0 on success, -1 on error (by fdata_removeClient, or ENOTRECOVERABLE
+ * if it is NOT possible to store the new owner).
+ */
+static int fs_removeClient(FileStorage_t* fs, char* pathname, int client, llist_t** newowners_list){
+	fs_shard_t* shard = fs_getshard(fs, pathname);
+	int newowner = -1;
+	fs_shard_rop_init(shard);
+	FileData_t* file = fs_search(fs, pathname);
+	/* If we don't get to remove all client metadata, there will be an inconsistent state in file */
+	if (file) SHARD_NOTREC_UNLOCK(shard, fdata_removeClient(file, client, &newowner),
+		"fs_clientCleanup: while removing client metadata\n");
+	fs_shard_op_end(shard);
+	if (newowner >= 0){
+		int* n_own = malloc(sizeof(int));
+		/* On failure, we could NOT know who is new owner and send it a success message! */
+		if (!n_own || (llist_push(*newowners_list, n_own) == -1)){
+			perror("fs_clientCleanup: while adding new owner to list");
+			free(n_own);
+			errno = ENOTRECOVERABLE;
+			return -1;
+		}
+		*n_own = newowner;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Visits (at most) FS_SWEEP_BATCH files of a pending reclamation.
+ * @return 1 if ALL its files have been visited, 0 if there are still other
+ * files, -1 on error (by fs_removeClient).
+ */
+static int fs_sweep_batch(FileStorage_t* fs, fs_sweep_t* sw, llist_t** newowners_list){
+	char* filename;
+	char* data;
+	for (int i = 0; i < FS_SWEEP_BATCH; i++){
+		if (!rht_iter_next(&sw->it, &filename, (void**)&data)) return 1;
+		if (fs_removeClient(fs, filename, sw->client, newowners_list) == -1) return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Removes the earliest lock wait from fs->lwaits (that MUST NOT be
+ * empty) into lw in O(log n), holding fs->sweepLock.
+ */
+static void fs_lwait_pop(FileStorage_t* fs, fs_lwait_t* lw){
+	*lw = fs->lwaits[0];
+	/* Sift-down of the last leaf from the root */
+	fs_lwait_t last = fs->lwaits[--fs->nlwaits];
+	int i = 0, child;
+	while ((child = 2 * i + 1) < fs->nlwaits){
+		if ((child + 1 < fs->nlwaits) && (fs->lwaits[child + 1].deadline < fs->lwaits[child].deadline)) child++;
+		if (fs->lwaits[child].deadline >= last.deadline) break;
+		fs->lwaits[i] = fs->lwaits[child];
+		i = child;
+	}
+	fs->lwaits[i] = last;
+}
+
+
+/**
+ * @brief Expires a lock wait whose deadline has passed: if client is still
+ * waiting for the lock (with the same deadline), it is removed from the
+ * waiters and fs->lockExpired is called.
+ * @return 0 on success, -1 on error (by fdata_cancelWait).
+ */
+static int fs_expireWait(FileStorage_t* fs, fs_lwait_t* lw){
+	fs_shard_t* shard = fs_getshard(fs, lw->pathname);
+	int ret = 1;
+	fs_shard_rop_init(shard);
+	FileData_t* file = fs_search(fs, lw->pathname);
+	if (file) ret = fdata_cancelWait(file, lw->client, lw->deadline);
+	fs_shard_op_end(shard);
+	if (ret == 0){ /* Client is NOT waiting anymore, so it can be notified */
+		ATOMIC_ADD(&fs->lockTimeouts, 1);
+		if (fs->lockExpired(fs->sweepArg, lw->client) == -1) perror("fs_sweeper: while notifying expired lock wait");
+	}
+	return (ret == -1 ? -1 : 0);
+}
+
+
+/**
+ * @brief Sweeper: expires the lock waits whose deadline has passed and
+ * reclaims the state left by disconnected clients on their files (i.e.,
+ * open flags) in round-robin among the pending reclamations, yielding after
+ * each batch of FS_SWEEP_BATCH files, and calls fs->sweepDone when a client
+ * has been completely reclaimed.
+ */
+static void* fs_sweeper(void* arg){
+	FileStorage_t* fs = arg;
+	/* Clients being swept are NOT waiting for any lock, so NO one shall be woken up */
+	llist_t* newowners = llist_init();
+	if (!newowners){ perror("fs_sweeper: while creating list"); exit(EXIT_FAILURE); }
+	LOCK(&fs->sweepLock);
+	while (true){
+		while (!fs->sweepHead && !fs->sweeperStop && ((fs->nlwaits == 0) || (fs->lwaits[0].deadline > stats_now()))){
+			if (fs->nlwaits == 0){ WAIT(&fs->sweepCond, &fs->sweepLock); continue; }
+			/* Until the first deadline (condition variable uses CLOCK_REALTIME) */
+			uint64_t now = stats_now();
+			uint64_t delta = (fs->lwaits[0].deadline > now ? fs->lwaits[0].deadline - now : 0);
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += (time_t)(delta / 1000000000ULL);
+			ts.tv_nsec += (long)(delta % 1000000000ULL);
+			if (ts.tv_nsec >= 1000000000L){ ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+			TMDWAIT(&fs->sweepCond, &fs->sweepLock, &ts);
+		}
+		if (fs->sweeperStop) break; /* Pending reclamations are discarded by fs_sweeper_stop */
+		if ((fs->nlwaits > 0) && (fs->lwaits[0].deadline <= stats_now())){ /* Expired waits come first */
+			fs_lwait_t lw;
+			fs_lwait_pop(fs, &lw);
+			UNLOCK(&fs->sweepLock);
+			if (fs_expireWait(fs, &lw) == -1){ perror("fs_sweeper: while expiring lock wait"); exit(EXIT_FAILURE); }
+			free(lw.pathname);
+			LOCK(&fs->sweepLock);
+			continue;
+		}
+		fs_sweep_t* sw = fs->sweepHead;
+		fs->sweepHead = sw->next;
+		if (!fs->sweepHead) fs->sweepTail = NULL;
+		UNLOCK(&fs->sweepLock);
+		int ret = fs_sweep_batch(fs, sw, &newowners);
+		if (ret == -1){ perror("fs_sweeper: while reclaiming client state"); exit(EXIT_FAILURE); }
+		if (ret == 1){
+			rht_destroy(sw->files, free, NULL);
+			fs_cidx_revive(fs, sw->client);
+			if (fs->sweepDone(fs->sweepArg, sw->client) == -1) perror("fs_sweeper: while completing reclamation");
+			free(sw);
+		}
+		sched_yield();
+		LOCK(&fs->sweepLock);
+		if (ret == 0){ /* Back to the tail of the queue */
+			sw->next = NULL;
+			if (fs->sweepTail) fs->sweepTail->next = sw;
+			else fs->sweepHead = sw;
+			fs->sweepTail = sw;
+		}
+	}
+	UNLOCK(&fs->sweepLock);
+	llist_destroy(newowners, free);
+	return NULL;
+}
+
+
+/**
+ * @brief Registers a lock wait of client on pathname that expires at
+ * deadline (see stats_now), such that the sweeper can enforce it, in
+ * O(log n) on the heap of lock waits.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- ENOTSUP: sweeper is NOT running;
+ *	- ENOMEM: unable to allocate memory.
+ */
+static int fs_lwait_add(FileStorage_t* fs, char* pathname, int client, uint64_t deadline){
+	char* path = NULL;
+	if (make_entry(pathname, &path) == -1) return -1;
+	LOCK(&fs->sweepLock);
+	if (!fs->sweeperOn || fs->sweeperStop){
+		UNLOCK(&fs->sweepLock);
+		free(path);
+		errno = ENOTSUP;
+		return -1;
+	}
+	if (fs->nlwaits == fs->lwaitsCap){
+		int cap = (fs->lwaitsCap > 0 ? 2 * fs->lwaitsCap : FS_LWAITS_SIZE);
+		fs_lwait_t* p = realloc(fs->lwaits, cap * sizeof(fs_lwait_t));
+		if (!p){
+			UNLOCK(&fs->sweepLock);
+			free(path);
+			errno = ENOMEM;
+			return -1;
+		}
+		fs->lwaits = p;
+		fs->lwaitsCap = cap;
+	}
+	/* Sift-up from the new leaf */
+	int i = fs->nlwaits++;
+	while ((i > 0) && (fs->lwaits[(i - 1) / 2].deadline > deadline)){
+		fs->lwaits[i] = fs->lwaits[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	fs->lwaits[i].pathname = path;
+	fs->lwaits[i].client = client;
+	fs->lwaits[i].deadline = deadline;
+	if (i == 0) SIGNAL(&fs->sweepCond); /* New first deadline */
+	UNLOCK(&fs->sweepLock);
+	return 0;
+}
+
+
 /* ******************************************* MAIN OPERATIONS ********************************************* */
 
 /**
  * @brief Initializes a FileStorage_t object.
- * @param nbuckets -- Number of buckets for the hashtable.
+ * @param nbuckets -- Number of buckets for the hashtable (shared among shards).
+ * @param nshards -- Number of shards.
  * @param storageCap -- Byte-size storage capacity of fs.
  * @param maxFileNo -- File capacity of fs.
+ * @param replPolicy -- Replacement policy (one of RP_* in replpolicy.h).
+ * @param tableType -- Hashtable implementation for shards (one of FS_TABLE_*).
+ * @param codec -- Codec for compressing file content at rest (one of CODEC_*).
+ * @param dedup -- If true, extents with the same content are shared among
+ * files and charged only once to the storage (see fdata.h).
  * @return A FileStorage_t object pointer on success, NULL on error.
  * Possible errors are:
  *	- EINVAL: invalid arguments;
  *	- ENOMEM: unable to allocate internal data structures;
- *	- any error by pthread_mutex_init/destroy, by tsqueue_init/destroy and by
- *	icl_hash_create.
+ *	- any error by pthread_mutex_init/destroy, by repl_init and by
+ *	icl_hash_create/rht_create.
  */
-FileStorage_t* fs_init(int nbuckets, size_t storageCap, int maxFileNo){
-	if ((storageCap == 0) || (maxFileNo <= 0) || (nbuckets <= 0)){ errno = EINVAL; return NULL; }
+FileStorage_t* fs_init(int nbuckets, int nshards, size_t storageCap, int maxFileNo, int replPolicy, int tableType, int codec, bool dedup){
+	if ((storageCap == 0) || (maxFileNo <= 0) || (nbuckets <= 0) || (nshards <= 0)){ errno = EINVAL; return NULL; }
+	if (!codec_name(codec)){ errno = EINVAL; return NULL; }
+	if ((tableType != FS_TABLE_CHAINED) && (tableType != FS_TABLE_RH)){ errno = EINVAL; return NULL; }
 	FileStorage_t* fs = malloc(sizeof(FileStorage_t));
 	if (!fs) return NULL;
 	memset(fs, 0, sizeof(FileStorage_t));
 	fs->maxFileNo = maxFileNo;
 	fs->storageCap = storageCap;
-	
-	MTX_INIT(&fs->gblock, NULL);
-	CD_INIT(&fs->conds[0], NULL);
-	CD_INIT(&fs->conds[1], NULL);
-	
-	fs->replQueue = tsqueue_init();
-	if (!fs->replQueue){
-		perror("While initializing FIFO replacement queue");
-		MTX_DESTROY(&fs->gblock);
-		CD_DESTROY(&fs->conds[0]);
-		CD_DESTROY(&fs->conds[1]);
+	fs->codec = codec;
+	fs->dedup = dedup;
+	for (int i = 0; i < FS_CIDX_LOCKS; i++) MTX_INIT(&fs->cidxLocks[i], NULL);
+	MTX_INIT(&fs->sweepLock, NULL);
+	CD_INIT(&fs->sweepCond, NULL);
+
+	fs->shards = calloc(nshards, sizeof(fs_shard_t));
+	if (!fs->shards){
 		free(fs);
 		errno = ENOMEM;
 		return NULL;
 	}
-	fs->fmap = icl_hash_create(nbuckets, NULL, NULL);
-	if (!fs->fmap){
-		MTX_DESTROY(&fs->gblock);
-		CD_DESTROY(&fs->conds[0]);
-		CD_DESTROY(&fs->conds[1]);
-		/* Unavoidable memory leak */
-		SYSCALL_NOTREC(tsqueue_destroy(fs->replQueue, dummy), NULL, "fs_init: while destroying FIFO replacement queue after error on initialization");
-		free(fs);
-		errno = ENOMEM;
-		return NULL;
+	fs->nshards = nshards;
+	int shardBuckets = MAX(1, nbuckets/nshards);
+	for (int i = 0; i < nshards; i++){
+		fs_shard_t* shard = &fs->shards[i];
+		if (fmap_create(shard, tableType, shardBuckets) == -1){
+			for (int j = 0; j < i; j++){
+				fmap_destroy(&fs->shards[j], slab_strfree, free);
+				MTX_DESTROY(&fs->shards[j].gblock);
+				MTX_DESTROY(&fs->shards[j].jlock);
+				CD_DESTROY(&fs->shards[j].conds[0]);
+				CD_DESTROY(&fs->shards[j].conds[1]);
+			}
+			free(fs->shards);
+			free(fs);
+			errno = ENOMEM;
+			return NULL;
+		}
+		MTX_INIT(&shard->gblock, NULL);
+		MTX_INIT(&shard->jlock, NULL);
+		CD_INIT(&shard->conds[0], NULL);
+		CD_INIT(&shard->conds[1], NULL);
+	}
+
+	fs->repl = repl_init(replPolicy);
+	if (!fs->repl){
+		int errno_copy = errno;
+		perror("While initializing replacement list");
+		for (int i = 0; i < nshards; i++){
+			fmap_destroy(&fs->shards[i], slab_strfree, free);
+			MTX_DESTROY(&fs->shards[i].gblock);
+			MTX_DESTROY(&fs->shards[i].jlock);
+			CD_DESTROY(&fs->shards[i].conds[0]);
+			CD_DESTROY(&fs->shards[i].conds[1]);
+		}
+		free(fs->shards);
+		free(fs);
+		errno = errno_copy;
+		return NULL;
+	}
+	return fs;
+}
+
+
+/* Wait handler for the files expelled at startup (NO client can be waiting) */
+static int fs_nowaiters(int chan, fd_waiter_t* waiters){ return 0; }
+
+
+/**
+ * @brief Expels restored files by cache replacement (as fs_resize, but in a
+ * single step) until the file and storage capacities of fs hold again, e.g.
+ * when they have been lowered in the configuration before a restart.
+ * @note Removals are logged in the journal, hence the journal MUST be started.
+ * @return 0 on success, -1 on error (by cache replacement).
+ */
+static int fs_restore_fit(FileStorage_t* fs){
+	int ret = 0;
+	fs_wop_init(fs);
+	if (ATOMIC_GET(&fs->fileno) > fs->maxFileNo){
+		fs->maxFileNo++; /* R_CREATE expels until fileno < maxFileNo */
+		ret = fs_replace(fs, -1, R_CREATE, 0, false, NULL, fs_nowaiters, NULL, -1);
+		fs->maxFileNo--;
+	}
+	if ((ret != -1) && (fs_used(fs) > fs->storageCap)) ret = fs_replace(fs, -1, R_WRITE, 0, false, NULL, fs_nowaiters, NULL, -1);
+	fs_op_end(fs);
+	return (ret == -1 ? -1 : 0);
+}
+
+
+/**
+ * @brief Enables persistence of fs in directory #dir: the storage is restored
+ * from the snapshot and the journal found in dir (if any), then ALL the following
+ * modifications are logged (see persist.h).
+ * @note This function MUST be called after fs_init and before ANY other operation.
+ * Files are restored WITHOUT checking file and storage capacities, then the
+ * ones in excess are expelled by cache replacement as the storage was full
+ * (they are NOT sent back to any client).
+ * @param syncms -- Interval in milliseconds between two group commits (<= 0 for default).
+ * @param snapInterval -- Seconds between two snapshots (<= 0 for a snapshot
+ * ONLY at termination, i.e. by fs_destroy).
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments or persistence already enabled;
+ *	- any error by persist_open, persist_load, persist_start and by cache replacement.
+ */
+int fs_persist(FileStorage_t* fs, char* dir, int syncms, int snapInterval){
+	if (!fs || !dir || fs->persist){ errno = EINVAL; return -1; }
+	persist_t* p = persist_open(dir, syncms);
+	if (!p) return -1;
+	fs->persist = p; /* Closed by fs_destroy even on failure */
+	if (persist_load(p, fs_restore_file, fs_replay, fs) == -1) return -1;
+	if (persist_start(p, snapInterval, fs_snapshotFn, fs) == -1) return -1;
+	return fs_restore_fit(fs);
+}
+
+
+/**
+ * @brief Sets the policy of fs for large files:
+ *	- files bigger than #maxSize bytes are rejected (if maxSize > 0);
+ *	- files of at least #threshold bytes (if threshold > 0) are large: the
+ *	space charged to them is at most #budget bytes (storage capacity if
+ *	budget == 0 or budget > storage capacity), and writing on one of them
+ *	expels ONLY other large files for staying within budget. Large files
+ *	are ALSO expelled first when making room in the storage for them.
+ * Files currently in the storage (e.g. restored by fs_persist) are classified
+ * by their current size.
+ * @note This function MUST be called before ANY operation by clients.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: fs is NULL.
+ */
+int fs_largeObjects(FileStorage_t* fs, size_t maxSize, size_t threshold, size_t budget){
+	if (!fs){ errno = EINVAL; return -1; }
+	fmap_iter_t it;
+	char* filename;
+	FileData_t* file;
+	fs_wop_init(fs);
+	fs->maxObjSize = maxSize;
+	fs->largeSize = threshold;
+	fs->largeBudget = (((budget == 0) || (budget > fs->storageCap)) ? fs->storageCap : budget);
+	fs->largeSpace = 0;
+	for (int i = 0; i < fs->nshards; i++){
+		fmap_foreach(&fs->shards[i], it, filename, file){
+			file->large = fs_islarge(fs, false, file->size);
+			repl_reclass(fs->repl, file);
+			if (file->large) fs->largeSpace += file->stored;
+		}
+	}
+	fs_op_end(fs);
+	return 0;
+}
+
+
+/**
+ * @brief Executes a single step for changing the file and storage capacities
+ * of fs to #maxFileNo and #storageCap while it is running, in a single global
+ * critical section. A capacity that is raised (or NOT lower than the current
+ * occupation) is set at once, while a capacity below the current occupation
+ * is lowered by at most FS_RESIZE_FILES files / FS_RESIZE_BYTES bytes per step,
+ * expelling files by cache replacement (they are NOT sent back to any client),
+ * such that other operations are served between two steps and a client that
+ * finds the storage full meanwhile expels only a few files.
+ * When the capacity of the storage is changed, the budget of large files is
+ * lowered to it if needed, and it follows it if it was equal to it.
+ * @param waitHandler -- As for fs_write (for clients waiting on expelled files).
+ * @return 0 if capacities are now the requested ones, 1 if more steps are
+ * needed, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- any error by cache replacement (capacities are anyway those of this step).
+ */
+int fs_resize(FileStorage_t* fs, size_t storageCap, int maxFileNo, int (*waitHandler)(int chan, fd_waiter_t* waiters), int chan){
+	if (!fs || (storageCap == 0) || (maxFileNo <= 0) || !waitHandler){ errno = EINVAL; return -1; }
+	int repl = 0;
+	fs_wop_init(fs);
+	/* File capacity: R_CREATE expels until fileno < maxFileNo, hence it is executed with a capacity of step + 1 */
+	int nfiles = ATOMIC_GET(&fs->fileno);
+	int fstep = (nfiles > maxFileNo + FS_RESIZE_FILES ? nfiles - FS_RESIZE_FILES : maxFileNo);
+	if (fstep < nfiles){
+		fs->maxFileNo = fstep + 1;
+		repl = fs_replace(fs, -1, R_CREATE, 0, false, NULL, waitHandler, NULL, chan);
+		if (repl == 0) fs->resizeCount++;
+	}
+	fs->maxFileNo = fstep;
+	/* Storage capacity */
+	size_t used = fs_used(fs);
+	size_t sstep = (used > storageCap + FS_RESIZE_BYTES ? used - FS_RESIZE_BYTES : storageCap);
+	if (fs->largeBudget == fs->storageCap) fs->largeBudget = sstep;
+	fs->storageCap = sstep;
+	if (fs->largeBudget > sstep) fs->largeBudget = sstep;
+	if ((repl != -1) && (sstep < used)){
+		int r = fs_replace(fs, -1, R_WRITE, 0, (fs->largeSize > 0), NULL, waitHandler, NULL, chan);
+		if (r == 0) fs->resizeCount++;
+		repl = r;
+	}
+	int ret = ((fstep == maxFileNo) && (sstep == storageCap) ? 0 : 1);
+	if (repl == 1) ret = 0; /* No file to expel, capacities are set anyway */
+	if (repl == -1) ret = -1;
+	if (ret == 0){
+		fs->maxFileNo = maxFileNo;
+		if (fs->largeBudget == fs->storageCap) fs->largeBudget = storageCap;
+		fs->storageCap = storageCap;
+		if (fs->largeBudget > storageCap) fs->largeBudget = storageCap;
+	}
+	fs_op_end(fs);
+	return ret;
+}
+
+
+/**
+ * @brief Starts rehashing the hashtable of each shard into nbuckets/nshards
+ * buckets (as fs_init), holding ONLY the gate of that shard for allocating
+ * the new buckets: entries are then moved by fs_rehash_step. A rehash still
+ * in progress is completed first. Shards with a Robin Hood table (that grows
+ * by itself) are untouched.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to allocate memory (following shards are NOT rehashed).
+ */
+int fs_rehash(FileStorage_t* fs, int nbuckets){
+	if (!fs || (nbuckets <= 0)){ errno = EINVAL; return -1; }
+	int shardBuckets = MAX(1, nbuckets/fs->nshards);
+	for (int i = 0; i < fs->nshards; i++){
+		fs_shard_t* shard = &fs->shards[i];
+		if (!shard->fmap) continue;
+		fs_shard_wop_init(shard);
+		int ret = icl_hash_resize(shard->fmap, shardBuckets);
+		fs_shard_op_end(shard);
+		if (ret == -1){ errno = ENOMEM; return -1; }
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Executes a step of the rehashing started by fs_rehash, moving (at
+ * most) FS_REHASH_BUCKETS buckets of each shard holding ONLY the gate of
+ * that shard, such that no operation waits for more than a step.
+ * @return 1 if there are still buckets to move, 0 if rehashing has been
+ * completed (or there is none), -1 on error (EINVAL).
+ */
+int fs_rehash_step(FileStorage_t* fs){
+	if (!fs){ errno = EINVAL; return -1; }
+	int ret = 0;
+	for (int i = 0; i < fs->nshards; i++){
+		fs_shard_t* shard = &fs->shards[i];
+		if (!shard->fmap) continue;
+		fs_shard_wop_init(shard);
+		if (icl_hash_rehash(shard->fmap, FS_REHASH_BUCKETS) == 1) ret = 1;
+		fs_shard_op_end(shard);
+	}
+	return ret;
+}
+
+
+/**
+ * @brief Takes a snapshot of fs: the journal is cut and references to the
+ * content of ALL files are taken within a single global critical section
+ * (NO data is copied), while the snapshot is written outside of it.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: fs is NULL or persistence is NOT active;
+ *	- ENOMEM: unable to allocate memory;
+ *	- any error by persist_snapshot.
+ */
+int fs_snapshot(FileStorage_t* fs){
+	if (!fs || !fs->persist || !fs->persist->started){ errno = EINVAL; return -1; }
+	fmap_iter_t it;
+	char* filename;
+	FileData_t* file;
+	size_t n = 0;
+	fs_wop_init(fs);
+	uint64_t segment = persist_cut(fs->persist);
+	size_t nfiles = (size_t)ATOMIC_GET(&fs->fileno);
+	pr_file_t* files = calloc(nfiles + 1, sizeof(pr_file_t));
+	if (!files){
+		fs_op_end(fs);
+		errno = ENOMEM;
+		return -1;
+	}
+	for (int i = 0; i < fs->nshards; i++){
+		fmap_foreach(&fs->shards[i], it, filename, file){
+			if (n == nfiles) break;
+			if (!(files[n].pathname = strdup(filename))) break;
+			fdata_stored(file, &files[n].body, &files[n].size, &files[n].codec); /* NEVER fails */
+			n++;
+		}
+	}
+	fs_op_end(fs);
+	int ret = 0;
+	if (n < nfiles){ errno = ENOMEM; ret = -1; } /* Snapshot would be incomplete */
+	else ret = persist_snapshot(fs->persist, segment, files, n);
+	int errno_copy = errno;
+	for (size_t i = 0; i < n; i++){
+		free(files[i].pathname);
+		fbody_release(files[i].body);
 	}
-	return fs;
+	free(files);
+	errno = errno_copy;
+	return ret;
 }
 
 
 /**
  * @brief Creates a new file by creating a new FileData_t object and putting it
  * in the hashtable.
+ * @note If file capacity has NOT been reached, ONLY the shard of pathname is
+ * locked, otherwise the global path is taken for executing cache replacement.
  * @param client -- File descriptor of the creator.
  * @return 0 on success, -1 on error.
  * Possible errors are:
  *	- EINVAL: invalid arguments;
  *	- EEXIST: the file is already existing;
- *	- any error by fs_replace, fs_search, fdata_create, make_entry,
- * icl_hash_insert, tsqueue_push. 
+ *	- any error by fs_replace, fs_search, fdata_create, make_key,
+ * icl_hash_insert/rht_insert and by the per-client index (ENOMEM).
  */
-int	fs_create(FileStorage_t* fs, char* pathname, int client, bool locking, int (*waitHandler)(int chan, tsqueue_t* waitQueue), int chan){
+int	fs_create(FileStorage_t* fs, char* pathname, int client, bool locking, int (*waitHandler)(int chan, fd_waiter_t* waiters), int chan){
 	if (!pathname || (client < 0) || !waitHandler){ errno = EINVAL; return -1; }
 	FileData_t* file;
-	bool bcreate = false;
-	
+	fs_shard_t* shard = fs_getshard(fs, pathname);
+	bool global = false; /* true <=> we are in the global path */
+
+	/* Creator has state on the new file (a stale entry is harmless if creation fails) */
+	if (fs_cidx_add(fs, client, pathname, locking) == -1) return -1;
 	/* Create the file separately from file storage */
-	int maxclient = MAX(client, DFL_MAXCLIENT);
-	file = fdata_create(maxclient, client, locking); /* Since this is a new file, it is automatically locked */
+	file = fdata_create(client, locking); /* Since this is a new file, it is automatically locked */
 	if (!file){
 		perror("While creating file");
 		return -1;
 	}
-	char* pathcopy1 = NULL;
-	char* pathcopy2 = NULL;
-	/* Copies entries for inserting in hashtable and queue */
-	if (make_entry(pathname, &pathcopy1) == -1){
-		DELRET_FSCREATE(file, pathcopy1, pathcopy2, "fs_create: while destroying file after failure");
-	}
-	if (make_entry(pathname, &pathcopy2) == -1){
-		DELRET_FSCREATE(file, pathcopy1, pathcopy2, "fs_create: while destroying file after failure");
+	file->codec = fs->codec;
+	file->dedup = fs->dedup;
+	char* pathcopy = NULL;
+	/* Copies entry for inserting in hashtable (it is shared with the replacement list) */
+	if (make_key(pathname, &pathcopy) == -1){
+		DELRET_FSCREATE(file, pathcopy, "fs_create: while destroying file after failure");
 	}
-	
+
 	/* Add file to file storage */
-	fs_wop_init(fs);
+	fs_shard_wop_init(shard);
 	if (fs_search(fs, pathname) != NULL){ /* File already existing */
 		errno = EEXIST;
-		fs_op_end(fs);
-		DELRET_FSCREATE(file, pathcopy1, pathcopy2, "fs_create: while destroying file after failure");
-	} else {
-		bcreate = (fs->fmap->nentries >= fs->maxFileNo);
-		if (bcreate){
-			int repl = fs_replace(fs, client, R_CREATE, 0, waitHandler, NULL, chan);
-			if (repl != 0){ /* Error while expelling files */
+		fs_shard_op_end(shard);
+		DELRET_FSCREATE(file, pathcopy, "fs_create: while destroying file after failure");
+	} else if (!fs_reserve_file(fs)){ /* File capacity reached: global path */
+		fs_shard_op_end(shard);
+		global = true;
+		fs_wop_init(fs);
+		if (fs_search(fs, pathname) != NULL){ /* File created meanwhile */
+			errno = EEXIST;
+			fs_op_end(fs);
+			DELRET_FSCREATE(file, pathcopy, "fs_create: while destroying file after failure");
+		}
+		if (!fs_reserve_file(fs)){ /* Still full (no other thread can reserve now) */
+			int repl = fs_replace(fs, client, R_CREATE, 0, false, NULL, waitHandler, NULL, chan);
+			if ((repl != 0) || !fs_reserve_file(fs)){ /* Error while expelling files */
 				if (repl == -1) perror("While updating cache");
 				fs_op_end(fs);
-				DELRET_FSCREATE(file, pathcopy1, pathcopy2, "fs_create: while destroying file after failure");
+				DELRET_FSCREATE(file, pathcopy, "fs_create: while destroying file after failure");
 			} else { fs->fcap_replCount++; fs->replCount++; }/* Cache replacement has been correctly executed */
-		} /* We don't need to repeat the search here */
+		}
 	}
 	/* Inserts new mapping in the hash table */
-	icl_entry_t* fent = icl_hash_insert(fs->fmap, pathcopy1, file);
-	if (!fent){
-		fs_op_end(fs);
-		DELRET_FSCREATE(file, pathcopy1, pathcopy2, "fs_create: while destroying file after failure");
-	}
-	/* Inserts new file in the replQueue */
-	if (tsqueue_push(fs->replQueue, pathcopy2) == -1){
-		fent->data = NULL; /* No operation performed by free */
-		FS_NOTREC_UNLOCK(fs, icl_hash_delete(fs->fmap, pathcopy1, free, free), "fs_create: while destroying filename in hashtable" );
-		pathcopy1 = NULL; /* No operation performed by free */
-		fs_op_end(fs);
-		DELRET_FSCREATE(file, pathcopy1, pathcopy2, "fs_create: while destroying file after failure");
+	if (fmap_insert(shard, pathcopy, file) == -1){
+		ATOMIC_SUB(&fs->fileno, 1);
+		FS_OP_END(fs, shard, global);
+		DELRET_FSCREATE(file, pathcopy, "fs_create: while destroying file after failure");
 	}
+	/* Links new file in the replacement list (NEVER fails here) */
+	file->pathname = pathcopy;
+	repl_insert(fs->repl, file);
 	/* Updates statistics */
-	fs->maxFileHosted = MAX(fs->maxFileHosted, fs->fmap->nentries);
-	fs_op_end(fs);
+	fs_update_max(&fs->maxFileHosted, ATOMIC_GET(&fs->fileno));
+	FS_LOG(fs, PR_CREATE, pathcopy, NULL, 0);
+	FS_OP_END(fs, shard, global);
 	return 0;
 }
 
@@ -385,27 +1508,34 @@ int	fs_create(FileStorage_t* fs, char* pathname, int client, bool locking, int (
  * Possible errors are:
  *	- EINVAL: invalid arguments;
  *	- ENOENT: file not existing;
- *	- any error by fdata_open and fs_search.
+ *	- any error by fdata_open, fs_search and by the per-client index (ENOMEM).
  */
 int	fs_open(FileStorage_t* fs, char* pathname, int client, bool locking){
 	if (!pathname || (client < 0)){ errno = EINVAL; return -1; }
 	FileData_t* file;
+	fs_shard_t* shard = fs_getshard(fs, pathname);
 	int ret = 0;
-	fs_rop_init(fs);
+	fs_shard_rop_init(shard);
 	file = fs_search(fs, pathname);
 	if (!file){ /* File not existing */
-		fs_op_end(fs);
+		repl_miss(fs->repl);
+		fs_shard_op_end(shard);
 		errno = ENOENT;
 		return -1;
 	}
+	if (fs_cidx_add(fs, client, pathname, locking) == -1){
+		fs_shard_op_end(shard);
+		return -1;
+	}
 	ret = fdata_open(file, client, locking);
-	fs_op_end(fs);
+	repl_access(fs->repl, file);
+	fs_shard_op_end(shard);
 	return ret;
 }
 
 
 /**
- * @brief Closes an open file for 'client'. 
+ * @brief Closes an open file for 'client'.
  * @return 0 on success, -1 on error.
  * Possible errors are:
  *	- EINVAL: invalid arguments;
@@ -415,27 +1545,29 @@ int	fs_open(FileStorage_t* fs, char* pathname, int client, bool locking){
 int	fs_close(FileStorage_t* fs, char* pathname, int client){
 	if (!pathname || (client < 0)){ errno = EINVAL; return -1; }
 	FileData_t* file;
-	fs_rop_init(fs);
+	fs_shard_t* shard = fs_getshard(fs, pathname);
+	fs_shard_rop_init(shard);
 	file = fs_search(fs, pathname);
 	if (!file){ /* File not existing */
-		fs_op_end(fs);
+		fs_shard_op_end(shard);
 		errno = ENOENT;
 		return -1;
 	}
 	int ret = fdata_close(file, client);
-	fs_op_end(fs);
+	if (ret == 0) fs_cidx_check(fs, file, pathname, client);
+	fs_shard_op_end(shard);
 	return ret;
 }
 
 
 /**
- * @brief Reads file 'pathname' into the pointer buf.
- * @param buf -- Address of a (void*) variable that does NOT point to any
- * already allocated memory (it shall be overwritten on success) and that 
- * shall contain a copy of file content.
+ * @brief Gets a reference to the content of file 'pathname' WITHOUT copying it.
+ * @param body -- Address of a (fbody_t*) variable that shall contain the
+ * reference to file content (NULL for an empty file), which MUST be released
+ * with fbody_release.
  * @param size -- Address of a (size_t) variable that shall contain size of
  * file content.
- * @note On error, (*)buf and (*)size are NOT valid.
+ * @note On error, (*)body and (*)size are NOT valid.
  * @return 0 on success, -1 on error.
  * Possible errors are:
  *	- EINVAL: invalid arguments;
@@ -443,27 +1575,30 @@ int	fs_close(FileStorage_t* fs, char* pathname, int client){
  *	- EBUSY: file is locked by another client;
  *	- any error by fs_search and fdata_read.
  */
-int	fs_read(FileStorage_t* fs, char* pathname, void** buf, size_t* size, int client){
-	if (!pathname || !buf || !size || (client < 0)){ errno = EINVAL; return -1; }
+int	fs_read(FileStorage_t* fs, char* pathname, fbody_t** body, size_t* size, int client){
+	if (!pathname || !body || !size || (client < 0)){ errno = EINVAL; return -1; }
 	FileData_t* file;
-	fs_rop_init(fs);
+	fs_shard_t* shard = fs_getshard(fs, pathname);
+	fs_shard_rop_init(shard);
 	file = fs_search(fs, pathname);
 	if (!file){ /* File not existing */
+		repl_miss(fs->repl);
 		errno = ENOENT;
-		fs_op_end(fs);
+		fs_shard_op_end(shard);
 		return -1;
 	}
-	int ret = fdata_read(file, buf, size, client, false);
-	fs_op_end(fs);
+	int ret = fdata_read(file, body, size, client, false);
+	if (ret == 0) repl_access(fs->repl, file);
+	fs_shard_op_end(shard);
 	return ret;
 }
 
 
 /**
- * @brief If N <= 0, reads ALL files in the server in that moment, else if 
+ * @brief If N <= 0, reads ALL files in the server in that moment, else if
  * N > 0 reads MIN(N, #{files in the server}) files and makes them available
  * as couples <size, content> in results.
- * @param results -- Pointer to an ALREADY initialized linkedlist of 
+ * @param results -- Pointer to an ALREADY initialized linkedlist of
  * fcontent_t objects.
  * @return 0 on success, -1 on error, exits on fatal error.
  * Possible errors are:
@@ -473,49 +1608,143 @@ int	fs_read(FileStorage_t* fs, char* pathname, void** buf, size_t* size, int cli
 int	fs_readN(FileStorage_t* fs, int client, int N, llist_t** results){
 	if (!results || (client < 0)){ errno = EINVAL; return -1; }
 
-	int tmpint = 0;
-	icl_entry_t* tmpent;
+	fmap_iter_t it;
 	char* filename;
 	FileData_t* file;
 	fcontent_t* fc;
-	void* buf;
+	fbody_t* buf;
 	size_t size;
 	fs_rop_init(fs);
-	if ((N <= 0) || (N > fs->fmap->nentries)) N = fs->fmap->nentries;
+	int fileno = ATOMIC_GET(&fs->fileno);
+	if ((N <= 0) || (N > fileno)) N = fileno;
 	int i = 0;
-	icl_hash_foreach(fs->fmap, tmpint, tmpent, filename, file){
+	for (int k = 0; k < fs->nshards; k++){
 		if (i >= N) break;
-		int read_ret = fdata_read(file, &buf, &size, client, true);
-		if (read_ret != 0){
-			if (errno = ENOTRECOVERABLE){
+		fmap_foreach(&fs->shards[k], it, filename, file){
+			if (i >= N) break;
+			int read_ret = fdata_read(file, &buf, &size, client, true);
+			if (read_ret != 0){
+				if (errno = ENOTRECOVERABLE){
+					fs_op_end(fs);
+					return -1;
+				}
+				continue;
+			}
+			fc = fcontent_init(filename, size, buf);
+			if (!fc){
+				fbody_release(buf);
+				perror("fs_readN: while creating struct for hosting file data\n");
+				fs_op_end(fs);
+				return -1; /* List could be partially filled and this is "ok" */
+			}
+			if (llist_push(*results, fc) == -1){
+				perror("fs_readN: while pushing file data onto result list\n");
+				fcontent_destroy(fc);
 				fs_op_end(fs);
 				return -1;
 			}
-			continue;
+			i++; /* File successfully read */
 		}
-		fc = fcontent_init(filename, size, buf);
-		if (!fc){
-			perror("fs_readN: while creating struct for hosting file data\n");
-			fs_op_end(fs);
-			return -1; /* List could be partially filled and this is "ok" */
-		}
-		if (llist_push(*results, fc) == -1){
-			perror("fs_readN: while pushing file data onto result list\n");
-			fcontent_destroy(fc);
-			fs_op_end(fs);
-			return -1;
-		}
-		i++; /* File successfully read */
 	}
 	fs_op_end(fs);
 	return 0;
 }
 
 
+/**
+ * @brief Initializes a cursor for reading (streaming) N files as in fs_readN,
+ * but WITHOUT reading them: ONLY a snapshot of (at most N) pathnames is taken,
+ * by holding the read gate of one shard at a time.
+ * @note The memory footprint of the cursor is bounded by the pathnames, and
+ * NO gate is held after returning.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to allocate memory.
+ */
+int	fs_cursor_init(FileStorage_t* fs, int N, fs_cursor_t* cursor){
+	if (!fs || !cursor){ errno = EINVAL; return -1; }
+	memset(cursor, 0, sizeof(*cursor));
+	int fileno = ATOMIC_GET(&fs->fileno);
+	if ((N <= 0) || (N > fileno)) N = fileno;
+	if (N == 0) return 0;
+	cursor->keys = calloc(N, sizeof(char*));
+	if (!cursor->keys){ errno = ENOMEM; return -1; }
+	fmap_iter_t it;
+	char* filename;
+	FileData_t* file;
+	for (int k = 0; (k < fs->nshards) && (cursor->nkeys < N); k++){
+		fs_shard_rop_init(&fs->shards[k]);
+		fmap_foreach(&fs->shards[k], it, filename, file){
+			if (cursor->nkeys >= N) break;
+			if (make_entry(filename, &cursor->keys[cursor->nkeys]) == -1){
+				fs_shard_op_end(&fs->shards[k]);
+				fs_cursor_destroy(cursor);
+				return -1;
+			}
+			cursor->nkeys++;
+		}
+		fs_shard_op_end(&fs->shards[k]);
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Gets a reference to the content of the next file of the cursor as
+ * in fs_read, but ignoring whether it is open or locked (as fs_readN) and by
+ * holding ONLY the read gate of its shard. Files removed or expelled after the
+ * snapshot are skipped.
+ * @param filename -- Address of a (char*) variable that shall contain the
+ * pathname of the file (owned by cursor).
+ * @param body, size -- As in fs_read.
+ * @return 0 on success, 1 if there are no more files, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- any (fatal) error by fdata_read.
+ */
+int	fs_cursor_next(FileStorage_t* fs, fs_cursor_t* cursor, int client, char** filename, fbody_t** body, size_t* size){
+	if (!fs || !cursor || (client < 0) || !filename || !body || !size){ errno = EINVAL; return -1; }
+	while (cursor->next < cursor->nkeys){
+		char* pathname = cursor->keys[cursor->next++];
+		fs_shard_t* shard = fs_getshard(fs, pathname);
+		fs_shard_rop_init(shard);
+		FileData_t* file = fs_search(fs, pathname);
+		int ret = (file ? fdata_read(file, body, size, client, true) : 1);
+		fs_shard_op_end(shard);
+		if (ret == 0){
+			*filename = pathname;
+			return 0;
+		} else if ((ret == -1) && (errno == ENOTRECOVERABLE)) return -1;
+	}
+	return 1;
+}
+
+
+/**
+ * @brief Destroys the pathnames snapshot of a cursor.
+ */
+void fs_cursor_destroy(fs_cursor_t* cursor){
+	if (!cursor) return;
+	for (int i = 0; i < cursor->nkeys; i++) free(cursor->keys[i]);
+	free(cursor->keys);
+	memset(cursor, 0, sizeof(*cursor));
+}
+
+
 /**
  * @brief Appends content of buf to file 'pathname', or writes the entire file
  * content in buf to it. In the latter case, this functions fails if LF_WRITE
  * is NOT set for the calling client.
+ * @note If the space for buf can be reserved without exceeding storage capacity,
+ * ONLY the shard of pathname is locked, otherwise the global path is taken for
+ * executing cache replacement.
+ * @note If storage has a codec or deduplicates content, the space for buf is
+ * reserved as it is and the bytes saved are given back after writing.
+ * @note Writes on large files (see fs_largeObjects) ALWAYS take the global
+ * path and are executed within it: make room within the budget of large
+ * files expels ONLY other large files, and then making room in the storage
+ * expels other large files before any other one.
  * @param buf -- Pointer to memory area containing data to write.
  * @param size -- byte-size of memory area poitned by buf.
  * @param wr -- Boolean that distinguishes between higher-level writeFile and
@@ -531,76 +1760,511 @@ int	fs_readN(FileStorage_t* fs, int client, int N, llist_t** results){
  * Possible errors are:
  *	- EINVAL: invalid arguments;
  *	- ENOENT: file not existing;
- *	- EFBIG: buffer size is greater than storage max capacity;
+ *	- EFBIG: buffer size is greater than storage max capacity, or file would
+ *	be bigger than the maximum size of a file or than the budget of large files;
  *	- EBADF: when wr == true, file cannot be entirely written (i.e., LF_WRITE
  *	is NOT set for the calling client);
+ *	- ENOSPC: there is no file to expel for making room to buf;
  *	- any error by fs_search and fdata_write.
  */
 int	fs_write(FileStorage_t* fs, char* pathname, void* buf, size_t size, int client, bool wr,
-	int (*waitHandler)(int chan, tsqueue_t* waitQueue), int (*sendBackHandler)(char* pathname, void* content, size_t size, int cfd, bool modified), int chan){
-	
+	int (*waitHandler)(int chan, fd_waiter_t* waiters), int (*sendBackHandler)(fcontent_t** files, int n, int cfd), int chan){
+
 	if (!pathname || !buf || (size < 0) || (client < 0) || !waitHandler){ errno = EINVAL; return -1; }
-	bool bwrite;
-	fs_wop_init(fs);
+	fs_shard_t* shard = fs_getshard(fs, pathname);
+	bool global = false; /* true <=> we are in the global path */
+	fs_shard_rop_init(shard);
 	FileData_t* file = fs_search(fs, pathname);
 	if (!file){ /* File not existing */
 		errno = ENOENT;
-		fs_op_end(fs);
+		fs_shard_op_end(shard);
 		return -1;
-	} else {
-		if (size > fs->storageCap){ /* Buffer too much big to be hosted in the storage */
-			errno = EFBIG;
+	}
+	if ((size > fs->storageCap) || fs_rejected(fs, file->large, file->size + size)){ /* Buffer too much big to be hosted in the storage */
+		errno = EFBIG;
+		fs_shard_op_end(shard);
+		return -1;
+	}
+	bool large = fs_islarge(fs, file->large, file->size + size);
+	if (large || !fs_reserve_space(fs, size)){ /* Large file or storage capacity would be exceeded: global path */
+		fs_shard_op_end(shard);
+		global = true;
+		fs_wop_init(fs);
+		int repl = 0;
+		if (large && (file = fs_search(fs, pathname))){ /* File can have been removed meanwhile (see below) */
+			size_t lsize = size + (file->large ? 0 : file->stored); /* Space to be charged to large files */
+			if (ATOMIC_GET(&fs->largeSpace) + lsize > fs->largeBudget){
+				repl = fs_replace(fs, client, R_LARGE, lsize, true, file, waitHandler, sendBackHandler, chan);
+				if (repl == 0){ fs->lcap_replCount++; fs->replCount++; }
+			}
+		}
+		if ((repl == 0) && !fs_reserve_space(fs, size)){ /* Still full (no other thread can reserve now) */
+			repl = fs_replace(fs, client, R_WRITE, size, large, (large ? file : NULL), waitHandler, sendBackHandler, chan);
+			if ((repl == 0) && !fs_reserve_space(fs, size)) repl = 1;
+			if (repl == 0){ fs->scap_replCount++; fs->replCount++; }/* Correct execution of cache replacement */
+		}
+		if (repl != 0){ /* Error while expelling files */
+			if (repl == -1) perror("While updating cache");
+			else errno = ENOSPC;
 			fs_op_end(fs);
 			return -1;
 		}
-		bwrite = (fs->spaceSize + size > fs->storageCap); /* These values are NOT modified (only ONE modifier at a time) */
-		if (bwrite){
-			int repl = fs_replace(fs, client, R_WRITE, size, waitHandler, sendBackHandler, chan);
-			if (repl != 0){ /* Error while expelling files */
-				if (repl == -1) perror("While updating cache");
-				fs_op_end(fs);
-				return -1;
-			} else { fs->scap_replCount++; fs->replCount++; }/* Correct execution of cache replacement */
-		}
-		fs_op_downgrade(fs); /* From "writer" to "reader" */
+		if (!large) fs_op_downgrade(fs); /* From "writer" to "reader" (large files are written as "writer") */
 		/* Here we need to repeat the search because the file can have been expelled by the replacement algorithm */
 		file = fs_search(fs, pathname);
 		if (!file){
+			ATOMIC_SUB(&fs->spaceSize, size);
 			errno = ENOENT;
 			fs_op_end(fs);
 			return -1;
 		}
-	 	if (fdata_write(file, buf, size, client, wr) == -1){
-	 		perror("While writing on file");
-	 		fs_op_end(fs);
- 			return -1;
-	 	} else fs->spaceSize += size; /* La scrittura è andata a buon fine e aggiorniamo lo spazio totale occupato (nessun altro lo sta leggendo) */
-	 	fs->maxSpaceSize = MAX(fs->spaceSize, fs->maxSpaceSize); /* Updates statistics */
-		fs_op_end(fs); /* Se non siamo usciti dalla funzione dobbiamo rilasciare la read-lock */
 	}
+	/* Now space for buf is reserved */
+	ssize_t charged;
+	size_t stored = file->stored; /* Before writing (ONLY for large files) */
+	/* Writes on the same shard can be concurrent (rop): their records must be logged in execution order */
+	if (fs->persist) LOCK(&shard->jlock);
+ 	if (fdata_write(file, buf, size, client, wr, &charged) == -1){
+ 		perror("While writing on file");
+		if (fs->persist) UNLOCK(&shard->jlock);
+ 		ATOMIC_SUB(&fs->spaceSize, size);
+ 		FS_OP_END(fs, shard, global);
+		return -1;
+ 	}
+	if (size > 0) FS_LOG(fs, PR_APPEND, pathname, buf, size);
+	if (fs->persist) UNLOCK(&shard->jlock);
+	if (charged < (ssize_t)size) ATOMIC_SUB(&fs->spaceSize, (size_t)((ssize_t)size - charged)); /* Compressed or shared data */
+	else if (charged > (ssize_t)size) ATOMIC_ADD(&fs->spaceSize, (size_t)(charged - (ssize_t)size)); /* Frame headers or copy-on-append */
+	if (large){ /* NO other thread is operating on the storage */
+		ATOMIC_ADD(&fs->largeSpace, file->stored - (file->large ? stored : 0));
+		file->large = true;
+		repl_reclass(fs->repl, file);
+	}
+ 	repl_access(fs->repl, file);
+ 	fs_update_maxsize(&fs->maxSpaceSize, fs_used(fs)); /* Updates statistics */
+	FS_OP_END(fs, shard, global); /* Se non siamo usciti dalla funzione dobbiamo rilasciare la read-lock */
+	return 0;
+}
+
+
+/**
+ * @brief Builds a new file for fs_put, filled with buf and closed OUTSIDE the
+ * storage (NO lock is needed), and a copy of #pathname for its key.
+ * @param pathcopy -- Address of a (char*) variable that shall contain the key.
+ * @param charged -- Address of a (size_t) variable that shall contain the space
+ * to be charged to the storage (shared extents excluded).
+ * @return The new file on success, NULL on error (nothing to free).
+ * Possible errors are:
+ *	- EFBIG: content is greater than storage max capacity, or than the
+ *	maximum size of a file;
+ *	- any error by fdata_create, fdata_write, make_key.
+ */
+static FileData_t* fs_put_build(FileStorage_t* fs, char* pathname, void* buf, size_t size, int client, char** pathcopy, size_t* charged){
+	FileData_t* file = fdata_create(client, false);
+	if (!file) return NULL;
+	file->codec = fs->codec;
+	file->dedup = fs->dedup;
+	char* key = NULL;
+	ssize_t written = 0;
+	if ((size > 0) && (fdata_write(file, buf, size, client, false, &written) == -1)){
+		DELNULL_FSPUT(file, key, "fs_put: while destroying file after failure");
+	}
+	/* Whole (possibly compressed) content must fit, even if some extents are shared with other files */
+	if (((file->body ? file->body->size : 0) > fs->storageCap) || fs_rejected(fs, false, size)){
+		errno = EFBIG;
+		DELNULL_FSPUT(file, key, "fs_put: while destroying file after failure");
+	}
+	fdata_close(file, client); /* NEVER fails, client has NO state on the stored file */
+	if (make_key(pathname, &key) == -1){
+		DELNULL_FSPUT(file, key, "fs_put: while destroying file after failure");
+	}
+	*pathcopy = key;
+	*charged = (size_t)written;
+	return file;
+}
+
+
+/**
+ * @brief Links a file built by fs_put_build into the storage, once a file
+ * slot and the space for it have been reserved (the gate of its shard MUST
+ * be held in writing mode, or the global one for a large file).
+ * @param rawsize -- Size of the content (buf) of the file, for the journal.
+ * @param size -- Space charged to the storage (see fs_put_build).
+ * @return 0 on success, -1 on error (reservations are given back).
+ */
+static int fs_put_link(FileStorage_t* fs, fs_shard_t* shard, FileData_t* file, char* pathcopy, void* buf, size_t rawsize, size_t size, bool large){
+	if (fmap_insert(shard, pathcopy, file) == -1){
+		ATOMIC_SUB(&fs->fileno, 1);
+		ATOMIC_SUB(&fs->spaceSize, size);
+		return -1;
+	}
+	file->pathname = pathcopy;
+	if (large){ /* Global path */
+		file->large = true;
+		ATOMIC_ADD(&fs->largeSpace, size);
+	}
+	repl_insert(fs->repl, file); /* In the list of its class */
+	/* Updates statistics */
+	fs_update_max(&fs->maxFileHosted, ATOMIC_GET(&fs->fileno));
+	fs_update_maxsize(&fs->maxSpaceSize, fs_used(fs));
+	FS_LOG(fs, PR_CREATE, pathcopy, NULL, 0);
+	if (rawsize > 0) FS_LOG(fs, PR_APPEND, pathcopy, buf, rawsize);
+	return 0;
+}
+
+
+/**
+ * @brief Inserts a file built by fs_put_build (see fs_put), which is
+ * destroyed on error together with pathcopy.
+ */
+static int fs_put_insert(FileStorage_t* fs, FileData_t* file, char* pathcopy, void* buf, size_t rawsize, size_t size, int client,
+	int (*waitHandler)(int chan, fd_waiter_t* waiters), int (*sendBackHandler)(fcontent_t** files, int n, int cfd), int chan){
+
+	fs_shard_t* shard = fs_getshard(fs, pathcopy);
+	bool global = false; /* true <=> we are in the global path */
+	bool fres = false, sres = false; /* true <=> file slot / space has been reserved */
+
+	fs_shard_wop_init(shard);
+	if (fs_search(fs, pathcopy) != NULL){ /* File already existing */
+		errno = EEXIST;
+		fs_shard_op_end(shard);
+		DELRET_FSCREATE(file, pathcopy, "fs_put: while destroying file after failure");
+	}
+	bool large = fs_islarge(fs, false, rawsize);
+	fres = fs_reserve_file(fs);
+	sres = fres && !large && fs_reserve_space(fs, size);
+	if (!sres){ /* Large file, file or storage capacity reached: global path */
+		fs_shard_op_end(shard);
+		global = true;
+		fs_wop_init(fs);
+		int error = 0;
+		if (fs_search(fs, pathcopy) != NULL) error = EEXIST; /* File created meanwhile */
+		if (!error && !fres && !(fres = fs_reserve_file(fs))){ /* Still full (no other thread can reserve now) */
+			int repl = fs_replace(fs, client, R_CREATE, 0, false, NULL, waitHandler, NULL, chan);
+			if ((repl != 0) || !(fres = fs_reserve_file(fs))){ /* Error while expelling files */
+				if (repl == -1) perror("While updating cache");
+				error = (repl == -1 ? errno : ENOSPC);
+			} else { fs->fcap_replCount++; fs->replCount++; }
+		}
+		if (!error && large && (ATOMIC_GET(&fs->largeSpace) + size > fs->largeBudget)){
+			int repl = fs_replace(fs, client, R_LARGE, size, true, NULL, waitHandler, sendBackHandler, chan);
+			if (repl != 0){
+				if (repl == -1) perror("While updating cache");
+				error = (repl == -1 ? errno : ENOSPC);
+			} else { fs->lcap_replCount++; fs->replCount++; }
+		}
+		if (!error && !(sres = fs_reserve_space(fs, size))){
+			int repl = fs_replace(fs, client, R_WRITE, size, large, NULL, waitHandler, sendBackHandler, chan);
+			if ((repl != 0) || !(sres = fs_reserve_space(fs, size))){
+				if (repl == -1) perror("While updating cache");
+				error = (repl == -1 ? errno : ENOSPC);
+			} else { fs->scap_replCount++; fs->replCount++; }
+		}
+		if (error){
+			if (fres) ATOMIC_SUB(&fs->fileno, 1);
+			if (sres) ATOMIC_SUB(&fs->spaceSize, size);
+			fs_op_end(fs);
+			errno = error;
+			DELRET_FSCREATE(file, pathcopy, "fs_put: while destroying file after failure");
+		}
+	}
+	/* Now both a file slot and space for buf are reserved */
+	if (fs_put_link(fs, shard, file, pathcopy, buf, rawsize, size, large) == -1){
+		FS_OP_END(fs, shard, global);
+		DELRET_FSCREATE(file, pathcopy, "fs_put: while destroying file after failure");
+	}
+	FS_OP_END(fs, shard, global);
 	return 0;
 }
 
 
+/**
+ * @brief Compound operation equivalent to {openFile(O_CREATE | O_LOCK),
+ * writeFile, closeFile, unlockFile} made by #client on a NOT existing file:
+ * the new file is built and filled with buf OUTSIDE the storage (hence NO other
+ * client can see it in an intermediate state) and then it is inserted within
+ * a SINGLE critical section with a single search in the hashtable.
+ * @note If both a slot for a new file and the space for buf can be reserved,
+ * ONLY the shard of pathname is locked, otherwise the global path is taken for
+ * executing cache replacement (as in fs_create and fs_write).
+ * @param buf -- Pointer to memory area containing file content (can be NULL
+ * iff size == 0).
+ * @param waitHandler, sendBackHandler -- As in fs_write; as in fs_create, files
+ * expelled for reaching file capacity are NOT sent back.
+ * @note A large file (see fs_largeObjects) is ALWAYS inserted by the global
+ * path, making room for it as in fs_write.
+ * @note Since content is compressed (and deduplicated) BEFORE reserving space,
+ * ONLY compressed size is required to be below storage capacity, while ONLY the
+ * extents NOT shared with other files are charged to the storage.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- EEXIST: the file is already existing;
+ *	- EFBIG: buffer size is greater than storage max capacity, or than the
+ *	maximum size of a file or the budget of large files;
+ *	- ENOSPC: there is no file to expel for making room to the new one;
+ *	- any error by fs_replace, fdata_create, fdata_write, make_key,
+ * icl_hash_insert/rht_insert.
+ */
+int	fs_put(FileStorage_t* fs, char* pathname, void* buf, size_t size, int client,
+	int (*waitHandler)(int chan, fd_waiter_t* waiters), int (*sendBackHandler)(fcontent_t** files, int n, int cfd), int chan){
+
+	if (!pathname || (!buf && (size > 0)) || (client < 0) || !waitHandler){ errno = EINVAL; return -1; }
+	char* pathcopy;
+	size_t charged;
+	FileData_t* file = fs_put_build(fs, pathname, buf, size, client, &pathcopy, &charged);
+	if (!file) return -1;
+	return fs_put_insert(fs, file, pathcopy, buf, size, charged, client, waitHandler, sendBackHandler, chan);
+}
+
+/**
+ * @brief Batched fs_put of #n NOT existing files by #client: ALL the files are
+ * built OUTSIDE the storage and then the ones for which a file slot and space
+ * can be reserved are inserted within a SINGLE acquisition of the write gates
+ * of their shards, with lookups sorted by home bucket and prefetched (see
+ * fs_bitem_t) and insertions in order of batch. Large files and files for which
+ * file or storage capacity has been reached are then inserted one at a time as
+ * in fs_put.
+ * @param bufs, sizes -- Arrays of n elements with the content of each file
+ * (bufs[i] can be NULL iff sizes[i] == 0).
+ * @param errs -- Array of n elements that shall contain 0 for each file stored
+ * and the error as in fs_put for the other ones.
+ * @param waitHandler, sendBackHandler -- As in fs_put.
+ * @return Number of files stored on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to allocate memory;
+ *	- ENOTRECOVERABLE: fatal error while destroying a file NOT stored.
+ */
+int	fs_putN(FileStorage_t* fs, char** pathnames, void** bufs, size_t* sizes, int n, int* errs, int client,
+	int (*waitHandler)(int chan, fd_waiter_t* waiters), int (*sendBackHandler)(fcontent_t** files, int n, int cfd), int chan){
+
+	if (!pathnames || !bufs || !sizes || (n < 0) || !errs || (client < 0) || !waitHandler){ errno = EINVAL; return -1; }
+	for (int i = 0; i < n; i++){
+		if (!pathnames[i] || (!bufs[i] && (sizes[i] > 0))){ errno = EINVAL; return -1; }
+	}
+	if (n == 0) return 0;
+	FileData_t** files = calloc(n, sizeof(FileData_t*));
+	char** keys = calloc(n, sizeof(char*));
+	size_t* charged = calloc(n, sizeof(size_t));
+	bool* reserved = calloc(n, sizeof(bool)); /* reserved[i] <=> a file slot and space have been reserved in the batch */
+	fs_bitem_t* items = malloc(n * sizeof(fs_bitem_t));
+	if (!files || !keys || !charged || !reserved || !items){
+		free(files);
+		free(keys);
+		free(charged);
+		free(reserved);
+		free(items);
+		errno = ENOMEM;
+		return -1;
+	}
+	int m = 0; /* Number of files built */
+	bool fatal = false;
+	for (int i = 0; i < n; i++){
+		files[i] = fs_put_build(fs, pathnames[i], bufs[i], sizes[i], client, &keys[i], &charged[i]);
+		if (files[i]) items[m++] = fs_bitem(fs, keys[i], i);
+		else if ((errs[i] = errno) == ENOTRECOVERABLE) fatal = true;
+	}
+	int nput = 0;
+	fs_batch_begin(fs, keys, items, m, true);
+	for (int k = 0; k < m; k++){ /* Lookups and reservations in order of bucket */
+		FS_BATCH_PREFETCH(fs, items, k, m);
+		int i = items[k].idx;
+		errs[i] = 0;
+		if (fmap_find(&fs->shards[items[k].shard], keys[i]) != NULL){ errs[i] = EEXIST; continue; } /* File already existing */
+		if (fs_islarge(fs, false, sizes[i]) || !fs_reserve_file(fs)) continue; /* Global path */
+		if (!fs_reserve_space(fs, charged[i])){ /* Global path */
+			ATOMIC_SUB(&fs->fileno, 1);
+			continue;
+		}
+		reserved[i] = true;
+	}
+	for (int i = 0; i < n; i++){ /* Insertions in order of batch (e.g. for FIFO replacement) */
+		if (!reserved[i]) continue;
+		fs_shard_t* shard = fs_getshard(fs, keys[i]);
+		if (fmap_find(shard, keys[i]) != NULL){ /* Same pathname earlier in the batch */
+			ATOMIC_SUB(&fs->fileno, 1);
+			ATOMIC_SUB(&fs->spaceSize, charged[i]);
+			errs[i] = EEXIST;
+		} else if (fs_put_link(fs, shard, files[i], keys[i], bufs[i], sizes[i], charged[i], false) == -1){
+			errs[i] = errno;
+		} else {
+			files[i] = NULL; /* Now owned by the storage */
+			keys[i] = NULL;
+			nput++;
+		}
+	}
+	fs_batch_end(fs, items, m);
+	for (int i = 0; i < n; i++){ /* In order of batch */
+		if (!files[i]) continue; /* Stored or NOT built */
+		if (errs[i] != 0){ /* NOT stored */
+			slab_strfree(keys[i]);
+			if (fdata_destroy(files[i]) == -1){
+				perror("fs_putN: while destroying file after failure");
+				fatal = true;
+			}
+		} else if (fs_put_insert(fs, files[i], keys[i], bufs[i], sizes[i], charged[i], client, waitHandler, sendBackHandler, chan) == 0){
+			nput++;
+		} else if ((errs[i] = errno) == ENOTRECOVERABLE) fatal = true;
+	}
+	free(files);
+	free(keys);
+	free(charged);
+	free(reserved);
+	free(items);
+	if (fatal){ errno = ENOTRECOVERABLE; return -1; }
+	return nput;
+}
+
+
+/**
+ * @brief Executes {open, read, close} on #file for client, as in fs_fetch (the
+ * gate of its shard MUST be held in reading mode).
+ * @return 0 on success, -1 on error.
+ */
+static int fs_fetchfile(FileStorage_t* fs, FileData_t* file, fbody_t** body, size_t* size, int client){
+	int ret = fdata_open(file, client, false);
+	if (ret == 0){
+		ret = fdata_read(file, body, size, client, false);
+		int errno_copy = errno;
+		if ((fdata_close(file, client) == -1) && (ret == 0)){
+			fbody_release(*body);
+			ret = -1;
+		} else errno = errno_copy;
+	}
+	if (ret == 0) repl_access(fs->repl, file);
+	return ret;
+}
+
+
+/**
+ * @brief Compound operation equivalent to {openFile(0), readFile, closeFile}
+ * made by #client, executed within a SINGLE read critical section on the shard
+ * of pathname with a single search in the hashtable.
+ * @param body, size -- As in fs_read.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOENT: file not existing;
+ *	- EBUSY: file is locked by another client;
+ *	- any error by fdata_open, fdata_read and fdata_close.
+ */
+int	fs_fetch(FileStorage_t* fs, char* pathname, fbody_t** body, size_t* size, int client){
+	if (!pathname || !body || !size || (client < 0)){ errno = EINVAL; return -1; }
+	FileData_t* file;
+	fs_shard_t* shard = fs_getshard(fs, pathname);
+	fs_shard_rop_init(shard);
+	file = fs_search(fs, pathname);
+	if (!file){ /* File not existing */
+		repl_miss(fs->repl);
+		errno = ENOENT;
+		fs_shard_op_end(shard);
+		return -1;
+	}
+	int ret = fs_fetchfile(fs, file, body, size, client);
+	fs_shard_op_end(shard);
+	return ret;
+}
+
+
+/**
+ * @brief Batched fs_fetch of #n files by #client, executed within a SINGLE
+ * acquisition of the read gates of their shards, with lookups sorted by home
+ * bucket and prefetched (see fs_bitem_t).
+ * @param bodies, sizes -- Arrays of n elements that shall contain the results
+ * of each fetch as in fs_fetch (bodies[i] is NULL for an empty or NOT read file).
+ * @param errs -- Array of n elements that shall contain 0 for each file read
+ * and the error as in fs_fetch (ENOENT, EBUSY) for the other ones.
+ * @return Number of files read on success, -1 on error (NO reference to file
+ * content is held).
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to allocate memory;
+ *	- ENOTRECOVERABLE: fatal error by fdata_open, fdata_read or fdata_close.
+ */
+int	fs_fetchN(FileStorage_t* fs, char** pathnames, int n, fbody_t** bodies, size_t* sizes, int* errs, int client){
+	if (!pathnames || (n < 0) || !bodies || !sizes || !errs || (client < 0)){ errno = EINVAL; return -1; }
+	for (int i = 0; i < n; i++){
+		if (!pathnames[i]){ errno = EINVAL; return -1; }
+		bodies[i] = NULL;
+		sizes[i] = 0;
+	}
+	if (n == 0) return 0;
+	fs_bitem_t* items = malloc(n * sizeof(fs_bitem_t));
+	if (!items){ errno = ENOMEM; return -1; }
+	for (int i = 0; i < n; i++) items[i] = fs_bitem(fs, pathnames[i], i);
+	fs_batch_begin(fs, pathnames, items, n, false);
+	int nread = 0;
+	bool fatal = false;
+	for (int k = 0; (k < n) && !fatal; k++){
+		FS_BATCH_PREFETCH(fs, items, k, n);
+		int i = items[k].idx;
+		FileData_t* file = fmap_find(&fs->shards[items[k].shard], pathnames[i]);
+		if (!file){ /* File not existing */
+			repl_miss(fs->repl);
+			errs[i] = ENOENT;
+		} else if (fs_fetchfile(fs, file, &bodies[i], &sizes[i], client) == 0){
+			errs[i] = 0;
+			nread++;
+		} else {
+			errs[i] = errno;
+			fatal = (errno == ENOTRECOVERABLE);
+			bodies[i] = NULL;
+			sizes[i] = 0;
+		}
+	}
+	fs_batch_end(fs, items, n);
+	free(items);
+	if (fatal){
+		for (int i = 0; i < n; i++){
+			fbody_release(bodies[i]);
+			bodies[i] = NULL;
+		}
+		errno = ENOTRECOVERABLE;
+		return -1;
+	}
+	return nread;
+}
+
+
 /**
  * @brief Sets O_LOCK global flags to the file identified by #pathname and
  * LF_OWNER for #client. If LF_OWNER is already set then it returns 0, else if
  * O_LOCK is not set, it sets it and returns 0, else it returns 1.
+ * @param msec -- If > 0, maximum waiting time (in milliseconds) for the lock,
+ * after which client is removed from the waiters and the sweeper notifies it
+ * (see fs_sweeper_start); if 0, client waits indefinitely.
  * @return 0 on success, -1 on error, 1 if file is locked by another client.
  * Possible errors are:
  * 	- EINVAL: invalid arguments;
  *	- ENOENT: file does not exist;
- *	- any error by fdata_lock and fs_search.
+ *	- ENOTSUP: msec > 0 but sweeper is NOT running;
+ *	- any error by fdata_lock, fs_search and by the per-client index (ENOMEM).
  */
-int fs_lock(FileStorage_t* fs, char* pathname, int client){
-	if (!pathname || (client < 0)){ errno = EINVAL; return -1; }
+int fs_lock(FileStorage_t* fs, char* pathname, int client, int msec){
+	if (!pathname || (client < 0) || (msec < 0)){ errno = EINVAL; return -1; }
+	uint64_t deadline = (msec > 0 ? stats_now() + (uint64_t)msec * 1000000ULL : 0);
 	FileData_t* file;
+	fs_shard_t* shard = fs_getshard(fs, pathname);
 	int res;
-	fs_rop_init(fs);		
+	fs_shard_rop_init(shard);
 	file = fs_search(fs, pathname);
-	if (!file){ fs_op_end(fs); errno = ENOENT; return -1; }
-	res = fdata_lock(file, client);
-	fs_op_end(fs);
+	if (!file){ fs_shard_op_end(shard); errno = ENOENT; return -1; }
+	if (fs_cidx_add(fs, client, pathname, true) == -1){
+		fs_shard_op_end(shard);
+		return -1;
+	}
+	res = fdata_lock(file, client, deadline);
+	fs_shard_op_end(shard);
+	/* If the wait CANNOT be registered, it is expired immediately (client is NOT notified by the sweeper) */
+	if ((res == 1) && (deadline > 0) && (fs_lwait_add(fs, pathname, client, deadline) == -1)){
+		int errno_copy = errno;
+		fs_shard_rop_init(shard);
+		file = fs_search(fs, pathname);
+		int cancel = (file ? fdata_cancelWait(file, client, deadline) : 0);
+		fs_shard_op_end(shard);
+		if (cancel == 0){ errno = errno_copy; return -1; } /* Otherwise, lock has been acquired (or file removed) meanwhile: client shall be notified as usual */
+	}
 	return res;
 }
 
@@ -609,6 +2273,7 @@ int fs_lock(FileStorage_t* fs, char* pathname, int client){
  * @brief Resets the O_LOCK flag to the file identified by pathname. This
  * operation completes successfully iff client is the current owner of the
  * O_LOCK flag.
+ * @param newowner -- As for fdata_unlock.
  * @return 0 on success, -1 on error.
  * Possible errors are:
  *	- EINVAL: invalid arguments;
@@ -616,19 +2281,21 @@ int fs_lock(FileStorage_t* fs, char* pathname, int client){
  *	- EPERM: calling client CANNOT unlock file;
  *	- any error by fdata_unlock and fs_search.
  */
-int fs_unlock(FileStorage_t* fs, char* pathname, int client, llist_t** newowner){
+int fs_unlock(FileStorage_t* fs, char* pathname, int client, int* newowner){
 	if (!pathname || (client < 0) || !newowner){ errno = EINVAL; return -1; }
 	FileData_t* file;
+	fs_shard_t* shard = fs_getshard(fs, pathname);
 	int res;
-	fs_rop_init(fs);
+	fs_shard_rop_init(shard);
 	file = fs_search(fs, pathname);
 	if (!file){
-		fs_op_end(fs);
+		fs_shard_op_end(shard);
 		errno = ENOENT;
 		return -1;
 	}
 	res = fdata_unlock(file, client, newowner); //FIXME La fdata_unlock NON si completa!
-	fs_op_end(fs);
+	if (res == 0) fs_cidx_check(fs, file, pathname, client);
+	fs_shard_op_end(shard);
 	if (res == 1){ errno = EPERM; res = -1; }
 	return res;
 }
@@ -642,78 +2309,164 @@ int fs_unlock(FileStorage_t* fs, char* pathname, int client, llist_t** newowner)
  *	- EINVAL: invalid arguments;
  *	- ENOENT: file does not exist;
  *	- EPERM: calling client CANNOT remove file;
- *	- any error by FileData_trash, icl_hash_delete, fs_search, tsqueue_iter_*.
+ *	- any error by FileData_trash, fs_search.
  */
-int fs_remove(FileStorage_t* fs, char* pathname, int client, int (*waitHandler)(int chan, tsqueue_t* waitQueue), int chan){
+int fs_remove(FileStorage_t* fs, char* pathname, int client, int (*waitHandler)(int chan, fd_waiter_t* waiters), int chan){
 	if (!pathname || (client < 0) || !waitHandler){ errno = EINVAL; return -1; }
 	FileData_t* file;
+	fs_shard_t* shard = fs_getshard(fs, pathname);
 	int ret = 0;
-	tsqueue_t* waitQueue = NULL;
-	
-	fs_wop_init(fs);
+	fd_waiter_t* waiters = NULL;
+
+	fs_shard_wop_init(shard);
 	file = fs_search(fs, pathname);
-	if (!file){ fs_op_end(fs); errno = ENOENT; return -1; }
-	if (file->clients[client] & LF_OWNER){ /* File is locked by calling client */
-		waitQueue = fdata_waiters(file);
-		if (!waitQueue){ /* waiting queue is untouched, operation fails with a (non necessarily) fatal error */
-			fs_op_end(fs);
-			return -1;
-		}
-		SYSCALL_NOTREC(waitHandler(chan, waitQueue), -1, "fs_remove: waitHandler");
-		/* Unavoidable memory leak */
-		FS_NOTREC_UNLOCK(fs, tsqueue_destroy(waitQueue, free), "fs_remove: while destroying waiting queue");
+	if (!file){ fs_shard_op_end(shard); errno = ENOENT; return -1; }
+	if (fdata_clientFlags(file, client) & LF_OWNER){ /* File is locked by calling client */
+		waiters = fdata_waiters(file);
+		SYSCALL_NOTREC(waitHandler(chan, waiters), -1, "fs_remove: waitHandler");
+		fdata_waitersFree(waiters);
 		/* "Phantom" file */
-		FS_NOTREC_UNLOCK(fs, fs_trash(fs, file, pathname), "fs_remove: while destroying file"); /* Updates spaceSize automatically */
-		char* pathcopy;
-		int res1, res2;
-		/* Removes filename from the replacement queue: failure here means possible aliasing with future files */
-		FS_NOTREC_UNLOCK(fs, tsqueue_iter_init(fs->replQueue), "fs_remove: while initializing iteration on replacement queue\n");
-		while (true){
-			FS_NOTREC_UNLOCK(fs, (res1 = tsqueue_iter_next(fs->replQueue, (void**)&pathcopy)), "fs_remove: while iterating on replacement queue\n");
-			if (res1 != 0) break;
-			if (!pathcopy) continue;
-			if ( strequal(pathname, pathcopy) ){
-				if ((res2 = tsqueue_iter_remove(fs->replQueue, (void**)&pathcopy)) == -1){ /* queue is untouched */
-					FS_NOTREC_UNLOCK(fs, tsqueue_iter_end(fs->replQueue), "fs_remove: while terminating iteration on queue");
-					errno = ENOTRECOVERABLE; /* "Phantom" filename in replacement queue */
-					fs_op_end(fs);
-					return -1;
-				} else if (res2 == 0) free(pathcopy);
-				break;
-			}
-		}
-		FS_NOTREC_UNLOCK(fs, tsqueue_iter_end(fs->replQueue), "fs_remove: while ending iteration on waiting queue");
+		SHARD_NOTREC_UNLOCK(shard, fs_trash(fs, file, pathname), "fs_remove: while destroying file"); /* Updates spaceSize and replacement list automatically */
 	} else {
 		errno = EPERM;
 		ret = -1;
 	}
-	fs_op_end(fs);
+	fs_shard_op_end(shard);
+	if (ret == 0) fs_cidx_drop(fs, client, pathname, true);
 	return ret;
 }
 
 
 /**
- * @brief Cleanups old data from a list of closed connections.
+ * @brief Cleanups old data from a list of closed connections, i.e. releases
+ * ALL the locks of client (handing them to the next waiters, if any) and
+ * removes it from ALL the waiting queues, and then reclaims its remaining
+ * state on the other files:
+ *	- by the sweeper, if it is running (see fs_sweeper_start);
+ *	- immediately, otherwise.
+ * @note ONLY the files in the per-client index of client are visited, one
+ * at a time and holding the gate of their shard in reading mode (as for any
+ * other operation on a single file), since client is NOT connected anymore
+ * and there is no need to see a consistent state of the whole storage.
+ * Files removed (or recreated) meanwhile are simply skipped (or untouched).
+ * @note While client is being reclaimed by the sweeper, its id MUST NOT be
+ * reused (i.e., its connection MUST NOT be closed until fs->sweepDone).
  * @param newowners -- Pointer to an ALREADY initialized linkedlist in which
  * woken up clients shall be put.
- * @return 0 on success, -1 on error.
+ * @return 0 on success, 1 if the connection of client shall NOT be closed
+ * yet, since its remaining state shall be reclaimed by the sweeper (or
+ * client is being cleaned up by a concurrent call), -1 on error.
  * Possible errors are:
- *	- EINVAL: invalid arguments.
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: the sweeper has been started and it is NOT possible to allocate
+ *	memory for a new reclamation (state of client has been already reclaimed).
  */
 int	fs_clientCleanup(FileStorage_t* fs, int client, llist_t** newowners_list){
 	if (!newowners_list || (client < 0)) { errno = EINVAL; return -1; }
+	fs_cfiles_t* cf = fs_cidx_detach(fs, client);
+	if (cf == FS_CIDX_DEAD) return 1; /* Concurrent cleanup (e.g., by a failed lock handoff) */
+	ATOMIC_ADD(&fs->cleanupCount, 1);
+	if (!cf){ fs_cidx_revive(fs, client); return 0; }
 	char* filename;
-	FileData_t* file;
-	int tmpint;
-	icl_entry_t* tmpent;
-	fs_wop_init(fs); /* Here there will NOT be any other using any file */
-	icl_hash_foreach(fs->fmap, tmpint, tmpent, filename, file){
-		/* If we don't get to remove all client metadata, there will be an inconsistent state in file */
-		FS_NOTREC_UNLOCK(fs, fdata_removeClient(file, client, newowners_list),
-			"fs_clientCleanup: while removing client metadata\n");
-	}
-	fs->cleanupCount++; /* Cleanup has been correctly executed */
-	fs_op_end(fs);
+	char* data;
+	rht_iter_t it;
+	if (cf->locks){ /* Locks are released immediately, such that waiters do NOT wait for the sweeper */
+		rht_foreach(cf->locks, it, filename, data){
+			if (fs_removeClient(fs, filename, client, newowners_list) == -1){ fs_cfiles_destroy(cf); return -1; }
+		}
+	}
+	if (!cf->files){
+		fs_cfiles_destroy(cf);
+		fs_cidx_revive(fs, client);
+		return 0;
+	}
+	fs_sweep_t* sw = NULL;
+	LOCK(&fs->sweepLock);
+	if (fs->sweeperOn && !fs->sweeperStop && (sw = malloc(sizeof(fs_sweep_t)))){
+		sw->client = client;
+		sw->files = cf->files;
+		cf->files = NULL;
+		rht_iter_init(sw->files, &sw->it);
+		sw->next = NULL;
+		if (fs->sweepTail) fs->sweepTail->next = sw;
+		else fs->sweepHead = sw;
+		fs->sweepTail = sw;
+		SIGNAL(&fs->sweepCond);
+	}
+	UNLOCK(&fs->sweepLock);
+	if (sw){ fs_cfiles_destroy(cf); return 1; }
+	/* Sweeper NOT running (or out of memory): state is reclaimed immediately */
+	int ret = 0;
+	rht_foreach(cf->files, it, filename, data){
+		if ((ret = fs_removeClient(fs, filename, client, newowners_list)) == -1) break;
+	}
+	fs_cfiles_destroy(cf);
+	fs_cidx_revive(fs, client);
+	return ret;
+}
+
+
+/**
+ * @brief Starts the sweeper, i.e. a thread that reclaims in background the
+ * state of the clients passed to fs_clientCleanup that is NOT needed by other
+ * clients (i.e., everything but locks and waiting queues), and that expires
+ * the lock waits with a timeout (see fs_lock).
+ * @param done -- Function called (by the sweeper) with (arg, client) when
+ * ALL the state of client has been reclaimed, e.g. for closing its connection.
+ * @param expired -- Function called (by the sweeper) with (arg, client) when
+ * the lock wait of client has expired, i.e. client is NOT waiting anymore
+ * and it shall be notified (e.g., with ETIMEDOUT).
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments or sweeper already started;
+ *	- any error by pthread_create.
+ */
+int fs_sweeper_start(FileStorage_t* fs, int (*done)(void* arg, int client), int (*expired)(void* arg, int client), void* arg){
+	if (!fs || !done || !expired){ errno = EINVAL; return -1; }
+	LOCK(&fs->sweepLock);
+	if (fs->sweeperOn){ UNLOCK(&fs->sweepLock); errno = EINVAL; return -1; }
+	fs->sweepDone = done;
+	fs->lockExpired = expired;
+	fs->sweepArg = arg;
+	fs->sweeperStop = false;
+	int r = pthread_create(&fs->sweeper, NULL, fs_sweeper, fs);
+	if (r == 0) fs->sweeperOn = true;
+	UNLOCK(&fs->sweepLock);
+	if (r != 0){ errno = r; return -1; }
+	return 0;
+}
+
+
+/**
+ * @brief Stops the sweeper (if running) and discards ALL the pending
+ * reclamations and lock waits with a timeout, for which fs->sweepDone and
+ * fs->lockExpired are NOT called: this is safe ONLY when the storage is going
+ * to be destroyed.
+ * @return 0 on success, -1 on error (fs == NULL).
+ */
+int fs_sweeper_stop(FileStorage_t* fs){
+	if (!fs){ errno = EINVAL; return -1; }
+	LOCK(&fs->sweepLock);
+	if (!fs->sweeperOn){ UNLOCK(&fs->sweepLock); return 0; }
+	fs->sweeperStop = true;
+	SIGNAL(&fs->sweepCond);
+	UNLOCK(&fs->sweepLock);
+	pthread_join(fs->sweeper, NULL);
+	LOCK(&fs->sweepLock);
+	while (fs->sweepHead){
+		fs_sweep_t* sw = fs->sweepHead;
+		fs->sweepHead = sw->next;
+		rht_destroy(sw->files, free, NULL);
+		free(sw);
+	}
+	fs->sweepTail = NULL;
+	for (int i = 0; i < fs->nlwaits; i++) free(fs->lwaits[i].pathname);
+	free(fs->lwaits);
+	fs->lwaits = NULL;
+	fs->nlwaits = 0;
+	fs->lwaitsCap = 0;
+	fs->sweeperOn = false;
+	UNLOCK(&fs->sweepLock);
 	return 0;
 }
 
@@ -723,33 +2476,54 @@ int	fs_clientCleanup(FileStorage_t* fs, int client, llist_t** newowners_list){
  * @return 0 on success, -1 on error.
  * Possible errors are:
  *	- EINVAL: invalid arguments;
- *	- any error by pthread_mutex_destroy, llist_destroy and icl_hash_destroy.
+ *	- any error by pthread_mutex_destroy, repl_destroy and icl_hash_destroy/rht_destroy.
  * @note This function sets to NULL and frees ALL files, and so it MUST be
  * executed when there is no other thread accessing filesystem.
  */
 int	fs_destroy(FileStorage_t* fs){
 	if (!fs){ errno = EINVAL; return -1; }
-	
+
+	fs_sweeper_stop(fs); /* No sweeper shall visit files destroyed below */
+	if (fs->persist && fs->persist->started){ /* Final snapshot: at restart, NO journal needs to be replayed */
+		persist_stopSnapshots(fs->persist);
+		if (fs_snapshot(fs) == -1) perror("fs_destroy: while taking final snapshot");
+	}
 	fs_wop_init(fs);
-	int tmpint;
-	icl_entry_t* tmpent;
+	fmap_iter_t it;
 	char* filename;
 	FileData_t* file;
-	icl_hash_foreach(fs->fmap, tmpint, tmpent, filename, file){
-		tmpent->data = NULL;
-		/* Unavoidable memory leak */
-		SYSCALL_NOTREC(fdata_destroy(file), -1, "fs_destroy: while destroying files");
-	}
-	/* No operation is performed on NULL pointers by free */
-	SYSCALL_NOTREC(icl_hash_destroy(fs->fmap, free, free), -1, "fs_destroy: while destroying file-hashtable");
-	/* Unavoidable memory leak */
-	SYSCALL_NOTREC(tsqueue_destroy(fs->replQueue, free), -1, "fs_destroy: while destroying replacement queue");
+	for (int i = 0; i < fs->nshards; i++){
+		fmap_foreach(&fs->shards[i], it, filename, file){
+			/* Unavoidable memory leak */
+			SYSCALL_NOTREC(fdata_destroy(file), -1, "fs_destroy: while destroying files");
+		}
+		/* Files have been already destroyed, so ONLY keys are freed */
+		SYSCALL_NOTREC(fmap_destroy(&fs->shards[i], slab_strfree, NULL), -1, "fs_destroy: while destroying file-hashtable");
+	}
+	SYSCALL_NOTREC(repl_destroy(fs->repl), -1, "fs_destroy: while destroying replacement list");
 	fs_op_end(fs);
-	
-	MTX_DESTROY(&fs->gblock);
-	CD_DESTROY(&fs->conds[0]);
-	CD_DESTROY(&fs->conds[1]);
-	
+	/* Files loaded from the snapshot do NOT use its mapping anymore */
+	if (fs->persist) persist_close(fs->persist);
+
+	for (int i = 0; i < fs->nshards; i++){
+		MTX_DESTROY(&fs->shards[i].gblock);
+		MTX_DESTROY(&fs->shards[i].jlock);
+		CD_DESTROY(&fs->shards[i].conds[0]);
+		CD_DESTROY(&fs->shards[i].conds[1]);
+	}
+	free(fs->shards);
+
+	for (int i = 0; i < FS_CIDX_NPAGES; i++){
+		if (!fs->cidx[i]) continue;
+		for (int j = 0; j < FS_CIDX_PAGESIZE; j++){
+			if (fs->cidx[i][j] && (fs->cidx[i][j] != FS_CIDX_DEAD)) fs_cfiles_destroy(fs->cidx[i][j]);
+		}
+		free(fs->cidx[i]);
+	}
+	for (int i = 0; i < FS_CIDX_LOCKS; i++) MTX_DESTROY(&fs->cidxLocks[i]);
+	MTX_DESTROY(&fs->sweepLock);
+	CD_DESTROY(&fs->sweepCond);
+
 	memset(fs, 0, sizeof(FileStorage_t));
 	free(fs); //FIXME Sure memset + free?
 	return 0;
@@ -765,45 +2539,78 @@ int	fs_destroy(FileStorage_t* fs){
 void fs_dumpfile(FileStorage_t* fs, char* pathname){ /* Equivalent to a fdata_printout to the file identified by 'pathname' */
 	if (!pathname){ errno = EINVAL; return; }
 	FileData_t* file;
-	fs_rop_init(fs);
+	fs_shard_t* shard = fs_getshard(fs, pathname);
+	fs_shard_rop_init(shard);
 	file = fs_search(fs, pathname);
 	if (!file) printf("File '%s' not found\n", pathname);
 	else {
 		printf("File '%s':\n", pathname);
 		fdata_printout(file);
 	}
-	fs_op_end(fs);	
+	fs_shard_op_end(shard);
 }
 
 
 /**
  * @brief Dumps a series of files and storage info, in particular
- *	all statistics (maxFileHosted,...,cleanupCount), current number
- * 	of files hosted by fs and a list of all of them with their size.
+ *	all statistics (maxFileHosted,...,lockTimeouts), current number
+ * 	of files hosted by fs and a list of all of them with their size
+ *	(and lock contention, if any), followed by the statistics of the
+ *	allocator (see slab_dump).
  */
 void fs_dumpAll(FileStorage_t* fs, FILE* stream){ /* Dumps all files and storage info */
 	if (!stream) stream = stdout; /* Default */
 	char* filename;
 	FileData_t* file;
-	int tmpint;
-	icl_entry_t* tmpentry;
+	fmap_iter_t it;
+	size_t logical = 0; /* Sum of file sizes */
 	fprintf(stream, "%s storage capacity (bytes) = %lu\n", FSDUMP_CYAN, fs->storageCap);
 	fprintf(stream, "%s max fileno = %d\n", FSDUMP_CYAN, fs->maxFileNo);
-	fprintf(stream, "%s current filedata-occupied space = %lu\n", FSDUMP_CYAN, fs->spaceSize);
-	fprintf(stream, "%s current fileno = %d\n", FSDUMP_CYAN, fs->fmap->nentries);
+	fprintf(stream, "%s storage shards = %d\n", FSDUMP_CYAN, fs->nshards);
+	fprintf(stream, "%s compression codec = %s\n", FSDUMP_CYAN, codec_name(fs->codec));
+	fprintf(stream, "%s deduplication = %s\n", FSDUMP_CYAN, (fs->dedup ? "extent" : "none"));
+	fprintf(stream, "%s current filedata-occupied space = %lu\n", FSDUMP_CYAN, fs_used(fs));
+	fprintf(stream, "%s current fileno = %d\n", FSDUMP_CYAN, ATOMIC_GET(&fs->fileno));
+	if (fs->maxObjSize > 0) fprintf(stream, "%s max file size = %lu\n", FSDUMP_CYAN, fs->maxObjSize);
+	if (fs->largeSize > 0) fprintf(stream, "%s large files: threshold = %lu, budget = %lu, current space = %lu\n", FSDUMP_CYAN,
+		fs->largeSize, fs->largeBudget, ATOMIC_GET(&fs->largeSpace));
 	fprintf(stream, "%s current files info:\n", FSDUMP_CYAN);
 	fprintf(stream, "---------------------------------\n");
-	icl_hash_foreach(fs->fmap, tmpint, tmpentry, filename, file){
-		fprintf(stream, "%s '%s'\n", FSDUMP_CYAN, filename);
-		fprintf(stream, "%s \tfile size = %lu\n", FSDUMP_CYAN, file->size);
-		fprintf(stream, "---------------------------------\n");
+	for (int i = 0; i < fs->nshards; i++){
+		fmap_foreach(&fs->shards[i], it, filename, file){
+			fprintf(stream, "%s '%s'\n", FSDUMP_CYAN, filename);
+			fprintf(stream, "%s \tfile size = %lu\n", FSDUMP_CYAN, file->size);
+			if ((fs->codec != CODEC_NONE) || fs->dedup) fprintf(stream, "%s \tstored size = %lu\n", FSDUMP_CYAN, file->stored);
+			if (file->large) fprintf(stream, "%s \tlarge file\n", FSDUMP_CYAN);
+			if (file->lstats.contended > 0) fprintf(stream, "%s \tlock acquisitions = %lu (contended = %lu, expired waits = %lu, max wait = %.3f ms)\n",
+				FSDUMP_CYAN, file->lstats.acquired, file->lstats.contended, file->lstats.timeouts, (double)file->lstats.maxWait / 1e6);
+			fprintf(stream, "---------------------------------\n");
+			logical += file->size;
+		}
+	}
+	if (fs->dedup){
+		size_t sharedBytes, savedBytes;
+		int sharedExts;
+		fdata_dedupStats(&sharedBytes, &sharedExts, &savedBytes);
+		fprintf(stream, "%s shared extents = %d (%lu bytes)\n", FSDUMP_CYAN, sharedExts, sharedBytes);
+		fprintf(stream, "%s bytes deduplicated (cumulative) = %lu\n", FSDUMP_CYAN, savedBytes);
 	}
+	size_t physical = fs_used(fs);
+	fprintf(stream, "%s logical-to-physical ratio = %.2f (%lu / %lu bytes)\n", FSDUMP_CYAN,
+		(physical > 0 ? (double)logical / physical : 1.0), logical, physical);
 	fprintf(stream, "%s now dumping statistics\n", FSDUMP_CYAN);
 	fprintf(stream, "%s max file hosted = %d\n", FSDUMP_CYAN, fs->maxFileHosted);
-	fprintf(stream, "%s max storage size = %d\n", FSDUMP_CYAN, fs->maxSpaceSize);
+	fprintf(stream, "%s max storage size = %lu\n", FSDUMP_CYAN, fs->maxSpaceSize);
 	fprintf(stream, "%s cache replacement algorithm executions for file cap overflowing = %d\n", FSDUMP_CYAN, fs->fcap_replCount);
 	fprintf(stream, "%s cache replacement algorithm executions for storage cap overflowing = %d\n", FSDUMP_CYAN, fs->scap_replCount);
+	if (fs->largeSize > 0) fprintf(stream, "%s cache replacement algorithm executions for large files budget overflowing = %d\n", FSDUMP_CYAN, fs->lcap_replCount);
+	if (fs->resizeCount > 0) fprintf(stream, "%s cache replacement algorithm executions for online resizing = %d\n", FSDUMP_CYAN, fs->resizeCount);
 	fprintf(stream, "%s TOTAL cache replacement algorithm executions = %d\n", FSDUMP_CYAN, fs->replCount);
 	fprintf(stream, "%s TOTAL number of evicted files = %d\n", FSDUMP_CYAN, fs->evictedFiles);
 	fprintf(stream, "%s client info cleanup executions = %d\n", FSDUMP_CYAN, fs->cleanupCount);
+	fprintf(stream, "%s expired lock waits = %d\n", FSDUMP_CYAN, fs->lockTimeouts);
+	if ((fs->maxObjSize > 0) || (fs->largeSize > 0)) fprintf(stream, "%s writes rejected for file size = %d\n", FSDUMP_CYAN, fs->rejectedFiles);
+	repl_dump(fs->repl, stream);
+	if (fs->persist) persist_dump(fs->persist, stream);
+	slab_dump(stream);
 }
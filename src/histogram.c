@@ -0,0 +1,155 @@
+#include <histogram.h>
+
+/*
+ * Relaxed atomic accesses: since there is a single writer, a recording is a
+ * load + store of the same counter (NO read-modify-write instruction), while
+ * concurrent readers never see a torn value.
+ */
+#define HIST_GET(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define HIST_SET(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELAXED)
+
+
+/* ********************** STATIC OPERATIONS ********************** */
+
+/* Index of the bucket containing value */
+static int hist_index(uint64_t value){
+	if (value < HIST_SUBBUCKETS) return (int)value;
+	int shift = (63 - __builtin_clzll(value)) - HIST_SUBBITS; /* Width of the bucket is 2^shift */
+	return ((shift + 1) << HIST_SUBBITS) + (int)((value >> shift) & (HIST_SUBBUCKETS - 1));
+}
+
+
+/* Highest value contained in the bucket #index */
+static uint64_t hist_upper(int index){
+	if (index < HIST_SUBBUCKETS) return (uint64_t)index;
+	int shift = (index >> HIST_SUBBITS) - 1;
+	uint64_t lower = ((uint64_t)((index & (HIST_SUBBUCKETS - 1)) | HIST_SUBBUCKETS)) << shift;
+	return lower + ((((uint64_t)1) << shift) - 1);
+}
+
+
+/* ********************** MAIN OPERATIONS ********************** */
+
+/**
+ * @brief Initializes an empty histogram.
+ * @return Pointer to hist_t object on success, NULL on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+hist_t* hist_init(void){
+	hist_t* h = malloc(sizeof(hist_t));
+	if (!h){ errno = ENOMEM; return NULL; }
+	memset(h, 0, sizeof(hist_t));
+	return h;
+}
+
+
+/**
+ * @brief Records #value in the histogram.
+ * @note ONLY one thread at a time can record values in the same histogram.
+ * @return 0 on success, -1 on error (h == NULL).
+ */
+int hist_record(hist_t* h, uint64_t value){
+	if (!h){ errno = EINVAL; return -1; }
+	int index = hist_index(value);
+	HIST_SET(&h->counts[index], HIST_GET(&h->counts[index]) + 1);
+	HIST_SET(&h->sum, HIST_GET(&h->sum) + value);
+	if (value > HIST_GET(&h->max)) HIST_SET(&h->max, value);
+	HIST_SET(&h->count, HIST_GET(&h->count) + 1);
+	return 0;
+}
+
+
+/**
+ * @brief Adds ALL the values recorded in #src to #dst.
+ * @note src can be concurrently written by its owner, while dst MUST NOT.
+ * @return 0 on success, -1 on error (invalid arguments).
+ */
+int hist_merge(hist_t* dst, hist_t* src){
+	if (!dst || !src){ errno = EINVAL; return -1; }
+	uint64_t count = 0;
+	for (int i = 0; i < HIST_NBUCKETS; i++){
+		uint64_t c = HIST_GET(&src->counts[i]);
+		dst->counts[i] += c;
+		count += c;
+	}
+	/* count is recomputed from buckets such that percentiles are consistent with them */
+	dst->count += count;
+	dst->sum += HIST_GET(&src->sum);
+	uint64_t max = HIST_GET(&src->max);
+	if (max > dst->max) dst->max = max;
+	return 0;
+}
+
+
+/**
+ * @brief Discards ALL the recorded values.
+ * @note There MUST NOT be any concurrent operation on h.
+ * @return 0 on success, -1 on error (h == NULL).
+ */
+int hist_reset(hist_t* h){
+	if (!h){ errno = EINVAL; return -1; }
+	memset(h, 0, sizeof(hist_t));
+	return 0;
+}
+
+
+/**
+ * @brief Gets the p-th percentile (0 <= p <= 100) of the recorded values,
+ * i.e. the highest value of the bucket that contains it (but NOT more
+ * than the maximum recorded value).
+ * @return The p-th percentile, 0 if there are no values or h == NULL.
+ */
+uint64_t hist_percentile(hist_t* h, double p){
+	if (!h || (h->count == 0)) return 0;
+	if (p < 0.0) p = 0.0;
+	if (p > 100.0) p = 100.0;
+	uint64_t rank = (uint64_t)((p / 100.0) * (double)h->count + 0.5); /* #values <= percentile */
+	if (rank == 0) rank = 1;
+	uint64_t seen = 0;
+	for (int i = 0; i < HIST_NBUCKETS; i++){
+		seen += h->counts[i];
+		if (seen >= rank){
+			uint64_t upper = hist_upper(i);
+			return (upper < h->max ? upper : h->max);
+		}
+	}
+	return h->max;
+}
+
+
+/**
+ * @return Mean of the recorded values, 0.0 if there are no values or h == NULL.
+ */
+double hist_mean(hist_t* h){
+	if (!h || (h->count == 0)) return 0.0;
+	return (double)h->sum / (double)h->count;
+}
+
+
+/**
+ * @brief Prints on #stream a JSON object with the number of values, their
+ * mean, maximum and the 50th/90th/99th/99.9th percentiles, where ALL the
+ * values are divided by #scale (e.g. 1000.0 for printing nanoseconds as
+ * microseconds).
+ * @return 0 on success, -1 on error (invalid arguments).
+ */
+int hist_printJSON(hist_t* h, FILE* stream, double scale){
+	if (!h || !stream || (scale <= 0.0)){ errno = EINVAL; return -1; }
+	fprintf(stream, "{\"count\": %lu, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}",
+		(unsigned long)h->count, hist_mean(h) / scale, (double)hist_percentile(h, 50.0) / scale,
+		(double)hist_percentile(h, 90.0) / scale, (double)hist_percentile(h, 99.0) / scale,
+		(double)hist_percentile(h, 99.9) / scale, (double)h->max / scale);
+	return 0;
+}
+
+
+/**
+ * @brief Destroys the histogram.
+ * @return 0 on success, -1 on error (h == NULL).
+ */
+int hist_destroy(hist_t* h){
+	if (!h){ errno = EINVAL; return -1; }
+	free(h);
+	return 0;
+}
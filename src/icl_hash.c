@@ -11,6 +11,7 @@
 /* $Id: icl_hash.c 2838 2011-11-22 04:25:02Z mfaverge $ */
 /* $UTK_Copyright: $ */
 
+#include <slab.h> /* Entries are allocated by the slab allocator of the server */
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -87,10 +88,27 @@ icl_hash_create( int nbuckets, unsigned int (*hash_function)(void*), int (*hash_
 
     ht->hash_function = hash_function ? hash_function : hash_pjw;
     ht->hash_key_compare = hash_key_compare ? hash_key_compare : string_compare;
+    ht->oldbuckets = NULL;
+    ht->oldnbuckets = 0;
+    ht->rehashidx = 0;
 
     return ht;
 }
 
+/**
+ * Bucket in which key shall be: during a resize (see icl_hash_resize), its
+ * bucket in the old array until that has been moved.
+ */
+static icl_entry_t **
+icl_hash_head(icl_hash_t *ht, void* key)
+{
+    unsigned int hash = (* ht->hash_function)(key);
+
+    if (ht->oldbuckets && ((int)(hash % ht->oldnbuckets) >= ht->rehashidx))
+        return &ht->oldbuckets[hash % ht->oldnbuckets];
+    return &ht->buckets[hash % ht->nbuckets];
+}
+
 /**
  * Search for an entry in a hash table.
  *
@@ -105,13 +123,10 @@ void *
 icl_hash_find(icl_hash_t *ht, void* key)
 {
     icl_entry_t* curr;
-    unsigned int hash_val;
 
     if(!ht || !key) return NULL;
 
-    hash_val = (* ht->hash_function)(key) % ht->nbuckets;
-
-    for (curr=ht->buckets[hash_val]; curr != NULL; curr=curr->next)
+    for (curr=*icl_hash_head(ht, key); curr != NULL; curr=curr->next)
         if ( ht->hash_key_compare(curr->key, key))
             return(curr->data);
 
@@ -131,26 +146,25 @@ icl_hash_find(icl_hash_t *ht, void* key)
 icl_entry_t *
 icl_hash_insert(icl_hash_t *ht, void* key, void *data)
 {
-    icl_entry_t *curr;
-    unsigned int hash_val;
+    icl_entry_t *curr, **head;
 
     if(!ht || !key) return NULL;
 
-    hash_val = (* ht->hash_function)(key) % ht->nbuckets;
+    head = icl_hash_head(ht, key);
 
-    for (curr=ht->buckets[hash_val]; curr != NULL; curr=curr->next)
+    for (curr=*head; curr != NULL; curr=curr->next)
         if ( ht->hash_key_compare(curr->key, key))
             return(NULL); /* key already exists */
 
     /* if key was not found */
-    curr = (icl_entry_t*)malloc(sizeof(icl_entry_t));
+    curr = (icl_entry_t*)slab_alloc(sizeof(icl_entry_t));
     if(!curr) return NULL;
 
     curr->key = key;
     curr->data = data;
-    curr->next = ht->buckets[hash_val]; /* add at start */
+    curr->next = *head; /* add at start */
 
-    ht->buckets[hash_val] = curr;
+    *head = curr;
     ht->nentries++;
 
     return curr;
@@ -170,15 +184,14 @@ icl_hash_insert(icl_hash_t *ht, void* key, void *data)
 icl_entry_t *
 icl_hash_update_insert(icl_hash_t *ht, void* key, void *data, void **olddata)
 {
-    icl_entry_t *curr, *prev;
-    unsigned int hash_val;
+    icl_entry_t *curr, *prev, **head;
 
     if(!ht || !key) return NULL;
 
-    hash_val = (* ht->hash_function)(key) % ht->nbuckets;
+    head = icl_hash_head(ht, key);
 
-    /* Scan bucket[hash_val] for key */
-    for (prev=NULL,curr=ht->buckets[hash_val]; curr != NULL; prev=curr, curr=curr->next)
+    /* Scan bucket of key */
+    for (prev=NULL,curr=*head; curr != NULL; prev=curr, curr=curr->next)
         /* If key found, remove node from list, free old key, and setup olddata for the return */
         if ( ht->hash_key_compare(curr->key, key)) {
             if (olddata != NULL) {
@@ -187,20 +200,20 @@ icl_hash_update_insert(icl_hash_t *ht, void* key, void *data, void **olddata)
             }
 
             if (prev == NULL)
-                ht->buckets[hash_val] = curr->next;
+                *head = curr->next;
             else
                 prev->next = curr->next;
         }
 
     /* Since key was either not found, or found-and-removed, create and prepend new node */
-    curr = (icl_entry_t*)malloc(sizeof(icl_entry_t));
+    curr = (icl_entry_t*)slab_alloc(sizeof(icl_entry_t));
     if(curr == NULL) return NULL; /* out of memory */
 
     curr->key = key;
     curr->data = data;
-    curr->next = ht->buckets[hash_val]; /* add at start */
+    curr->next = *head; /* add at start */
 
-    ht->buckets[hash_val] = curr;
+    *head = curr;
     ht->nentries++; /* this is okay because key was either not found or found-and-removed */
 
     if(olddata!=NULL && *olddata!=NULL)
@@ -221,24 +234,23 @@ icl_hash_update_insert(icl_hash_t *ht, void* key, void *data, void **olddata)
  */
 int icl_hash_delete(icl_hash_t *ht, void* key, void (*free_key)(void*), void (*free_data)(void*))
 {
-    icl_entry_t *curr, *prev;
-    unsigned int hash_val;
+    icl_entry_t *curr, *prev, **head;
 
     if(!ht || !key) return -1;
-    hash_val = (* ht->hash_function)(key) % ht->nbuckets;
+    head = icl_hash_head(ht, key);
 
     prev = NULL;
-    for (curr=ht->buckets[hash_val]; curr != NULL; )  {
+    for (curr=*head; curr != NULL; )  {
         if ( ht->hash_key_compare(curr->key, key)) {
             if (prev == NULL) {
-                ht->buckets[hash_val] = curr->next;
+                *head = curr->next;
             } else {
                 prev->next = curr->next;
             }
             if (*free_key && curr->key) (*free_key)(curr->key);
             if (*free_data && curr->data) (*free_data)(curr->data);
             ht->nentries--; /* This was WRONG, since key has been found and icl_entry_t curr removed and nothing has been touched before */
-            free(curr);
+            slab_free(curr, sizeof(icl_entry_t));
             return 0;
         }
         prev = curr;
@@ -248,6 +260,74 @@ int icl_hash_delete(icl_hash_t *ht, void* key, void (*free_key)(void*), void (*f
     return -1;
 }
 
+/**
+ * Start rehashing the entries of the hash table into a new array of buckets:
+ * entries are moved (relinked, NOT reallocated) a few buckets at a time by
+ * icl_hash_rehash, and meanwhile each key is searched in the old array until
+ * its bucket has been moved. A resize still in progress is completed first.
+ *
+ * @param ht -- the hash table to be resized
+ * @param nbuckets -- the new number of buckets
+ *
+ * @returns 0 on success, -1 on failure (the hash table is untouched).
+ */
+int icl_hash_resize(icl_hash_t *ht, int nbuckets)
+{
+    icl_entry_t **buckets;
+
+    if(!ht || (nbuckets <= 0)) return -1;
+    if(ht->oldbuckets) icl_hash_rehash(ht, ht->oldnbuckets);
+    if(nbuckets == ht->nbuckets) return 0;
+
+    buckets = (icl_entry_t**)calloc(nbuckets, sizeof(icl_entry_t*));
+    if(!buckets) return -1;
+
+    ht->oldbuckets = ht->buckets;
+    ht->oldnbuckets = ht->nbuckets;
+    ht->rehashidx = 0;
+    ht->buckets = buckets;
+    ht->nbuckets = nbuckets;
+
+    return 0;
+}
+
+/**
+ * Move the entries of (at most) n buckets of the old array into the new one
+ * during a resize (see icl_hash_resize), and free the old array once ALL of
+ * them have been moved.
+ *
+ * @param ht -- the hash table being resized
+ * @param n -- maximum number of buckets to move
+ *
+ * @returns 1 if there are still buckets to move, 0 otherwise.
+ */
+int icl_hash_rehash(icl_hash_t *ht, int n)
+{
+    icl_entry_t *curr, *next;
+    unsigned int hash_val;
+
+    if(!ht || !ht->oldbuckets) return 0;
+
+    for (; (n > 0) && (ht->rehashidx < ht->oldnbuckets); n--, ht->rehashidx++) {
+        for (curr=ht->oldbuckets[ht->rehashidx]; curr!=NULL; ) {
+            next=curr->next;
+            hash_val = (* ht->hash_function)(curr->key) % ht->nbuckets;
+            curr->next = ht->buckets[hash_val];
+            ht->buckets[hash_val] = curr;
+            curr=next;
+        }
+        ht->oldbuckets[ht->rehashidx] = NULL;
+    }
+    if (ht->rehashidx < ht->oldnbuckets) return 1;
+
+    free(ht->oldbuckets);
+    ht->oldbuckets = NULL;
+    ht->oldnbuckets = 0;
+    ht->rehashidx = 0;
+
+    return 0;
+}
+
 /**
  * Free hash table structures (key and data are freed using functions).
  *
@@ -265,13 +345,16 @@ icl_hash_destroy(icl_hash_t *ht, void (*free_key)(void*), void (*free_data)(void
 
     if(!ht) return -1;
 
+    /* Moves the remaining buckets of a resize, such that ALL entries are in ht->buckets */
+    icl_hash_rehash(ht, ht->oldnbuckets);
+
     for (i=0; i<ht->nbuckets; i++) {
         bucket = ht->buckets[i];
         for (curr=bucket; curr!=NULL; ) {
             next=curr->next;
             if (*free_key && curr->key) (*free_key)(curr->key);
             if (*free_data && curr->data) (*free_data)(curr->data);
-            free(curr);
+            slab_free(curr, sizeof(icl_entry_t));
             curr=next;
         }
     }
@@ -299,8 +382,9 @@ icl_hash_dump(FILE* stream, icl_hash_t* ht)
 
     if(!ht) return -1;
 
-    for(i=0; i<ht->nbuckets; i++) {
-        bucket = ht->buckets[i];
+    /* Buckets of the new array, then those of the old one NOT moved yet (if any) */
+    for(i=0; i<ht->nbuckets + ht->oldnbuckets; i++) {
+        bucket = (i < ht->nbuckets ? ht->buckets[i] : ht->oldbuckets[i - ht->nbuckets]);
         for(curr=bucket; curr!=NULL; ) {
             if(curr->key)
                 fprintf(stream, "icl_hash_dump: %s: %s\n", (char *)curr->key, (char*)curr->data);
@@ -325,8 +409,8 @@ int icl_hash_printKeys(FILE* stream, icl_hash_t* ht){
 
 	if (!ht) return -1;
 	
-	for (i = 0; i < ht->nbuckets; i++){
-		bucket = ht->buckets[i];
+	for (i = 0; i < ht->nbuckets + ht->oldnbuckets; i++){ /* As icl_hash_dump */
+		bucket = (i < ht->nbuckets ? ht->buckets[i] : ht->oldbuckets[i - ht->nbuckets]);
 		for (curr = bucket; curr != NULL; curr = curr->next){
 			if (curr->key) fprintf(stream, "token: %s\n", (char*)curr->key);
 		}
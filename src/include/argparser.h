@@ -55,6 +55,7 @@ bool
 /* Main cmdline parsing functions */
 bool issubstr(char* str1, char* str2);
 llist_t* splitArgs(char* str);
+char* joinArgs(llist_t* args);
 int parseOption(int argc, char* argv[], optdef_t options[], int optlen, optval_t* opt, int* offset);
 char* printOptParseError(int err);
 llist_t* parseCmdLine(int argc, char* argv[], optdef_t options[], int optlen);
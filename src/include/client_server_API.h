@@ -17,6 +17,31 @@
 /* Flag for printing error/success messages from server */
 extern bool prints_enabled;
 
+/*
+ * Maximum number of bytes of pending asynchronous requests (less than
+ * a socket buffer, see client_server_API.c).
+ */
+#define ASYNC_MAXINFLIGHT 65536
+
+/* Maximum number of pending asynchronous requests */
+#define ASYNC_MAXPENDING 64
+
+/*
+ * Maximum number of bytes sent by a single request of writeFile (larger
+ * files are sent as a sequence of chunks, see client_server_API.c).
+ */
+#define WRITE_CHUNK (4 * 1048576)
+
+
+/* Connection handle (see connCreate) */
+typedef struct clientconn_s clientconn_t;
+
+clientconn_t*
+	connCreate(void);
+
+int
+	connSelect(clientconn_t* conn),
+	connDestroy(clientconn_t* conn);
 
 int 
 	openConnection(const char* sockname, int msec, const struct timespec abstime),
@@ -27,6 +52,30 @@ int
 	writeFile(const char* pathname, const char* dirname),
 	appendToFile(const char* pathname, void* buf, size_t size, const char* dirname),
 	lockFile(const char* pathname),
+	lockFileTimed(const char* pathname, const struct timespec abstime),
 	unlockFile(const char* pathname),
 	closeFile(const char* pathname),
-	removeFile(const char* pathname);
+	removeFile(const char* pathname),
+	/* Compound requests (see M_PUTF, M_FETCHF) */
+	putFile(const char* pathname, const char* dirname),
+	fetchFile(const char* pathname, void** buf, size_t* size),
+	/* Batched compound requests (see M_FETCHNF, M_PUTNF) */
+	readFiles(const char* pathnames[], int n, void* bufs[], size_t sizes[], int errs[]),
+	writeFiles(const char* pathnames[], int n, const char* dirname, int errs[]),
+	/* Live statistics of the server (see M_STATS) */
+	getStats(void** buf, size_t* size);
+
+/* Asynchronous API: each function returns a handle for the request (see asyncWait) */
+int
+	asyncOpenFile(const char* pathname, int flags),
+	asyncReadFile(const char* pathname),
+	asyncWriteFile(const char* pathname, const char* dirname),
+	asyncCloseFile(const char* pathname),
+	asyncLockFile(const char* pathname),
+	asyncUnlockFile(const char* pathname),
+	asyncRemoveFile(const char* pathname),
+	asyncPutFile(const char* pathname, const char* dirname),
+	asyncFetchFile(const char* pathname),
+	asyncWait(int handle, void** buf, size_t* size),
+	asyncPoll(int handle),
+	asyncWaitAll(void);
@@ -0,0 +1,40 @@
+/**
+ * @brief Compression codecs for file content at rest. Each codec compresses
+ * and decompresses a single block (whose raw size is known when decompressing)
+ * and it is implemented here WITHOUT any external library:
+ *	- CODEC_NONE: no compression;
+ *	- CODEC_LZ4: LZ4 block format (greedy single-probe matcher, fast
+ *	decompression with full bounds checking).
+ *
+ * @author Salvatore Correnti
+ */
+#if !defined(_CODEC_H)
+#define _CODEC_H
+
+#include <defines.h>
+#include <stdint.h>
+
+#define CODEC_NONE 0
+#define CODEC_LZ4 1
+
+/* Number of codecs */
+#define CODEC_NUM 2
+
+/* Maximum compressed size of a block of n bytes (for ANY codec) */
+#define CODEC_BOUND(n) ((n) + (n)/255 + 16)
+
+/* log2 of the number of entries in the LZ4 match table */
+#define LZ4_HASHLOG 12
+
+
+int
+	codec_id(char* name),
+	codec_decompress(int codec, const void* src, size_t srclen, void* dst, size_t rawlen);
+
+size_t
+	codec_compress(int codec, const void* src, size_t srclen, void* dst, size_t dstcap);
+
+char*
+	codec_name(int codec);
+
+#endif /* _CODEC_H */
@@ -6,8 +6,14 @@
 
 int dirscan(const char nomedir[], long n, llist_t** filelist);
 
+int dirwalk(const char nomedir[], long n, int (*fileFn)(char* pathname, void* arg), void* arg);
+
 int loadFile(const char* pathname, void** buf, size_t* size);
 
+int mapFile(const char* pathname, void** buf, size_t* size);
+
+int unmapFile(void* buf, size_t size);
+
 int saveFile(const char* pathname, const char* basedir, void* content, size_t size);
 
 #endif /* _DIR_UTILS_H */
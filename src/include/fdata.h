@@ -11,6 +11,9 @@
 #include <fflags.h> /* Global flags for current file (not considering O_CREATE and O_LOCK, which are exported also to client) */
 #include <tsqueue.h>
 #include <linkedlist.h>
+#include <codec.h>
+#include <slab.h>
+#include <sys/uio.h>
 
 
 /* Client-local flags */
@@ -19,38 +22,198 @@
 #define LF_WRITE 4 /* A writeFile by corresponding client will NOT fail */
 #define LF_WAIT 8 /* Client is waiting for lock on this file */
 
+/* Number of client entries stored inline in each file (see fd_clients_t) */
+#define FD_INLINE_CLIENTS 4
+
+/* Minimum capacity of the overflow table of client entries (MUST be a power of 2) */
+#define FD_CLTABLE_MINCAP 16
+
+
+/* Byte-size of a single extent of file content */
+#define FD_EXTENT_SIZE 16384
+
+/* Number of extents needed for size bytes */
+#define FD_NEXTENTS(size) (((size) + FD_EXTENT_SIZE - 1) / FD_EXTENT_SIZE)
+
+/* Chunks of written data smaller than this are NOT compressed */
+#define FD_ZMIN 64
+
+/* Number of buckets of the table of deduplicated extents */
+#define FD_DEDUP_BUCKETS 16384
+
+
+/**
+ * @brief Fixed-size extent of file content, whose header and data are two
+ * objects of the slab allocator (see slab.h). An extent can be shared among
+ * more versions of the same file content, and it is freed by its last holder.
+ * When deduplication is enabled, an extent can also be shared among
+ * DIFFERENT files with the same content: such an extent is inserted in a
+ * content-addressed table (shared == 1) and it is NEVER modified again, so
+ * that an append to a file whose last extent is shared copies it at first
+ * (copy-on-append).
+ * Finally, an extent can refer to a part of a (read-only) snapshot mapped in
+ * memory (see persist.h): such an extent is NEVER modified as well and it is
+ * NOT freed (ONLY its header is).
+ */
+typedef struct fextent_s {
+	int refs; /* Number of fbody_t objects holding this extent, atomically updated */
+	struct fextent_s* next; /* Next extent in the same bucket (in the table) */
+	int shared; /* 1 <=> extent is in the table of deduplicated extents, atomically updated */
+	bool mapped; /* true <=> data is in a mapped snapshot (set ONLY at creation) */
+	size_t dlen; /* Bytes of data identified by fp (ONLY if shared) */
+	uint64_t fp; /* Fingerprint of the first dlen bytes (ONLY if shared) */
+	char* data; /* FD_EXTENT_SIZE bytes, allocated separately from the header if NOT mapped */
+} fextent_t;
+
+
+/**
+ * @brief Reference-counted file content as a sequence of fixed-size extents
+ * (a rope), such that an append is O(append size) and content is sent by
+ * scatter-gather directly from the extents.
+ * A reader takes a reference (under the file rwlock) and sends directly from
+ * it, so that NO copy is made; a writer modifies it in place ONLY if the file
+ * is its unique holder, otherwise it creates a new version sharing all the
+ * extents (bytes beyond the size of a version are NEVER read by its holders,
+ * so the new one can fill the shared last extent) and the old version is
+ * freed by its last reader.
+ */
+typedef struct fbody_s {
+	fextent_t** exts; /* Extents */
+	int nexts; /* Number of extents */
+	int cap; /* len(exts) */
+	size_t size; /* Size of content */
+	int refs; /* Number of holders (file + readers), atomically updated */
+} fbody_t;
+
+
+/**
+ * @brief Client-local flags of a file.
+ */
+typedef struct fd_client_s {
+	int client; /* Client id, -1 <=> empty slot */
+	unsigned char flags; /* LF_* flags, 0 <=> stale entry (it can be reused by another client) */
+} fd_client_t;
+
+
+/**
+ * @brief Set of the clients that have (had) some state on a file: the first
+ * FD_INLINE_CLIENTS ones are stored inline, the others in an open-addressing
+ * (linear probing) table keyed by client id, allocated ONLY when the inline
+ * slots are all in use, such that a file opened by a few clients costs a few
+ * bytes whatever the client ids are. A client with NO entry has NO flags set.
+ * Entries are inserted ONLY with the file rwlock in writing mode (stale ones
+ * are reused or dropped when the table is rebuilt), while the flags of an
+ * existing entry can be modified in reading mode by atomic byte operations,
+ * since each client modifies ONLY its own flags.
+ */
+typedef struct fd_clients_s {
+	fd_client_t inl[FD_INLINE_CLIENTS]; /* Inline entries */
+	fd_client_t* table; /* Overflow table (NULL if not allocated) */
+	int cap; /* len(table), power of 2 */
+	int used; /* NOT empty slots of table (stale entries included) */
+} fd_clients_t;
+
+
+/**
+ * @brief Client waiting for the lock of a file: waiters are kept in a FIFO
+ * list (guarded by the file rwlock in writing mode) whose nodes are allocated
+ * ONLY when a client has to wait, such that a file with NO waiters costs
+ * nothing but two pointers.
+ */
+typedef struct fd_waiter_s {
+	int client;
+	uint64_t since; /* When client started waiting (see stats_now) */
+	uint64_t deadline; /* When the wait expires (see stats_now), 0 if never */
+	struct fd_waiter_s* next;
+} fd_waiter_t;
+
+
+/**
+ * @brief Lock contention counters of a file (guarded by the file rwlock in writing mode).
+ */
+typedef struct fd_lockstats_s {
+	unsigned long acquired; /* #acquisitions of the lock */
+	unsigned long contended; /* #acquisitions after having waited for the lock */
+	unsigned long timeouts; /* #waits expired (see fdata_cancelWait) */
+	uint64_t waitTime; /* Total waiting time (ns) of contended acquisitions */
+	uint64_t maxWait; /* Maximum waiting time (ns) of a contended acquisition */
+} fd_lockstats_t;
+
+
+/**
+ * @brief Header of a frame of compressed file content. When a file has a
+ * codec, its body is a sequence of frames, each one containing (at most)
+ * FD_EXTENT_SIZE bytes of written data compressed independently, such that
+ * an append does NOT touch previous frames and a reader decompresses ONLY
+ * its own (temporary) copy of the content.
+ */
+typedef struct fd_frame_s {
+	uint32_t rawlen; /* Bytes of data in the frame */
+	uint32_t zlen; /* Bytes of compressed data following the header, 0 if rawlen bytes of RAW data follow */
+} fd_frame_t;
+
 
 typedef struct FileData_s {
 
-	void* data; /* File content */
+	fbody_t* body; /* File content (NULL if empty), as a sequence of fd_frame_t if (codec != CODEC_NONE) */
 	size_t size; /* Current file size */	
+	int codec; /* Codec of body, set ONLY before first write (one of CODEC_*) */
+	bool dedup; /* true <=> full extents of body are deduplicated, set ONLY before first write */
+	size_t stored; /* Bytes of body in NOT shared extents, charged to storage capacity (== size if CODEC_NONE and !dedup) */
 	unsigned char flags; /* Global flags */
-	unsigned char* clients; /* Byte array of client-local flags */
-	int maxclient; /* len(clients) - 1 */
-	tsqueue_t* waiting; /* Waiting clients */
+	fd_clients_t clients; /* Client-local flags */
+	fd_waiter_t* whead; /* Waiting clients (NULL if none) */
+	fd_waiter_t* wtail; /* Last waiting client (NULL if none) */
+	fd_lockstats_t lstats; /* Lock contention counters */
 	pthread_rwlock_t lock; /* For reading/writing file content */
 
+	/* Replacement list links (see replpolicy.h), guarded by the list mutex */
+	char* pathname; /* Key of the file in the storage hashtable (NOT owned) */
+	struct FileData_s* rprev;
+	struct FileData_s* rnext;
+	bool linked; /* true <=> file is in a replacement list */
+	signed char rclass; /* Class of the list in which file is linked (one of RC_*) */
+	unsigned long rstamp; /* Link order in the replacement lists */
+	struct repl_bucket_s* rbucket; /* Bucket for the frequency of file (LFU) */
+	unsigned int freq; /* Number of accesses (LFU, atomic) */
+	bool refbit; /* Reference bit (CLOCK, atomic) */
+	bool pending; /* true <=> file is in the deferred promotions buffer (LRU/LFU, atomic) */
+	bool large; /* true <=> file is in the class of large files (see fs_largeObjects), changed ONLY under the global gate (then see repl_reclass) */
+
 } FileData_t;
 
 
 FileData_t*
-	fdata_create(int maxclient, int creator, bool locking); /* -> fss_create */
+	fdata_create(int creator, bool locking); /* -> fss_create */
 
 int
 	fdata_open(FileData_t* fdata, int client, bool locking), /* -> fss_open */
 	fdata_close(FileData_t* fdata, int client), /* -> fss_close */
-	fdata_read(FileData_t* fdata, void** buf, size_t* size, int client, bool ign_open), /* -> fss_read */
-	fdata_write(FileData_t* fdata, void* buf, size_t size, int client, bool wr), /* fss_write/fss_append */
-	fdata_lock(FileData_t* fdata, int client), /* (try)lock */
-	fdata_unlock(FileData_t* fdata, int client, llist_t** newowner), /* (try)unlock and returns new owner (if any) */
-	fdata_removeClient(FileData_t* fdata, int client, llist_t** newowner), /* removes all info of a set of clients */
-	fdata_resize(FileData_t* fdata, int client), /* fss->resize */
-	fdata_destroy(FileData_t* fdata);
-
-tsqueue_t*
+	fdata_read(FileData_t* fdata, fbody_t** body, size_t* size, int client, bool ign_open), /* -> fss_read */
+	fdata_write(FileData_t* fdata, void* buf, size_t size, int client, bool wr, ssize_t* charged), /* fss_write/fss_append */
+	fdata_content(FileData_t* fdata, fbody_t** body, size_t* size), /* Raw content reference without any client check */
+	fdata_stored(FileData_t* fdata, fbody_t** body, size_t* size, int* codec), /* Stored (possibly compressed) content reference */
+	fdata_map(FileData_t* fdata, int codec, void* data, size_t len, size_t size), /* Content of an empty file from a mapping */
+	fdata_lock(FileData_t* fdata, int client, uint64_t deadline), /* (try)lock */
+	fdata_cancelWait(FileData_t* fdata, int client, uint64_t deadline), /* Expires the wait of client for lock */
+	fdata_unlock(FileData_t* fdata, int client, int* newowner), /* (try)unlock and returns new owner (if any) */
+	fdata_removeClient(FileData_t* fdata, int client, int* newowner), /* removes all info of a set of clients */
+	fdata_destroy(FileData_t* fdata),
+	fbody_iov(fbody_t* body, size_t size, struct iovec** iov);
+
+fd_waiter_t*
 	fdata_waiters(FileData_t* fdata);
 	
 void
+	fdata_waitersFree(fd_waiter_t* waiters),
+	fbody_release(fbody_t* body),
+	fdata_dedupStats(size_t* sharedBytes, int* sharedExts, size_t* savedBytes),
 	fdata_printout(FileData_t* fdata);
+
+size_t
+	fdata_sharedBytes(void);
+
+unsigned char
+	fdata_clientFlags(FileData_t* fdata, int client); /* Client-local flags (0 if client has no entry) */
 	
 #endif /* _FDATA_H */
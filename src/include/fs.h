@@ -2,8 +2,9 @@
  * @brief Definition of file storage data structure.
  * FileStorage_t is made up essentially by:
  *	- a hashtable that maps current used filenames to their respective FileData_t objects;
- *	- a FIFO concurrent queue that contains filenames of any file inserted in the hashtable.
- *		Each time a file is removed its name is also removed.
+ *	- a replacement list (replpolicy.h) that links ALL files inserted in the hashtable
+ *		according to the configured policy (FIFO, LRU, LFU, CLOCK). Links are embedded
+ *		in files, so each time a file is removed it is unlinked in O(1).
  *	- a mutex used to execute write/append operations only ONE at a time: this is necessary to
  *		avoid multiple file writings such that each one does NOT exceed file/storage capacity,
  *		but together do. This mutex is used ONLY by these functions.
@@ -12,6 +13,33 @@
  * The lock on the hashtable can be acquired in "reading" mode even by fs_write/append functions,
  * since they do not modify the hashtable itself, and most of the times a read and a write on
  * different files could be executed concurrently.
+ * The hashtable and its gate can be partitioned by hash of pathname into N shards
+ * (FileStorageShards in config.txt): operations on a single file use ONLY the gate
+ * of its shard, while operations that involve the whole storage (cache replacement,
+ * readN, cleanup) use the "global" gate, i.e. the gates of ALL shards acquired in
+ * increasing order. Current number of files and occupied space are updated
+ * atomically, such that the global path is taken ONLY when a limit is crossed.
+ * For each client, the storage keeps the set of pathnames of the files on which
+ * it has some state (opened, locked or waiting for lock), such that fs_clientCleanup
+ * visits ONLY them instead of ALL the files: moreover, when the sweeper is running
+ * (fs_sweeper_start), fs_clientCleanup releases ONLY the locks of the client and
+ * the remaining state is reclaimed in background, a few files at a time; the
+ * sweeper also expires the waits for a file lock with a timeout (fs_lock).
+ * Optionally (fs_largeObjects), files above a size threshold form a class of
+ * "large" files with their own budget of space: a large write expels ONLY
+ * large files for staying within the budget, and it is charged to large files
+ * first when making room in the storage, such that it CANNOT flush the whole
+ * set of (small) hot files. Cache replacement computes the whole set of victims
+ * at once, and expelled files are sent back to the client in a single batch.
+ * Optionally (fs_persist), ALL the modifications are logged in a journal and
+ * the storage is periodically saved to a snapshot (see persist.h), from which
+ * it is restored at startup.
+ * Batches of compound operations (fs_fetchN, fs_putN) acquire ONCE the gates of
+ * ALL the shards involved and visit their hashtables in order of bucket.
+ * File and storage capacities can be changed while the storage is running
+ * (fs_resize), expelling files a batch at a time when they are lowered, and
+ * chained hashtables can be rehashed incrementally, moving a few buckets of
+ * each shard at a time (fs_rehash, fs_rehash_step).
  *
  * @author Salvatore Correnti
  */
@@ -22,85 +50,259 @@
 #include <defines.h>
 #include <util.h>
 #include <icl_hash.h>
+#include <rhtable.h>
 #include <linkedlist.h>
 #include <tsqueue.h>
 #include <fdata.h>
+#include <replpolicy.h>
+#include <persist.h>
 
 /* Flags for replacement algorithm */
 #define R_CREATE 1
 #define R_WRITE 2
+#define R_LARGE 3 /* Expels large files until the space charged to them (plus size) is within their budget */
 
-/* Default maxclient value for fdata_create */
-#define DFL_MAXCLIENT 1023
+/* Hashtable implementations for shards */
+#define FS_TABLE_CHAINED 0 /* icl_hash: fixed number of buckets with chaining */
+#define FS_TABLE_RH 1 /* rhtable: resizable Robin Hood open addressing */
+
+/* Size and number of pages of the per-client index of files (see FileStorage_t) */
+#define FS_CIDX_PAGESIZE 1024
+#define FS_CIDX_NPAGES 1024
+
+/* Number of mutexes guarding the per-client index (client i uses #i % FS_CIDX_LOCKS) */
+#define FS_CIDX_LOCKS 64
+
+/* Maximum number of files visited by the sweeper before yielding */
+#define FS_SWEEP_BATCH 32
+
+/* Initial capacity of the heap of lock waits with a timeout */
+#define FS_LWAITS_SIZE 16
+
+/* Maximum number of files and bytes by which a capacity is lowered in a single step of fs_resize */
+#define FS_RESIZE_FILES 64
+#define FS_RESIZE_BYTES (4 * MBVALUE * KBVALUE)
+
+/* Maximum number of buckets of a chained hashtable moved in a single step of fs_rehash_step */
+#define FS_REHASH_BUCKETS 64
+
+/* Distance (in items) at which buckets are prefetched by batched operations (fs_fetchN, fs_putN) */
+#define FS_PREFETCH_DIST 4
 
 /* Cyan-colored string for fs_dump */
 #define FSDUMP_CYAN "\033[1;36mfs_dump:\033[0m"
 
 /**
- * @brief Struct for hosting <size, content> couples for fs_readN.
+ * @brief Struct for hosting <size, content> couples for fs_readN (and
+ * expelled files for the sendBackHandler).
+ * @note content is a reference to file content (NOT a copy), released
+ * by fcontent_destroy.
  */
 typedef struct fcontent_s {
 	char* filename;
 	size_t size;
-	void* content;
+	fbody_t* content;
+	bool modified; /* Expelled files ONLY: true <=> file has been modified since its creation */
 } fcontent_t;
 
 
 
 /**
- * @brief Struct describing the filesystem.
+ * @brief Struct describing a shard of the filesystem, i.e. a partition of
+ * the mappings pathname->file (by hash of pathname) with its own gate.
  */
-typedef struct FileStorage_s {
+typedef struct fs_shard_s {
 
-	icl_hash_t* fmap; /* Table of ALL current CORRECT mapping pathname->offset */
+	/* Table of ALL current CORRECT mapping pathname->offset in the shard (exactly one is NOT NULL) */
+	icl_hash_t* fmap; /* FS_TABLE_CHAINED */
+	rhtable_t* rmap; /* FS_TABLE_RH */
 
-	pthread_mutex_t gblock; /* mutex per ogni operazione di fs_rop_*, fs_wop_*, fs_lock/unlock */
+	pthread_mutex_t gblock; /* mutex per ogni operazione sullo shard */
 	int waiters[2]; /* waiters[i] == #{threads in attesa per un'operazione di tipo i} */
 	pthread_cond_t conds[2]; /* actives[i] == #{threads sospesi per un'operazione di tipo i} */	
 	int state; /* actives[i] == #{threads attivi su un'operazione di tipo i} */
+	pthread_mutex_t jlock; /* Keeps writes and their journal records in the same order (ONLY with persistence) */
+
+} fs_shard_t;
+
+
+/**
+ * @brief Iterator over the hashtable of a shard (independent of implementation).
+ */
+typedef struct fmap_iter_s {
+	fs_shard_t* shard;
+	int bucket; /* Next bucket (FS_TABLE_CHAINED) */
+	icl_entry_t* ent; /* Next entry in the current bucket (FS_TABLE_CHAINED) */
+	rht_iter_t rit; /* FS_TABLE_RH */
+} fmap_iter_t;
+
+
+/**
+ * @brief Cursor for reading files one at a time (streaming readNFiles):
+ * a snapshot of pathnames taken by fs_cursor_init, whose files are read
+ * by fs_cursor_next WITHOUT holding any gate between two of them.
+ */
+typedef struct fs_cursor_s {
+	char** keys; /* Copies of pathnames */
+	int nkeys; /* len(keys) */
+	int next; /* Index of the next key to read */
+} fs_cursor_t;
+
+
+/**
+ * @brief Item of a batched operation (fs_fetchN, fs_putN): items are sorted
+ * by shard, such that gates are acquired in increasing order, and then by
+ * home bucket, such that lookups visit each hashtable in order.
+ */
+typedef struct fs_bitem_s {
+	int idx; /* Index of the file in the batch */
+	int shard; /* Index of the shard of its pathname */
+	size_t bucket; /* Home bucket of its pathname in the hashtable of the shard */
+} fs_bitem_t;
+
+
+/**
+ * @brief Files of a client in the per-client index (keys are copies of pathnames, data == key).
+ */
+typedef struct fs_cfiles_s {
+	rhtable_t* files; /* Files on which client has some state (NULL if none) */
+	rhtable_t* locks; /* Files of #files that client has locked or is waiting for (NULL if none) */
+} fs_cfiles_t;
+
+
+/**
+ * @brief Pending reclamation of the state of a disconnected client (see fs_sweeper_start).
+ */
+typedef struct fs_sweep_s {
+	int client;
+	rhtable_t* files; /* Files to visit (as in fs_cfiles_t) */
+	rht_iter_t it; /* Next file to visit */
+	struct fs_sweep_s* next;
+} fs_sweep_t;
+
+
+/**
+ * @brief Wait for a file lock with a timeout (see fs_lock), enforced by the sweeper.
+ */
+typedef struct fs_lwait_s {
+	char* pathname; /* Copy of the pathname of the file */
+	int client;
+	uint64_t deadline; /* When the wait expires (see stats_now) */
+} fs_lwait_t;
+
+
+/**
+ * @brief Struct describing the filesystem.
+ */
+typedef struct FileStorage_s {
+
+	fs_shard_t* shards; /* Array of shards */
+	int nshards; /* len(shards) */
 
 	int maxFileNo; /* Maximum number of storable files */
 	size_t storageCap; /* Storage capacity in KBytes */
-	tsqueue_t* replQueue; /* FIFO queue for tracing file(s) to remove */
-	size_t spaceSize; /* Current total size of the occupied space */
+	replpolicy_t* repl; /* Replacement list for tracing file(s) to remove */
+	int codec; /* Codec of file content at rest (one of CODEC_*) */
+	bool dedup; /* true <=> file content is deduplicated (by extents) among files */
+	size_t spaceSize; /* Current size of the space charged to files, i.e. compressed size of NOT shared extents (atomic) */
+	int fileno; /* Current number of files (atomic) */
+	persist_t* persist; /* Journal and snapshot (NULL if persistence is disabled) */
+
+	/* Large files (see fs_largeObjects) */
+	size_t maxObjSize; /* Maximum size of a file (0 if there is no limit apart from storageCap) */
+	size_t largeSize; /* Minimum size of a large file (0 if there is no class of large files) */
+	size_t largeBudget; /* Maximum space charged to large files */
+	size_t largeSpace; /* Current space charged to large files (atomic) */
+
+	/*
+	Per-client index: cidx[c / FS_CIDX_PAGESIZE][c % FS_CIDX_PAGESIZE] are the files of client c (NULL
+	if none), pages are lazily allocated as the per-fd table in protocol.c, while the files of a client
+	are created/modified ONLY under the corresponding mutex.
+	*/
+	fs_cfiles_t** cidx[FS_CIDX_NPAGES];
+	pthread_mutex_t cidxLocks[FS_CIDX_LOCKS];
+
+	/* Sweeper (see fs_sweeper_start) */
+	pthread_t sweeper;
+	bool sweeperOn; /* true <=> sweeper has been started and NOT stopped yet */
+	bool sweeperStop; /* true <=> sweeper shall terminate */
+	fs_sweep_t* sweepHead; /* Queue of pending reclamations */
+	fs_sweep_t* sweepTail;
+	fs_lwait_t* lwaits; /* Lock waits with a timeout, as a binary min-heap by deadline (lwaits[0] is the earliest) */
+	int nlwaits; /* len(lwaits) */
+	int lwaitsCap;
+	pthread_mutex_t sweepLock; /* Guards the members above */
+	pthread_cond_t sweepCond; /* For waking up the sweeper */
+	int (*sweepDone)(void* arg, int client); /* Called when ALL the state of client has been reclaimed */
+	int (*lockExpired)(void* arg, int client); /* Called when the lock wait of client has expired */
+	void* sweepArg;
 
-	/* Statistics members (la mutua esclusione è garantita dal fatto che sono tutti modificati da operazioni che settano active_cwr) */
+	/* Statistics members (la mutua esclusione è garantita dal fatto che sono tutti modificati da operazioni globali, eccetto i massimi, cleanupCount e lockTimeouts che sono atomici) */
 	int maxFileHosted; /* MAX(#file ospitati) */
-	int maxSpaceSize; /* MAX(#dimensione dello storage) */
+	size_t maxSpaceSize; /* MAX(#dimensione dello storage) */
 	int replCount; /* #esecuzioni del cache replacement */
 	int cleanupCount; /* #esecuzioni di fs_clientCleanup */
+	int lockTimeouts; /* #attese di lock scadute (atomico) */
 	int evictedFiles; /* #files espulsi */
 	int fcap_replCount; /* #Esecuzioni del cache replacement per overflow del massimo numero di files */
 	int scap_replCount; /* #Esecuzioni del cache replacement per overflow della capacità di storage */
+	int lcap_replCount; /* #Esecuzioni del cache replacement per overflow del budget dei file grandi */
+	int rejectedFiles; /* #scritture rifiutate per dimensione del file (atomico) */
+	int resizeCount; /* #Esecuzioni del cache replacement per riduzione delle capacità (fs_resize) */
 
 } FileStorage_t;
 
 fcontent_t*
-	fcontent_init(char* pathname, size_t size, void* content);
+	fcontent_init(char* pathname, size_t size, fbody_t* content);
 	
 void
-	fcontent_destroy(fcontent_t* fc);
+	fcontent_destroy(fcontent_t* fc),
+	fs_cursor_destroy(fs_cursor_t* cursor);
 
 
 	/* Creation / Destruction */
-	FileStorage_t* fs_init(int nbuckets, size_t storageCap, int maxFileNo);
+	FileStorage_t* fs_init(int nbuckets, int nshards, size_t storageCap, int maxFileNo, int replPolicy, int tableType, int codec, bool dedup);
 	int	fs_destroy(FileStorage_t* fs);
 
+	/* Background reclamation of disconnected clients */
+	int fs_sweeper_start(FileStorage_t* fs, int (*done)(void* arg, int client), int (*expired)(void* arg, int client), void* arg);
+	int fs_sweeper_stop(FileStorage_t* fs);
+
+	/* Persistence */
+	int fs_persist(FileStorage_t* fs, char* dir, int syncms, int snapInterval);
+	int fs_snapshot(FileStorage_t* fs);
+
+	/* Large files */
+	int fs_largeObjects(FileStorage_t* fs, size_t maxSize, size_t threshold, size_t budget);
+
+	/* Live reconfiguration */
+	int fs_resize(FileStorage_t* fs, size_t storageCap, int maxFileNo, int (*waitHandler)(int chan, fd_waiter_t* waiters), int chan);
+	int fs_rehash(FileStorage_t* fs, int nbuckets);
+	int fs_rehash_step(FileStorage_t* fs);
+
 int
 	/* Modifying operations */
-	fs_create(FileStorage_t* fs, char* pathname, int client, bool locking, int (*waitHandler)(int chan, tsqueue_t* waitQueue), int chan),
+	fs_create(FileStorage_t* fs, char* pathname, int client, bool locking, int (*waitHandler)(int chan, fd_waiter_t* waiters), int chan),
 	fs_clientCleanup(FileStorage_t* fs, int client, llist_t** newowners_list),
-	fs_remove(FileStorage_t* fs, char* pathname, int client, int (*waitHandler)(int chan, tsqueue_t* waitQueue), int chan),
+	fs_remove(FileStorage_t* fs, char* pathname, int client, int (*waitHandler)(int chan, fd_waiter_t* waiters), int chan),
+	fs_put(FileStorage_t* fs, char* pathname, void* buf, size_t size, int client,
+		int (*waitHandler)(int chan, fd_waiter_t* waiters), int (*sendBackHandler)(fcontent_t** files, int n, int cfd), int chan),
+	fs_putN(FileStorage_t* fs, char** pathnames, void** bufs, size_t* sizes, int n, int* errs, int client,
+		int (*waitHandler)(int chan, fd_waiter_t* waiters), int (*sendBackHandler)(fcontent_t** files, int n, int cfd), int chan),
 	
 	/* Non-modifying operations that DO NOT call modifying ones */
 	fs_open(FileStorage_t* fs, char* pathname, int client, bool locking),
 	fs_close(FileStorage_t* fs, char* pathname, int client),
-	fs_read(FileStorage_t* fs, char* pathname, void** buf, size_t*, int client),
+	fs_read(FileStorage_t* fs, char* pathname, fbody_t** body, size_t* size, int client),
 	fs_readN(FileStorage_t* fs, int client, int N, llist_t** results),
+	fs_fetch(FileStorage_t* fs, char* pathname, fbody_t** body, size_t* size, int client),
+	fs_fetchN(FileStorage_t* fs, char** pathnames, int n, fbody_t** bodies, size_t* sizes, int* errs, int client),
+	fs_cursor_init(FileStorage_t* fs, int N, fs_cursor_t* cursor),
+	fs_cursor_next(FileStorage_t* fs, fs_cursor_t* cursor, int client, char** filename, fbody_t** body, size_t* size),
 	
 	/* Non-modifying operations that COULD call modifying ones */
 	fs_write(FileStorage_t* fs, char* pathname, void* buf, size_t size, int client, bool wr,
-		int (*waitHandler)(int chan, tsqueue_t* waitQueue), int (*sendBackHandler)(char* pathname, void* content, size_t size, int cfd, bool modified), int chan),
+		int (*waitHandler)(int chan, fd_waiter_t* waiters), int (*sendBackHandler)(fcontent_t** files, int n, int cfd), int chan),
 	
 	/**
 	 * @brief Registrazione di cosa ogni thread vuole fare:
@@ -115,6 +317,7 @@ int
 	 * @note Questa "api" è di fatto equivalente a una read-write lock di tipo
 	 * writer-preferred con la possibilità per uno scrittore di "trasformarsi"
 	 * in lettore atomicamente.
+	 * @note Queste funzioni agiscono su TUTTI gli shard (percorso "globale").
 	*/
 	fs_rop_init(FileStorage_t* fs),
 	fs_wop_init(FileStorage_t* fs),
@@ -122,8 +325,8 @@ int
 	fs_op_downgrade(FileStorage_t* fs),
 	
 	/* Locking / Unlocking */
-	fs_lock(FileStorage_t* fs, char* pathname, int client),
-	fs_unlock(FileStorage_t* fs, char* pathname, int client, llist_t** newowner);
+	fs_lock(FileStorage_t* fs, char* pathname, int client, int msec),
+	fs_unlock(FileStorage_t* fs, char* pathname, int client, int* newowner);
 
 
 void
@@ -0,0 +1,51 @@
+/**
+ * @brief Latency histograms in the style of HdrHistogram: values (e.g.
+ * nanoseconds) are counted in log-linear buckets, i.e. each power of 2 is
+ * split in HIST_SUBBUCKETS buckets of equal width, such that ANY value in
+ * [0, 2^64) is stored with a relative error of at most 1/HIST_SUBBUCKETS
+ * in a fixed amount of memory and recording is a constant-time increment.
+ * A histogram has a SINGLE writer (hist_record), but it can be read (see
+ * hist_merge) by other threads at the same time WITHOUT any lock: in that
+ * case, the result is a (slightly) approximated snapshot.
+ *
+ * @author Salvatore Correnti
+ */
+#if !defined(_HISTOGRAM_H)
+#define _HISTOGRAM_H
+
+#include <defines.h>
+#include <stdint.h>
+
+/* log2 of the number of buckets for each power of 2 */
+#define HIST_SUBBITS 5
+#define HIST_SUBBUCKETS (1 << HIST_SUBBITS)
+
+/* Number of buckets for covering ALL the values in [0, 2^64) */
+#define HIST_NBUCKETS ((64 - HIST_SUBBITS + 1) * HIST_SUBBUCKETS)
+
+
+typedef struct hist_s {
+	uint64_t counts[HIST_NBUCKETS];
+	uint64_t count; /* #recorded values */
+	uint64_t sum; /* Sum of recorded values */
+	uint64_t max; /* Maximum recorded value */
+} hist_t;
+
+
+hist_t*
+	hist_init(void);
+
+int
+	hist_record(hist_t* h, uint64_t value),
+	hist_merge(hist_t* dst, hist_t* src),
+	hist_reset(hist_t* h),
+	hist_printJSON(hist_t* h, FILE* stream, double scale),
+	hist_destroy(hist_t* h);
+
+uint64_t
+	hist_percentile(hist_t* h, double p);
+
+double
+	hist_mean(hist_t* h);
+
+#endif /* _HISTOGRAM_H */
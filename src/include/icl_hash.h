@@ -28,6 +28,9 @@ typedef struct icl_hash_s {
     icl_entry_t **buckets;
     unsigned int (*hash_function)(void*);
     int (*hash_key_compare)(void*, void*);
+    icl_entry_t **oldbuckets; /* Buckets being moved by an incremental resize (see icl_hash_resize), NULL otherwise */
+    int oldnbuckets;
+    int rehashidx; /* oldbuckets[0, ..., rehashidx-1] have ALREADY been moved */
 } icl_hash_t;
 
 icl_hash_t *
@@ -46,6 +49,9 @@ icl_hash_destroy(icl_hash_t *, void (*)(void*), void (*)(void*)),
 
 int icl_hash_delete( icl_hash_t *ht, void* key, void (*free_key)(void*), void (*free_data)(void*) );
 
+int icl_hash_resize( icl_hash_t *ht, int nbuckets ),
+    icl_hash_rehash( icl_hash_t *ht, int n );
+
 /* simple hash function */
 unsigned int hash_pjw(void* key);
 
@@ -53,6 +59,7 @@ unsigned int hash_pjw(void* key);
 int string_compare(void* a, void* b);
 
 
+/* NOT for a table being resized (see icl_hash_resize) */
 #define icl_hash_foreach(ht, tmpint, tmpent, kp, dp)    \
     for (tmpint=0;tmpint<ht->nbuckets; tmpint++)        \
         for (tmpent=ht->buckets[tmpint];                                \
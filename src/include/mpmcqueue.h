@@ -0,0 +1,61 @@
+/**
+ * @brief Bounded lock-free multi-producer/multi-consumer queue (ring of
+ * sequenced cells in the style of D. Vyukov's), as an alternative to tsqueue
+ * for hot dispatching paths. Push and pop are a single CAS in the common
+ * case and NO allocation is made after initialization. Consumers can pop
+ * more items at a time and park on a futex (instead of a condition variable)
+ * when the queue is empty; producers wake them ONLY if someone is parked.
+ * As for tsqueue, the queue can be closed: mpmcq_push fails from then on,
+ * while mpmcq_pop keeps working until the queue is empty.
+ *
+ * @author Salvatore Correnti
+ */
+#if !defined(_MPMCQUEUE_H)
+#define _MPMCQUEUE_H
+
+#include <defines.h>
+#include <util.h>
+#include <tsqueue.h> /* QRET_* and queue_state_t */
+#include <stdint.h>
+
+/* Default capacity of a queue (rounded up to a power of 2) */
+#define MPMCQ_DFL_SIZE 4096
+
+/* Cache line size for avoiding false sharing between producers and consumers */
+#define MPMCQ_CACHELINE 64
+
+
+/* A single cell of the ring: seq says whether it can be written or read at a given position */
+typedef struct mpmcq_cell_s {
+	size_t seq;
+	void* elem;
+} mpmcq_cell_t;
+
+
+typedef struct mpmcq_s {
+	mpmcq_cell_t* cells;
+	size_t mask; /* len(cells) - 1 */
+	char pad0[MPMCQ_CACHELINE];
+	size_t pushPos; /* Next position to write, atomically updated */
+	char pad1[MPMCQ_CACHELINE];
+	size_t popPos; /* Next position to read, atomically updated */
+	char pad2[MPMCQ_CACHELINE];
+	int event; /* Futex word, incremented by each push and by close */
+	int sleepers; /* Number of parked consumers */
+	int state; /* queue_state_t */
+} mpmcq_t;
+
+
+mpmcq_t*
+	mpmcq_init(size_t size);
+
+int
+	mpmcq_push(mpmcq_t* q, void* elem),
+	mpmcq_pop(mpmcq_t* q, void** elems, int max, bool nonblocking),
+	mpmcq_close(mpmcq_t* q),
+	mpmcq_destroy(mpmcq_t* q, void(*freeItems)(void*));
+
+size_t
+	mpmcq_getSize(mpmcq_t* q);
+
+#endif /* _MPMCQUEUE_H */
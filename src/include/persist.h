@@ -0,0 +1,149 @@
+/**
+ * @brief Optional persistence of the file storage in a directory, made up of:
+ *	- an append-only journal of the operations that modify the set of files or
+ *	their content (creation, writing, removal and eviction), split in segments
+ *	"journal.<N>" and written by a flusher thread that commits ALL the records
+ *	accumulated in the meantime with a single write + fdatasync (group commit);
+ *	- a snapshot "snapshot" of the whole content of the storage at the beginning
+ *	of a journal segment, which is mapped in memory at startup such that files
+ *	are served directly from the mapping (see fdata_map) and startup time does
+ *	NOT depend on the size of data.
+ * Operations are NOT delayed until their records are durable: on a crash, at
+ * most the last JournalSyncMs milliseconds of operations can be lost. Each new
+ * snapshot is written aside and then atomically renamed, and ALL the journal
+ * segments before it are deleted.
+ *
+ * @author Salvatore Correnti
+ */
+#if !defined(_PERSIST_H)
+#define _PERSIST_H
+
+#include <defines.h>
+#include <util.h>
+#include <fdata.h>
+#include <stdint.h>
+
+/* Types of journal records */
+#define PR_CREATE 1 /* File creation (no data) */
+#define PR_APPEND 2 /* Data written at the end of the file */
+#define PR_REMOVE 3 /* File removal or eviction (no data) */
+
+/* Default interval between two group commits */
+#define PR_DFL_SYNCMS 10
+
+/* Pending bytes beyond which the flusher is woken up immediately */
+#define PR_FLUSHLEN 1048576
+
+/* Pending bytes beyond which logging operations wait for the flusher (backpressure) */
+#define PR_MAXPENDING (64 * 1048576)
+
+/* Magic numbers of journal records and snapshot files */
+#define PR_REC_MAGIC 0x4c4e524aU /* "JRNL" */
+#define PR_SNAP_MAGIC "SOLSNAP1"
+
+/* Cyan-colored string for persist_dump */
+#define PERSISTDUMP_CYAN "\033[1;36mpersist_dump:\033[0m"
+
+
+/**
+ * @brief Header of a journal record, followed by pathlen bytes of pathname
+ * ('\0' included) and datalen bytes of data.
+ */
+typedef struct pr_record_s {
+	uint32_t magic; /* PR_REC_MAGIC */
+	uint32_t type; /* One of PR_* */
+	uint32_t pathlen;
+	uint32_t sum; /* Checksum of pathname and data */
+	uint64_t datalen;
+} pr_record_t;
+
+
+/**
+ * @brief Header of a snapshot, followed by nfiles entries.
+ */
+typedef struct pr_snaphdr_s {
+	char magic[8]; /* PR_SNAP_MAGIC (without '\0') */
+	uint64_t segment; /* First journal segment NOT contained in the snapshot */
+	uint64_t nfiles;
+} pr_snaphdr_t;
+
+
+/**
+ * @brief Header of a file in a snapshot, followed by pathlen bytes of pathname
+ * ('\0' included) and len bytes of stored content.
+ */
+typedef struct pr_snapentry_s {
+	uint32_t pathlen;
+	int32_t codec; /* Codec of stored content (one of CODEC_*) */
+	uint64_t size; /* File size */
+	uint64_t len; /* Bytes of stored content */
+} pr_snapentry_t;
+
+
+/**
+ * @brief A file to be written in a snapshot.
+ */
+typedef struct pr_file_s {
+	char* pathname;
+	int codec;
+	size_t size;
+	fbody_t* body; /* Stored content (NULL if empty) */
+} pr_file_t;
+
+
+typedef struct persist_s {
+
+	char* dir; /* Directory of journal and snapshot */
+	int syncms; /* Interval between two group commits */
+	int snapInterval; /* Seconds between two snapshots (0 if never, except at termination) */
+	int (*snapshotFn)(void* arg); /* Takes a snapshot (by persist_cut + persist_snapshot) */
+	void* arg;
+
+	pthread_mutex_t lock;
+	pthread_cond_t fcond; /* Flusher wake-up */
+	pthread_cond_t scond; /* Snapshotter wake-up */
+	pthread_cond_t dcond; /* Pending records have been written */
+	char* buf; /* Pending records */
+	size_t len; /* Bytes of pending records */
+	size_t cap; /* len(buf) */
+	long cutlen; /* Bytes of buf belonging to the previous segment (-1 if no cut is pending) */
+	uint64_t segment; /* Current segment (records are logged to it) */
+	int fd; /* Current segment file (ONLY for the flusher) */
+	bool stop; /* Flusher termination */
+	bool sstop; /* Snapshotter termination */
+	bool started; /* true <=> flusher is running, i.e. records can be logged */
+	bool snapping; /* true <=> snapshotter is running */
+	pthread_t flusher;
+	pthread_t snapshotter;
+
+	void* map; /* Snapshot mapped at startup */
+	size_t maplen;
+
+	/* Statistics */
+	long records; /* #records logged */
+	long commits; /* #group commits */
+	size_t bytes; /* #bytes written to the journal */
+	int snapshots; /* #snapshots taken */
+
+} persist_t;
+
+
+persist_t*
+	persist_open(char* dir, int syncms);
+
+int
+	persist_load(persist_t* p, int (*fileFn)(void* arg, char* pathname, int codec, size_t size, void* data, size_t len),
+		int (*recordFn)(void* arg, int type, char* pathname, void* data, size_t len), void* arg),
+	persist_start(persist_t* p, int snapInterval, int (*snapshotFn)(void* arg), void* arg),
+	persist_log(persist_t* p, int type, char* pathname, void* data, size_t len),
+	persist_snapshot(persist_t* p, uint64_t segment, pr_file_t* files, size_t nfiles),
+	persist_stopSnapshots(persist_t* p),
+	persist_close(persist_t* p);
+
+uint64_t
+	persist_cut(persist_t* p);
+
+void
+	persist_dump(persist_t* p, FILE* stream);
+
+#endif /* _PERSIST_H */
@@ -10,6 +10,7 @@
 #include <defines.h>
 #include <util.h>
 #include <fflags.h>
+#include <stdint.h>
 
 /**
  * @brief Types of messages that client and server can send each other.
@@ -29,36 +30,136 @@
  * M_APPENDF -> Request to append content to a file. Contains two arguments, i.e. the path of
  * the file and the content to append with its size in bytes.
  * M_CLOSEF -> Request to close a file. Contains one arguments, the path of the file.
+ * M_LOCKF -> Request to lock a file. Contains two arguments, i.e. the path of the file and an
+ * integer for the maximum waiting time in milliseconds (if 0, it waits indefinitely): when it
+ * expires, it is replied by a M_ERR message with ETIMEDOUT.
  * M_REMOVEF -> Request to remove a file from server storage. Contains one arguments, the path
  * of the file.
+ * M_PUTF -> Compound request equivalent to {openFile(O_CREATE | O_LOCK), writeFile, closeFile,
+ * unlockFile} on a new file. Contains two arguments, as M_WRITEF.
+ * M_FETCHF -> Compound request equivalent to {openFile(0), readFile, closeFile}. Contains one
+ * argument, the path of the file, and it is replied as M_READF.
+ * M_STATS -> Request of the live statistics of the server (see stats.h). Contains one argument,
+ * an integer for flags (reserved, 0), and it is replied either by a M_STATS message whose argument
+ * is a JSON object ('\0'-terminated) or by a M_ERR one.
+ * M_FETCHNF -> Batched M_FETCHF on many files (at most MSG_BATCH_MAXFILES). Contains one argument
+ * for each file, its path, and it is replied by a single msg_sendv of a M_GETF message for each file
+ * read (in order of request) followed by a M_FETCHNF message whose argument is an array of int with
+ * the result of each file (0 on success, 'errno' value of the server on error), or by a M_ERR message.
+ * M_PUTNF -> Batched M_PUTF on many files (at most MSG_BATCH_MAXFILES). Contains two arguments for
+ * each file, as M_PUTF, and it is replied by the expelled files (if any) followed by a M_PUTNF message
+ * as for M_FETCHNF, or by a M_ERR message.
  *
  * NOTE: a 'M_OK' or 'M_ERR' message can come as first message from the server or after any other
  * one (e.g., a writing operation causes to send the expelled files BEFORE the ok/err message):
  * their "extra" argument simply indicates how many other messages there are after them (if any).
 */
-typedef enum {M_OK, M_ERR, M_OPENF, M_READF, M_READNF, M_GETF, M_WRITEF, M_APPENDF, M_CLOSEF, M_LOCKF, M_UNLOCKF, M_REMOVEF} msg_t;
+typedef enum {M_OK, M_ERR, M_OPENF, M_READF, M_READNF, M_GETF, M_WRITEF, M_APPENDF, M_CLOSEF, M_LOCKF, M_UNLOCKF, M_REMOVEF, M_PUTF, M_FETCHF, M_STATS, M_FETCHNF, M_PUTNF} msg_t;
 
 /* #{elements} in the above enum */
-#define MTYPES_SIZE 12
+#define MTYPES_SIZE 17
 
-/* A single information packet: len + content! */
+/* Maximum number of files of a batched request (M_FETCHNF, M_PUTNF) */
+#define MSG_BATCH_MAXFILES 1024
+
+/**
+ * A single information packet: len + content!
+ * If iovcnt > 0, content is an array of iovcnt (struct iovec) whose total
+ * length is len, and it is sent by scatter-gather (NEVER received this way).
+ */
 typedef struct packet_s {
 	size_t len;
 	void* content;
+	int iovcnt;
 } packet_t;
 
 
 typedef struct message_s {
 	msg_t type;
-	ssize_t argn; /* Number of other arguments (all of them in separate writes on socket) */
+	ssize_t argn; /* Number of other arguments */
 	packet_t* args;
+	uint32_t reqid; /* Request ID (see msg_setreqid), ALWAYS 0 in legacy format */
 } message_t;
 
 
+/**
+ * Wire formats of a connection:
+ *	- MSG_LEGACY: type, argn and each <len, content> are written separately;
+ *	- MSG_FRAMED: a fixed header (mframe_t) carrying type, argn and (at most)
+ *	MSG_FRAME_INLINE argument lengths, possibly followed by the remaining lengths,
+ *	followed by ALL contents, written by a single writev.
+ * MSG_AUTO means that format is not yet known: it is detected by the first
+ * message received (by the magic number of a framed header) and then used for
+ * sending, while it is handled as MSG_LEGACY when sending before receiving.
+ *
+ * A framed message also carries a request ID: each fd has a current one, that
+ * is set either explicitly (msg_setreqid, e.g. by a client before sending a
+ * request) or by the last message received on it, and that is stamped on any
+ * message sent on it with (msg->reqid == 0). Hence a server echoes the ID of
+ * a request in ALL the messages of its reply with NO change to its handlers,
+ * and a client can pipeline requests and match replies by their IDs.
+ */
+#define MSG_AUTO 0
+#define MSG_LEGACY 1
+#define MSG_FRAMED 2
+
+/* Magic number of a framed header ("SOLF"); a legacy message starts with a (small) msg_t */
+#define MSG_FRAME_MAGIC 0x534F4C46u
+
+/* Number of argument lengths carried by a framed header */
+#define MSG_FRAME_INLINE 4
+
+/* Maximum number of arguments of a received framed message */
+#define MSG_FRAME_MAXARGN 4096
+
+
+/* Maximum number of arguments of a message built on the stack by msend */
+#define MSG_STACK_ARGS 8
+
+/* Default chunk size of a message arena */
+#define MARENA_DFL_SIZE 65536
+
+/* Alignment of arena allocations */
+#define MARENA_ALIGN 16
+
+
+/**
+ * @brief Bump allocator for received messages (message_t, packet_t array and
+ * contents), reset after each request such that NO allocation is made in steady
+ * state. Allocations bigger than a quarter of the chunk (e.g. file contents)
+ * are malloc'd separately and freed on reset.
+ */
+typedef struct marena_s {
+	char* chunk; /* Preallocated memory */
+	size_t size; /* len(chunk) */
+	size_t used; /* Bytes of chunk currently allocated */
+	void** large; /* Separately allocated blocks */
+	int nlarge; /* Number of blocks in large */
+	int caplarge; /* len(large) */
+} marena_t;
+
+
+/* Header of a framed message */
+typedef struct mframe_s {
+	uint32_t magic; /* MSG_FRAME_MAGIC */
+	uint32_t type; /* msg_t */
+	uint32_t argn;
+	uint32_t reqid; /* Request ID (0 if none) */
+	uint64_t lens[MSG_FRAME_INLINE]; /* Lengths of the first arguments (unused ones are 0) */
+} mframe_t;
+
+
 /* ************************************ Prototypes ************************************* */
 
 int
-	print_reqtype(msg_t type, char* buf, size_t size);
+	print_reqtype(msg_t type, char* buf, size_t size),
+	msg_getformat(int fd),
+	msg_setformat(int fd, int format),
+	msg_setreqid(int fd, uint32_t reqid),
+	msg_peektype(int fd);
+
+uint32_t
+	msg_getreqid(int fd);
 
 ssize_t
 	getArgn(msg_t);
@@ -72,13 +173,26 @@ void*
 message_t*
 	msg_init(void);
 
+marena_t*
+	marena_init(size_t size);
+
+void*
+	marena_alloc(marena_t* arena, size_t size);
+
+void
+	marena_reset(marena_t* arena),
+	marena_destroy(marena_t* arena);
+
 int
 	msg_make(message_t*, msg_t, ...),
 	msg_destroy(message_t*, void(*freeArgs)(void*), void(*freeContent)(void*)),
 	msg_send(message_t*, int),
+	msg_sendv(message_t* msgs, int n, int fd),
 	msg_recv(message_t*, int),
+	msg_recv_arena(message_t* msg, int fd, marena_t* arena),
 	msend(int fd, message_t** msg, msg_t type, char* creatmsg, char* sendmsg, ...),
-	mrecv(int fd, message_t** msg, char* creatmsg, char* recvmsg);
+	mrecv(int fd, message_t** msg, char* creatmsg, char* recvmsg),
+	mrecv_arena(int fd, message_t** msg, marena_t* arena);
 
 void
 	printMsg(message_t*);
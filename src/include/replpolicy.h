@@ -0,0 +1,130 @@
+/**
+ * @brief Pluggable cache replacement policies for the file storage.
+ * Files are linked in intrusive doubly linked lists (links are embedded
+ * in FileData_t), such that insertion, removal, access bookkeeping and
+ * victim selection are O(1) and no copy of the pathname is needed. There
+ * is a list for each class of files (normal/large, see fs_largeObjects),
+ * such that victims can be selected in a class without scanning the other
+ * one, and LFU keeps a list for each frequency (bucket) in each class.
+ * Supported policies are:
+ *	- FIFO: victim is the oldest created file (default);
+ *	- LRU: victim is the least recently used file;
+ *	- LFU: victim is the least frequently used file (the one that has reached
+ *	its frequency first among them);
+ *	- CLOCK: second-chance approximation of LRU.
+ * The list has its own mutex for insertions, removals and victim selection,
+ * while accesses (hits/misses) are registered WITHOUT taking it, since they
+ * are made by operations that hold a shard of the storage in "reading" mode:
+ * counters, LFU frequencies and CLOCK reference bits are updated atomically,
+ * and LRU promotions are deferred in a lock-free buffer that is drained
+ * (under the mutex) before insertions and victim selections.
+ *
+ * @author Salvatore Correnti
+ */
+#if !defined(_REPLPOLICY_H)
+#define _REPLPOLICY_H
+
+#include <defines.h>
+#include <util.h>
+#include <fdata.h>
+
+/* Replacement policies */
+#define RP_FIFO 0
+#define RP_LRU 1
+#define RP_LFU 2
+#define RP_CLOCK 3
+
+/* Classes of files */
+#define RC_ANY -1 /* ONLY for victim selection */
+#define RC_NORMAL 0
+#define RC_LARGE 1
+#define RC_NUM 2
+
+/* Slots of the deferred promotions buffer (LRU) */
+#define REPL_PBUFSIZE 256
+
+/* Attempts to find a free slot in the deferred promotions buffer */
+#define REPL_PBUFTRIES 4
+
+/* Cyan-colored string for repl_dump */
+#define REPLDUMP_CYAN "\033[1;36mrepl_dump:\033[0m"
+
+
+/**
+ * @brief Intrusive list of files, ordered by stamp (head is the oldest one).
+ */
+typedef struct repl_list_s {
+	FileData_t* head;
+	FileData_t* tail;
+} repl_list_t;
+
+
+/**
+ * @brief Files with the same frequency (LFU).
+ */
+typedef struct repl_bucket_s {
+	repl_list_t files;
+	unsigned int freq;
+	struct repl_bucket_s* prev;
+	struct repl_bucket_s* next; /* Next bucket by increasing frequency */
+} repl_bucket_t;
+
+
+/**
+ * @brief Files of a class: the head of files is the first candidate victim
+ * for FIFO and LRU, the hand is the clock hand for CLOCK, buckets (starting
+ * from one) are ordered by increasing frequency for LFU.
+ */
+typedef struct repl_class_s {
+	repl_list_t files; /* FIFO, LRU, CLOCK */
+	FileData_t* hand; /* Clock hand (CLOCK only, NULL <=> head) */
+	repl_bucket_t one; /* First bucket (freq == 1, NEVER destroyed), other ones are NEVER empty (LFU only) */
+	int size; /* Number of linked files */
+} repl_class_t;
+
+
+/**
+ * @brief Replacement lists, one for each class of files.
+ */
+typedef struct replpolicy_s {
+
+	int policy; /* One of RP_* */
+	repl_class_t classes[RC_NUM];
+	int size; /* Number of linked files */
+	unsigned long clock; /* Last stamp given to a file */
+	unsigned long cpos; /* Stamp of the last file visited by the clock (CLOCK only) */
+	pthread_mutex_t lock; /* Guards ALL fields above and list links of files */
+
+	/* Deferred promotions (LRU), slots are set by CAS and cleared ONLY under lock */
+	FileData_t* pbuf[REPL_PBUFSIZE];
+	unsigned int pnext; /* Next slot to try (atomic) */
+
+	/* Statistics (atomic) */
+	long hits; /* Accesses to existing files */
+	long misses; /* Accesses to non-existing files */
+
+} replpolicy_t;
+
+
+replpolicy_t*
+	repl_init(int policy);
+
+int
+	repl_policy(char* name),
+	repl_insert(replpolicy_t* r, FileData_t* file),
+	repl_remove(replpolicy_t* r, FileData_t* file),
+	repl_access(replpolicy_t* r, FileData_t* file),
+	repl_miss(replpolicy_t* r),
+	repl_reclass(replpolicy_t* r, FileData_t* file),
+	repl_destroy(replpolicy_t* r);
+
+FileData_t*
+	repl_victim(replpolicy_t* r);
+
+FileData_t*
+	repl_victimOf(replpolicy_t* r, int cls, FileData_t* exclude);
+
+void
+	repl_dump(replpolicy_t* r, FILE* stream);
+
+#endif /* _REPLPOLICY_H */
@@ -0,0 +1,91 @@
+/**
+ * @brief Open-addressing hash table with Robin Hood hashing for string keys.
+ * Each slot caches the full 64-bit hash of its key, so that probing compares
+ * strings ONLY when hashes match and resizing does NOT rehash keys.
+ * The table grows incrementally: when the load factor exceeds 7/8 a new table
+ * of double capacity is allocated and the old one is migrated a few slots at
+ * a time by each subsequent insertion/deletion (migrated slots become
+ * tombstones), so there is no stop-the-world rehash.
+ * @note Lookups (rht_find) and iterations do NOT modify the table, so they
+ * can be concurrently executed by multiple readers, while insertions and
+ * deletions require exclusive access.
+ *
+ * @author Salvatore Correnti
+ */
+#if !defined(_RHTABLE_H)
+#define _RHTABLE_H
+
+#include <defines.h>
+#include <stdint.h>
+
+/* Minimum capacity of a table (MUST be a power of 2) */
+#define RHT_MINCAP 16
+
+/* Number of old slots migrated by each insertion/deletion during a resize */
+#define RHT_MIGRATE_STEP 16
+
+
+/**
+ * @brief Slot of a table: hash == RHT_EMPTY means empty slot,
+ * hash == RHT_TOMB means migrated slot (only in the old table).
+ */
+typedef struct rht_slot_s {
+	uint64_t hash;
+	char* key;
+	void* data;
+} rht_slot_t;
+
+#define RHT_EMPTY 0
+#define RHT_TOMB 1
+
+
+/* Single array of slots */
+typedef struct rht_array_s {
+	rht_slot_t* slots; /* NULL iff not allocated */
+	size_t cap; /* len(slots), power of 2 */
+	size_t size; /* Number of (NOT migrated) entries */
+} rht_array_t;
+
+
+typedef struct rhtable_s {
+	rht_array_t cur; /* Current table: ALL insertions go here */
+	rht_array_t old; /* Table being migrated (old.slots == NULL if none) */
+	size_t migrated; /* Next slot of old to migrate */
+	int nentries; /* Total number of entries */
+} rhtable_t;
+
+
+/**
+ * @brief Iterator over ALL entries of a table.
+ */
+typedef struct rht_iter_s {
+	rhtable_t* ht;
+	int which; /* 0 = cur, 1 = old */
+	size_t idx; /* Next slot to visit */
+} rht_iter_t;
+
+
+rhtable_t*
+	rht_create(int nbuckets);
+
+void*
+	rht_find(rhtable_t* ht, char* key);
+
+int
+	rht_insert(rhtable_t* ht, char* key, void* data),
+	rht_delete(rhtable_t* ht, char* key, void (*free_key)(void*), void (*free_data)(void*)),
+	rht_destroy(rhtable_t* ht, void (*free_key)(void*), void (*free_data)(void*)),
+	rht_iter_init(rhtable_t* ht, rht_iter_t* it);
+
+bool
+	rht_iter_next(rht_iter_t* it, char** key, void** data);
+
+uint64_t
+	rht_hash(char* key);
+
+
+/* Iterates over ALL entries of ht, (kp, dp) are set to each (key, data) couple */
+#define rht_foreach(ht, it, kp, dp) \
+	for (rht_iter_init(ht, &it); rht_iter_next(&it, &kp, (void**)&dp); )
+
+#endif /* _RHTABLE_H */
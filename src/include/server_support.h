@@ -7,6 +7,7 @@
 #include <defines.h>
 #include <util.h>
 #include <linkedlist.h>
+#include <stdint.h>
 
 /* WORKERS POOL MANAGER */
 
@@ -25,6 +26,7 @@ wpool_t*
 int
 	wpool_run(wpool_t*, int, void*(*threadFun)(void*), void*),
 	wpool_runAll(wpool_t*, void*(*threadFun)(void*), void**),
+	wpool_grow(wpool_t*, int, void*(*threadFun)(void*), void**),
 	wpool_join(wpool_t*, int),
 	wpool_joinAll(wpool_t*),
 	wpool_retval(wpool_t*, int, void**),
@@ -33,4 +35,119 @@ int
 /* WORKERS POOL MANAGER */
 
 
+/* CONNECTIONS TABLE */
+
+/* Initial length of a connections table */
+#define DFL_CONNTAB_SIZE 1024
+
+/**
+ * @brief State of a single client connection.
+ */
+typedef struct conn_s {
+	int fd; /* Connection file descriptor */
+	bool active; /* true <=> connection is open */
+} conn_t;
+
+
+/**
+ * @brief Table of all client connections indexed by file descriptor, used
+ * when client fds are NOT kept into fd_sets (e.g. with the epoll engine).
+ * The table grows on demand, so there is no limit on the fd values it can
+ * contain apart from the system one.
+ */
+typedef struct conntab_s {
+	pthread_mutex_t lock; /* Guards ALL fields below */
+	conn_t** conns; /* conns[fd] is NULL iff fd has never been used for a connection */
+	int size; /* len(conns) */
+	int nactives; /* Number of active connections */
+} conntab_t;
+
+conntab_t*
+	conntab_init(int size);
+
+int
+	conntab_open(conntab_t*, int),
+	conntab_close(conntab_t*, int),
+	conntab_nactives(conntab_t*),
+	conntab_closeAll(conntab_t*),
+	conntab_destroy(conntab_t*);
+
+bool
+	conntab_isactive(conntab_t*, int);
+
+/* CONNECTIONS TABLE */
+
+
+/* ADMISSION CONTROL */
+
+/* Initial length of an admission table and of a deferred list */
+#define DFL_ADMTAB_SIZE 1024
+#define DFL_DEFERRED_SIZE 64
+
+/**
+ * @brief Token bucket of a single client connection: a request is admitted
+ * ONLY by consuming a token, and tokens are refilled at a constant rate up
+ * to the size of the bucket.
+ */
+typedef struct tbucket_s {
+	double tokens; /* Tokens currently available */
+	uint64_t last; /* Time (ns) of the last refill */
+} tbucket_t;
+
+
+/**
+ * @brief Table of the token buckets of ALL client connections indexed by
+ * file descriptor (growing on demand as conntab_t), with the same rate and
+ * burst for all of them.
+ */
+typedef struct admtab_s {
+	pthread_mutex_t lock; /* Guards ALL fields below */
+	tbucket_t* buckets; /* buckets[fd] */
+	int size; /* len(buckets) */
+	double rate; /* Tokens per second */
+	double burst; /* Size of each bucket */
+	long admitted; /* Requests admitted */
+	long deferred; /* Requests deferred (a request can be deferred more times) */
+} admtab_t;
+
+
+/**
+ * @brief A request whose dispatching has been deferred for lack of tokens.
+ */
+typedef struct deferred_s {
+	int fd; /* Client connection */
+	uint64_t when; /* Time (ns) at which a token is expected to be available */
+} deferred_t;
+
+
+/**
+ * @brief List of deferred requests, owned by a single thread (NO lock), in
+ * which each fd appears at most once (its connection is NOT listened while
+ * deferred). Items are a binary min-heap by time (items[0] is the earliest).
+ */
+typedef struct deflist_s {
+	deferred_t* items;
+	int n; /* len(items) */
+	int cap;
+} deflist_t;
+
+admtab_t*
+	admtab_init(double rate, double burst, int size);
+
+int
+	admtab_reset(admtab_t*, int fd, uint64_t now),
+	admtab_take(admtab_t*, int fd, uint64_t now, uint64_t* wait),
+	admtab_destroy(admtab_t*);
+
+int
+	deflist_init(deflist_t*),
+	deflist_push(deflist_t*, int fd, uint64_t when),
+	deflist_pop(deflist_t*, uint64_t now, int* fd, uint64_t* next);
+
+void
+	deflist_destroy(deflist_t*);
+
+/* ADMISSION CONTROL */
+
+
 #endif /* _SERVER_SUPPORT_H */
@@ -0,0 +1,92 @@
+/**
+ * @brief Size-class slab allocator for the small objects of the file storage
+ * (files, pathnames, hashtable entries, waiters, file bodies and extents).
+ * Each allocation is rounded up to one of SLAB_NCLASSES size classes, and the
+ * objects of a class are carved from chunks (slabs) of at least SLAB_CHUNK
+ * bytes that are NEVER given back to the system: a freed object is reused ONLY
+ * by an allocation of the same class, such that churn (e.g. eviction and
+ * creation of files) does NOT fragment the heap.
+ * Each thread keeps its own cache of free objects for each class, and moves
+ * SLAB_BATCH objects at a time from/to the depot of the class (guarded by a
+ * mutex) when its cache is empty/too much full, such that most allocations
+ * and frees require NO lock; caches are given back to the depots when their
+ * thread terminates.
+ * Since objects have NO header, the size of an object MUST be passed when it
+ * is freed (slab_free), apart from strings (slab_strfree). Allocations bigger
+ * than SLAB_MAXSIZE are passed to malloc/free: these include the data of file
+ * extents (FD_EXTENT_SIZE bytes), such that the memory of evicted content is
+ * given back to the system and chunks keep ONLY metadata and pathnames.
+ *
+ * @author Salvatore Correnti
+ */
+#if !defined(_SLAB_H)
+#define _SLAB_H
+
+#include <defines.h>
+#include <stdint.h>
+
+/* Number of size classes and size of the biggest one */
+#define SLAB_NCLASSES 28
+#define SLAB_MAXSIZE 4096
+
+/* Minimum size of a chunk (a chunk contains at least SLAB_MINOBJS objects) */
+#define SLAB_CHUNK 65536
+#define SLAB_MINOBJS 8
+
+/* Number of objects moved at once between a thread cache and a depot */
+#define SLAB_BATCH 32
+
+/* Cyan-colored string for slab_dump */
+#define SLABDUMP_CYAN "\033[1;36mslab_dump:\033[0m"
+
+
+/* A free object (its first bytes) */
+typedef struct slab_obj_s {
+	struct slab_obj_s* next;
+} slab_obj_t;
+
+
+/**
+ * @brief Depot of a size class: free objects shared among threads and
+ * chunks allocated for the class.
+ */
+typedef struct slab_class_s {
+	size_t size; /* Size of objects */
+	pthread_mutex_t lock; /* Guards ALL the members below */
+	slab_obj_t* head; /* Free objects */
+	long nfree; /* len(head) */
+	int nchunks; /* Number of chunks */
+	size_t reserved; /* Bytes of ALL chunks */
+} slab_class_t;
+
+
+/**
+ * @brief Cache of a thread: free objects of each class and statistics (that
+ * have a single writer, as in histogram.h). The counters of a thread can be
+ * "negative" if it frees objects allocated by other threads, but they are
+ * consistent once summed over ALL the threads.
+ */
+typedef struct slab_cache_s {
+	slab_obj_t* free[SLAB_NCLASSES];
+	int nfree[SLAB_NCLASSES]; /* len(free[i]) */
+	long allocs[SLAB_NCLASSES]; /* Allocations in class i */
+	long frees[SLAB_NCLASSES]; /* Frees in class i */
+	uint64_t requested[SLAB_NCLASSES]; /* Bytes requested by allocations minus those of frees (modulo 2^64) */
+	long bigAllocs; /* Allocations bigger than SLAB_MAXSIZE */
+	long bigFrees;
+	struct slab_cache_s* next; /* Next registered thread */
+} slab_cache_t;
+
+
+void*
+	slab_alloc(size_t size);
+
+char*
+	slab_strdup(const char* s);
+
+void
+	slab_free(void* ptr, size_t size),
+	slab_strfree(void* s),
+	slab_dump(FILE* stream);
+
+#endif /* _SLAB_H */
@@ -0,0 +1,56 @@
+/**
+ * @brief Live statistics of the server: each worker (or reactor) registers
+ * its own set of latency histograms (see histogram.h) for:
+ *	- the handling time of each type of request (msg_t);
+ *	- the time spent waiting at some contention points (ST_*).
+ * Since each set has a single writer, recording requires NO lock, while a
+ * snapshot of ALL the sets (stats_json) can be taken at any time, e.g. for
+ * replying to a M_STATS request, WITHOUT stopping the server.
+ * Threads that are NOT registered (e.g. manager) record nothing.
+ *
+ * @author Salvatore Correnti
+ */
+#if !defined(_STATS_H)
+#define _STATS_H
+
+#include <defines.h>
+#include <histogram.h>
+#include <protocol.h>
+#include <stdint.h>
+
+/* Contention points */
+#define ST_ROPWAIT 0 /* Waiting for a shard gate in reading mode (fs_rop_init) */
+#define ST_WOPWAIT 1 /* Waiting for a shard gate in writing mode (fs_wop_init) */
+#define ST_QUEUEWAIT 2 /* Time spent by a ready client in the dispatch queue (connQueue) */
+#define ST_REPLACE 3 /* Execution of cache replacement (fs_replace) */
+#define ST_LOCKWAIT 4 /* Time spent by a client waiting for a file lock (recorded at handoff) */
+#define ST_NWAITS 5
+
+/* Size and number of pages of the per-fd table of dispatch times */
+#define ST_PAGESIZE 4096
+#define ST_NPAGES 1024
+
+
+/**
+ * @brief Statistics of a single thread.
+ */
+typedef struct stats_s {
+	hist_t* reqs[MTYPES_SIZE]; /* Handling time (ns) of requests by type */
+	hist_t* waits[ST_NWAITS]; /* Waiting time (ns) by contention point */
+	struct stats_s* next; /* Next registered thread */
+} stats_t;
+
+
+int
+	stats_register(void),
+	stats_request(int type, uint64_t start),
+	stats_wait(int point, uint64_t start),
+	stats_enqueue(int fd),
+	stats_dequeue(int fd),
+	stats_json(char** buf, size_t* size),
+	stats_destroy(void);
+
+uint64_t
+	stats_now(void);
+
+#endif /* _STATS_H */
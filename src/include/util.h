@@ -20,6 +20,11 @@
 #define EXTRA_LEN_PRINT_ERROR   512
 #endif
 
+/* Maximum number of iovec elements for a single writev (not exported by POSIX-only headers) */
+#if !defined(IOV_MAX)
+#define IOV_MAX 1024
+#endif
+
 bool 
 	isUseless(char*),
 	isPath(const char*),
@@ -33,6 +38,8 @@ bool
 int
 	readn(long, void*, size_t),
 	writen(long, void*, size_t),
+	writevn(long, struct iovec*, int),
+	readvn(long, struct iovec*, int),
 	getInt(char* str, long* val),
 	getFloat(char* str, float* val);
 
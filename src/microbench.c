@@ -0,0 +1,770 @@
+/**
+ * @brief Microbenchmarks of the core data structures of the server, run in
+ * isolation (WITHOUT any server or client):
+ *	- hash: icl_hash_insert and icl_hash_find (hits and misses) on a table
+ *	of num keys (single thread, since icl_hash is NOT concurrent);
+ *	- queue: tsqueue_push/tsqueue_pop (and mpmcq_push/mpmcq_pop, for
+ *	comparison) with N producers and N consumers on the same queue;
+ *	- msg: msend/mrecv_arena of messages with a content of each size over a
+ *	socketpair, in both legacy and framed formats;
+ *	- fs: fs_read of files of each size shared among N threads, and fs_write
+ *	(appends) of each size by N threads on a storage small enough that cache
+ *	replacement runs (expelled files are created again, NOT measured); since
+ *	fs_read gives a reference to the content, its MB/s includes NO copy.
+ * Each case runs for a fixed time and reports throughput (and latency
+ * percentiles for fs operations), optionally also as a JSON file, such that
+ * the effect of a change can be measured on each structure.
+ * Anything printed on stdout by the benchmarked code (e.g. expelled files) is
+ * discarded, while results are printed on the original stdout.
+ *
+ * @author Salvatore Correnti.
+ */
+#include <defines.h>
+#include <util.h>
+#include <argparser.h>
+#include <histogram.h>
+#include <icl_hash.h>
+#include <tsqueue.h>
+#include <mpmcqueue.h>
+#include <protocol.h>
+#include <fs.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+
+/* Benchmarks */
+#define MB_HASH 0
+#define MB_QUEUE 1
+#define MB_MSG 2
+#define MB_FS 3
+#define MB_NUM 4
+
+/* Default parameters */
+#define MB_DFL_DURATION 1000
+#define MB_DFL_KEYS 100000
+#define MB_DFL_SEED 1
+
+/* Maximum number of thread counts and sizes */
+#define MB_MAXVALS 16
+
+/* Operations between two checks of the clock (hash) or of the queue size (tsqueue producers) */
+#define MB_CHECK_EVERY 1024
+
+/* Maximum number of items in a tsqueue (producers yield above it, such that memory is bounded) */
+#define MB_QUEUE_MAXITEMS 65536
+
+/* Capacity of the mpmc queue and maximum number of items popped at once */
+#define MB_MPMC_CAP 4096
+#define MB_MPMC_BATCH 32
+
+/* Files of the fs benchmark and growth (in appends) of a file before the storage is full */
+#define MB_FS_FILES 64
+#define MB_FS_GROWTH 16
+
+/* Buckets and shards of the storage of the fs benchmark */
+#define MB_FS_BUCKETS 1024
+#define MB_FS_SHARDS 8
+
+static char* mbNames[] = {"hash", "queue", "msg", "fs"};
+
+
+/**
+ * @brief A benchmark thread.
+ */
+typedef struct mbthread_s {
+	pthread_t tid;
+	int id;
+	uint64_t rng; /* State of the random number generator */
+	uint64_t ops; /* Successful operations */
+	hist_t* lat; /* Latencies (in ns) of operations (NULL if NOT measured) */
+	int ret; /* Result of the thread */
+} mbthread_t;
+
+
+/**
+ * @brief Parameters and shared state of the benchmarks.
+ */
+typedef struct mb_s {
+	bool run[MB_NUM]; /* Selected benchmarks */
+	long threads[MB_MAXVALS];
+	int nthreads; /* len(threads) */
+	long sizes[MB_MAXVALS];
+	int nsizes; /* len(sizes) */
+	long nkeys;
+	long duration; /* Milliseconds */
+	long seed;
+	char* outpath; /* JSON output file (NULL if none) */
+
+	FILE* report; /* Table of results (original stdout) */
+	FILE* out; /* Opened outpath */
+	int nresults; /* Results written to out */
+	pthread_barrier_t start; /* Threads start together */
+	int stop;
+
+	/* State of the current case */
+	void* buf; /* Content of messages and writes (at least max(sizes) bytes) */
+	long size;
+	int fd[2]; /* socketpair (msg) */
+	int format; /* MSG_LEGACY or MSG_FRAMED (msg) */
+	tsqueue_t* tsq;
+	mpmcq_t* mpmcq;
+	FileStorage_t* fs;
+	char** files; /* Pathnames (fs) */
+	int nfiles; /* len(files) */
+	int perThread; /* Files written by each thread (fs), i.e. files[id * perThread, (id + 1) * perThread) */
+} mb_t;
+
+static mb_t mb;
+
+
+/* Checks that ALL the arguments are names of benchmarks */
+static bool allBenchNames(llist_t* args){
+	llistnode_t* node;
+	if (!args) return false;
+	llist_foreach(args, node){
+		int i = 0;
+		while ((i < MB_NUM) && !strequal(node->datum, mbNames[i])) i++;
+		if (i == MB_NUM) return false;
+	}
+	return true;
+}
+
+
+/**
+ * @brief Global array that contains all accepted options.
+ */
+optdef_t options[] = {
+	{"-h", 0, 0, allNumbers, true, NULL, "Shows this help message and exits"},
+
+	{"-b", 1, -1, allBenchNames, true, "name[,name]", "benchmarks to run among hash, queue, msg and fs (default all)"},
+
+	{"-t", 1, MB_MAXVALS, allNumbers, true, "num[,num]", "numbers of threads (of producers and consumers for queue) of each case (default 1,2,4,8)"},
+
+	{"-s", 1, MB_MAXVALS, allNumbers, true, "size[,size]", "sizes (in bytes) of messages and files of each case (default 1024,16384,262144)"},
+
+	{"-k", 1, 1, allNumbers, true, "num", "number of keys of the hash table (default 100000)"},
+
+	{"-d", 1, 1, allNumbers, true, "msec", "duration (in milliseconds) of each case (default 1000)"},
+
+	{"-o", 1, 1, allPaths, true, "filename", "file in which to write the results in JSON format"},
+
+	{"-S", 1, 1, allNumbers, true, "num", "seed of the random number generators (default 1)"},
+};
+
+/* Length of options array */
+int optlen = 8;
+
+
+/* ********************** STATIC OPERATIONS ********************** */
+
+/* xorshift64* generator (as in bench.c) */
+static uint64_t mb_rand(uint64_t* state){
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+/* Nanoseconds of the monotonic clock */
+static uint64_t mb_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/* Sleeps for the duration of a case */
+static void mb_sleep(void){
+	struct timespec ts = {.tv_sec = mb.duration / 1000, .tv_nsec = (mb.duration % 1000) * 1000000};
+	while ((nanosleep(&ts, &ts) == -1) && (errno == EINTR));
+}
+
+
+/* waitHandler for the file storage: there is NO client to notify */
+static int mb_waitHandler(int chan, fd_waiter_t* waiters){ return 0; }
+
+
+/**
+ * @brief Prints the result of a case (size < 0 if NOT meaningful, lat
+ * == NULL if latencies have NOT been measured) on stdout and in mb.out.
+ */
+static void mb_result(char* name, long threads, long size, uint64_t ops, double elapsed, hist_t* lat){
+	char sizebuf[32], mbsbuf[32], p50buf[32], p99buf[32];
+	double opsec = (elapsed > 0.0 ? (double)ops / elapsed : 0.0);
+	double nsop = (ops > 0 ? elapsed * 1e9 / (double)ops : 0.0);
+	snprintf(sizebuf, sizeof(sizebuf), (size >= 0 ? "%ld" : "-"), size);
+	if (size > 0) snprintf(mbsbuf, sizeof(mbsbuf), "%.1f", opsec * (double)size / (1024.0 * 1024.0));
+	else snprintf(mbsbuf, sizeof(mbsbuf), "-");
+	if (lat && (lat->count > 0)){
+		snprintf(p50buf, sizeof(p50buf), "%.1f", hist_percentile(lat, 50.0) / 1000.0);
+		snprintf(p99buf, sizeof(p99buf), "%.1f", hist_percentile(lat, 99.0) / 1000.0);
+	} else {
+		snprintf(p50buf, sizeof(p50buf), "-");
+		snprintf(p99buf, sizeof(p99buf), "-");
+	}
+	fprintf(mb.report, "%-18s %7ld %9s %12lu %14.1f %10.1f %10s %10s %10s\n", name, threads, sizebuf, (unsigned long)ops, opsec, nsop, mbsbuf, p50buf, p99buf);
+	fflush(mb.report);
+	if (!mb.out) return;
+	fprintf(mb.out, "%s\n\t\t{\"bench\": \"%s\", \"threads\": %ld, \"size\": %ld, \"ops\": %lu, \"elapsed\": %.6f, \"ops_per_sec\": %.1f, \"ns_per_op\": %.1f",
+		(mb.nresults > 0 ? "," : ""), name, threads, size, (unsigned long)ops, elapsed, opsec, nsop);
+	if (lat){
+		fprintf(mb.out, ", \"latency\": ");
+		hist_printJSON(lat, mb.out, 1000.0);
+	}
+	fprintf(mb.out, "}");
+	mb.nresults++;
+}
+
+
+/**
+ * @brief Runs n threads executing fun(thread) behind a starting barrier for
+ * the duration of a case (fun MUST return once mb.stop is set), and reports
+ * the sum of their operations (and merged latencies if measure == true).
+ * @return 0 on success, -1 on error.
+ */
+static int mb_runThreads(char* name, long n, long size, void* (*fun)(void*), bool measure){
+	mbthread_t* threads = calloc(n, sizeof(mbthread_t));
+	hist_t* lat = (measure ? hist_init() : NULL);
+	if (!threads || (measure && !lat)){
+		free(threads);
+		if (lat) hist_destroy(lat);
+		errno = ENOMEM;
+		return -1;
+	}
+	int ret = 0;
+	long started = 0;
+	for (long i = 0; i < n; i++){
+		threads[i].id = (int)i;
+		threads[i].rng = ((uint64_t)mb.seed + (uint64_t)i + 1) * 0x9E3779B97F4A7C15ULL;
+		if (measure && !(threads[i].lat = hist_init())){ ret = -1; break; }
+	}
+	ATOMIC_SET(&mb.stop, 0);
+	if ((ret == 0) && (pthread_barrier_init(&mb.start, NULL, n + 1) != 0)) ret = -1;
+	if (ret == 0){
+		for (; started < n; started++){
+			if (pthread_create(&threads[started].tid, NULL, fun, &threads[started]) != 0) break;
+		}
+		if (started < n){ /* Threads already started are stuck on the barrier */
+			fprintf(stderr, "%s: unable to start ALL the threads\n", name);
+			exit(EXIT_FAILURE);
+		}
+		pthread_barrier_wait(&mb.start);
+		uint64_t start = mb_now();
+		mb_sleep();
+		ATOMIC_SET(&mb.stop, 1);
+		uint64_t ops = 0;
+		for (long i = 0; i < n; i++){
+			pthread_join(threads[i].tid, NULL);
+			ops += threads[i].ops;
+			if (measure) hist_merge(lat, threads[i].lat);
+			if (threads[i].ret == -1) ret = -1;
+		}
+		double elapsed = (double)(mb_now() - start) / 1e9;
+		pthread_barrier_destroy(&mb.start);
+		mb_result(name, n, size, ops, elapsed, lat);
+	}
+	for (long i = 0; i < n; i++){ if (threads[i].lat) hist_destroy(threads[i].lat); }
+	free(threads);
+	if (lat) hist_destroy(lat);
+	return ret;
+}
+
+
+/* ********************** HASH ********************** */
+
+/**
+ * @brief Inserts mb.nkeys keys in an icl_hash table, then looks up random
+ * present and missing keys for the duration of a case.
+ * @return 0 on success, -1 on error.
+ */
+static int mb_hash(void){
+	char** keys = calloc(2 * mb.nkeys, sizeof(char*)); /* Present keys, then missing ones */
+	if (!keys){ errno = ENOMEM; return -1; }
+	int ret = 0;
+	for (long i = 0; (i < 2 * mb.nkeys) && (ret == 0); i++){
+		if (!(keys[i] = malloc(48))) ret = -1;
+		else snprintf(keys[i], 48, "/microbench/%s%ld", (i < mb.nkeys ? "file" : "miss"), i);
+	}
+	icl_hash_t* ht = (ret == 0 ? icl_hash_create(mb.nkeys, NULL, NULL) : NULL);
+	if (ht){
+		uint64_t start = mb_now();
+		for (long i = 0; (i < mb.nkeys) && (ret == 0); i++){
+			if (!icl_hash_insert(ht, keys[i], keys[i])) ret = -1;
+		}
+		if (ret == 0) mb_result("icl_hash_insert", 1, -1, mb.nkeys, (double)(mb_now() - start) / 1e9, NULL);
+		for (int miss = 0; (miss < 2) && (ret == 0); miss++){
+			uint64_t rng = ((uint64_t)mb.seed + 1) * 0x9E3779B97F4A7C15ULL;
+			uint64_t ops = 0, found = 0;
+			uint64_t end = mb_now() + (uint64_t)mb.duration * 1000000ULL;
+			start = mb_now();
+			do {
+				for (int j = 0; j < MB_CHECK_EVERY; j++){
+					long k = (long)(mb_rand(&rng) % (uint64_t)mb.nkeys) + (miss ? mb.nkeys : 0);
+					if (icl_hash_find(ht, keys[k])) found++;
+				}
+				ops += MB_CHECK_EVERY;
+			} while (mb_now() < end);
+			if (found != (miss ? 0 : ops)){ fprintf(stderr, "icl_hash_find: wrong lookup results\n"); ret = -1; }
+			else mb_result((miss ? "icl_hash_find_miss" : "icl_hash_find"), 1, -1, ops, (double)(mb_now() - start) / 1e9, NULL);
+		}
+		icl_hash_destroy(ht, NULL, NULL);
+	} else ret = -1;
+	for (long i = 0; i < 2 * mb.nkeys; i++) free(keys[i]);
+	free(keys);
+	return ret;
+}
+
+
+/* ********************** QUEUE ********************** */
+
+static void* mb_tsqProducer(void* arg){
+	mbthread_t* t = arg;
+	pthread_barrier_wait(&mb.start);
+	while (!ATOMIC_GET(&mb.stop)){
+		for (int j = 0; j < MB_CHECK_EVERY; j++){
+			if (tsqueue_push(mb.tsq, &mb) != 0){ t->ret = -1; return NULL; }
+		}
+		t->ops += MB_CHECK_EVERY;
+		while ((tsqueue_getSize(mb.tsq) > MB_QUEUE_MAXITEMS) && !ATOMIC_GET(&mb.stop)) sched_yield();
+	}
+	return NULL;
+}
+
+
+static void* mb_tsqConsumer(void* arg){
+	mbthread_t* t = arg;
+	void* item;
+	pthread_barrier_wait(&mb.start);
+	while (true){
+		int res = tsqueue_pop(mb.tsq, &item, false);
+		if (res == -1){ t->ret = -1; break; }
+		if (res > 0) break; /* Closed and empty */
+		t->ops++;
+	}
+	return NULL;
+}
+
+
+static void* mb_mpmcProducer(void* arg){
+	mbthread_t* t = arg;
+	pthread_barrier_wait(&mb.start);
+	while (!ATOMIC_GET(&mb.stop)){
+		if (mpmcq_push(mb.mpmcq, &mb) != 0){ t->ret = -1; break; }
+		t->ops++;
+	}
+	return NULL;
+}
+
+
+static void* mb_mpmcConsumer(void* arg){
+	mbthread_t* t = arg;
+	void* items[MB_MPMC_BATCH];
+	pthread_barrier_wait(&mb.start);
+	while (true){
+		int n = mpmcq_pop(mb.mpmcq, items, MB_MPMC_BATCH, false);
+		if (n == -1){ t->ret = -1; break; }
+		if (n == 0) break; /* Closed and empty */
+		t->ops += n;
+	}
+	return NULL;
+}
+
+
+/**
+ * @brief Runs n producers and n consumers on the same queue (a tsqueue if
+ * mpmc == false, else a mpmcq): producers stop at the end of the case, then
+ * the queue is closed and consumers drain it.
+ * @return 0 on success, -1 on error.
+ */
+static int mb_queueCase(long n, bool mpmc){
+	mbthread_t* threads = calloc(2 * n, sizeof(mbthread_t)); /* Producers, then consumers */
+	if (!threads){ errno = ENOMEM; return -1; }
+	if (mpmc) mb.mpmcq = mpmcq_init(MB_MPMC_CAP);
+	else mb.tsq = tsqueue_init();
+	if ((mpmc && !mb.mpmcq) || (!mpmc && !mb.tsq)){
+		free(threads);
+		return -1;
+	}
+	int ret = 0;
+	ATOMIC_SET(&mb.stop, 0);
+	if (pthread_barrier_init(&mb.start, NULL, 2 * n + 1) != 0){ free(threads); return -1; }
+	for (long i = 0; i < 2 * n; i++){
+		void* (*fun)(void*) = (i < n ? (mpmc ? mb_mpmcProducer : mb_tsqProducer) : (mpmc ? mb_mpmcConsumer : mb_tsqConsumer));
+		threads[i].id = (int)i;
+		if (pthread_create(&threads[i].tid, NULL, fun, &threads[i]) != 0){
+			fprintf(stderr, "queue: unable to start ALL the threads\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	pthread_barrier_wait(&mb.start);
+	uint64_t start = mb_now();
+	mb_sleep();
+	ATOMIC_SET(&mb.stop, 1);
+	for (long i = 0; i < n; i++) pthread_join(threads[i].tid, NULL);
+	if (mpmc) mpmcq_close(mb.mpmcq);
+	else tsqueue_close(mb.tsq);
+	uint64_t ops = 0;
+	for (long i = 0; i < 2 * n; i++){
+		if (i >= n){
+			pthread_join(threads[i].tid, NULL);
+			ops += threads[i].ops;
+		}
+		if (threads[i].ret == -1) ret = -1;
+	}
+	double elapsed = (double)(mb_now() - start) / 1e9;
+	pthread_barrier_destroy(&mb.start);
+	mb_result((mpmc ? "mpmcq_push_pop" : "tsqueue_push_pop"), n, -1, ops, elapsed, NULL);
+	if (mpmc){
+		mpmcq_destroy(mb.mpmcq, NULL);
+		mb.mpmcq = NULL;
+	} else {
+		tsqueue_destroy(mb.tsq, dummy); /* Already drained */
+		mb.tsq = NULL;
+	}
+	free(threads);
+	return ret;
+}
+
+
+static int mb_queue(void){
+	for (int i = 0; i < mb.nthreads; i++){
+		if ((mb_queueCase(mb.threads[i], false) == -1) || (mb_queueCase(mb.threads[i], true) == -1)) return -1;
+	}
+	return 0;
+}
+
+
+/* ********************** MSG ********************** */
+
+/* Sends messages on mb.fd[0] until the end of the case, then closes it */
+static void* mb_msgSender(void* arg){
+	mbthread_t* t = arg;
+	char pathname[] = "/microbench/file";
+	message_t* msg;
+	msg_setformat(mb.fd[0], mb.format);
+	pthread_barrier_wait(&mb.start);
+	while (!ATOMIC_GET(&mb.stop)){
+		if (msend(mb.fd[0], &msg, M_WRITEF, NULL, NULL, sizeof(pathname), pathname, (size_t)mb.size, mb.buf) == -1){
+			t->ret = -1;
+			break;
+		}
+	}
+	close(mb.fd[0]);
+	return NULL;
+}
+
+
+/* Receives messages from mb.fd[1] until the sender closes its end */
+static void* mb_msgReceiver(void* arg){
+	mbthread_t* t = arg;
+	message_t* msg;
+	marena_t* arena = marena_init(MARENA_DFL_SIZE);
+	if (!arena){ t->ret = -1; return NULL; }
+	msg_setformat(mb.fd[1], MSG_AUTO); /* fd can be a reused one */
+	pthread_barrier_wait(&mb.start);
+	while (mrecv_arena(mb.fd[1], &msg, arena) == 0){
+		t->ops++;
+		marena_reset(arena);
+	}
+	marena_destroy(arena);
+	close(mb.fd[1]);
+	return NULL;
+}
+
+
+/**
+ * @brief Sends messages of #size bytes of content through a socketpair in
+ * #format, with a sender and a receiver thread.
+ * @return 0 on success, -1 on error.
+ */
+static int mb_msgCase(long size, int format){
+	mbthread_t threads[2];
+	memset(threads, 0, sizeof(threads));
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, mb.fd) == -1) return -1;
+	mb.size = size;
+	mb.format = format;
+	ATOMIC_SET(&mb.stop, 0);
+	if (pthread_barrier_init(&mb.start, NULL, 3) != 0) return -1;
+	if ((pthread_create(&threads[0].tid, NULL, mb_msgSender, &threads[0]) != 0) ||
+		(pthread_create(&threads[1].tid, NULL, mb_msgReceiver, &threads[1]) != 0)){
+		fprintf(stderr, "msg: unable to start ALL the threads\n");
+		exit(EXIT_FAILURE);
+	}
+	pthread_barrier_wait(&mb.start);
+	uint64_t start = mb_now();
+	mb_sleep();
+	ATOMIC_SET(&mb.stop, 1);
+	pthread_join(threads[0].tid, NULL);
+	pthread_join(threads[1].tid, NULL);
+	double elapsed = (double)(mb_now() - start) / 1e9;
+	pthread_barrier_destroy(&mb.start);
+	mb_result((format == MSG_FRAMED ? "msg_framed" : "msg_legacy"), 1, size, threads[1].ops, elapsed, NULL);
+	return ((threads[0].ret == 0) && (threads[1].ret == 0) ? 0 : -1);
+}
+
+
+static int mb_msg(void){
+	for (int i = 0; i < mb.nsizes; i++){
+		if ((mb_msgCase(mb.sizes[i], MSG_LEGACY) == -1) || (mb_msgCase(mb.sizes[i], MSG_FRAMED) == -1)) return -1;
+	}
+	return 0;
+}
+
+
+/* ********************** FS ********************** */
+
+/* Reads random files (opened by each thread before starting) */
+static void* mb_fsReader(void* arg){
+	mbthread_t* t = arg;
+	int client = t->id + 1;
+	for (int i = 0; (i < mb.nfiles) && (t->ret == 0); i++){
+		if (fs_open(mb.fs, mb.files[i], client, false) == -1){
+			perror("fs_open");
+			t->ret = -1;
+		}
+	}
+	pthread_barrier_wait(&mb.start);
+	while ((t->ret == 0) && !ATOMIC_GET(&mb.stop)){
+		fbody_t* body = NULL;
+		size_t size;
+		char* pathname = mb.files[mb_rand(&t->rng) % (uint64_t)mb.nfiles];
+		uint64_t start = mb_now();
+		if (fs_read(mb.fs, pathname, &body, &size, client) == -1){
+			perror("fs_read");
+			t->ret = -1;
+			break;
+		}
+		if (body) fbody_release(body);
+		hist_record(t->lat, mb_now() - start);
+		t->ops++;
+	}
+	return NULL;
+}
+
+
+/* Appends to random files among its own ones, creating again the expelled ones */
+static void* mb_fsWriter(void* arg){
+	mbthread_t* t = arg;
+	int client = t->id + 1;
+	char** files = mb.files + (size_t)t->id * mb.perThread;
+	for (int i = 0; (i < mb.perThread) && (t->ret == 0); i++){
+		if (fs_create(mb.fs, files[i], client, false, mb_waitHandler, 0) == -1){
+			perror("fs_create");
+			t->ret = -1;
+		}
+	}
+	pthread_barrier_wait(&mb.start);
+	while ((t->ret == 0) && !ATOMIC_GET(&mb.stop)){
+		char* pathname = files[mb_rand(&t->rng) % (uint64_t)mb.perThread];
+		uint64_t start = mb_now();
+		if (fs_write(mb.fs, pathname, mb.buf, (size_t)mb.size, client, false, mb_waitHandler, NULL, 0) == 0){
+			hist_record(t->lat, mb_now() - start);
+			t->ops++;
+		} else if ((errno != ENOENT) || (fs_create(mb.fs, pathname, client, false, mb_waitHandler, 0) == -1)){
+			perror("fs_write");
+			t->ret = -1;
+		}
+	}
+	return NULL;
+}
+
+
+/* Allocates n pathnames with prefix #prefix in mb.files */
+static int mb_fsFiles(int n, char* prefix){
+	if (!(mb.files = calloc(n, sizeof(char*)))){ errno = ENOMEM; return -1; }
+	mb.nfiles = n;
+	for (int i = 0; i < n; i++){
+		if (!(mb.files[i] = malloc(64))){ errno = ENOMEM; return -1; }
+		snprintf(mb.files[i], 64, "/microbench/%s%d", prefix, i);
+	}
+	return 0;
+}
+
+
+static void mb_fsCleanup(void){
+	if (mb.fs) fs_destroy(mb.fs);
+	mb.fs = NULL;
+	for (int i = 0; i < mb.nfiles; i++) free(mb.files[i]);
+	free(mb.files);
+	mb.files = NULL;
+	mb.nfiles = 0;
+}
+
+
+/**
+ * @brief Reads files of #size bytes with n threads, then appends #size bytes
+ * with n threads, each one on a new file storage.
+ * @return 0 on success, -1 on error.
+ */
+static int mb_fsCase(long n, long size){
+	int ret = 0;
+	mb.size = size;
+	/* Reads: ALL files are hosted */
+	size_t cap = (size_t)MB_FS_FILES * (size_t)size * 2;
+	if (!(mb.fs = fs_init(MB_FS_BUCKETS, MB_FS_SHARDS, cap, 2 * MB_FS_FILES, RP_LRU, FS_TABLE_RH, CODEC_NONE, false)) ||
+		(mb_fsFiles(MB_FS_FILES, "file") == -1)) ret = -1;
+	for (int i = 0; (i < mb.nfiles) && (ret == 0); i++){
+		if ((fs_create(mb.fs, mb.files[i], 0, false, mb_waitHandler, 0) == -1) ||
+			(fs_write(mb.fs, mb.files[i], mb.buf, (size_t)size, 0, false, mb_waitHandler, NULL, 0) == -1)){
+			perror("mb_fsCase: while creating files");
+			ret = -1;
+		}
+	}
+	if (ret == 0) ret = mb_runThreads("fs_read", n, size, mb_fsReader, true);
+	mb_fsCleanup();
+	if (ret == -1) return -1;
+	/* Appends: storage is full after MB_FS_GROWTH appends per file on average */
+	mb.perThread = (int)MAX(1, MB_FS_FILES / n);
+	cap = (size_t)mb.perThread * (size_t)n * (size_t)size * MB_FS_GROWTH;
+	if (!(mb.fs = fs_init(MB_FS_BUCKETS, MB_FS_SHARDS, cap, 2 * mb.perThread * (int)n, RP_LRU, FS_TABLE_RH, CODEC_NONE, false)) ||
+		(mb_fsFiles(mb.perThread * (int)n, "wfile") == -1)) ret = -1;
+	if (ret == 0) ret = mb_runThreads("fs_write", n, size, mb_fsWriter, true);
+	mb_fsCleanup();
+	return ret;
+}
+
+
+static int mb_fs(void){
+	for (int i = 0; i < mb.nsizes; i++){
+		for (int j = 0; j < mb.nthreads; j++){
+			if (mb_fsCase(mb.threads[j], mb.sizes[i]) == -1) return -1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Reads the options into mb.
+ * @return 0 on success, -1 on error (with a message on stderr).
+ */
+static int mb_options(llist_t* optvals, bool* help){
+	llistnode_t* node;
+	llistnode_t* anode;
+	optval_t* optval;
+	long val;
+	*help = false;
+	llist_foreach(optvals, node){
+		optval = (optval_t*)node->datum;
+		char* arg = (optval->args && optval->args->head ? optval->args->head->datum : NULL);
+		switch (optval->def->name[1]){
+			case 'h': { *help = true; break; }
+			case 'o': { mb.outpath = arg; break; }
+			case 'b': {
+				for (int i = 0; i < MB_NUM; i++) mb.run[i] = false;
+				llist_foreach(optval->args, anode){
+					for (int i = 0; i < MB_NUM; i++){ if (strequal(anode->datum, mbNames[i])) mb.run[i] = true; }
+				}
+				break;
+			}
+			case 't': {
+				mb.nthreads = 0;
+				llist_foreach(optval->args, anode){ getInt(anode->datum, &mb.threads[mb.nthreads++]); }
+				break;
+			}
+			case 's': {
+				mb.nsizes = 0;
+				llist_foreach(optval->args, anode){ getInt(anode->datum, &mb.sizes[mb.nsizes++]); }
+				break;
+			}
+			default: {
+				getInt(arg, &val);
+				switch (optval->def->name[1]){
+					case 'k': { mb.nkeys = val; break; }
+					case 'd': { mb.duration = val; break; }
+					case 'S': { mb.seed = val; break; }
+				}
+			}
+		}
+	}
+	if (*help) return 0;
+	for (int i = 0; i < mb.nthreads; i++){
+		if ((mb.threads[i] <= 0) || (mb.threads[i] > MB_FS_FILES)){
+			fprintf(stderr, "Numbers of threads must be in [1, %d]\n", MB_FS_FILES);
+			return -1;
+		}
+	}
+	for (int i = 0; i < mb.nsizes; i++){
+		if (mb.sizes[i] <= 0){ fprintf(stderr, "Sizes must be positive\n"); return -1; }
+	}
+	if ((mb.nkeys <= 0) || (mb.nkeys > INT_MAX / 2) || (mb.duration <= 0)){
+		fprintf(stderr, "Number of keys and duration must be positive\n");
+		return -1;
+	}
+	return 0;
+}
+
+
+/* ********************** MAIN ********************** */
+
+int main(int argc, char* argv[]){
+	long dflThreads[] = {1, 2, 4, 8};
+	long dflSizes[] = {1024, 16384, 262144};
+	for (int i = 0; i < MB_NUM; i++) mb.run[i] = true;
+	mb.nthreads = 4;
+	memcpy(mb.threads, dflThreads, sizeof(dflThreads));
+	mb.nsizes = 3;
+	memcpy(mb.sizes, dflSizes, sizeof(dflSizes));
+	mb.nkeys = MB_DFL_KEYS;
+	mb.duration = MB_DFL_DURATION;
+	mb.seed = MB_DFL_SEED;
+
+	llist_t* optvals = NULL;
+	if (argc > 1){
+		if (!(optvals = parseCmdLine(argc, argv, options, optlen))){
+			fprintf(stderr, "Error while parsing command-line arguments\n");
+			exit(EXIT_FAILURE);
+		}
+		bool help;
+		if (mb_options(optvals, &help) == -1){
+			llist_destroy(optvals, (void(*)(void*))optval_destroy);
+			exit(EXIT_FAILURE);
+		}
+		if (help){
+			print_help(argv[0], options, optlen);
+			llist_destroy(optvals, (void(*)(void*))optval_destroy);
+			return 0;
+		}
+	}
+	signal(SIGPIPE, SIG_IGN); /* A failed receiver MUST NOT kill the sender */
+	int nullfd = open("/dev/null", O_WRONLY);
+	int repfd = dup(STDOUT_FILENO);
+	if ((nullfd == -1) || (repfd == -1) || !(mb.report = fdopen(repfd, "w")) || (dup2(nullfd, STDOUT_FILENO) == -1)){
+		perror("While redirecting stdout");
+		exit(EXIT_FAILURE);
+	}
+	close(nullfd);
+
+	long maxsize = 1;
+	for (int i = 0; i < mb.nsizes; i++){ if (mb.sizes[i] > maxsize) maxsize = mb.sizes[i]; }
+	int ret = EXIT_SUCCESS;
+	if (!(mb.buf = malloc(maxsize))){ perror("malloc"); ret = EXIT_FAILURE; }
+	else {
+		uint64_t state = (uint64_t)mb.seed * 0x9E3779B97F4A7C15ULL + 1;
+		for (long i = 0; i < maxsize; i++) ((unsigned char*)mb.buf)[i] = (unsigned char)mb_rand(&state);
+	}
+	if ((ret == EXIT_SUCCESS) && mb.outpath && !(mb.out = fopen(mb.outpath, "w"))){ perror("fopen"); ret = EXIT_FAILURE; }
+	if (ret == EXIT_SUCCESS){
+		int (*benches[MB_NUM])(void) = {mb_hash, mb_queue, mb_msg, mb_fs};
+		if (mb.out) fprintf(mb.out, "{\n\t\"duration_ms\": %ld,\n\t\"keys\": %ld,\n\t\"seed\": %ld,\n\t\"results\": [", mb.duration, mb.nkeys, mb.seed);
+		fprintf(mb.report, "%-18s %7s %9s %12s %14s %10s %10s %10s %10s\n", "bench", "threads", "size", "ops", "ops/sec", "ns/op", "MB/s", "p50(us)", "p99(us)");
+		for (int i = 0; (i < MB_NUM) && (ret == EXIT_SUCCESS); i++){
+			if (mb.run[i] && (benches[i]() == -1)){
+				fprintf(stderr, "Benchmark '%s' failed: %s\n", mbNames[i], strerror(errno));
+				ret = EXIT_FAILURE;
+			}
+		}
+		if (mb.out){
+			fprintf(mb.out, "\n\t]\n}\n");
+			if (fclose(mb.out) == EOF){ perror("fclose"); ret = EXIT_FAILURE; }
+		}
+	}
+	fclose(mb.report);
+	free(mb.buf);
+	if (optvals) llist_destroy(optvals, (void(*)(void*))optval_destroy);
+	return ret;
+}
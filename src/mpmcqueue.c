@@ -0,0 +1,191 @@
+#include <mpmcqueue.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/**
+ * CODICE NON-POSIX:
+ *	- Il parcheggio dei consumatori utilizza la system call Linux-specific futex,
+ *	invocata tramite syscall(SYS_futex, ...), il cui prototipo NON è esportato
+ *	con _POSIX_C_SOURCE ed è quindi dichiarato qui.
+ */
+long syscall(long number, ...);
+
+
+/* ********************** STATIC OPERATIONS ********************** */
+
+/* Parks the calling thread until *addr != val (or a spurious wakeup) */
+static void futex_wait(int* addr, int val){
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+
+/* Wakes up at most n threads parked on addr */
+static void futex_wake(int* addr, int n){
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+
+/**
+ * @brief Tries to write elem in the next free cell.
+ * @return true on success, false if queue is full.
+ */
+static bool mpmcq_tryPush(mpmcq_t* q, void* elem){
+	size_t pos = ATOMIC_GET(&q->pushPos);
+	mpmcq_cell_t* cell;
+	while (true){
+		cell = &q->cells[pos & q->mask];
+		intptr_t dif = (intptr_t)ATOMIC_GET(&cell->seq) - (intptr_t)pos;
+		if (dif == 0){ /* Cell is free for this position */
+			if (ATOMIC_CAS(&q->pushPos, &pos, pos + 1)) break; /* On failure, pos is reloaded */
+		} else if (dif < 0) return false; /* Cell still contains an item of the previous round */
+		else pos = ATOMIC_GET(&q->pushPos); /* Another producer took this position */
+	}
+	cell->elem = elem;
+	ATOMIC_SET(&cell->seq, pos + 1); /* Publishes item */
+	return true;
+}
+
+
+/**
+ * @brief Tries to read the next item.
+ * @return true on success, false if queue is empty.
+ */
+static bool mpmcq_tryPop(mpmcq_t* q, void** elem){
+	size_t pos = ATOMIC_GET(&q->popPos);
+	mpmcq_cell_t* cell;
+	while (true){
+		cell = &q->cells[pos & q->mask];
+		intptr_t dif = (intptr_t)ATOMIC_GET(&cell->seq) - (intptr_t)(pos + 1);
+		if (dif == 0){ /* Cell contains the item for this position */
+			if (ATOMIC_CAS(&q->popPos, &pos, pos + 1)) break;
+		} else if (dif < 0) return false; /* Item not yet published */
+		else pos = ATOMIC_GET(&q->popPos); /* Another consumer took this position */
+	}
+	*elem = cell->elem;
+	ATOMIC_SET(&cell->seq, pos + q->mask + 1); /* Frees cell for the next round */
+	return true;
+}
+
+
+/* ********************** MAIN OPERATIONS ********************** */
+
+/**
+ * @brief Initializes an empty open queue of capacity (at least) #size.
+ * @return Pointer to mpmcq_t object on success, NULL on error.
+ * Possible errors are:
+ *	- EINVAL: size == 0;
+ *	- ENOMEM: unable to allocate memory.
+ */
+mpmcq_t* mpmcq_init(size_t size){
+	if (size == 0){ errno = EINVAL; return NULL; }
+	size_t cap = 1;
+	while (cap < size) cap <<= 1;
+	mpmcq_t* q = malloc(sizeof(mpmcq_t));
+	if (!q){ errno = ENOMEM; return NULL; }
+	memset(q, 0, sizeof(mpmcq_t));
+	q->cells = malloc(cap * sizeof(mpmcq_cell_t));
+	if (!q->cells){
+		free(q);
+		errno = ENOMEM;
+		return NULL;
+	}
+	for (size_t i = 0; i < cap; i++){
+		q->cells[i].seq = i;
+		q->cells[i].elem = NULL;
+	}
+	q->mask = cap - 1;
+	q->state = Q_OPEN;
+	return q;
+}
+
+
+/**
+ * @brief Inserts elem in the queue, waking up a parked consumer (if any).
+ * If queue is full, the caller yields until a cell is freed.
+ * @return 0 on success, -1 on error, QRET_CLOSED if queue is closed.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments.
+ */
+int mpmcq_push(mpmcq_t* q, void* elem){
+	if (!q || !elem){ errno = EINVAL; return -1; }
+	while (true){
+		if (ATOMIC_GET(&q->state) == Q_CLOSED) return QRET_CLOSED;
+		if (mpmcq_tryPush(q, elem)) break;
+		sched_yield(); /* Full: capacity should be chosen such that this is (very) unlikely */
+	}
+	ATOMIC_ADD(&q->event, 1);
+	if (ATOMIC_GET(&q->sleepers) > 0) futex_wake(&q->event, 1);
+	return 0;
+}
+
+
+/**
+ * @brief Extracts at most #max items and writes them in elems (a batch).
+ * If queue is empty and nonblocking == false, the caller is parked until an
+ * item is inserted or the queue is closed.
+ * @return Number of extracted items (> 0) on success, 0 if queue is empty and
+ * either nonblocking == true or queue is closed, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments.
+ */
+int mpmcq_pop(mpmcq_t* q, void** elems, int max, bool nonblocking){
+	if (!q || !elems || (max <= 0)){ errno = EINVAL; return -1; }
+	int n = 0;
+	while (true){
+		while ((n < max) && mpmcq_tryPop(q, &elems[n])) n++;
+		if ((n > 0) || nonblocking) return n;
+		/* Empty: reads event BEFORE checking again, so that a concurrent push changes it */
+		int event = ATOMIC_GET(&q->event);
+		ATOMIC_ADD(&q->sleepers, 1);
+		if (mpmcq_tryPop(q, &elems[n])) n++;
+		else if (ATOMIC_GET(&q->state) == Q_CLOSED){
+			ATOMIC_SUB(&q->sleepers, 1);
+			/* An item could have been pushed before closing */
+			while ((n < max) && mpmcq_tryPop(q, &elems[n])) n++;
+			return n;
+		} else futex_wait(&q->event, event);
+		ATOMIC_SUB(&q->sleepers, 1);
+	}
+}
+
+
+/**
+ * @brief Closes the queue, waking up ALL parked consumers.
+ * @return 0 on success, -1 on error (q == NULL).
+ */
+int mpmcq_close(mpmcq_t* q){
+	if (!q){ errno = EINVAL; return -1; }
+	ATOMIC_SET(&q->state, Q_CLOSED);
+	ATOMIC_ADD(&q->event, 1);
+	futex_wake(&q->event, INT_MAX);
+	return 0;
+}
+
+
+/**
+ * @return Number of items currently in the queue (approximated if there
+ * are concurrent operations).
+ */
+size_t mpmcq_getSize(mpmcq_t* q){
+	if (!q) return 0;
+	size_t pop = ATOMIC_GET(&q->popPos);
+	size_t push = ATOMIC_GET(&q->pushPos);
+	return (push >= pop ? push - pop : 0);
+}
+
+
+/**
+ * @brief Destroys the queue and ALL the remaining items with freeItems.
+ * @note There MUST NOT be any concurrent operation.
+ * @return 0 on success, -1 on error (q == NULL).
+ */
+int mpmcq_destroy(mpmcq_t* q, void(*freeItems)(void*)){
+	if (!q){ errno = EINVAL; return -1; }
+	void* elem;
+	if (!freeItems) freeItems = dummy;
+	while (mpmcq_tryPop(q, &elem)) freeItems(elem);
+	free(q->cells);
+	free(q);
+	return 0;
+}
@@ -0,0 +1,583 @@
+#include <persist.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* Names of files in the persistence directory */
+#define PR_SNAPNAME "snapshot"
+#define PR_SNAPTMP "snapshot.tmp"
+#define PR_SEGPREFIX "journal."
+
+
+/* ********************** STATIC OPERATIONS ********************** */
+
+/* FNV-1a checksum of pathname and data */
+static uint32_t pr_checksum(const char* pathname, size_t pathlen, const void* data, size_t len){
+	uint32_t h = 2166136261U;
+	const unsigned char* q = (const unsigned char*)pathname;
+	for (size_t i = 0; i < pathlen; i++) h = (h ^ q[i]) * 16777619U;
+	q = data;
+	for (size_t i = 0; i < len; i++) h = (h ^ q[i]) * 16777619U;
+	return h;
+}
+
+
+/**
+ * @brief Writes ALL the len bytes of buf to fd.
+ * @return 0 on success, -1 on error (errno set by write).
+ */
+static int pr_writeall(int fd, const void* buf, size_t len){
+	const char* q = buf;
+	while (len > 0){
+		ssize_t w = write(fd, q, len);
+		if (w == -1){
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		q += w;
+		len -= (size_t)w;
+	}
+	return 0;
+}
+
+
+/**
+ * @return Heap-allocated path of the file #name in the persistence directory
+ * (or of the segment #seg if name == NULL), NULL on error (ENOMEM).
+ */
+static char* pr_filename(persist_t* p, const char* name, uint64_t seg){
+	size_t n = strlen(p->dir) + (name ? strlen(name) : strlen(PR_SEGPREFIX) + 20) + 2;
+	char* path = malloc(n);
+	if (!path){ errno = ENOMEM; return NULL; }
+	if (name) snprintf(path, n, "%s/%s", p->dir, name);
+	else snprintf(path, n, "%s/%s%llu", p->dir, PR_SEGPREFIX, (unsigned long long)seg);
+	return path;
+}
+
+
+/* Synchronizes the persistence directory, such that created/renamed/deleted entries are durable */
+static void pr_syncdir(persist_t* p){
+	int fd = open(p->dir, O_RDONLY);
+	if (fd == -1) return;
+	fsync(fd); /* Errors are ignored (e.g. not supported) */
+	close(fd);
+}
+
+
+static int pr_segcmp(const void* a, const void* b){
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+
+/**
+ * @brief Gets ALL the journal segments in the persistence directory.
+ * @param segs -- Address of a (uint64_t*) variable that shall contain a
+ * heap-allocated array of segment numbers in increasing order (to be freed
+ * by the caller).
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory;
+ *	- any error by opendir.
+ */
+static int pr_segments(persist_t* p, uint64_t** segs, size_t* nsegs){
+	DIR* d = opendir(p->dir);
+	if (!d) return -1;
+	struct dirent* ent;
+	size_t n = 0, cap = 0;
+	*segs = NULL;
+	while ((ent = readdir(d)) != NULL){
+		if (strncmp(ent->d_name, PR_SEGPREFIX, strlen(PR_SEGPREFIX)) != 0) continue;
+		char* num = ent->d_name + strlen(PR_SEGPREFIX);
+		char* end;
+		if (!isdigit((unsigned char)num[0])) continue;
+		unsigned long long seg = strtoull(num, &end, 10);
+		if (*end != '\0') continue;
+		if (n == cap){
+			cap = (cap > 0 ? 2 * cap : 16);
+			uint64_t* tmp = realloc(*segs, cap * sizeof(uint64_t));
+			if (!tmp){
+				free(*segs);
+				closedir(d);
+				errno = ENOMEM;
+				return -1;
+			}
+			*segs = tmp;
+		}
+		(*segs)[n++] = (uint64_t)seg;
+	}
+	closedir(d);
+	if (n > 0) qsort(*segs, n, sizeof(uint64_t), pr_segcmp);
+	*nsegs = n;
+	return 0;
+}
+
+
+/**
+ * @brief Replays ALL the valid records of a journal segment by recordFn. A
+ * truncated or corrupted record (e.g. the last one written before a crash)
+ * terminates the segment.
+ * @return 0 on success, -1 on error (by open/read or recordFn).
+ */
+static int pr_replay(persist_t* p, uint64_t seg, int (*recordFn)(void* arg, int type, char* pathname, void* data, size_t len), void* arg){
+	char* path = pr_filename(p, NULL, seg);
+	if (!path) return -1;
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if ((fd == -1) || (fstat(fd, &st) == -1)){
+		perror("persist: while opening journal segment");
+		if (fd != -1) close(fd);
+		free(path);
+		return -1;
+	}
+	size_t size = (size_t)st.st_size;
+	char* buf = (size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL);
+	close(fd);
+	if (buf == MAP_FAILED){
+		perror("persist: while mapping journal segment");
+		free(path);
+		return -1;
+	}
+	int ret = 0;
+	size_t off = 0;
+	long nrec = 0;
+	while (off < size){
+		pr_record_t rec;
+		if (size - off < sizeof(rec)) break;
+		memcpy(&rec, buf + off, sizeof(rec));
+		if ((rec.magic != PR_REC_MAGIC) || (rec.pathlen == 0) || (rec.datalen > size) ||
+			(size - off - sizeof(rec) < rec.pathlen + rec.datalen)) break;
+		char* pathname = buf + off + sizeof(rec);
+		char* data = pathname + rec.pathlen;
+		if ((pathname[rec.pathlen - 1] != '\0') || (pr_checksum(pathname, rec.pathlen, data, rec.datalen) != rec.sum)) break;
+		if (recordFn(arg, (int)rec.type, pathname, (rec.datalen > 0 ? data : NULL), rec.datalen) == -1){ ret = -1; break; }
+		off += sizeof(rec) + rec.pathlen + rec.datalen;
+		nrec++;
+	}
+	if ((ret == 0) && (off < size)) fprintf(stderr, "persist: '%s' truncated after %ld records (%lu bytes ignored)\n", path, nrec, size - off);
+	if (buf) munmap(buf, size);
+	free(path);
+	return ret;
+}
+
+
+/**
+ * @brief Creates a new (empty) journal segment and makes it current for the flusher.
+ * @return 0 on success, -1 on error (by open).
+ */
+static int pr_opensegment(persist_t* p, uint64_t seg){
+	char* path = pr_filename(p, NULL, seg);
+	if (!path) return -1;
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	free(path);
+	if (fd == -1) return -1;
+	pr_syncdir(p);
+	if (p->fd != -1) close(p->fd);
+	p->fd = fd;
+	return 0;
+}
+
+
+/* Flusher thread: writes and synchronizes pending records (group commit) */
+static void* pr_flusher(void* arg){
+	persist_t* p = arg;
+	char* spare = NULL; /* Buffer swapped with the pending one */
+	size_t sparecap = 0;
+	LOCK(&p->lock);
+	while (true){
+		if (!p->stop && (p->len == 0) && (p->cutlen < 0)){
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += p->syncms / 1000;
+			ts.tv_nsec += (long)(p->syncms % 1000) * 1000000L;
+			if (ts.tv_nsec >= 1000000000L){ ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+			TMDWAIT(&p->fcond, &p->lock, &ts);
+		}
+		if ((p->len == 0) && (p->cutlen < 0)){
+			if (p->stop) break;
+			continue;
+		}
+		/* Takes ALL pending records, such that logging goes on meanwhile */
+		char* data = p->buf;
+		size_t len = p->len;
+		size_t datacap = p->cap;
+		long cut = p->cutlen;
+		uint64_t seg = p->segment;
+		p->buf = spare;
+		p->cap = sparecap;
+		p->len = 0;
+		p->cutlen = -1;
+		UNLOCK(&p->lock);
+
+		int res = 0;
+		if (cut >= 0){ /* Records before cut belong to the previous segment */
+			if ((cut > 0) && (pr_writeall(p->fd, data, (size_t)cut) == -1)) res = -1;
+			if (fdatasync(p->fd) == -1) res = -1;
+			if (pr_opensegment(p, seg) == -1) res = -1;
+		}
+		size_t head = (cut > 0 ? (size_t)cut : 0); /* Bytes already written */
+		if ((len > head) && (pr_writeall(p->fd, data + head, len - head) == -1)) res = -1;
+		if (fdatasync(p->fd) == -1) res = -1;
+		if (res == -1) perror("persist: while writing journal");
+
+		LOCK(&p->lock);
+		p->commits++;
+		p->bytes += len;
+		spare = data;
+		sparecap = datacap;
+		BCAST(&p->dcond);
+	}
+	UNLOCK(&p->lock);
+	free(spare);
+	return NULL;
+}
+
+
+/* Snapshotter thread: takes a snapshot every snapInterval seconds */
+static void* pr_snapshotter(void* arg){
+	persist_t* p = arg;
+	LOCK(&p->lock);
+	while (!p->sstop){
+		struct timespec ts, now;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += p->snapInterval;
+		do {
+			TMDWAIT(&p->scond, &p->lock, &ts);
+			clock_gettime(CLOCK_REALTIME, &now);
+		} while (!p->sstop && ((now.tv_sec < ts.tv_sec) || ((now.tv_sec == ts.tv_sec) && (now.tv_nsec < ts.tv_nsec))));
+		if (p->sstop) break;
+		UNLOCK(&p->lock);
+		if (p->snapshotFn(p->arg) == -1) perror("persist: while taking snapshot");
+		LOCK(&p->lock);
+	}
+	UNLOCK(&p->lock);
+	return NULL;
+}
+
+
+/* ********************** MAIN OPERATIONS ********************** */
+
+/**
+ * @brief Opens (and creates if needed) the persistence directory #dir.
+ * @param syncms -- Interval in milliseconds between two group commits
+ * (PR_DFL_SYNCMS if <= 0).
+ * @return Pointer to persist_t object on success, NULL on error.
+ * Possible errors are:
+ *	- EINVAL: dir is NULL;
+ *	- ENOTDIR: dir is NOT a directory;
+ *	- ENOMEM: unable to allocate memory;
+ *	- any error by mkdir/stat.
+ */
+persist_t* persist_open(char* dir, int syncms){
+	if (!dir){ errno = EINVAL; return NULL; }
+	struct stat st;
+	if ((mkdir(dir, 0755) == -1) && (errno != EEXIST)) return NULL;
+	if (stat(dir, &st) == -1) return NULL;
+	if (!S_ISDIR(st.st_mode)){ errno = ENOTDIR; return NULL; }
+	persist_t* p = malloc(sizeof(persist_t));
+	if (!p){ errno = ENOMEM; return NULL; }
+	memset(p, 0, sizeof(persist_t));
+	p->dir = malloc(strlen(dir) + 1);
+	if (!p->dir){
+		free(p);
+		errno = ENOMEM;
+		return NULL;
+	}
+	strcpy(p->dir, dir);
+	p->syncms = (syncms > 0 ? syncms : PR_DFL_SYNCMS);
+	p->cutlen = -1;
+	p->fd = -1;
+	MTX_INIT(&p->lock, NULL);
+	CD_INIT(&p->fcond, NULL);
+	CD_INIT(&p->scond, NULL);
+	CD_INIT(&p->dcond, NULL);
+	return p;
+}
+
+
+/**
+ * @brief Loads the snapshot (if any) by calling fileFn for each of its files,
+ * whose content is left mapped in memory until persist_close, then replays ALL
+ * the journal segments after it by calling recordFn for each record, and finally
+ * opens a new segment for logging.
+ * @note pathname and data passed to callbacks are valid ONLY during the call,
+ * except for data passed to fileFn.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- EBADMSG: invalid snapshot;
+ *	- any error by open/mmap, pr_segments, pr_replay and callbacks.
+ */
+int persist_load(persist_t* p, int (*fileFn)(void* arg, char* pathname, int codec, size_t size, void* data, size_t len),
+	int (*recordFn)(void* arg, int type, char* pathname, void* data, size_t len), void* arg){
+	if (!p || !fileFn || !recordFn || p->started || (p->fd != -1)){ errno = EINVAL; return -1; }
+	uint64_t first = 0; /* First segment to replay */
+	char* path = pr_filename(p, PR_SNAPNAME, 0);
+	if (!path) return -1;
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if ((fd == -1) && (errno != ENOENT)) return -1;
+	if (fd != -1){
+		struct stat st;
+		if (fstat(fd, &st) == -1){ close(fd); return -1; }
+		size_t size = (size_t)st.st_size;
+		if (size < sizeof(pr_snaphdr_t)){ close(fd); errno = EBADMSG; return -1; }
+		char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED) return -1;
+		p->map = map;
+		p->maplen = size;
+		pr_snaphdr_t hdr;
+		memcpy(&hdr, map, sizeof(hdr));
+		if (memcmp(hdr.magic, PR_SNAP_MAGIC, sizeof(hdr.magic)) != 0){ errno = EBADMSG; return -1; }
+		size_t off = sizeof(hdr);
+		for (uint64_t i = 0; i < hdr.nfiles; i++){
+			pr_snapentry_t ent;
+			if (size - off < sizeof(ent)){ errno = EBADMSG; return -1; }
+			memcpy(&ent, map + off, sizeof(ent));
+			off += sizeof(ent);
+			if ((ent.pathlen == 0) || (ent.len > size) || (size - off < ent.pathlen + ent.len) ||
+				(map[off + ent.pathlen - 1] != '\0')){ errno = EBADMSG; return -1; }
+			if (fileFn(arg, map + off, ent.codec, ent.size, map + off + ent.pathlen, ent.len) == -1) return -1;
+			off += ent.pathlen + ent.len;
+		}
+		first = hdr.segment;
+	}
+	uint64_t* segs;
+	size_t nsegs;
+	if (pr_segments(p, &segs, &nsegs) == -1) return -1;
+	p->segment = first;
+	for (size_t i = 0; i < nsegs; i++){
+		path = NULL;
+		if (segs[i] < first){ /* Already contained in the snapshot (left by a crash) */
+			if ((path = pr_filename(p, NULL, segs[i]))) unlink(path);
+			free(path);
+		} else if (pr_replay(p, segs[i], recordFn, arg) == -1){
+			free(segs);
+			return -1;
+		} else p->segment = segs[i] + 1; /* A segment is NEVER appended after restart */
+	}
+	free(segs);
+	return pr_opensegment(p, p->segment);
+}
+
+
+/**
+ * @brief Starts the flusher thread and, if snapInterval > 0, a thread that
+ * calls snapshotFn(arg) every snapInterval seconds.
+ * @note persist_load MUST have been called before.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- any error by pthread_create.
+ */
+int persist_start(persist_t* p, int snapInterval, int (*snapshotFn)(void* arg), void* arg){
+	if (!p || (p->fd == -1) || p->started || ((snapInterval > 0) && !snapshotFn)){ errno = EINVAL; return -1; }
+	p->snapInterval = MAX(snapInterval, 0);
+	p->snapshotFn = snapshotFn;
+	p->arg = arg;
+	int r;
+	if ((r = pthread_create(&p->flusher, NULL, pr_flusher, p)) != 0){ errno = r; return -1; }
+	p->started = true;
+	if (p->snapInterval > 0){
+		if ((r = pthread_create(&p->snapshotter, NULL, pr_snapshotter, p)) != 0){
+			errno = r;
+			return -1;
+		}
+		p->snapping = true;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Appends a record to the journal, which will be committed by the
+ * flusher within syncms milliseconds. If too many bytes are still pending,
+ * the caller waits until they have been written.
+ * @note Records of the same file MUST be logged in the same order in which
+ * the corresponding operations have been executed.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to allocate memory.
+ */
+int persist_log(persist_t* p, int type, char* pathname, void* data, size_t len){
+	if (!p || !pathname || (!data && (len > 0)) || (type < PR_CREATE) || (type > PR_REMOVE)){ errno = EINVAL; return -1; }
+	pr_record_t rec;
+	rec.magic = PR_REC_MAGIC;
+	rec.type = (uint32_t)type;
+	rec.pathlen = (uint32_t)(strlen(pathname) + 1);
+	rec.datalen = len;
+	rec.sum = pr_checksum(pathname, rec.pathlen, data, len);
+	size_t n = sizeof(rec) + rec.pathlen + len;
+	int ret = 0;
+	LOCK(&p->lock);
+	while (!p->stop && (p->len >= PR_MAXPENDING)){ WAIT(&p->dcond, &p->lock); }
+	if (p->len + n > p->cap){
+		size_t newcap = MAX(2 * p->cap, p->len + n);
+		char* tmp = realloc(p->buf, newcap);
+		if (!tmp){ errno = ENOMEM; ret = -1; }
+		else {
+			p->buf = tmp;
+			p->cap = newcap;
+		}
+	}
+	if (ret == 0){
+		memcpy(p->buf + p->len, &rec, sizeof(rec));
+		memcpy(p->buf + p->len + sizeof(rec), pathname, rec.pathlen);
+		if (len > 0) memcpy(p->buf + p->len + sizeof(rec) + rec.pathlen, data, len);
+		p->len += n;
+		p->records++;
+		if (p->len >= PR_FLUSHLEN){ SIGNAL(&p->fcond); }
+	}
+	UNLOCK(&p->lock);
+	return ret;
+}
+
+
+/**
+ * @brief Terminates the current journal segment: records logged from now on
+ * belong to a new one, from which a snapshot of the current state shall start.
+ * @note The caller MUST ensure that NO operation is being logged meanwhile,
+ * such that the state seen by the snapshot corresponds to the cut.
+ * @return Number of the new segment.
+ */
+uint64_t persist_cut(persist_t* p){
+	LOCK(&p->lock);
+	while (p->cutlen >= 0){ WAIT(&p->dcond, &p->lock); } /* Previous cut still pending */
+	p->cutlen = (long)p->len;
+	uint64_t seg = ++p->segment;
+	SIGNAL(&p->fcond);
+	UNLOCK(&p->lock);
+	return seg;
+}
+
+
+/**
+ * @brief Writes a snapshot of #nfiles files that starts from journal segment
+ * #segment (as returned by persist_cut), replaces the previous one and
+ * deletes ALL the segments before it.
+ * @return 0 on success, -1 on error (the previous snapshot is untouched).
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to allocate memory;
+ *	- any error by open/write/fsync/rename.
+ */
+int persist_snapshot(persist_t* p, uint64_t segment, pr_file_t* files, size_t nfiles){
+	if (!p || (!files && (nfiles > 0))){ errno = EINVAL; return -1; }
+	char* tmppath = pr_filename(p, PR_SNAPTMP, 0);
+	char* path = pr_filename(p, PR_SNAPNAME, 0);
+	int fd = ((tmppath && path) ? open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1);
+	int ret = (fd == -1 ? -1 : 0);
+	pr_snaphdr_t hdr;
+	memcpy(hdr.magic, PR_SNAP_MAGIC, sizeof(hdr.magic));
+	hdr.segment = segment;
+	hdr.nfiles = nfiles;
+	if (ret == 0) ret = pr_writeall(fd, &hdr, sizeof(hdr));
+	for (size_t i = 0; (ret == 0) && (i < nfiles); i++){
+		pr_snapentry_t ent;
+		struct iovec* iov = NULL;
+		ent.pathlen = (uint32_t)(strlen(files[i].pathname) + 1);
+		ent.codec = files[i].codec;
+		ent.size = files[i].size;
+		ent.len = (files[i].body ? files[i].body->size : 0);
+		int n = fbody_iov(files[i].body, ent.len, &iov);
+		if ((n == -1) || (pr_writeall(fd, &ent, sizeof(ent)) == -1) || (pr_writeall(fd, files[i].pathname, ent.pathlen) == -1)) ret = -1;
+		for (int j = 0; (ret == 0) && (j < n); j++) ret = pr_writeall(fd, iov[j].iov_base, iov[j].iov_len);
+		free(iov);
+	}
+	if ((ret == 0) && (fsync(fd) == -1)) ret = -1;
+	if (fd != -1) close(fd);
+	if ((ret == 0) && (rename(tmppath, path) == -1)) ret = -1;
+	if (ret == -1){
+		int errno_copy = errno;
+		if (tmppath) unlink(tmppath);
+		errno = errno_copy;
+	} else {
+		pr_syncdir(p);
+		/* Segments before the snapshot are NOT needed anymore */
+		uint64_t* segs;
+		size_t nsegs;
+		if (pr_segments(p, &segs, &nsegs) == 0){
+			for (size_t i = 0; i < nsegs; i++){
+				if (segs[i] >= segment) break;
+				char* segpath = pr_filename(p, NULL, segs[i]);
+				if (segpath) unlink(segpath);
+				free(segpath);
+			}
+			free(segs);
+		}
+		LOCK(&p->lock);
+		p->snapshots++;
+		UNLOCK(&p->lock);
+	}
+	free(tmppath);
+	free(path);
+	return ret;
+}
+
+
+/**
+ * @brief Stops (and joins) the snapshotter thread, if any.
+ * @return 0 on success, -1 on error (p == NULL).
+ */
+int persist_stopSnapshots(persist_t* p){
+	if (!p){ errno = EINVAL; return -1; }
+	LOCK(&p->lock);
+	p->sstop = true;
+	BCAST(&p->scond);
+	UNLOCK(&p->lock);
+	if (p->snapping){
+		pthread_join(p->snapshotter, NULL);
+		p->snapping = false;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Commits ALL pending records, stops threads and frees ALL resources,
+ * including the mapping of the snapshot loaded at startup.
+ * @note NO file content loaded from the snapshot can be in use anymore.
+ * @return 0 on success, -1 on error (p == NULL).
+ */
+int persist_close(persist_t* p){
+	if (!p){ errno = EINVAL; return -1; }
+	persist_stopSnapshots(p);
+	LOCK(&p->lock);
+	p->stop = true;
+	SIGNAL(&p->fcond);
+	BCAST(&p->dcond);
+	UNLOCK(&p->lock);
+	if (p->started) pthread_join(p->flusher, NULL);
+	if (p->fd != -1) close(p->fd);
+	if (p->map) munmap(p->map, p->maplen);
+	MTX_DESTROY(&p->lock);
+	CD_DESTROY(&p->fcond);
+	CD_DESTROY(&p->scond);
+	CD_DESTROY(&p->dcond);
+	free(p->buf);
+	free(p->dir);
+	free(p);
+	return 0;
+}
+
+
+/**
+ * @brief Dumps persistence information and statistics to stream.
+ */
+void persist_dump(persist_t* p, FILE* stream){
+	if (!p) return;
+	if (!stream) stream = stdout;
+	LOCK(&p->lock);
+	fprintf(stream, "%s directory = %s\n", PERSISTDUMP_CYAN, p->dir);
+	fprintf(stream, "%s current journal segment = %llu\n", PERSISTDUMP_CYAN, (unsigned long long)p->segment);
+	fprintf(stream, "%s journal records = %ld\n", PERSISTDUMP_CYAN, p->records);
+	fprintf(stream, "%s group commits = %ld (%.2f records per commit)\n", PERSISTDUMP_CYAN, p->commits,
+		(p->commits > 0 ? (double)p->records / p->commits : 0.0));
+	fprintf(stream, "%s journal bytes written = %lu\n", PERSISTDUMP_CYAN, p->bytes);
+	fprintf(stream, "%s snapshots taken = %d\n", PERSISTDUMP_CYAN, p->snapshots);
+	UNLOCK(&p->lock);
+}
@@ -3,6 +3,10 @@
  *	- a message identifier (msg_t), saying which type of operation needs to be performed (defined in protocol.h);
  *	- 1 or more (serialized) packet_t objects, i.e. couples of <data, sizeof(data)>, where sizeof(data) is sent at
  *	first, followed by data. The first is the path of the file to which operation needs to be / has been performed.
+ * Each connection uses one of two wire formats (see protocol.h): the legacy one, in which all these fields are
+ * written separately, or the framed one, in which a header carries type and ALL lengths and the whole message
+ * is written by a single writev and read by (at most) one read for the header and one readv for the contents.
+ * The format of a connection is detected by the receiver on the first message, so that legacy peers keep working.
  *
  * Typical usage for a sender is:
  *	message_t* msg;
@@ -44,6 +48,127 @@
  */
 static void nothing(void* data){ return; }
 
+
+/* Number of iovec elements on the stack for sending/receiving framed messages */
+#define MSG_STACK_IOV 16
+
+/* Size and number of pages of the per-fd table */
+#define FMT_PAGESIZE 4096
+#define FMT_NPAGES 1024
+
+/* Per-fd state of a connection */
+typedef struct fdinfo_s {
+	uint32_t reqid; /* Current request ID */
+	unsigned char format; /* One of MSG_* */
+} fdinfo_t;
+
+/**
+ * @brief Wire format and current request ID of each fd (MSG_AUTO and 0 by default):
+ * a two-level table of lazily allocated pages, such that lookups require NO lock.
+ */
+static fdinfo_t* fdPages[FMT_NPAGES];
+
+
+/* ******************************** per-fd functions **************************************** */
+
+/**
+ * @brief Gets the entry of fd in the per-fd table, allocating its page if create == true.
+ * @return Pointer to the entry on success, NULL if fd is out of range, or its page is not
+ * allocated and create == false, or on error (ENOMEM).
+ */
+static fdinfo_t* fdinfo_get(int fd, bool create){
+	if ((fd < 0) || (fd >= FMT_PAGESIZE * FMT_NPAGES)) return NULL;
+	fdinfo_t** slot = &fdPages[fd / FMT_PAGESIZE];
+	fdinfo_t* page = ATOMIC_GET(slot);
+	if (!page && create){
+		fdinfo_t* newpage = calloc(FMT_PAGESIZE, sizeof(fdinfo_t));
+		if (!newpage){ errno = ENOMEM; return NULL; }
+		if (ATOMIC_CAS(slot, &page, newpage)) page = newpage;
+		else free(newpage); /* Installed by another thread, page is now set to it */
+	}
+	return (page ? &page[fd % FMT_PAGESIZE] : NULL);
+}
+
+
+/**
+ * @return Wire format of fd (one of MSG_*), MSG_AUTO if not set or fd is out of range.
+ */
+int msg_getformat(int fd){
+	fdinfo_t* info = fdinfo_get(fd, false);
+	return (info ? ATOMIC_GET(&info->format) : MSG_AUTO);
+}
+
+
+/**
+ * @brief Sets the wire format of fd, e.g. to MSG_AUTO for a newly accepted connection
+ * or to MSG_FRAMED for a connection to a server that supports framing.
+ * @note Setting MSG_AUTO also resets the current request ID of fd, since fd is
+ * supposed to be a new connection.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid fd or format;
+ *	- ENOMEM: unable to allocate a page of the table.
+ */
+int msg_setformat(int fd, int format){
+	if ((fd < 0) || (fd >= FMT_PAGESIZE * FMT_NPAGES) || (format < MSG_AUTO) || (format > MSG_FRAMED)){
+		errno = EINVAL;
+		return -1;
+	}
+	fdinfo_t* info = fdinfo_get(fd, (format != MSG_AUTO));
+	if (!info) return (format == MSG_AUTO ? 0 : -1); /* MSG_AUTO is the default value */
+	if (format == MSG_AUTO) ATOMIC_SET(&info->reqid, 0);
+	ATOMIC_SET(&info->format, (unsigned char)format);
+	return 0;
+}
+
+
+/**
+ * @return Current request ID of fd, 0 if not set or fd is out of range.
+ */
+uint32_t msg_getreqid(int fd){
+	fdinfo_t* info = fdinfo_get(fd, false);
+	return (info ? ATOMIC_GET(&info->reqid) : 0);
+}
+
+
+/**
+ * @brief Sets the current request ID of fd, i.e. the one stamped on the next
+ * (framed) messages sent on fd, until another one is set or received.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid fd;
+ *	- ENOMEM: unable to allocate a page of the table.
+ */
+int msg_setreqid(int fd, uint32_t reqid){
+	if ((fd < 0) || (fd >= FMT_PAGESIZE * FMT_NPAGES)){ errno = EINVAL; return -1; }
+	fdinfo_t* info = fdinfo_get(fd, (reqid != 0));
+	if (!info) return (reqid == 0 ? 0 : -1);
+	ATOMIC_SET(&info->reqid, reqid);
+	return 0;
+}
+
+
+/**
+ * @brief Gets the type of the next message on (socket) fd WITHOUT consuming
+ * anything and WITHOUT blocking, e.g. for classifying a request before
+ * dispatching it.
+ * @return Type of the message on success, -1 on error.
+ * Possible errors are:
+ *	- EAGAIN: type has NOT arrived yet (or EOF has been read);
+ *	- any error by recv.
+ */
+int msg_peektype(int fd){
+	uint32_t h[2]; /* Legacy type or framed magic + type */
+	int format = msg_getformat(fd);
+	size_t need = (format == MSG_LEGACY ? sizeof(uint32_t) : sizeof(h));
+	ssize_t res = recv(fd, h, need, MSG_PEEK | MSG_DONTWAIT);
+	if (res == -1) return -1;
+	if (((size_t)res >= sizeof(uint32_t)) && (format != MSG_FRAMED) && (h[0] != MSG_FRAME_MAGIC)) return (int)h[0];
+	if (((size_t)res == sizeof(h)) && (h[0] == MSG_FRAME_MAGIC)) return (int)h[1];
+	errno = EAGAIN;
+	return -1;
+}
+
 /* ******************************** msg_t functions **************************************** */
 
 /**
@@ -60,14 +185,19 @@ ssize_t getArgn(msg_t type){
 		case M_READF: /* filename */
 		case M_READNF: /* fileno */
 		case M_CLOSEF: /* filename */
-		case M_LOCKF: /* filename */
 		case M_UNLOCKF: /* filename */
 		case M_REMOVEF: /* filename */
+		case M_FETCHF: /* filename */
+		case M_STATS: /* flags (request), statistics (reply) */
+		case M_FETCHNF: /* results (reply); requests have one argument for each file */
+		case M_PUTNF: /* results (reply); requests have two arguments for each file */
 			return 1;
 
 		case M_OPENF: /* filename, flags */
+		case M_LOCKF: /* filename, timeout (ms) */
 		case M_WRITEF: /* filename, content */
 		case M_APPENDF: /* filename, content */
+		case M_PUTF: /* filename, content */
 			return 2;
 
 		case M_GETF: /* filename, filecontent, modified? */
@@ -128,6 +258,26 @@ int print_reqtype(msg_t type, char* buf, size_t size){
 			strncpy(buf, "file getting request(s)", size);
 			break;
 		}
+		case M_PUTF: {
+			strncpy(buf, "file putting request(s)", size);
+			break;
+		}
+		case M_FETCHF: {
+			strncpy(buf, "file fetching request(s)", size);
+			break;
+		}
+		case M_STATS: {
+			strncpy(buf, "statistics request(s)", size);
+			break;
+		}
+		case M_FETCHNF: {
+			strncpy(buf, "batched file fetching request(s)", size);
+			break;
+		}
+		case M_PUTNF: {
+			strncpy(buf, "batched file putting request(s)", size);
+			break;
+		}
 		default : {
 			return -1;
 		}
@@ -146,6 +296,7 @@ packet_t* packet_init(size_t len, void* content){
 	if (!p) return NULL;
 	p->len = len;
 	p->content = content;
+	p->iovcnt = 0;
 	return p;
 }
 
@@ -159,6 +310,93 @@ void* packet_destroy(packet_t* p){
 	return res;
 }
 
+/* ****************************** marena_t functions *************************************** */
+
+/**
+ * @brief Initializes an empty arena with a chunk of #size bytes.
+ * @return Pointer to marena_t object on success, NULL on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+marena_t* marena_init(size_t size){
+	marena_t* arena = malloc(sizeof(marena_t));
+	if (!arena){ errno = ENOMEM; return NULL; }
+	memset(arena, 0, sizeof(marena_t));
+	if (size < MARENA_ALIGN) size = MARENA_ALIGN;
+	arena->chunk = malloc(size);
+	if (!arena->chunk){
+		free(arena);
+		errno = ENOMEM;
+		return NULL;
+	}
+	arena->size = size;
+	return arena;
+}
+
+
+/**
+ * @brief Allocates #size bytes (aligned to MARENA_ALIGN) from arena.
+ * @return Pointer to allocated memory on success, NULL on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+void* marena_alloc(marena_t* arena, size_t size){
+	size_t asize = (size + MARENA_ALIGN - 1) & ~((size_t)MARENA_ALIGN - 1);
+	if ((asize <= arena->size / 4) && (arena->used + asize <= arena->size)){
+		void* ptr = arena->chunk + arena->used;
+		arena->used += asize;
+		return ptr;
+	}
+	/* Large or not fitting allocation */
+	if (arena->nlarge == arena->caplarge){
+		int newcap = (arena->caplarge > 0 ? 2 * arena->caplarge : 4);
+		void** large = realloc(arena->large, newcap * sizeof(void*));
+		if (!large){ errno = ENOMEM; return NULL; }
+		arena->large = large;
+		arena->caplarge = newcap;
+	}
+	void* ptr = malloc(size > 0 ? size : 1);
+	if (!ptr){ errno = ENOMEM; return NULL; }
+	arena->large[arena->nlarge++] = ptr;
+	return ptr;
+}
+
+
+/**
+ * @brief Frees ALL memory allocated from arena, which can be reused from scratch.
+ */
+void marena_reset(marena_t* arena){
+	if (!arena) return;
+	for (int i = 0; i < arena->nlarge; i++) free(arena->large[i]);
+	arena->nlarge = 0;
+	arena->used = 0;
+}
+
+
+/**
+ * @brief Destroys arena and ALL memory allocated from it.
+ */
+void marena_destroy(marena_t* arena){
+	if (!arena) return;
+	marena_reset(arena);
+	free(arena->large);
+	free(arena->chunk);
+	free(arena);
+}
+
+
+/* Allocates from arena, or from the heap if arena is NULL */
+static void* msg_alloc(marena_t* arena, size_t size){
+	return (arena ? marena_alloc(arena, size) : malloc(size));
+}
+
+
+/* Frees memory allocated by msg_alloc (no-op for arenas, which are reset as a whole) */
+static void msg_free(marena_t* arena, void* ptr){
+	if (!arena) free(ptr);
+}
+
+
 /* ****************************** message_t functions ************************************** */
 
 /**
@@ -226,16 +464,97 @@ int msg_destroy(message_t* msg, void (*freeArgs)(void*), void (*freeContent)(voi
 }
 
 
+/* Number of iovec elements of msg as a framed message */
+static int msg_frame_iovcnt(message_t* msg){
+	int iovcnt = (msg->argn > MSG_FRAME_INLINE ? 2 : 1);
+	for (ssize_t i = 0; i < msg->argn; i++) iovcnt += (msg->args[i].iovcnt > 0 ? msg->args[i].iovcnt : 1);
+	return iovcnt;
+}
+
+
+/**
+ * @brief Builds the framed message msg for fd in #h (header), #*extra (extra
+ * lengths, to be freed by the caller) and #iov (msg_frame_iovcnt(msg) elements).
+ * @return 0 on success, -1 on error (ENOMEM).
+ */
+static int msg_frame(message_t* msg, int fd, mframe_t* h, uint64_t** extra, struct iovec* iov){
+	memset(h, 0, sizeof(*h));
+	h->magic = MSG_FRAME_MAGIC;
+	h->type = (uint32_t)msg->type;
+	h->argn = (uint32_t)msg->argn;
+	h->reqid = (msg->reqid != 0 ? msg->reqid : msg_getreqid(fd));
+	*extra = NULL;
+	if (msg->argn > MSG_FRAME_INLINE){
+		*extra = malloc((msg->argn - MSG_FRAME_INLINE) * sizeof(uint64_t));
+		if (!*extra){ errno = ENOMEM; return -1; }
+	}
+	for (ssize_t i = 0; i < msg->argn; i++){
+		if (i < MSG_FRAME_INLINE) h->lens[i] = msg->args[i].len;
+		else (*extra)[i - MSG_FRAME_INLINE] = msg->args[i].len;
+	}
+	int k = 0;
+	iov[k].iov_base = h;
+	iov[k++].iov_len = sizeof(*h);
+	if (*extra){
+		iov[k].iov_base = *extra;
+		iov[k++].iov_len = (msg->argn - MSG_FRAME_INLINE) * sizeof(uint64_t);
+	}
+	for (ssize_t i = 0; i < msg->argn; i++){
+		if (msg->args[i].iovcnt > 0){
+			memcpy(&iov[k], msg->args[i].content, msg->args[i].iovcnt * sizeof(struct iovec));
+			k += msg->args[i].iovcnt;
+		} else {
+			iov[k].iov_base = msg->args[i].content;
+			iov[k++].iov_len = msg->args[i].len;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Sends the message msg to file descriptor fd as a framed message,
+ * i.e. header, extra lengths (if any) and ALL contents by a single writev.
+ * @return As msg_send.
+ */
+static int msg_send_framed(message_t* msg, int fd){
+	mframe_t h;
+	uint64_t* extra = NULL;
+	int iovcnt = msg_frame_iovcnt(msg);
+	struct iovec stackiov[MSG_STACK_IOV];
+	struct iovec* iov = stackiov;
+	if (iovcnt > MSG_STACK_IOV){
+		iov = malloc(iovcnt * sizeof(struct iovec));
+		if (!iov){ errno = ENOMEM; return -1; }
+	}
+	if (msg_frame(msg, fd, &h, &extra, iov) == -1){
+		if (iov != stackiov) free(iov);
+		errno = ENOMEM;
+		return -1;
+	}
+	int res = writevn(fd, iov, iovcnt);
+	int errno_copy = errno;
+	if (iov != stackiov) free(iov);
+	free(extra);
+	errno = errno_copy;
+	SYSCALL_RETURN(res, -1, "When writing framed message"); /* perror could overwrite errno */
+	if (res == 0){ errno = EBADMSG; return 0; }
+	return 1;
+}
+
+
 /**
- * @brief Sends the message msg to file descriptor fd.
+ * @brief Sends the message msg to file descriptor fd, using the wire format of fd.
  * @note This function requires an ALREADY initialized message_t object.
  * @return 1 on success, -1 on error during a writen, 0 if a writen returned 0.
  * Possible errors are:
  *	- EBADMSG: a writen has returned 0 and so the message has not been completely sent;
  *	- EPIPE: during writing on pipe/socket, the reading endpoint has been closed;
- *	- any error by writen.
+ *	- ENOMEM: (framed format only) unable to allocate memory for the iovec array;
+ *	- any error by writen/writevn.
 */
 int msg_send(message_t* msg, int fd){
+	if (msg_getformat(fd) == MSG_FRAMED) return msg_send_framed(msg, fd);
 	ssize_t res;
 	SYSCALL_RETURN((res = writen(fd, &msg->type, sizeof(msg_t))), -1, "When writing msgtype");
 	if (res == 0){ errno = EBADMSG; return 0; }
@@ -244,72 +563,214 @@ int msg_send(message_t* msg, int fd){
 	for (ssize_t i = 0; i < msg->argn; i++){
 		SYSCALL_RETURN((res = writen(fd, &msg->args[i].len, sizeof(size_t))), -1, "When writing arglen");
 		if (res == 0){ errno = EBADMSG; return 0; }
-		SYSCALL_RETURN((res = writen(fd, msg->args[i].content, msg->args[i].len)), -1, "When writing args");
+		if (msg->args[i].iovcnt > 0){
+			SYSCALL_RETURN((res = writevn(fd, msg->args[i].content, msg->args[i].iovcnt)), -1, "When writing args");
+		} else SYSCALL_RETURN((res = writen(fd, msg->args[i].content, msg->args[i].len)), -1, "When writing args");
 		if (res == 0){ errno = EBADMSG; return 0; }
 	}
 	return 1;
 }
 
+/**
+ * @brief Sends the #n messages msgs (in this order) to file descriptor fd: with
+ * the framed format, ALL of them are sent by a single writev (e.g. for a batch
+ * of files), otherwise they are sent one at a time as by msg_send.
+ * @return As msg_send.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: (framed format only) unable to allocate memory for the iovec array;
+ *	- any error by msg_send.
+ */
+int msg_sendv(message_t* msgs, int n, int fd){
+	if (!msgs || (n < 0)){ errno = EINVAL; return -1; }
+	if (n == 0) return 1;
+	if (msg_getformat(fd) != MSG_FRAMED){
+		for (int i = 0; i < n; i++){
+			int res = msg_send(&msgs[i], fd);
+			if (res != 1) return res;
+		}
+		return 1;
+	}
+	int iovcnt = 0;
+	for (int i = 0; i < n; i++) iovcnt += msg_frame_iovcnt(&msgs[i]);
+	mframe_t* hs = malloc(n * sizeof(mframe_t));
+	uint64_t** extras = calloc(n, sizeof(uint64_t*));
+	struct iovec* iov = malloc(iovcnt * sizeof(struct iovec));
+	int res = -1;
+	int k = 0, i = 0;
+	if (hs && extras && iov){
+		for (i = 0; i < n; i++){
+			if (msg_frame(&msgs[i], fd, &hs[i], &extras[i], iov + k) == -1) break;
+			k += msg_frame_iovcnt(&msgs[i]);
+		}
+		if (i == n) res = writevn(fd, iov, iovcnt);
+	}
+	int errno_copy = (hs && extras && iov && (i == n) ? errno : ENOMEM);
+	if (extras){ for (int j = 0; j < n; j++) free(extras[j]); }
+	free(extras);
+	free(hs);
+	free(iov);
+	errno = errno_copy;
+	SYSCALL_RETURN(res, -1, "When writing framed messages"); /* perror could overwrite errno */
+	if (res == 0){ errno = EBADMSG; return 0; }
+	return 1;
+}
+
+
 /**
  * @brief Utility macro for the 'msg_recv' function.
  */
-#define CLEANUP_RETURN(msg, res, i, string) \
+#define CLEANUP_RETURN(msg, arena, res, i, string) \
 	do { \
-		for (ssize_t j = 0; j < i; j++) free(msg->args[j].content); \
-		free(msg->args); \
+		for (ssize_t j = 0; j < i; j++) msg_free(arena, msg->args[j].content); \
+		msg_free(arena, msg->args); \
 		msg->args = NULL; \
 		msg->argn = 0; \
 		if (res == -1){ \
+			int errno_copy = errno; \
 			perror(string); \
+			errno = errno_copy; \
 			return -1; \
 		} \
 	} while(0);
 
 
 /**
- * @brief Receives the message req from file descriptor fd.
+ * @brief Receives the remaining part of a framed message whose header is h,
+ * i.e. extra lengths (if any) and ALL contents by a single readv.
+ * @return As msg_recv.
+ */
+static int msg_recv_framed(message_t* msg, int fd, mframe_t* h, marena_t* arena){
+	if ((h->magic != MSG_FRAME_MAGIC) || (h->argn > MSG_FRAME_MAXARGN)){ errno = EBADMSG; return -1; }
+	int res;
+	msg->type = (msg_t)h->type;
+	msg->argn = (ssize_t)h->argn;
+	msg->reqid = h->reqid;
+	if (msg->reqid != msg_getreqid(fd)) msg_setreqid(fd, msg->reqid); /* On (ENOMEM) error, replies shall carry a wrong ID */
+	msg->args = msg_alloc(arena, msg->argn * sizeof(packet_t));
+	if (!msg->args) return -1; /* ENOMEM */
+	memset(msg->args, 0, msg->argn * sizeof(packet_t));
+	struct iovec stackiov[MSG_STACK_IOV];
+	struct iovec* iov = stackiov;
+	if (msg->argn > MSG_STACK_IOV){
+		iov = malloc(msg->argn * sizeof(struct iovec));
+		if (!iov) CLEANUP_RETURN(msg, arena, -1, 0, "When allocating memory for iovec array");
+	}
+	for (ssize_t i = 0; (i < msg->argn) && (i < MSG_FRAME_INLINE); i++) msg->args[i].len = h->lens[i];
+	if (msg->argn > MSG_FRAME_INLINE){
+		uint64_t* extra = (uint64_t*)iov; /* Extra lengths are read into (the space of) iovec array */
+		res = readn(fd, extra, (msg->argn - MSG_FRAME_INLINE) * sizeof(uint64_t));
+		if (res <= 0){
+			if (iov != stackiov) free(iov);
+			CLEANUP_RETURN(msg, arena, res, 0, "When reading arglens");
+			errno = EBADMSG;
+			return 0;
+		}
+		for (ssize_t i = MSG_FRAME_INLINE; i < msg->argn; i++) msg->args[i].len = extra[i - MSG_FRAME_INLINE];
+	}
+	for (ssize_t i = 0; i < msg->argn; i++){
+		msg->args[i].content = msg_alloc(arena, msg->args[i].len);
+		if (!msg->args[i].content){
+			if (iov != stackiov) free(iov);
+			CLEANUP_RETURN(msg, arena, -1, i, "When allocating memory for next arg");
+		}
+		iov[i].iov_base = msg->args[i].content;
+		iov[i].iov_len = msg->args[i].len;
+	}
+	res = readvn(fd, iov, (int)msg->argn);
+	if (iov != stackiov) free(iov);
+	if (res <= 0) CLEANUP_RETURN(msg, arena, res, msg->argn, "When reading args");
+	if (res == 0){ errno = EBADMSG; return 0; }
+	return 1;
+}
+
+
+/**
+ * @brief Receives the message req from file descriptor fd. If the format of fd
+ * is MSG_AUTO, it is detected and set by this message.
  * @param msg -- An initialized message_t* object, possibly NOT used after [msg_destroy +]
  * msg_init for not losing data.
+ * @param arena -- Arena in which packet_t array and contents are allocated, or NULL
+ * for allocating them on the heap.
  * @return 1 on success, -1 on error during a readn, 0 if a readn returned 0 (EOF) before
  * having read ALL message bytes.
  * @note If msg_recv returns -1, msg content is NOT valid and it should be destroyed with
  * msg_destroy(msg, nothing, nothing) (or (msg, NULL, NULL)). Function implementation guarantees
  * that all heap-allocated memory for receiving arguments other than message type and argn would
  * have been freed BEFORE returning, so there could not be memory leaks. 
+ * @note NO byte beyond the message is read, such that readiness notification on fd
+ * (select/epoll) is still valid for the next one.
  * Possible errors are:
  *	- EBADMSG: EOF was read during a readn before having completely read all message content,
- *		and so the message has not been completely read;
+ *		and so the message has not been completely read, or an invalid framed header has been read;
  *	- ENOMEM: unable to allocate memory to store received content;
  *	-any error by readn.
 */
-int msg_recv(message_t* msg, int fd){		
+static int msg_recv_in(message_t* msg, int fd, marena_t* arena){		
 	int res;
+	int format = msg_getformat(fd);
+	mframe_t h;
+	
+	if (format == MSG_FRAMED){
+		SYSCALL_RETURN((res = readn(fd, &h, sizeof(h))), -1, "When reading framed header");
+		if (res == 0){ errno = EBADMSG; return 0; }
+		return msg_recv_framed(msg, fd, &h, arena);
+	}
 	
 	/* res == -1 => an error (different from connreset) has occurred; the same applies on the following reads */
-	SYSCALL_RETURN((res = readn(fd, &msg->type, sizeof(msg_t))), -1, "When reading msgtype");
+	SYSCALL_RETURN((res = readn(fd, &h.magic, sizeof(uint32_t))), -1, "When reading msgtype");
 	/* EOF was read => connection has been closed; the same applies on the following reads */
 	if (res == 0){ errno = EBADMSG; return 0; }
 	
+	if ((format == MSG_AUTO) && (h.magic == MSG_FRAME_MAGIC)){ /* Framed peer */
+		SYSCALL_RETURN((res = readn(fd, ((char*)&h) + sizeof(uint32_t), sizeof(h) - sizeof(uint32_t))), -1, "When reading framed header");
+		if (res == 0){ errno = EBADMSG; return 0; }
+		msg_setformat(fd, MSG_FRAMED); /* On (ENOMEM) error, replies will simply be sent in legacy format */
+		return msg_recv_framed(msg, fd, &h, arena);
+	} else if (format == MSG_AUTO) msg_setformat(fd, MSG_LEGACY);
+	msg->type = (msg_t)h.magic; /* sizeof(msg_t) == sizeof(uint32_t) */
+	msg->reqid = 0;
+	
 	SYSCALL_RETURN((res = readn(fd, &msg->argn, sizeof(ssize_t))), -1, "When reading argn");
 	if (res == 0){ errno = EBADMSG; return 0; }
 	
-	msg->args = calloc(msg->argn, sizeof(packet_t));
+	if ((msg->argn < 0) || (msg->argn > MSG_FRAME_MAXARGN)){ errno = EBADMSG; return -1; }
+	msg->args = msg_alloc(arena, msg->argn * sizeof(packet_t));
 	if (!msg->args) return -1; /* ENOMEM */
+	memset(msg->args, 0, msg->argn * sizeof(packet_t));
 	for (ssize_t i = 0; i < msg->argn; i++){
 	
 		res = readn(fd, &msg->args[i].len, sizeof(size_t));
-		if (res <= 0) CLEANUP_RETURN(msg, res, i, "When reading arglen");
+		if (res <= 0) CLEANUP_RETURN(msg, arena, res, i, "When reading arglen");
 		if (res == 0){ errno = EBADMSG; return 0; }
 		
-		msg->args[i].content = malloc(msg->args[i].len);
-		if (!msg->args[i].content) CLEANUP_RETURN(msg, -1, i, "When allocating memory for next arg");
+		msg->args[i].content = msg_alloc(arena, msg->args[i].len);
+		if (!msg->args[i].content) CLEANUP_RETURN(msg, arena, -1, i, "When allocating memory for next arg");
 		res = readn(fd, msg->args[i].content, msg->args[i].len);
-		if (res <= 0) CLEANUP_RETURN(msg, res, i+1, "When reading arg");
+		if (res <= 0) CLEANUP_RETURN(msg, arena, res, i+1, "When reading arg");
 		if (res == 0){ errno = EBADMSG; return 0; }
 	}
 	return 1;
 }
 
+/**
+ * @brief As msg_recv_arena, with ALL content allocated on the heap.
+ */
+int msg_recv(message_t* msg, int fd){
+	return msg_recv_in(msg, fd, NULL);
+}
+
+
+/**
+ * @brief As msg_recv, but packet_t array and ALL contents are allocated in
+ * #arena, such that msg MUST NOT be destroyed with msg_destroy and it stays
+ * valid until the next marena_reset.
+ */
+int msg_recv_arena(message_t* msg, int fd, marena_t* arena){
+	if (!arena){ errno = EINVAL; return -1; }
+	return msg_recv_in(msg, fd, arena);
+}
+
 /**
  * @brief Prints out the content of a message (apart from req->args[i].content,
  * whose format is NOT predictable).
@@ -325,8 +786,10 @@ void printMsg(message_t* req){
 
 /**
  * @brief Utility function for making and sending a message to the server.
- * @param msg -- Address of a message_t* object (possibly not containing
- * any relevant data) in which data to be sent shall be written.
+ * @note The message is built on the stack (at most MSG_STACK_ARGS arguments),
+ * so that NO allocation is made for sending.
+ * @param msg -- Address of a message_t* object, which is set to NULL (the
+ * message does NOT survive the call).
  * @param type -- A msg_t value representing message type.
  * @param creatmsg -- An error message for failure in msg initialization.
  * @param sendmsg -- An error message for failure in msg sending.
@@ -334,43 +797,52 @@ void printMsg(message_t* req){
  * where l is the byte-size or arg. 
  * @return 0 on success, -1 on error.
  * Possible errors are:
+ *	- EINVAL: invalid message type;
  *	- ENOMEM: unable to allocate memory for msg;
  *	- EBADMSG: message has not been completely sent;
  *	- EPIPE: when writing on socket/pipe, the other endpoint has been closed.
  */
 int msend(int fd, message_t** msg, msg_t type, char* creatmsg, char* sendmsg, ...){
-	*msg = msg_init();
-	if (*msg == NULL){
+	message_t m;
+	packet_t stackp[MSG_STACK_ARGS];
+	*msg = NULL;
+	m.type = type;
+	m.argn = getArgn(type);
+	m.reqid = 0; /* Current request ID of fd */
+	if (m.argn < 0){
 		if (creatmsg) perror(creatmsg); /* Pass them as NULL to avoid these printouts */ 
+		errno = EINVAL;
 		return -1;
 	}
-	(*msg)->type = type;
-	(*msg)->argn = getArgn(type);
-	packet_t* p = calloc((*msg)->argn, sizeof(packet_t));
-	if (!p){
-		msg_destroy(*msg, nothing, nothing);
-		errno = ENOMEM;
-		return -1;
+	packet_t* p = stackp;
+	if (m.argn > MSG_STACK_ARGS){
+		p = calloc(m.argn, sizeof(packet_t));
+		if (!p){
+			if (creatmsg) perror(creatmsg);
+			errno = ENOMEM;
+			return -1;
+		}
 	}
 	
 	va_list args;
 	va_start(args, sendmsg);
-	for (ssize_t i = 0; i < (*msg)->argn; i++){
+	for (ssize_t i = 0; i < m.argn; i++){
 		p[i].len = va_arg(args, size_t);
 		p[i].content = va_arg(args, void*);
+		p[i].iovcnt = 0;
 	}
 	va_end(args);
 	
-	(*msg)->args = p;
-	if (msg_send(*msg, fd) < 1){ /* Message not correctly sent */
+	m.args = p;
+	int ret = 0;
+	if (msg_send(&m, fd) < 1){ /* Message not correctly sent */
 		if (sendmsg) perror(sendmsg);
-		int errno_copy = errno;
-		msg_destroy(*msg, free, nothing);
-		errno = errno_copy;
-		return -1;
+		ret = -1;
 	}
-	msg_destroy(*msg, free, nothing); /* No copy on the heap */
-	return 0;
+	int errno_copy = errno;
+	if (p != stackp) free(p);
+	errno = errno_copy;
+	return ret;
 }
 
 
@@ -405,3 +877,26 @@ int mrecv(int fd, message_t** msg, char* creatmsg, char* recvmsg){
 	}
 	return 0;
 }
+
+
+/**
+ * @brief As mrecv, but message is allocated in #arena (see msg_recv_arena),
+ * such that NO allocation is made in steady state.
+ * @note Message is valid until the next marena_reset(arena) and MUST NOT
+ * be destroyed with msg_destroy.
+ * @return 0 on success, -1 on error (*msg is NULL).
+ * Possible errors are:
+ *	- EINVAL: arena is NULL;
+ *	- any error by msg_recv_arena.
+ */
+int mrecv_arena(int fd, message_t** msg, marena_t* arena){
+	if (!arena){ errno = EINVAL; return -1; }
+	*msg = marena_alloc(arena, sizeof(message_t));
+	if (*msg == NULL) return -1;
+	memset(*msg, 0, sizeof(message_t));
+	if (msg_recv_arena(*msg, fd, arena) < 1){ /* Message not correctly received (memory is reclaimed by marena_reset) */
+		*msg = NULL;
+		return -1;
+	}
+	return 0;
+}
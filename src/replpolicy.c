@@ -0,0 +1,463 @@
+#include <replpolicy.h>
+
+/* Policy names (indexed by RP_*) */
+static char* policyNames[] = {"FIFO", "LRU", "LFU", "CLOCK"};
+
+/* Number of policies */
+#define RP_NUM 4
+
+
+/* ********************** STATIC OPERATIONS ********************** */
+
+/* Appends file at the tail of list l */
+static void list_link(repl_list_t* l, FileData_t* file){
+	file->rnext = NULL;
+	file->rprev = l->tail;
+	if (l->tail) l->tail->rnext = file;
+	else l->head = file;
+	l->tail = file;
+}
+
+
+/* Unlinks file from list l */
+static void list_unlink(repl_list_t* l, FileData_t* file){
+	if (file->rprev) file->rprev->rnext = file->rnext;
+	else l->head = file->rnext;
+	if (file->rnext) file->rnext->rprev = file->rprev;
+	else l->tail = file->rprev;
+	file->rprev = NULL;
+	file->rnext = NULL;
+}
+
+
+/**
+ * @brief Gets the bucket of class c for frequency #freq by walking forward
+ * from bucket #from (from->freq <= freq), creating it if not existing (LFU).
+ * @return The found/created bucket, or the last one with frequency < freq
+ * if it is not possible to create it (ENOMEM, the file is kept at a lower
+ * frequency than its real one).
+ */
+static repl_bucket_t* repl_bucket(repl_bucket_t* from, unsigned int freq){
+	repl_bucket_t* b = from;
+	while (b->next && (b->next->freq <= freq)) b = b->next;
+	if (b->freq == freq) return b;
+	repl_bucket_t* nb = malloc(sizeof(repl_bucket_t));
+	if (!nb) return b;
+	memset(nb, 0, sizeof(repl_bucket_t));
+	nb->freq = freq;
+	nb->prev = b;
+	nb->next = b->next;
+	if (b->next) b->next->prev = nb;
+	b->next = nb;
+	return nb;
+}
+
+
+/* Destroys bucket b if it is empty (the first bucket of a class is NEVER destroyed) */
+static void repl_bucket_release(repl_class_t* c, repl_bucket_t* b){
+	if ((b == &c->one) || b->files.head) return;
+	b->prev->next = b->next;
+	if (b->next) b->next->prev = b->prev;
+	free(b);
+}
+
+
+/* Unlinks file from the list of its class or from its bucket (lock MUST be held) */
+static void repl_unlink(replpolicy_t* r, FileData_t* file){
+	repl_class_t* c = &r->classes[file->rclass];
+	if (c->hand == file) c->hand = file->rnext; /* Could become NULL: it will be restarted from head */
+	if (r->policy == RP_LFU){
+		list_unlink(&file->rbucket->files, file);
+		repl_bucket_release(c, file->rbucket);
+		file->rbucket = NULL;
+	} else list_unlink(&c->files, file);
+	file->linked = false;
+	c->size--;
+	r->size--;
+}
+
+
+/**
+ * @brief Links file as the most recent one of the class identified by
+ * file->rclass, or (LFU) of the bucket for its frequency (lock MUST be held).
+ */
+static void repl_link(replpolicy_t* r, FileData_t* file){
+	repl_class_t* c = &r->classes[file->rclass];
+	file->rstamp = ++r->clock;
+	if (r->policy == RP_LFU){
+		file->rbucket = repl_bucket(&c->one, ATOMIC_GET(&file->freq));
+		list_link(&file->rbucket->files, file);
+	} else list_link(&c->files, file);
+	file->linked = true;
+	c->size++;
+	r->size++;
+}
+
+
+/**
+ * @brief Moves file to the bucket for its current frequency (LFU, lock MUST be held).
+ * @return true if file has been moved, false otherwise.
+ */
+static bool repl_rebucket(replpolicy_t* r, FileData_t* file){
+	repl_class_t* c = &r->classes[file->rclass];
+	repl_bucket_t* b = file->rbucket;
+	repl_bucket_t* nb = repl_bucket(b, ATOMIC_GET(&file->freq));
+	if (nb == b) return false;
+	list_unlink(&b->files, file);
+	repl_bucket_release(c, b);
+	file->rbucket = nb;
+	file->rstamp = ++r->clock;
+	list_link(&nb->files, file);
+	return true;
+}
+
+
+/**
+ * @brief Applies ALL the deferred promotions, by moving the files in the
+ * promotion buffer to the tail of their class list (LRU) or to the bucket
+ * for their current frequency (LFU) (lock MUST be held).
+ * @note Slots are emptied ONLY here, such that a slot read as not NULL
+ * cannot be overwritten by repl_defer before being cleared.
+ */
+static void repl_drain(replpolicy_t* r){
+	for (int i = 0; i < REPL_PBUFSIZE; i++){
+		FileData_t* file = ATOMIC_GET(&r->pbuf[i]);
+		if (!file) continue;
+		ATOMIC_SET(&r->pbuf[i], NULL);
+		ATOMIC_SET(&file->pending, false);
+		if (!file->linked) continue;
+		if (r->policy == RP_LFU) repl_rebucket(r, file);
+		else if (r->classes[file->rclass].files.tail != file){
+			repl_unlink(r, file);
+			repl_link(r, file);
+		}
+	}
+}
+
+
+/**
+ * @brief Records a promotion of file (LRU/LFU) in the promotion buffer WITHOUT
+ * taking the list mutex: a file is in the buffer at most once, and if NO
+ * free slot is found after REPL_PBUFTRIES attempts the promotion is lost
+ * (the list is an approximation of the LRU order until the next drain, while
+ * LFU moves a file with a lost promotion when it is selected, see repl_lfuFirst).
+ */
+static void repl_defer(replpolicy_t* r, FileData_t* file){
+	bool pending = false;
+	if (!ATOMIC_CAS(&file->pending, &pending, true)) return; /* Already in the buffer */
+	for (int i = 0; i < REPL_PBUFTRIES; i++){
+		unsigned int k = ATOMIC_ADD(&r->pnext, 1) % REPL_PBUFSIZE;
+		FileData_t* empty = NULL;
+		if (ATOMIC_CAS(&r->pbuf[k], &empty, file)) return;
+	}
+	ATOMIC_SET(&file->pending, false); /* Buffer full */
+}
+
+
+/**
+ * @brief Gets the least frequently used file of class c other than #exclude,
+ * by moving to the right bucket the candidates whose promotions have been
+ * lost (see repl_defer) (LFU, lock MUST be held).
+ * @note Buckets other than the first one are NEVER empty, hence at most
+ * three of them are visited for each candidate.
+ */
+static FileData_t* repl_lfuFirst(replpolicy_t* r, repl_class_t* c, FileData_t* exclude){
+	while (true){
+		FileData_t* file = NULL;
+		for (repl_bucket_t* b = &c->one; b && !file; b = b->next){
+			file = b->files.head;
+			if (file && (file == exclude)) file = file->rnext;
+		}
+		if (!file || (ATOMIC_GET(&file->freq) <= file->rbucket->freq) || !repl_rebucket(r, file)) return file;
+	}
+}
+
+
+/**
+ * @brief Gets the first candidate victim of class c other than #exclude
+ * (FIFO, LRU, LFU, lock MUST be held).
+ */
+static FileData_t* repl_first(replpolicy_t* r, repl_class_t* c, FileData_t* exclude){
+	if (r->policy == RP_LFU) return repl_lfuFirst(r, c, exclude);
+	FileData_t* file = c->files.head;
+	if (file && (file == exclude)) file = file->rnext;
+	return file;
+}
+
+
+/**
+ * @return true <=> candidate f1 shall be expelled before candidate f2
+ * (both NOT NULL): LFU compares frequencies and then stamps, while the other
+ * policies compare ONLY stamps (i.e. creation/last access/link order).
+ */
+static bool repl_before(replpolicy_t* r, FileData_t* f1, FileData_t* f2){
+	if ((r->policy == RP_LFU) && (f1->rbucket->freq != f2->rbucket->freq)) return (f1->rbucket->freq < f2->rbucket->freq);
+	return (f1->rstamp < f2->rstamp);
+}
+
+
+/**
+ * @brief Runs the clock on class #cls (on ALL classes if cls == RC_ANY) (CLOCK,
+ * lock MUST be held). Classes have a hand each, and the next file to visit is
+ * the one with the least stamp greater than the stamp r->cpos of the last
+ * visited one (or the one with the least stamp if there is not such a file),
+ * such that ALL files are visited in link order as with a single clock.
+ * @note At most two rounds: after the first one, NO file (except #exclude)
+ * has its reference bit set.
+ */
+static FileData_t* repl_clock(replpolicy_t* r, int cls, FileData_t* exclude){
+	int steps = 2 * (cls == RC_ANY ? r->size : r->classes[cls].size);
+	for (int i = 0; i < steps; i++){
+		repl_class_t* c = NULL;
+		FileData_t* file = NULL;
+		bool ahead = false;
+		for (int j = 0; j < RC_NUM; j++){
+			if ((cls != RC_ANY) && (j != cls)) continue;
+			FileData_t* h = (r->classes[j].hand ? r->classes[j].hand : r->classes[j].files.head);
+			if (!h) continue;
+			bool hahead = (h->rstamp > r->cpos);
+			if (!file || (hahead && !ahead) || ((hahead == ahead) && (h->rstamp < file->rstamp))){
+				c = &r->classes[j];
+				file = h;
+				ahead = hahead;
+			}
+		}
+		if (!file) break;
+		if (file != exclude){
+			if (!ATOMIC_GET(&file->refbit)) return file;
+			ATOMIC_SET(&file->refbit, false); /* Second chance */
+		}
+		c->hand = file->rnext; /* NULL <=> restarts from head */
+		r->cpos = file->rstamp;
+	}
+	return NULL;
+}
+
+
+/* ********************** MAIN OPERATIONS ********************** */
+
+/**
+ * @brief Gets the policy identified by #name (case-sensitive).
+ * @return One of RP_* on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: name is NULL or does not identify any policy.
+ */
+int repl_policy(char* name){
+	if (name){
+		for (int i = 0; i < RP_NUM; i++){
+			if (strequal(name, policyNames[i])) return i;
+		}
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+
+/**
+ * @brief Initializes an empty replacement list with the given policy.
+ * @return Pointer to replpolicy_t object on success, NULL on error.
+ * Possible errors are:
+ *	- EINVAL: invalid policy;
+ *	- ENOMEM: unable to allocate memory.
+ */
+replpolicy_t* repl_init(int policy){
+	if ((policy < 0) || (policy >= RP_NUM)){ errno = EINVAL; return NULL; }
+	replpolicy_t* r = malloc(sizeof(replpolicy_t));
+	if (!r){ errno = ENOMEM; return NULL; }
+	memset(r, 0, sizeof(replpolicy_t));
+	r->policy = policy;
+	for (int j = 0; j < RC_NUM; j++) r->classes[j].one.freq = 1;
+	MTX_INIT(&r->lock, NULL);
+	return r;
+}
+
+
+/**
+ * @brief Inserts a new file in the list of its class (as the most recent one).
+ * @return 0 on success, -1 on error, 1 if file is already linked.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments.
+ */
+int repl_insert(replpolicy_t* r, FileData_t* file){
+	if (!r || !file){ errno = EINVAL; return -1; }
+	int ret = 0;
+	LOCK(&r->lock);
+	if ((r->policy == RP_LRU) || (r->policy == RP_LFU)) repl_drain(r);
+	if (file->linked) ret = 1;
+	else {
+		file->freq = 1;
+		file->refbit = false;
+		file->rclass = (file->large ? RC_LARGE : RC_NORMAL);
+		repl_link(r, file);
+	}
+	UNLOCK(&r->lock);
+	return ret;
+}
+
+
+/**
+ * @brief Removes file from the list in O(1) (but if file has a deferred
+ * promotion, the promotion buffer is drained such that it does NOT keep
+ * a reference to file after its destruction).
+ * @return 0 on success, -1 on error, 1 if file is not linked.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments.
+ */
+int repl_remove(replpolicy_t* r, FileData_t* file){
+	if (!r || !file){ errno = EINVAL; return -1; }
+	int ret = 0;
+	LOCK(&r->lock);
+	if (ATOMIC_GET(&file->pending)) repl_drain(r);
+	if (!file->linked) ret = 1;
+	else repl_unlink(r, file);
+	UNLOCK(&r->lock);
+	return ret;
+}
+
+
+/**
+ * @brief Registers an access (hit) to an existing file WITHOUT taking the
+ * list mutex: LRU defers moving it to the tail (see repl_defer), LFU
+ * increments its frequency and defers moving it to the next bucket,
+ * CLOCK sets its reference bit.
+ * @note Caller MUST guarantee that file is NOT removed from the list
+ * concurrently (in the file storage, removals are made with the shard
+ * of the file acquired in "writing" mode). Hence file->linked does NOT
+ * change during this call.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments.
+ */
+int repl_access(replpolicy_t* r, FileData_t* file){
+	if (!r || !file){ errno = EINVAL; return -1; }
+	ATOMIC_ADD(&r->hits, 1);
+	if (!file->linked) return 0;
+	switch (r->policy){
+		case RP_LRU: {
+			repl_defer(r, file);
+			break;
+		}
+		case RP_LFU: {
+			unsigned int freq = ATOMIC_GET(&file->freq);
+			while ((freq < UINT_MAX) && !ATOMIC_CAS(&file->freq, &freq, freq + 1));
+			repl_defer(r, file);
+			break;
+		}
+		case RP_CLOCK: {
+			ATOMIC_SET(&file->refbit, true);
+			break;
+		}
+		default: break; /* FIFO */
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Registers an access to a non-existing file (miss).
+ * @return 0 on success, -1 on error (r == NULL).
+ */
+int repl_miss(replpolicy_t* r){
+	if (!r){ errno = EINVAL; return -1; }
+	ATOMIC_ADD(&r->misses, 1);
+	return 0;
+}
+
+
+/**
+ * @brief Moves file to the list of the class identified by file->large,
+ * as its most recent file (LFU keeps its frequency), if it is linked in
+ * another one. This function shall be called when file->large changes.
+ * @return 0 on success, -1 on error, 1 if file is not linked.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments.
+ */
+int repl_reclass(replpolicy_t* r, FileData_t* file){
+	if (!r || !file){ errno = EINVAL; return -1; }
+	int ret = 0;
+	LOCK(&r->lock);
+	if (!file->linked) ret = 1;
+	else if (file->rclass != (file->large ? RC_LARGE : RC_NORMAL)){
+		repl_unlink(r, file);
+		file->rclass = (file->large ? RC_LARGE : RC_NORMAL);
+		repl_link(r, file);
+	}
+	UNLOCK(&r->lock);
+	return ret;
+}
+
+
+/**
+ * @brief Selects the next file to expel according to the policy.
+ * @note The victim is NOT removed from the list (it shall be removed
+ * when it is destroyed, e.g. by the file storage).
+ * @return Pointer to victim on success, NULL if list is empty or on error.
+ */
+FileData_t* repl_victim(replpolicy_t* r){
+	return repl_victimOf(r, RC_ANY, NULL);
+}
+
+
+/**
+ * @brief Selects the next file to expel according to the policy among the
+ * files of class #cls (ALL files if cls == RC_ANY) other than #exclude.
+ * @note Victim selection is O(1) for FIFO, LRU and LFU, since each class has
+ * its own list (LFU: its own frequency buckets) and with RC_ANY the first
+ * candidates of the classes are compared, and amortized O(1) for CLOCK
+ * (see repl_clock).
+ * @return Pointer to victim on success, NULL if there is no such file or on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments.
+ */
+FileData_t* repl_victimOf(replpolicy_t* r, int cls, FileData_t* exclude){
+	if (!r || (cls < RC_ANY) || (cls >= RC_NUM)){ errno = EINVAL; return NULL; }
+	FileData_t* victim = NULL;
+	LOCK(&r->lock);
+	if ((r->policy == RP_LRU) || (r->policy == RP_LFU)) repl_drain(r);
+	if (r->policy == RP_CLOCK) victim = repl_clock(r, cls, exclude);
+	else {
+		for (int j = 0; j < RC_NUM; j++){
+			if ((cls != RC_ANY) && (j != cls)) continue;
+			FileData_t* file = repl_first(r, &r->classes[j], exclude);
+			if (file && (!victim || repl_before(r, file, victim))) victim = file;
+		}
+	}
+	UNLOCK(&r->lock);
+	return victim;
+}
+
+
+/**
+ * @brief Destroys the replacement list WITHOUT touching linked files.
+ * @return 0 on success, -1 on error (r == NULL).
+ */
+int repl_destroy(replpolicy_t* r){
+	if (!r){ errno = EINVAL; return -1; }
+	for (int j = 0; j < RC_NUM; j++){
+		repl_bucket_t* b = r->classes[j].one.next;
+		while (b){
+			repl_bucket_t* next = b->next;
+			free(b);
+			b = next;
+		}
+	}
+	MTX_DESTROY(&r->lock);
+	free(r);
+	return 0;
+}
+
+
+/**
+ * @brief Dumps policy and hit/miss statistics to stream.
+ */
+void repl_dump(replpolicy_t* r, FILE* stream){
+	if (!r) return;
+	if (!stream) stream = stdout;
+	long hits = ATOMIC_GET(&r->hits);
+	long misses = ATOMIC_GET(&r->misses);
+	long total = hits + misses;
+	fprintf(stream, "%s replacement policy = %s\n", REPLDUMP_CYAN, policyNames[r->policy]);
+	fprintf(stream, "%s hits = %ld\n", REPLDUMP_CYAN, hits);
+	fprintf(stream, "%s misses = %ld\n", REPLDUMP_CYAN, misses);
+	fprintf(stream, "%s hit ratio = %.4f\n", REPLDUMP_CYAN, (total > 0 ? (double)hits/total : 0.0));
+}
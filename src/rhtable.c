@@ -0,0 +1,302 @@
+#include <rhtable.h>
+#include <util.h>
+
+/* Distance of the entry with hash h in slot idx from its "home" slot */
+#define RHT_DIST(h, idx, mask) (((idx) - ((h) & (mask))) & (mask))
+
+
+/* ********************** STATIC OPERATIONS ********************** */
+
+/* Final mixer (from MurmurHash3 fmix64) */
+static uint64_t rht_mix(uint64_t x){
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+
+/**
+ * @brief Allocates an empty array of #cap slots.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+static int rht_array_init(rht_array_t* a, size_t cap){
+	rht_slot_t* slots = calloc(cap, sizeof(rht_slot_t)); /* All slots are RHT_EMPTY */
+	if (!slots){ errno = ENOMEM; return -1; }
+	a->slots = slots;
+	a->cap = cap;
+	a->size = 0;
+	return 0;
+}
+
+
+/**
+ * @brief Searches #key (with hash h) in array #a, stopping as soon as an empty
+ * slot or an entry "richer" than the searched one is found (Robin Hood invariant).
+ * @note Tombstones do NOT break the invariant, since entries are never shifted
+ * in an array that contains them.
+ * @return Index of the slot on success, -1 if not found.
+ */
+static long rht_array_lookup(rht_array_t* a, char* key, uint64_t h){
+	if (!a->slots) return -1;
+	size_t mask = a->cap - 1;
+	size_t idx = h & mask;
+	for (size_t dist = 0; dist < a->cap; dist++, idx = (idx + 1) & mask){
+		rht_slot_t* s = &a->slots[idx];
+		if (s->hash == RHT_EMPTY) return -1;
+		if (s->hash == RHT_TOMB) continue;
+		if (RHT_DIST(s->hash, idx, mask) < dist) return -1; /* key would have been placed before */
+		if ((s->hash == h) && strequal(s->key, key)) return (long)idx;
+	}
+	return -1;
+}
+
+
+/**
+ * @brief Robin Hood insertion of a NOT present key in a NOT full array
+ * WITHOUT tombstones (i.e. the current one).
+ */
+static void rht_array_put(rht_array_t* a, uint64_t h, char* key, void* data){
+	size_t mask = a->cap - 1;
+	size_t idx = h & mask;
+	size_t dist = 0;
+	rht_slot_t curr = {h, key, data};
+	while (true){
+		rht_slot_t* s = &a->slots[idx];
+		if (s->hash == RHT_EMPTY){
+			*s = curr;
+			a->size++;
+			return;
+		}
+		size_t sdist = RHT_DIST(s->hash, idx, mask);
+		if (sdist < dist){ /* Takes the slot from the "richer" entry */
+			rht_slot_t tmp = *s;
+			*s = curr;
+			curr = tmp;
+			dist = sdist;
+		}
+		idx = (idx + 1) & mask;
+		dist++;
+	}
+}
+
+
+/* Backward-shift deletion of slot idx from an array WITHOUT tombstones */
+static void rht_array_remove(rht_array_t* a, size_t idx){
+	size_t mask = a->cap - 1;
+	size_t next = (idx + 1) & mask;
+	while ((a->slots[next].hash != RHT_EMPTY) && (RHT_DIST(a->slots[next].hash, next, mask) > 0)){
+		a->slots[idx] = a->slots[next];
+		idx = next;
+		next = (next + 1) & mask;
+	}
+	memset(&a->slots[idx], 0, sizeof(rht_slot_t));
+	a->size--;
+}
+
+
+/**
+ * @brief Migrates (at most) #nslots slots of the old array to the current
+ * one, and frees the old array when migration is complete.
+ */
+static void rht_migrate(rhtable_t* ht, size_t nslots){
+	if (!ht->old.slots) return;
+	while ((nslots > 0) && (ht->migrated < ht->old.cap) && (ht->old.size > 0)){
+		rht_slot_t* s = &ht->old.slots[ht->migrated++];
+		if (s->hash > RHT_TOMB){
+			rht_array_put(&ht->cur, s->hash, s->key, s->data); /* Cached hash is reused */
+			s->hash = RHT_TOMB;
+			ht->old.size--;
+		}
+		nslots--;
+	}
+	if ((ht->migrated >= ht->old.cap) || (ht->old.size == 0)){
+		free(ht->old.slots);
+		memset(&ht->old, 0, sizeof(rht_array_t));
+		ht->migrated = 0;
+	}
+}
+
+
+/* ********************** MAIN OPERATIONS ********************** */
+
+/**
+ * @brief 64-bit hash of a string: 8 bytes at a time, with a final mix
+ * (multiply-xorshift, in the style of wyhash/xxh64).
+ * @return Hash value, ALWAYS > RHT_TOMB.
+ */
+uint64_t rht_hash(char* key){
+	size_t len = strlen(key);
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len * 0xa0761d6478bd642fULL);
+	uint64_t w;
+	while (len >= 8){
+		memcpy(&w, key, 8);
+		h = (h ^ rht_mix(w)) * 0xe7037ed1a0b428dbULL;
+		h = (h << 31) | (h >> 33);
+		key += 8;
+		len -= 8;
+	}
+	w = 0;
+	memcpy(&w, key, len);
+	h = rht_mix(h ^ w ^ 0x8ebc6af09c88c6e3ULL);
+	return (h > RHT_TOMB ? h : h + 2);
+}
+
+
+/**
+ * @brief Creates an empty table with an initial capacity of (at least)
+ * #nbuckets slots.
+ * @return Pointer to the table on success, NULL on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+rhtable_t* rht_create(int nbuckets){
+	size_t cap = RHT_MINCAP;
+	while (cap < (size_t)nbuckets) cap <<= 1;
+	rhtable_t* ht = malloc(sizeof(rhtable_t));
+	if (!ht){ errno = ENOMEM; return NULL; }
+	memset(ht, 0, sizeof(rhtable_t));
+	if (rht_array_init(&ht->cur, cap) == -1){
+		free(ht);
+		return NULL;
+	}
+	return ht;
+}
+
+
+/**
+ * @brief Searches #key in the table.
+ * @return Data associated to key on success, NULL if not found.
+ */
+void* rht_find(rhtable_t* ht, char* key){
+	if (!ht || !key) return NULL;
+	uint64_t h = rht_hash(key);
+	long idx = rht_array_lookup(&ht->cur, key, h);
+	if (idx >= 0) return ht->cur.slots[idx].data;
+	idx = rht_array_lookup(&ht->old, key, h);
+	if (idx >= 0) return ht->old.slots[idx].data;
+	return NULL;
+}
+
+
+/**
+ * @brief Inserts the new mapping key -> data (key is NOT copied). If the
+ * load factor exceeds 7/8, a new array of double capacity is allocated and
+ * the current one starts being migrated.
+ * @return 0 on success, -1 on error, 1 if key is already present.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to grow a full table.
+ */
+int rht_insert(rhtable_t* ht, char* key, void* data){
+	if (!ht || !key){ errno = EINVAL; return -1; }
+	uint64_t h = rht_hash(key);
+	if ((rht_array_lookup(&ht->cur, key, h) >= 0) || (rht_array_lookup(&ht->old, key, h) >= 0)) return 1;
+	rht_migrate(ht, RHT_MIGRATE_STEP);
+	if ((ht->cur.size + 1) * 8 > ht->cur.cap * 7){
+		rht_array_t newcur;
+		rht_migrate(ht, ht->old.cap); /* An old array still not migrated is VERY unlikely */
+		if (rht_array_init(&newcur, ht->cur.cap * 2) == 0){
+			ht->old = ht->cur;
+			ht->cur = newcur;
+			ht->migrated = 0;
+			rht_migrate(ht, RHT_MIGRATE_STEP);
+		} else if (ht->cur.size + 1 >= ht->cur.cap) return -1; /* At least one empty slot is needed */
+	}
+	rht_array_put(&ht->cur, h, key, data);
+	ht->nentries++;
+	return 0;
+}
+
+
+/**
+ * @brief Removes the mapping for #key and frees key and data with the
+ * given functions (if not NULL).
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOENT: key not found.
+ */
+int rht_delete(rhtable_t* ht, char* key, void (*free_key)(void*), void (*free_data)(void*)){
+	if (!ht || !key){ errno = EINVAL; return -1; }
+	uint64_t h = rht_hash(key);
+	rht_slot_t s;
+	long idx = rht_array_lookup(&ht->cur, key, h);
+	if (idx >= 0){
+		s = ht->cur.slots[idx];
+		rht_array_remove(&ht->cur, (size_t)idx);
+	} else if ((idx = rht_array_lookup(&ht->old, key, h)) >= 0){
+		s = ht->old.slots[idx];
+		ht->old.slots[idx].hash = RHT_TOMB;
+		ht->old.size--;
+	} else { errno = ENOENT; return -1; }
+	ht->nentries--;
+	/* key could be the same pointer as s.key, so it is freed ONLY now */
+	if (free_key && s.key) free_key(s.key);
+	if (free_data && s.data) free_data(s.data);
+	rht_migrate(ht, RHT_MIGRATE_STEP);
+	return 0;
+}
+
+
+/**
+ * @brief Destroys the table, freeing all keys and data with the given
+ * functions (if not NULL).
+ * @return 0 on success, -1 on error (ht == NULL).
+ */
+int rht_destroy(rhtable_t* ht, void (*free_key)(void*), void (*free_data)(void*)){
+	if (!ht){ errno = EINVAL; return -1; }
+	rht_iter_t it;
+	char* key;
+	void* data;
+	rht_foreach(ht, it, key, data){
+		if (free_key && key) free_key(key);
+		if (free_data && data) free_data(data);
+	}
+	free(ht->cur.slots);
+	free(ht->old.slots);
+	free(ht);
+	return 0;
+}
+
+
+/**
+ * @brief Initializes an iterator over ALL entries of ht.
+ * @note Table MUST NOT be modified during iteration.
+ * @return 0 on success, -1 on error.
+ */
+int rht_iter_init(rhtable_t* ht, rht_iter_t* it){
+	if (!ht || !it){ errno = EINVAL; return -1; }
+	it->ht = ht;
+	it->which = 0;
+	it->idx = 0;
+	return 0;
+}
+
+
+/**
+ * @brief Gets next entry of the iteration.
+ * @return true if an entry has been found (and *key, *data are set),
+ * false if iteration is terminated.
+ */
+bool rht_iter_next(rht_iter_t* it, char** key, void** data){
+	if (!it || !it->ht) return false;
+	while (it->which < 2){
+		rht_array_t* a = (it->which == 0 ? &it->ht->cur : &it->ht->old);
+		while (a->slots && (it->idx < a->cap)){
+			rht_slot_t* s = &a->slots[it->idx++];
+			if (s->hash > RHT_TOMB){
+				*key = s->key;
+				*data = s->data;
+				return true;
+			}
+		}
+		it->which++;
+		it->idx = 0;
+	}
+	return false;
+}
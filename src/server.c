@@ -13,16 +13,52 @@
 #include <parser.h>
 #include <protocol.h>
 #include <tsqueue.h>
+#include <mpmcqueue.h>
 #include <server_support.h>
+#include <stats.h>
 #include <signal.h>
 #include <limits.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 /* Flags for server state (see below) */
 #define S_OPEN 0
 #define S_CLOSED 1
 #define S_SHUTDOWN 2
 
+/* Event engines for the manager (see config.txt) */
+#define E_SELECT 0
+#define E_EPOLL 1
+#define E_REACTOR 2 /* ReactorThreads > 0 */
+
+/* Maximum number of events returned by a single epoll_pwait */
+#define EPOLL_MAXEVENTS 256
+
+/* Maximum number of events returned by a single epoll_wait of a reactor */
+#define REACTOR_MAXEVENTS 64
+
+/* Dispatch queue implementations for connQueue (see config.txt) */
+#define DQ_TSQUEUE 0
+#define DQ_MPMC 1
+
+/* Maximum number of ready fds popped by a worker at once (DQ_MPMC only) */
+#define WORKER_POPBATCH 4
+
+/* Item of a dispatch queue that makes the worker that pops it exit (never equal to a FD_TOPTR) */
+#define WORKER_EXIT ((void*)(intptr_t)-1)
+
+/* Dispatch classes of requests, each one with its own queue (see BulkWorkers in config.txt) */
+#define DC_META 0 /* Metadata requests (open, close, lock, unlock, remove, stats) */
+#define DC_BULK 1 /* Data requests (read, readN, fetch, write, append, put) */
+#define DC_NCLASSES 2
+
+/* Nanoseconds to milliseconds (rounded up) for epoll timeouts of deferred requests */
+#define NS_TOMS(ns) (((ns) + 999999ULL) / 1000000ULL)
+
 /* Cyan-colored string for server dump */
 #define SERVER_DUMP_CYAN "\033[1;36mserver_dump:\033[0m"
 
@@ -57,12 +93,18 @@ do {\
 } while(0);
 
 
-/* Closes listen socket and pipe (if open) */
+/* Closes listen socket, pipe and epoll/event fds (if open) */
 #define CLOSE_CHANNELS(server)\
 do {\
 	if (server->pfd[0] >= 0){ close(server->pfd[0]); server->pfd[0] = -1; }\
 	if (server->pfd[1] >= 0){ close(server->pfd[1]); server->pfd[1] = -1; }\
 	if (server->sockfd >= 0){ close(server->sockfd); server->sockfd = -1; }\
+	if (server->epfd >= 0){ close(server->epfd); server->epfd = -1; }\
+	if (server->evfd >= 0){ close(server->evfd); server->evfd = -1; }\
+	if (server->stopfd >= 0){ close(server->stopfd); server->stopfd = -1; }\
+	for (int k = 0; server->repfds && (k < server->wpool->nworkers); k++){\
+		if (server->repfds[k] >= 0){ close(server->repfds[k]); server->repfds[k] = -1; }\
+	}\
 } while(0);
 
 
@@ -176,12 +218,61 @@ do {\
 } while(0);
 
 
+/**
+ * A client fd is pushed on connQueue as a (NOT NULL) pointer value,
+ * such that NO allocation is needed for dispatching a request.
+ */
+#define FD_TOPTR(fd) ((void*)(intptr_t)((fd) + 1))
+#define PTR_TOFD(ptr) ((int)(intptr_t)(ptr) - 1)
+
+
+/* Pushes an item on the dispatch queue of class dc */
+#define CONNQ_PUSHPTR(server, ptr, dc)\
+	(server->dqueue == DQ_MPMC ? mpmcq_push(server->connRing[dc], ptr) : tsqueue_push(server->connQueue[dc], ptr))
+
+/* Pushes a ready client fd on the dispatch queue of class dc (marking the time for ST_QUEUEWAIT) */
+#define CONNQ_PUSH(server, fd, dc)\
+	(stats_enqueue(fd), CONNQ_PUSHPTR(server, FD_TOPTR(fd), dc))
+
+/* Closes the dispatch queue of class dc (its workers exit when it is empty) */
+#define CONNQ_CLOSE1(server, dc)\
+	(server->dqueue == DQ_MPMC ? mpmcq_close(server->connRing[dc]) : tsqueue_close(server->connQueue[dc]))
+
+/* Closes ALL the dispatch queues */
+#define CONNQ_CLOSE(server)\
+	(CONNQ_CLOSE1(server, DC_META), (server->bulkWorkers > 0 ? CONNQ_CLOSE1(server, DC_BULK) : 0))
+
+/* Number of fds currently in the dispatch queue of class dc */
+#define CONNQ_SIZE1(server, dc)\
+	(server->dqueue == DQ_MPMC ? mpmcq_getSize(server->connRing[dc]) : tsqueue_getSize(server->connQueue[dc]))
+
+/* Number of fds currently in ALL the dispatch queues */
+#define CONNQ_SIZE(server)\
+	(CONNQ_SIZE1(server, DC_META) + (server->bulkWorkers > 0 ? CONNQ_SIZE1(server, DC_BULK) : 0))
+
+
 /** 
- * Sends back client fd to server for relistening.
+ * Sends back client fd to server for relistening (select engine),
+ * or re-arms/closes it directly (epoll engine).
  */
 #define FD_SENDBACK(server, cfd)\
 do {\
-	SYSCALL_EXIT(write(server->pfd[1], cfd, sizeof(*cfd)), "server_worker: while sending back client fd");\
+	if (server->engine != E_SELECT){\
+		SYSCALL_EXIT(epoll_sendback(server, *(cfd)), "server_worker: while re-arming client fd");\
+	} else {\
+		SYSCALL_EXIT(write(server->pfd[1], cfd, sizeof(*cfd)), "server_worker: while sending back client fd");\
+	}\
+} while(0);
+
+
+/* Closes listen socket ONLY [epoll] */
+#define EPOLL_CLOSE_LSOCKET(server)\
+do {\
+	if (server->sockfd >= 0){\
+		epoll_ctl(server->epfd, EPOLL_CTL_DEL, server->sockfd, NULL);\
+		close(server->sockfd);\
+		server->sockfd = -1;\
+	}\
 } while(0);
 
 
@@ -200,7 +291,6 @@ do {\
 			fd_switch(cfd);\
 		} else {\
 			perror("Error while sending message to client");\
-			free(cfd);\
 			exit(EXIT_FAILURE);\
 		}\
 	}\
@@ -210,7 +300,7 @@ do {\
 /**
  * Handles requests with only a M_OK/M_ERR response message, i.e.
  *	- M_OPENF, M_CLOSEF, M_LOCKF, M_UNLOCKF, M_REMOVEF, M_OPENF, 
- *		M_WRITEF, M_APPENDF.
+ *		M_WRITEF, M_APPENDF, M_PUTF.
  * @param req -- Code of function request (e.g. fs_open(...));
  * @param fname -- Name of function;
  * @param cfd -- Pointer to client fd;
@@ -237,25 +327,26 @@ do {\
 
 
 /**
- * Handles a read request for a single file, i.e. M_READF.
- * @note filename, buf, size are of the SAME type as those
- * in API function readFile.
- * @note After sending response to client, *buf is freed.
+ * Handles a read request for a single file, i.e. M_READF and M_FETCHF.
+ * @param req -- Code of function request (fs_read or fs_fetch).
+ * @note buf is the address of a (fbody_t*) variable that shall contain
+ * a reference to file content, which is sent WITHOUT any copy and released
+ * after sending response to client.
  * @param cfd -- Pointer to client fd.
  * @param errmsg -- Error message for perror.
  */
-#define READ_REQ_HANDLER(server, filename, buf, size, cfd, errmsg)\
+#define READ_REQ_HANDLER(server, req, filename, buf, size, cfd, errmsg)\
 do {\
 	int error = 0;\
 	int send_ret = 0;\
 	message_t* msg;\
-	int result = fs_read(server->fs, filename, buf, size, *cfd);\
+	int result = (req);\
 	CHECK_FATAL_EXIT(server); /* Checks non-recoverable errors */\
 	/* Handles message sending */\
 	if (result == 0){\
 		bool modified = false;\
-		send_ret = msend(*cfd, &msg, M_GETF, NULL, NULL, strlen(filename)+1, filename, *size, *buf, sizeof(bool), &modified);\
-		free(*buf);\
+		send_ret = server_sendfile(*cfd, filename, *buf, *size, modified);\
+		fbody_release(*buf);\
 		HANDLE_SEND_RET(send_ret, cfd); /* "Embedded" CHECK_FATAL_EXIT(server) */\
 		if (send_ret == 0){\
 			send_ret = msend(*cfd, &msg, M_OK, NULL, NULL);\
@@ -270,47 +361,43 @@ do {\
 } while(0);
 
 /**
- * Handles a readNFiles request, i.e. M_READNF.
+ * Handles a readNFiles request, i.e. M_READNF, by streaming files: a
+ * snapshot of pathnames is taken and then files are read and sent one at
+ * a time, so that NO gate is held while sending and at most one file
+ * content is referenced (a full socket buffer only blocks this thread).
  * @param N -- #{files} to read according to readNFiles specification;
  * @param cfd -- Pointer to client fd;
- * @param results -- Pointer (llist_t**) to ALREADY initialized list
- * for hosting files content.
  * @param errmsg -- Error message for perror.
- * @note After sending back response to client, cfd is ALWAYS freed.
  */
-#define READNF_REQ_HANDLER(server, N, cfd, results, errmsg)\
+#define READNF_REQ_HANDLER(server, N, cfd, errmsg)\
 do {\
 	int error = 0;\
 	int send_ret = 0;\
 	message_t* msg;\
-	llistnode_t* node;\
+	fs_cursor_t cursor;\
 	char* filename;\
-	void* filecontent;\
+	fbody_t* filecontent;\
 	size_t filesize;\
-	fcontent_t* file;\
-	int res = fs_readN(server->fs, *cfd, N, results);\
-	CHECK_FATAL_EXIT(server); /* Checks non-recoverable errors */\
+	int res = fs_cursor_init(server->fs, N, &cursor);\
+	if (res == -1){ CHECK_FATAL_EXIT(server); } /* Checks non-recoverable errors */\
 	/* Handles message sending */\
 	if (res == 0){\
 		bool modified = false;\
-		llist_foreach(*results, node){\
-			file = (fcontent_t*)(node->datum);\
-			filename = file->filename;\
-			filesize = file->size;\
-			filecontent = file->content;\
-			send_ret = msend(*cfd, &msg, M_GETF, NULL, NULL, strlen(filename)+1, filename, filesize, filecontent, sizeof(bool), &modified);\
+		while ((res = fs_cursor_next(server->fs, &cursor, *cfd, &filename, &filecontent, &filesize)) == 0){\
+			send_ret = server_sendfile(*cfd, filename, filecontent, filesize, modified);\
+			fbody_release(filecontent);\
 			HANDLE_SEND_RET(send_ret, cfd); /* "Embedded" CHECK_FATAL_EXIT(server) */\
 			if (send_ret == -1) break; /* Connection closed */\
 		}\
-		SYSCALL_EXIT(llist_destroy(*results, (void(*)(void*))fcontent_destroy), "llist_destroy");\
-		if (send_ret == 0){ /* Connection still open, cfd NOT freed and > 0 */\
+		fs_cursor_destroy(&cursor);\
+		if (res == -1){ CHECK_FATAL_EXIT(server); }\
+		if (send_ret == 0){ /* Connection still open */\
 			send_ret = msend(*cfd, &msg, M_OK, NULL, NULL);\
 			HANDLE_SEND_RET(send_ret, cfd);\
 		}\
-	} else if (res == -1){\
+	} else {\
 		perror(errmsg);\
 		error = errno;\
-		SYSCALL_EXIT(llist_destroy(*results, (void(*)(void*))fcontent_destroy), "llist_destroy");\
 		send_ret = msend(*cfd, &msg, M_ERR, NULL, NULL, sizeof(error), &error);\
 		HANDLE_SEND_RET(send_ret, cfd);\
 	}\
@@ -339,9 +426,23 @@ int optlen = 1;
  */
 static volatile sig_atomic_t serverState = S_OPEN;
 
+/* Set by SIGUSR1 for reloading configuration (see server_reload) */
+static volatile sig_atomic_t reloadRequested = 0;
+
+/* Path of the configuration file (reloaded on SIGUSR1), set by main */
+static char* configPath = NULL;
+
 /* Global variable for hosting server address */
 static char serverPath[UNIX_PATH_MAX];
 
+/**
+ * epoll instances of reactors (E_REACTOR engine): client fd cfd is owned
+ * by reactor #(cfd % nReactors), such that ANY thread (e.g. the one that
+ * unlocks a file) can re-arm it without looking up any table.
+ */
+static int* reactorEpfds = NULL;
+static int nReactors = 0;
+
 /* Minimum cleanup before exiting */
 void cleanup(void){
 	unlink(serverPath);
@@ -356,16 +457,33 @@ void term_sighandler(int sig){
 	}
 }
 
+/* Signal handler for configuration reloading */
+void reload_sighandler(int sig){
+	if (serverState == S_OPEN) reloadRequested = 1;
+}
+
 /**
  * @brief Struct describing server.
  */
 typedef struct server_s {
 
 	struct sockaddr_un sa; /* Server address (socketPath and length of path) */
+	int family; /* AF_UNIX, or AF_INET/AF_INET6 if TCPPort is set */
+	struct sockaddr_storage tcpAddr; /* Server address (TCPAddress and TCPPort, AF_INET/AF_INET6 ONLY) */
+	socklen_t tcpAddrLen;
+	int tcpBuf; /* Size (bytes) of socket buffers, 0 for system default (AF_INET/AF_INET6 ONLY) */
 	wpool_t* wpool; /* Workers pool (contains #workers )*/
 	int pfd[2]; /* Pipe for receiving back fds */
 	int readback[_POSIX_PIPE_BUF]; /* Array in which to store read fds from pipe */
-	tsqueue_t* connQueue; /* Concurrent queue for handling client requests dispatching */
+	int dqueue; /* DQ_TSQUEUE or DQ_MPMC */
+	tsqueue_t* connQueue[DC_NCLASSES]; /* Concurrent queues for handling client requests dispatching (DQ_TSQUEUE) */
+	mpmcq_t* connRing[DC_NCLASSES]; /* Lock-free alternative to connQueue (DQ_MPMC) */
+	int bulkWorkers; /* Workers (the last ones) that ONLY handle DC_BULK requests, 0 for a single (DC_META) queue */
+	long dispatched[DC_NCLASSES]; /* Requests dispatched to each queue (by manager) */
+	
+	/* Admission control (NULL if there is NO limit for clients) */
+	admtab_t* admission; /* Token buckets of client connections */
+	deflist_t deferred; /* Requests deferred by manager for lack of tokens (NOT for reactors) */
 	FileStorage_t* fs; /* File storage (will contain storage size in bytes and fileStorageBuckets) */
 	int sockfd; /* Listen socket file descriptor */
 	int sockBacklog; /* Defaults to SOMAXCONN */
@@ -380,7 +498,31 @@ typedef struct server_s {
 	fd_set rdset; /* File descriptors monitored for listening */
 	fd_set saveset; /* Backup fd_set for reinitialization */
 	/* pselect utilities */	
-	sigset_t psmask; /* Signal mask for pselect */
+	sigset_t psmask; /* Signal mask for pselect (and epoll_pwait) */
+	
+	/* Event engine */
+	int engine; /* E_SELECT, E_EPOLL or E_REACTOR */
+	int (*wHandler)(int chan, fd_waiter_t* waiters); /* WaitHandler passed to fs functions */
+	int chan; /* Channel passed to wHandler (pfd[1] for select, epfd for epoll) */
+	
+	/* epoll utilities (unused with E_SELECT) */
+	int epfd; /* epoll instance */
+	int evfd; /* eventfd for waking up manager when the last connection is closed */
+	conntab_t* conns; /* Active client connections */
+	struct epoll_event events[EPOLL_MAXEVENTS]; /* Ready events returned by epoll_pwait */
+	
+	/* Reactors utilities (ONLY with E_REACTOR) */
+	int stopfd; /* eventfd (never consumed) for stopping ALL reactors */
+	int* repfds; /* epoll instance of each reactor (== reactorEpfds) */
+	
+	/* Live reconfiguration (see server_reload) */
+	struct wArgs_s** wargs; /* Arguments of ALL threads ever spawned in wpool (len == wpool->nworkers) */
+	int metaWorkers; /* Workers currently serving DC_META requests */
+	bool resizing; /* true <=> file storage is being resized to the capacities below */
+	bool rehashing; /* true <=> chained hashtables are being rehashed (see fs_rehash_step) */
+	size_t newStorageCap;
+	int newMaxFileNo;
+	
 	
 } server_t;
 
@@ -389,69 +531,313 @@ typedef struct wArgs_s {
 	server_t* server;
 	int workerId; /* Identifier [1, #workers] */
 	int requests;
+	int epfd; /* Own epoll instance (ONLY for reactors) */
+	int dclass; /* Dispatch class of handled requests (ONLY for workers) */
 } wArgs_t;
 
 /* File descriptor "switching" function */
 static void fd_switch(int* fd){ *fd = -(*fd)-1; }
 
+
+/**
+ * @return epoll instance in which client connection cfd is registered,
+ * i.e. that of its reactor (E_REACTOR) or #epfd otherwise.
+ */
+static int conn_epfd(int epfd, int cfd){
+	return (nReactors > 0 ? reactorEpfds[cfd % nReactors] : epfd);
+}
+
+
+/**
+ * @brief Re-arms a client connection in the epoll set such that manager
+ * can dispatch it again on its next request.
+ * @return 0 on success, -1 on error.
+ */
+static int epoll_rearm(int epfd, int cfd){
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.fd = cfd;
+	return epoll_ctl(epfd, EPOLL_CTL_MOD, cfd, &ev);
+}
+
+
+/**
+ * @brief Equivalent of FD_SENDBACK for the epoll engine: if cfd >= 0,
+ * connection is re-armed, otherwise (connection closed during handling)
+ * -cfd-1 is removed from the epoll set and closed, and if it was the last
+ * active one, manager is woken up for (eventually) terminating.
+ * @return 0 on success, -1 on error.
+ */
+static int epoll_sendback(server_t* server, int cfd){
+	if (cfd >= 0) return epoll_rearm(conn_epfd(server->epfd, cfd), cfd);
+	fd_switch(&cfd);
+	printf("Connection #%d closed by client\n", cfd);
+	if (epoll_ctl(conn_epfd(server->epfd, cfd), EPOLL_CTL_DEL, cfd, NULL) == -1) return -1;
+	int ret = conntab_close(server->conns, cfd);
+	if (ret == -1) return -1;
+	if (ret == 0){
+		uint64_t one = 1;
+		if (write(server->evfd, &one, sizeof(one)) == -1) return -1;
+	}
+	return 0;
+}
+
 /**
  * @brief WaitHandler (as described for FileStorage_t)
  * for sending back error (ENOENT) messages to client
  * when a file is removed or expelled.
  * @return 0 on success, -1 on error.
- * @note On error, waitQueue is unmodified.
+ * @note waiters are NOT modified.
  */
-int server_wHandler(int chan, tsqueue_t* waitQueue){
-	if (!waitQueue) return -1;
-	int res1 = 0;
-	int* cfd;
+int server_wHandler(int chan, fd_waiter_t* waiters){
 	int error = ENOENT; /* Error message to send back to clients */
 	message_t* msg;
-	SYSCALL_NOTREC(tsqueue_iter_init(waitQueue), -1, "server_wHandler: while starting iteration");
-	while (true){
-		SYSCALL_NOTREC( (res1 = tsqueue_iter_next(waitQueue, (void**)&cfd)), -1, "server_wHandler: while iterating");
-		if (res1 != 0) break; /* Iteration ended */
-		if (!cfd) continue; /* NULL pointer in queue */
-		int send_ret = msend(*cfd, &msg, M_ERR, NULL, NULL,sizeof(error), &error);
-		HANDLE_SEND_RET(send_ret, cfd);
-		int cfdcopy = *cfd;
-		if (*cfd < 0) fd_switch(cfd); /* original queue shall be untouched */
+	for (fd_waiter_t* w = waiters; w; w = w->next){
+		int cfd = w->client;
+		int send_ret = msend(cfd, &msg, M_ERR, NULL, NULL,sizeof(error), &error);
+		HANDLE_SEND_RET(send_ret, &cfd);
 		/* If connection has been closed, then a fd < 0 shall be sent */
-		SYSCALL_NOTREC(write(chan, &cfdcopy, sizeof(cfdcopy)) , -1, "server_wHandler: while sending back client fd");
+		SYSCALL_NOTREC(write(chan, &cfd, sizeof(cfd)) , -1, "server_wHandler: while sending back client fd");
+	}
+	return 0;
+}
+
+
+/**
+ * @brief WaitHandler for the epoll (and reactor) engine: as server_wHandler,
+ * but waiting clients are directly re-armed on the epoll instance #chan (or
+ * on that of their reactors).
+ * @note Connections closed meanwhile are re-armed too: epoll shall report
+ * the hangup and the worker that gets it will handle the client cleanup.
+ * @return 0 on success, -1 on error.
+ */
+int server_wHandler_epoll(int chan, fd_waiter_t* waiters){
+	int error = ENOENT; /* Error message to send back to clients */
+	message_t* msg;
+	for (fd_waiter_t* w = waiters; w; w = w->next){
+		int send_ret = msend(w->client, &msg, M_ERR, NULL, NULL,sizeof(error), &error);
+		if ((send_ret == -1) && (errno != EPIPE) && (errno != EBADMSG)){
+			perror("Error while sending message to client");
+			exit(EXIT_FAILURE);
+		}
+		SYSCALL_NOTREC(epoll_rearm(conn_epfd(chan, w->client), w->client), -1, "server_wHandler_epoll: while re-arming client fd");
 	}
-	SYSCALL_NOTREC(tsqueue_iter_end(waitQueue), -1, "server_wHandler: while ending iteration");
 	return 0;
 }
 
 
+/**
+ * @brief Sends a M_GETF message for the first #size bytes of file content
+ * #body, by scatter-gather directly from its extents (NO copy is made).
+ * @return 0 on success, -1 on error (as msend).
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory for iovec array;
+ *	- any error by msg_send.
+ */
+static int server_sendfile(int cfd, char* pathname, fbody_t* body, size_t size, bool modified){
+	struct iovec* iov;
+	int iovcnt = fbody_iov(body, size, &iov);
+	if (iovcnt == -1) return -1;
+	message_t msg;
+	packet_t args[3] = {
+		{strlen(pathname)+1, pathname, 0},
+		{size, iov, iovcnt},
+		{sizeof(bool), &modified, 0},
+	};
+	msg.type = M_GETF;
+	msg.argn = 3;
+	msg.args = args;
+	msg.reqid = 0; /* ID of the current request of cfd */
+	int ret = (msg_send(&msg, cfd) < 1 ? -1 : 0);
+	int errno_copy = errno;
+	free(iov);
+	errno = errno_copy;
+	return ret;
+}
+
+
 /**
  * @brief SendBackHandler (as described for FileStorage_t)
  * for sending back expelled files to calling client
- * when writing on file storage.
+ * when writing on file storage: ALL the (NOT empty) files are sent as M_GETF
+ * messages by a single msg_sendv, by scatter-gather directly from their extents.
  * @return 0 on success, -1 on error.
  * @note On error, content is untouched.
  */
-int server_sbHandler(char* pathname, void* content, size_t size, int cfd, bool modified){
-	if (!pathname || !content || (cfd < 0)) return -1;
-	message_t* msg;
-	int send_ret = msend(cfd, &msg, M_GETF, NULL, NULL, strlen(pathname)+1, pathname, size, content, sizeof(bool), &modified);
+int server_sbHandler(fcontent_t** files, int n, int cfd){
+	if (!files || (n < 0) || (cfd < 0)) return -1;
+	if (n == 0) return 0;
+	message_t* msgs = calloc(n, sizeof(message_t));
+	packet_t* args = calloc(3 * n, sizeof(packet_t));
+	struct iovec** iovs = calloc(n, sizeof(struct iovec*));
+	int nmsgs = 0;
+	int send_ret = 0;
+	if (!msgs || !args || !iovs) send_ret = -1;
+	for (int i = 0; (send_ret == 0) && (i < n); i++){
+		fcontent_t* fc = files[i];
+		if (!fc->content) continue; /* Empty file */
+		int iovcnt = fbody_iov(fc->content, fc->size, &iovs[nmsgs]);
+		if (iovcnt == -1){ send_ret = -1; break; }
+		packet_t* margs = &args[3 * nmsgs];
+		margs[0] = (packet_t){strlen(fc->filename)+1, fc->filename, 0};
+		margs[1] = (packet_t){fc->size, iovs[nmsgs], iovcnt};
+		margs[2] = (packet_t){sizeof(bool), &fc->modified, 0};
+		msgs[nmsgs].type = M_GETF;
+		msgs[nmsgs].argn = 3;
+		msgs[nmsgs].args = margs;
+		msgs[nmsgs].reqid = 0; /* ID of the current request of cfd */
+		nmsgs++;
+	}
+	if (send_ret == 0) send_ret = (msg_sendv(msgs, nmsgs, cfd) < 1 ? -1 : 0);
+	else errno = ENOMEM;
+	int errno_copy = errno;
+	for (int i = 0; iovs && (i < nmsgs); i++) free(iovs[i]);
+	free(iovs);
+	free(args);
+	free(msgs);
+	errno = errno_copy;
 	if (send_ret == -1){
 		if ((errno != EPIPE) && (errno != EBADMSG)) exit(EXIT_FAILURE);
 	}
 	return 0;
 }
 
+/**
+ * @brief Handles a M_FETCHNF request: files are fetched by fs_fetchN and the
+ * whole reply (a M_GETF message for each file read followed by the M_FETCHNF
+ * one with the results) is sent by a single msg_sendv, by scatter-gather
+ * directly from the extents of files.
+ * @return 0 on success, -1 on error (reply has NOT been sent).
+ * Possible errors are:
+ *	- EINVAL: invalid request (NO file or too many files);
+ *	- ENOMEM: unable to allocate memory;
+ *	- any error by fs_fetchN.
+ */
+static int server_fetchN(server_t* server, message_t* req, int* cfd){
+	int n = (int)req->argn;
+	if ((n <= 0) || (n > MSG_BATCH_MAXFILES)){ errno = EINVAL; return -1; }
+	char** pathnames = malloc(n * sizeof(char*));
+	fbody_t** bodies = malloc(n * sizeof(fbody_t*));
+	size_t* sizes = malloc(n * sizeof(size_t));
+	int* errs = malloc(n * sizeof(int));
+	message_t* msgs = calloc(n + 1, sizeof(message_t));
+	packet_t* args = calloc(3 * n + 1, sizeof(packet_t));
+	struct iovec** iovs = calloc(n, sizeof(struct iovec*));
+	bool modified = false;
+	int nread = -1, nmsgs = 0;
+	if (!pathnames || !bodies || !sizes || !errs || !msgs || !args || !iovs) errno = ENOMEM;
+	else {
+		for (int i = 0; i < n; i++) pathnames[i] = req->args[i].content;
+		nread = fs_fetchN(server->fs, pathnames, n, bodies, sizes, errs, *cfd);
+	}
+	for (int i = 0; (nread >= 0) && (i < n); i++){
+		if (errs[i] != 0) continue;
+		int iovcnt = fbody_iov(bodies[i], sizes[i], &iovs[nmsgs]);
+		if (iovcnt == -1){ nread = -1; break; }
+		packet_t* margs = &args[3 * nmsgs];
+		margs[0] = (packet_t){strlen(pathnames[i])+1, pathnames[i], 0};
+		margs[1] = (packet_t){sizes[i], iovs[nmsgs], iovcnt};
+		margs[2] = (packet_t){sizeof(bool), &modified, 0};
+		msgs[nmsgs].type = M_GETF;
+		msgs[nmsgs].argn = 3;
+		msgs[nmsgs].args = margs;
+		nmsgs++; /* reqid == 0, i.e. ID of the current request of cfd */
+	}
+	int ret = 0;
+	if (nread >= 0){
+		args[3 * nmsgs] = (packet_t){n * sizeof(int), errs, 0};
+		msgs[nmsgs].type = M_FETCHNF;
+		msgs[nmsgs].argn = 1;
+		msgs[nmsgs].args = &args[3 * nmsgs];
+		int send_ret = (msg_sendv(msgs, nmsgs + 1, *cfd) < 1 ? -1 : 0);
+		HANDLE_SEND_RET(send_ret, cfd);
+	} else ret = -1;
+	int errno_copy = errno;
+	for (int i = 0; i < nmsgs; i++) free(iovs[i]);
+	for (int i = 0; (nread >= 0) && (i < n); i++) fbody_release(bodies[i]);
+	free(iovs);
+	free(args);
+	free(msgs);
+	free(errs);
+	free(sizes);
+	free(bodies);
+	free(pathnames);
+	errno = errno_copy;
+	return ret;
+}
+
 
-/* Calls fs_clientCleanup and sends back *cfd for indicating closed connection */
+/**
+ * @brief Handles a M_PUTNF request: files are stored by fs_putN (expelled
+ * files are sent back by server_sbHandler) and then the M_PUTNF message with
+ * the results is sent.
+ * @return 0 on success, -1 on error (reply has NOT been sent).
+ * Possible errors are:
+ *	- EINVAL: invalid request (odd number of arguments, NO file or too many files);
+ *	- ENOMEM: unable to allocate memory;
+ *	- any error by fs_putN.
+ */
+static int server_putN(server_t* server, message_t* req, int* cfd){
+	int n = (int)(req->argn / 2);
+	if ((req->argn % 2 != 0) || (n <= 0) || (n > MSG_BATCH_MAXFILES)){ errno = EINVAL; return -1; }
+	char** pathnames = malloc(n * sizeof(char*));
+	void** bufs = malloc(n * sizeof(void*));
+	size_t* sizes = malloc(n * sizeof(size_t));
+	int* errs = malloc(n * sizeof(int));
+	int ret = -1;
+	if (!pathnames || !bufs || !sizes || !errs) errno = ENOMEM;
+	else {
+		for (int i = 0; i < n; i++){
+			pathnames[i] = req->args[2 * i].content;
+			bufs[i] = req->args[2 * i + 1].content;
+			sizes[i] = req->args[2 * i + 1].len;
+		}
+		ret = fs_putN(server->fs, pathnames, bufs, sizes, n, errs, *cfd, server->wHandler, &server_sbHandler, server->chan);
+	}
+	if (ret >= 0){
+		message_t* msg;
+		int send_ret = msend(*cfd, &msg, M_PUTNF, NULL, NULL, n * sizeof(int), errs);
+		HANDLE_SEND_RET(send_ret, cfd);
+		ret = 0;
+	}
+	int errno_copy = errno;
+	free(errs);
+	free(sizes);
+	free(bufs);
+	free(pathnames);
+	errno = errno_copy;
+	return ret;
+}
+
+
+/**
+ * @brief Called by the sweeper of the file storage when ALL the state of
+ * a closed connection has been reclaimed: sends it back to server.
+ */
+static int server_sweepDone(void* arg, int client){
+	server_t* server = arg;
+	int cfd = client;
+	fd_switch(&cfd); /* => < 0 */
+	FD_SENDBACK(server, &cfd); /* Closed connection (sent back to server) */
+	return 0;
+}
+
+
+/*
+ * Calls fs_clientCleanup and sends back *cfd for indicating closed connection, unless
+ * its remaining state is reclaimed by the sweeper (that sends it back by server_sweepDone).
+ */
 int server_cleanup_handler(server_t* server, int* cfd, llist_t** newowners){
 	int send_ret;
 	message_t* msg;
 	int* nextfd;
 	int popret = 0;
+	int cleanup_ret;
 	if (*cfd < 0) fd_switch(cfd);
-	SYSCALL_EXIT(fs_clientCleanup(server->fs, *cfd, newowners), "fs_clientCleanup");
+	SYSCALL_EXIT((cleanup_ret = fs_clientCleanup(server->fs, *cfd, newowners)), "fs_clientCleanup");
 	fd_switch(cfd); /* => < 0*/
-	FD_SENDBACK(server, cfd); /* Closed connection (sent back to server) */
+	if (cleanup_ret == 0){ FD_SENDBACK(server, cfd); } /* Closed connection (sent back to server) */
 	while (true){
 		SYSCALL_RETURN( (popret = llist_pop(*newowners, (void**)&nextfd)), -1, "cleanup_handler: while getting next lock owner");
 		if (popret == 1) break;
@@ -465,6 +851,92 @@ int server_cleanup_handler(server_t* server, int* cfd, llist_t** newowners){
 	return 0;
 }
 
+
+/*
+ * Called by the sweeper when the lock wait of client has expired: sends back
+ * an ETIMEDOUT error message and re-arms the connection (or cleanups it if
+ * it has been closed meanwhile).
+ */
+static int server_lockExpired(void* arg, int client){
+	server_t* server = arg;
+	int cfd = client;
+	int error = ETIMEDOUT;
+	message_t* msg;
+	int send_ret = msend(cfd, &msg, M_ERR, NULL, NULL, sizeof(error), &error);
+	HANDLE_SEND_RET(send_ret, &cfd);
+	if (cfd < 0){ /* Connection closed */
+		llist_t* newowners = llist_init();
+		if (!newowners) return -1;
+		SYSCALL_EXIT(server_cleanup_handler(server, &cfd, &newowners), "server_cleanup_handler");
+		llist_destroy(newowners, free);
+	} else { FD_SENDBACK(server, &cfd); }
+	return 0;
+}
+
+
+/**
+ * @brief Resolves the (numeric or symbolic) #address and #port of the TCP
+ * listener into #*addr (of length #*addrlen), using the wildcard address of
+ * ANY family if address == NULL.
+ * @return The address family (AF_INET or AF_INET6) on success, -1 on error.
+ */
+static int server_resolve(char* address, int port, struct sockaddr_storage* addr, socklen_t* addrlen){
+	struct addrinfo hints, *res;
+	char service[16];
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	snprintf(service, sizeof(service), "%d", port);
+	int err = getaddrinfo(address, service, &hints, &res);
+	if (err != 0){
+		fprintf(stderr, "server_init: while resolving TCP address '%s': %s\n", (address ? address : "*"), gai_strerror(err));
+		return -1;
+	}
+	memcpy(addr, res->ai_addr, res->ai_addrlen);
+	*addrlen = res->ai_addrlen;
+	int family = res->ai_family;
+	freeaddrinfo(res);
+	return family;
+}
+
+
+/**
+ * @brief Sets the TCP options of #fd, i.e. TCP_NODELAY (replies are small and
+ * sent by a single write) and the socket buffers (if TCPBufferKB > 0).
+ * @note For the listen socket, these options are inherited by the accepted
+ * connections, but they are set again on them anyway.
+ * @return 0 on success, -1 on error (by setsockopt).
+ */
+static int server_tcpopts(server_t* server, int fd){
+	int one = 1;
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1) return -1;
+	if (server->tcpBuf > 0){
+		if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &server->tcpBuf, sizeof(server->tcpBuf)) == -1) return -1;
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &server->tcpBuf, sizeof(server->tcpBuf)) == -1) return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Opens the listen socket (server->sockfd), binds it to the configured
+ * address (AF_UNIX or TCP) and makes server listen for new connections.
+ * @return 0 on success, -1 on error (by socket, setsockopt, bind or listen).
+ */
+static int server_listen(server_t* server){
+	if ((server->sockfd = socket(server->family, SOCK_STREAM, 0)) == -1) return -1;
+	if (server->family == AF_UNIX) return ((bind(server->sockfd, (const struct sockaddr*)(&server->sa), UNIX_PATH_MAX) == -1)
+		|| (listen(server->sockfd, server->sockBacklog) == -1) ? -1 : 0);
+	int one = 1;
+	/* Buffers are set BEFORE listen, since the TCP window scale is negotiated at connection */
+	if (setsockopt(server->sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1) return -1;
+	if (server_tcpopts(server, server->sockfd) == -1) return -1;
+	if (bind(server->sockfd, (const struct sockaddr*)(&server->tcpAddr), server->tcpAddrLen) == -1) return -1;
+	return listen(server->sockfd, server->sockBacklog);
+}
+
+
 /**
  * @brief Initializes server fields with configuration parameters.
  * @param config -- Pointer to config_t object with all configuration
@@ -475,8 +947,9 @@ server_t* server_init(config_t* config, sigset_t sigmask){
 	if (!config) return NULL;
 	
 	/* Checks correctness of config parameters as stated in config files */
-	if (!config->socketPath) return NULL;
-	else if (config->workersInPool <= 0) return NULL;
+	if (!config->socketPath && (config->tcpPort <= 0)) return NULL;
+	else if (config->tcpPort > 65535) return NULL;
+	else if ((config->workersInPool <= 0) && (config->reactorThreads <= 0)) return NULL;
 	else if (config->storageSize <= 0) return NULL;
 	else if (config->maxFileNo <= 0) return NULL;
 	else if (config->fileStorageBuckets <= 0) return NULL;
@@ -495,6 +968,7 @@ server_t* server_init(config_t* config, sigset_t sigmask){
 	sigdelset(&server->psmask, SIGINT);
 	sigdelset(&server->psmask, SIGQUIT);
 	sigdelset(&server->psmask, SIGHUP);
+	sigdelset(&server->psmask, SIGUSR1);
 	
 	/* Initializes numerical fields */
 	memset(server->pfd, -1, sizeof(server->pfd));
@@ -502,14 +976,44 @@ server_t* server_init(config_t* config, sigset_t sigmask){
 	server->nactives = 0; /* No active connection */
 	server->maxlisten = -1; /* No listening */
 	server->accepted = 0;
+	server->epfd = -1;
+	server->evfd = -1;
+	server->conns = NULL;
+	server->stopfd = -1;
+	server->repfds = NULL;
+
+	/* Configures event engine */
+	if (!config->eventEngine || strequal(config->eventEngine, "select")) server->engine = E_SELECT;
+	else if (strequal(config->eventEngine, "epoll")) server->engine = E_EPOLL;
+	else { /* Unknown engine */
+		fprintf(stderr, "server_init: unknown event engine '%s'\n", config->eventEngine);
+		free(server);
+		return NULL;
+	}
+	if (config->reactorThreads > 0) server->engine = E_REACTOR; /* Reactors are ALWAYS epoll-based */
+	if (server->engine != E_SELECT){
+		server->conns = conntab_init(0);
+		if (!server->conns){
+			free(server);
+			return NULL;
+		}
+	}
 
-	/* Configures socket path */
+	/* Configures socket path (or TCP address, that takes precedence) */
 	memset(&server->sa, 0, sizeof(server->sa));
-	if (config->socketPath){
+	memset(&server->tcpAddr, 0, sizeof(server->tcpAddr));
+	server->tcpAddrLen = 0;
+	server->tcpBuf = (config->tcpBufferKB > 0 ? config->tcpBufferKB * KBVALUE : 0);
+	if (config->tcpPort > 0){
+		server->family = server_resolve(config->tcpAddress, config->tcpPort, &server->tcpAddr, &server->tcpAddrLen);
+	} else if (config->socketPath){
+		server->family = AF_UNIX;
 		server->sa.sun_family = AF_UNIX;
 		strncpy(server->sa.sun_path, config->socketPath, UNIX_PATH_MAX);
 		strncpy(serverPath, config->socketPath, UNIX_PATH_MAX);
-	} else { /* (FATAL) ERROR */
+	} else server->family = -1;
+	if (server->family == -1){ /* (FATAL) ERROR */
+		if (server->conns) conntab_destroy(server->conns);
 		free(server);
 		return NULL;
 	}
@@ -517,57 +1021,331 @@ server_t* server_init(config_t* config, sigset_t sigmask){
 	/* Configures server numerical params */
 	server->sockBacklog = (config->sockBacklog > 0 ? config->sockBacklog : SOMAXCONN);
 	
-	/* Configures workers pool */
-	server->wpool = wpool_init(config->workersInPool);
+	/* Configures workers pool (reactors are run in it when ReactorThreads > 0) */
+	server->wpool = wpool_init(server->engine == E_REACTOR ? config->reactorThreads : config->workersInPool);
+	if (server->wpool && (server->engine == E_REACTOR)){
+		server->repfds = malloc(server->wpool->nworkers * sizeof(int));
+		if (server->repfds) memset(server->repfds, -1, server->wpool->nworkers * sizeof(int));
+		else {
+			wpool_destroy(server->wpool);
+			server->wpool = NULL;
+		}
+	}
 	if (!server->wpool){ /* (FATAL) ERROR */
+		if (server->conns) conntab_destroy(server->conns);
 		free(server);
 		return NULL;
 	}
 	
 	/* Configures filesystem */
-	server->fs = fs_init(config->fileStorageBuckets, (KBVALUE * (size_t)config->storageSize), config->maxFileNo);
+	int replPolicy = (config->replacementPolicy ? repl_policy(config->replacementPolicy) : RP_FIFO);
+	if (replPolicy == -1) fprintf(stderr, "server_init: unknown replacement policy '%s'\n", config->replacementPolicy);
+	int tableType = FS_TABLE_CHAINED;
+	if (config->fileStorageTable && strequal(config->fileStorageTable, "robinhood")) tableType = FS_TABLE_RH;
+	else if (config->fileStorageTable && !strequal(config->fileStorageTable, "chained")){
+		fprintf(stderr, "server_init: unknown file storage table '%s'\n", config->fileStorageTable);
+		tableType = -1;
+	}
+	int codec = (config->compression ? codec_id(config->compression) : CODEC_NONE);
+	if (codec == -1) fprintf(stderr, "server_init: unknown compression codec '%s'\n", config->compression);
+	int dedup = 0;
+	if (config->deduplication && strequal(config->deduplication, "extent")) dedup = 1;
+	else if (config->deduplication && !strequal(config->deduplication, "none")){
+		fprintf(stderr, "server_init: unknown deduplication mode '%s'\n", config->deduplication);
+		dedup = -1;
+	}
+	server->fs = ((replPolicy == -1) || (tableType == -1) || (codec == -1) || (dedup == -1) ? NULL : fs_init(config->fileStorageBuckets,
+		(config->fileStorageShards > 0 ? config->fileStorageShards : 1), (KBVALUE * (size_t)config->storageSize), config->maxFileNo, replPolicy, tableType, codec, (dedup == 1)));
+	if (server->fs && config->persistDir && (fs_persist(server->fs, config->persistDir, config->journalSyncMs, config->snapshotInterval) == -1)){
+		perror("server_init: while restoring file storage");
+		fs_destroy(server->fs);
+		server->fs = NULL;
+	}
+	if (server->fs && ((config->maxObjectKB > 0) || (config->largeObjectKB > 0)) && (fs_largeObjects(server->fs,
+		KBVALUE * (size_t)config->maxObjectKB, KBVALUE * (size_t)config->largeObjectKB, KBVALUE * (size_t)config->largeBudgetKB) == -1)){
+		perror("server_init: while setting policy for large files");
+		fs_destroy(server->fs);
+		server->fs = NULL;
+	}
 	if (!server->fs){
+		free(server->repfds);
 		wpool_destroy(server->wpool);
+		if (server->conns) conntab_destroy(server->conns);
 		free(server);
 		return NULL;
 	}
 	
-	/* Initializes connection queue */
-	server->connQueue = tsqueue_init();
-	if (!server->connQueue){
+	/* Initializes connection queues (one for each class if there are bulk workers, that do NOT exist with reactors) */
+	memset(server->connQueue, 0, sizeof(server->connQueue));
+	memset(server->connRing, 0, sizeof(server->connRing));
+	memset(server->dispatched, 0, sizeof(server->dispatched));
+	server->bulkWorkers = ((server->engine == E_REACTOR) || (config->bulkWorkers < 0) ? 0 : config->bulkWorkers);
+	server->metaWorkers = server->wpool->nworkers - server->bulkWorkers;
+	server->wargs = NULL;
+	server->resizing = false;
+	server->rehashing = false;
+	server->dqueue = DQ_TSQUEUE;
+	if (config->dispatchQueue && strequal(config->dispatchQueue, "mpmc")) server->dqueue = DQ_MPMC;
+	else if (config->dispatchQueue && !strequal(config->dispatchQueue, "tsqueue")){
+		fprintf(stderr, "server_init: unknown dispatch queue '%s'\n", config->dispatchQueue);
+		server->dqueue = -1;
+	}
+	if (server->bulkWorkers >= server->wpool->nworkers){
+		fprintf(stderr, "server_init: BulkWorkers (%d) must be less than WorkersInPool (%d)\n", server->bulkWorkers, server->wpool->nworkers);
+		server->dqueue = -1;
+	}
+	bool qfailed = (server->dqueue == -1);
+	for (int dc = 0; !qfailed && (dc < (server->bulkWorkers > 0 ? DC_NCLASSES : 1)); dc++){
+		if (server->dqueue == DQ_MPMC) server->connRing[dc] = mpmcq_init(MPMCQ_DFL_SIZE);
+		else server->connQueue[dc] = tsqueue_init();
+		qfailed = (!server->connQueue[dc] && !server->connRing[dc]);
+	}
+	/* Initializes admission control */
+	server->admission = NULL;
+	memset(&server->deferred, 0, sizeof(server->deferred));
+	if (!qfailed && (config->clientRate > 0)){
+		server->admission = admtab_init((double)config->clientRate, (double)(config->clientBurst > 0 ? config->clientBurst : config->clientRate), 0);
+		qfailed = (!server->admission);
+	}
+	if (!qfailed) qfailed = (deflist_init(&server->deferred) == -1);
+	if (qfailed){
+		for (int dc = 0; dc < DC_NCLASSES; dc++){
+			if (server->connRing[dc]) mpmcq_destroy(server->connRing[dc], dummy);
+			if (server->connQueue[dc]) tsqueue_destroy(server->connQueue[dc], dummy);
+		}
+		if (server->admission) admtab_destroy(server->admission);
+		free(server->repfds);
 		wpool_destroy(server->wpool);
 		fs_destroy(server->fs);
+		if (server->conns) conntab_destroy(server->conns);
+		free(server);
 		return NULL;
 	}
 	return server;
 }
 
 
+/**
+ * @brief Classifies the ready request of client cfd by peeking its type.
+ * @return DC_BULK for a data request if there are bulk workers, DC_META
+ * otherwise (also when type has NOT arrived yet or connection is closed,
+ * such that it is detected by the worker).
+ */
+static int server_classify(server_t* server, int cfd){
+	if (server->bulkWorkers == 0) return DC_META;
+	switch (msg_peektype(cfd)){
+		case M_READF:
+		case M_FETCHF:
+		case M_READNF:
+		case M_WRITEF:
+		case M_APPENDF:
+		case M_PUTF:
+		case M_FETCHNF:
+		case M_PUTNF:
+			return DC_BULK;
+		default:
+			return DC_META;
+	}
+}
+
+
+/**
+ * @brief Admission control for the ready request of client cfd: if the
+ * client has NO token, request is added to #deferred (and cfd is NOT
+ * listened until it is admitted).
+ * @return 0 if request is admitted, 1 if it has been deferred, -1 on error.
+ */
+static int server_admit(server_t* server, deflist_t* deferred, int cfd, uint64_t now){
+	uint64_t wait;
+	if (!server->admission) return 0;
+	int ret = admtab_take(server->admission, cfd, now, &wait);
+	if (ret == 1) return (deflist_push(deferred, cfd, now + wait) == 0 ? 1 : -1);
+	return ret;
+}
+
+
+/**
+ * @brief Dispatches the ready request of client cfd (if admitted) on the
+ * queue of its class [manager].
+ * @return 0 on success, -1 on error.
+ */
+static int server_dispatch(server_t* server, int cfd, uint64_t now){
+	int ret = server_admit(server, &server->deferred, cfd, now);
+	if (ret != 0) return (ret == 1 ? 0 : -1);
+	int dc = server_classify(server, cfd);
+	server->dispatched[dc]++;
+	return CONNQ_PUSH(server, cfd, dc);
+}
+
+
+/**
+ * @brief Dispatches ALL the deferred requests whose clients have now a token [manager].
+ * @param wait -- Set to the nanoseconds until the next deferred request can be
+ * admitted, 0 if there is none.
+ * @return 0 on success, -1 on error.
+ */
+static int server_undefer(server_t* server, uint64_t* wait){
+	int cfd, ret;
+	uint64_t next;
+	uint64_t now = stats_now();
+	*wait = 0;
+	while ((ret = deflist_pop(&server->deferred, now, &cfd, &next)) == 0){
+		if (server_dispatch(server, cfd, now) == -1) return -1;
+	}
+	if (ret == -1) return -1;
+	if (next > 0) *wait = next - now; /* > 0 since all requests before now have been popped */
+	return 0;
+}
+
+
+void* server_worker(wArgs_t* wArgs);
+
+
+/**
+ * @brief Parses configuration file #path into #config (initialized by config_init).
+ * @return 0 on success, -1 on error.
+ */
+static int server_loadconfig(char* path, config_t* config){
+	icl_hash_t* dict = icl_hash_create(PARSEDICT_BUCKETS, NULL, NULL);
+	if (!dict) return -1;
+	if ( !parseFile(path, dict) ){
+		perror("Error on parseFile");
+		icl_hash_destroy(dict, free, free);
+		return -1;
+	}
+	if (config_parsedict(config, dict) != 0){
+		perror("Error on parseDict");
+		icl_hash_destroy(dict, free, free);
+		return -1;
+	}
+	SYSCALL_EXIT(icl_hash_destroy(dict, free, free), "icl_hash_destroy");
+	return 0;
+}
+
+
+/**
+ * @brief Changes the number of workers that serve DC_META requests to #n [manager]:
+ * new workers are spawned in wpool, while removed ones exit as soon as they pop
+ * a WORKER_EXIT item (i.e. after the requests already enqueued before it).
+ * @return 0 on success, -1 on error.
+ */
+static int server_resizePool(server_t* server, int n){
+	int old = server->wpool->nworkers;
+	if (n <= 0){ errno = EINVAL; return -1; }
+	for (; server->metaWorkers > n; server->metaWorkers--){
+		if (CONNQ_PUSHPTR(server, WORKER_EXIT, DC_META) == -1) return -1;
+	}
+	if (server->metaWorkers == n) return 0;
+	int k = n - server->metaWorkers;
+	wArgs_t** wargs = realloc(server->wargs, (old + k) * sizeof(wArgs_t*));
+	if (!wargs){ errno = ENOMEM; return -1; }
+	server->wargs = wargs;
+	memset(wargs + old, 0, k * sizeof(wArgs_t*));
+	int ret = 0;
+	for (int i = old; (ret == 0) && (i < old + k); i++){
+		wargs[i] = malloc(sizeof(wArgs_t));
+		if (!wargs[i]){ errno = ENOMEM; ret = -1; break; }
+		memset(wargs[i], 0, sizeof(wArgs_t));
+		wargs[i]->server = server;
+		wargs[i]->workerId = i+1;
+		wargs[i]->dclass = DC_META;
+	}
+	if (ret == 0) ret = wpool_grow(server->wpool, k, (void*(*)(void*))&server_worker, (void**)(wargs + old));
+	int errno_copy = errno;
+	for (int i = server->wpool->nworkers; i < old + k; i++){ free(wargs[i]); wargs[i] = NULL; } /* NOT spawned */
+	server->metaWorkers += server->wpool->nworkers - old;
+	errno = errno_copy;
+	return ret;
+}
+
+
+/**
+ * @brief Reloads the configuration file on SIGUSR1 [manager] and applies
+ * (while server is running) the new values of:
+ *	- WorkersInPool (NOT with reactors), by server_resizePool;
+ *	- StorageKB/MB/GBSize and MaxFileNo, by fs_resize steps executed by
+ *	manager between two rounds of dispatching (see server_resizeStep);
+ *	- FileStorageBuckets, by fs_rehash and then fs_rehash_step steps executed
+ *	as for fs_resize.
+ * All other parameters are ignored. Errors are NOT fatal.
+ */
+static void server_reload(server_t* server){
+	config_t config;
+	config_init(&config);
+	printf("\033[1;35mReloading configuration from '%s'\033[0m\n", configPath);
+	if (server_loadconfig(configPath, &config) == -1){
+		fprintf(stderr, "server_reload: invalid configuration file, nothing changed\n");
+		config_reset(&config);
+		return;
+	}
+	if ((server->engine != E_REACTOR) && (config.workersInPool > 0) && (config.workersInPool != server->metaWorkers + server->bulkWorkers)){
+		if (config.workersInPool <= server->bulkWorkers) fprintf(stderr, "server_reload: WorkersInPool must be greater than BulkWorkers (%d)\n", server->bulkWorkers);
+		else if (server_resizePool(server, config.workersInPool - server->bulkWorkers) == -1) perror("server_reload: while resizing workers pool");
+		printf("\033[1;35mserver_reload: workers = %d (%d for bulk requests)\033[0m\n", server->metaWorkers + server->bulkWorkers, server->bulkWorkers);
+	}
+	if ((config.storageSize > 0) && (config.maxFileNo > 0)){
+		server->newStorageCap = KBVALUE * (size_t)config.storageSize;
+		server->newMaxFileNo = config.maxFileNo;
+		server->resizing = true;
+	}
+	if (config.fileStorageBuckets > 0){
+		if (fs_rehash(server->fs, config.fileStorageBuckets) == -1) perror("server_reload: fs_rehash");
+		else server->rehashing = true;
+	}
+	config_reset(&config);
+}
+
+
+/**
+ * @brief Executes a step of the rehashing and of the resizing of the file
+ * storage requested by server_reload (if any) [manager].
+ */
+static void server_resizeStep(server_t* server){
+	if (server->rehashing && (fs_rehash_step(server->fs) != 1)){
+		server->rehashing = false;
+		printf("\033[1;35mserver_reload: file storage rehashed\033[0m\n");
+	}
+	if (!server->resizing) return;
+	int ret = fs_resize(server->fs, server->newStorageCap, server->newMaxFileNo, server->wHandler, server->chan);
+	if (ret == -1) perror("server_reload: fs_resize");
+	if (ret != 1){
+		server->resizing = false;
+		printf("\033[1;35mserver_reload: storage capacity = %lu bytes, max fileno = %d\033[0m\n", server->newStorageCap, server->newMaxFileNo);
+	}
+}
+
+
 /**
  * @brief Manager function.
  * @return 0 on success, -1 on error.
  */
 int server_manager(server_t* server){
 	int pres = 0;
-	int* nfd = NULL;
 	int cfd = 0;
 	int dispatched = 0;
+	uint64_t now, wait;
+	struct timespec timeout;
 	printf("Thread manager - start\n");
 	while (true){
 		
 		/* Mainloop 0 - Handle S_CLOSED server termination and reset readback array */
 		if ((serverState == S_CLOSED) && (server->nactives == 0)) break; /* Closing and no more client connections active */
 		memset(server->readback, 0, sizeof(server->readback));
+		server_resizeStep(server);
+		SYSCALL_EXIT(server_undefer(server, &wait), "server_manager: while dispatching deferred requests");
+		if (server->resizing || server->rehashing) wait = 0; /* Next step after a non-blocking round */
+		timeout.tv_sec = (time_t)(wait / 1000000000ULL);
+		timeout.tv_nsec = (long)(wait % 1000000000ULL);
 
-		/* Mainloop 1 - Handle pselect */
+		/* Mainloop 1 - Handle pselect (with a timeout for the next deferred request or resizing step, if any) */
 		server->rdset = server->saveset;
 		/* SIGNAL UMASKING IN PSELECT */
-		pres = pselect(server->maxlisten + 1, &server->rdset, NULL, NULL, NULL, &server->psmask);
+		pres = pselect(server->maxlisten + 1, &server->rdset, NULL, NULL, ((wait > 0) || server->resizing || server->rehashing ? &timeout : NULL), &server->psmask);
 		/* ALL SIGNALS ARE MASKED NOW */
 		if (pres == -1){
 			if (errno == EINTR){ /* Signal caught or other interrupt */
 				if (serverState != S_OPEN){
-					printf("\033[1;35mTermination signal caught (actives = %d) (enqueued = %lu)\033[0m\n", server->nactives, tsqueue_getSize(server->connQueue));
+					printf("\033[1;35mTermination signal caught (actives = %d) (enqueued = %lu)\033[0m\n", server->nactives, CONNQ_SIZE(server));
 					CLOSE_LSOCKET(server);
 				} /* No more connections (data in server->rdset are NOT valid!) */
 				if (serverState == S_CLOSED) continue;
@@ -577,21 +1355,20 @@ int server_manager(server_t* server){
 					server->maxlisten = -1;
 					break;
 				}
+				if (reloadRequested){ reloadRequested = 0; server_reload(server); }
+				continue; /* Data in server->rdset are NOT valid */
 			} else return -1;
-		} else if (pres == 0){ printf("Timeout expired\n"); continue; }/* Timeout expired with no ready fds */
+		} else if (pres == 0) continue; /* Timeout expired for a deferred request (or resizing step) with no ready fds */
 		/* Mainloop - 2 : Handle current listened clients */
+		now = (server->admission ? stats_now() : 0);
 		dispatched = 0;
 		cfd = 0;
 		while (dispatched < pres){
 			if (FD_ISSET(cfd, &server->rdset)){ /* Ready fd */
 				dispatched++;
 				if ((cfd == server->sockfd) || (cfd == server->pfd[0]) || (cfd == server->pfd[1])) continue; /* Handle them after */
-				nfd = malloc(sizeof(int));
-				if (!nfd) exit(EXIT_FAILURE); /* Unrecoverable error */
-				*nfd = cfd;
 				UNLISTEN(server, cfd); /* No problem with maxlisten updates */
-				SYSCALL_EXIT(tsqueue_push(server->connQueue, nfd), "server_manager: tsqueue_push");
-				nfd = NULL;
+				SYSCALL_EXIT(server_dispatch(server, cfd, now), "server_manager: while dispatching fd");
 			}
 			cfd++;
 		}
@@ -600,6 +1377,9 @@ int server_manager(server_t* server){
 			if ( FD_ISSET(server->sockfd, &server->rdset) ){
 				int newcfd;
 				SYSCALL_EXIT((newcfd = accept(server->sockfd, NULL, 0)), "server_manager: accept");
+				if ((server->family != AF_UNIX) && (server_tcpopts(server, newcfd) == -1)) perror("server_manager: setsockopt"); /* NOT fatal */
+				SYSCALL_EXIT(msg_setformat(newcfd, MSG_AUTO), "server_manager: msg_setformat"); /* Detected by first request */
+				if (server->admission){ SYSCALL_EXIT(admtab_reset(server->admission, newcfd, stats_now()), "server_manager: admtab_reset"); }
 				OPEN_CLCONN(server, newcfd);
 				server->accepted++;
 			}
@@ -619,177 +1399,460 @@ int server_manager(server_t* server){
 			}
 		}
 	} /* end of while loop */
-	tsqueue_close(server->connQueue); /* Unblocks all workers */
+	CONNQ_CLOSE(server); /* Unblocks all workers */
 	printf("\033[1;37mThread manager - exiting\033[0m\n");
 	return 0;
 }
 
 
+/**
+ * @brief Manager function for the epoll engine. Client connections are
+ * registered with EPOLLONESHOT, so any ready fd is disabled by the kernel
+ * until the worker that handles the request re-arms it (or closes it):
+ * there is no need for UNLISTEN/RELISTEN and for the fds pipe.
+ * With the reactor engine, manager ONLY accepts new connections and
+ * assigns them to reactors, that listen and handle their requests.
+ * @return 0 on success, -1 on error.
+ */
+int server_manager_epoll(server_t* server){
+	int pres = 0;
+	int cfd = 0;
+	uint64_t now, wait;
+	struct epoll_event ev;
+	printf("Thread manager - start\n");
+	while (true){
+		
+		/* Mainloop 0 - Handle S_CLOSED server termination */
+		if ((serverState == S_CLOSED) && (conntab_nactives(server->conns) == 0)) break;
+		
+		/* Mainloop 1 - Handle epoll_pwait (with a timeout for the next deferred request or resizing step, if any) */
+		server_resizeStep(server);
+		SYSCALL_EXIT(server_undefer(server, &wait), "server_manager_epoll: while dispatching deferred requests");
+		/* SIGNAL UMASKING IN EPOLL_PWAIT */
+		pres = epoll_pwait(server->epfd, server->events, EPOLL_MAXEVENTS, (server->resizing || server->rehashing ? 0 : (wait > 0 ? (int)NS_TOMS(wait) : -1)), &server->psmask);
+		/* ALL SIGNALS ARE MASKED NOW */
+		if (pres == -1){
+			if (errno == EINTR){ /* Signal caught or other interrupt */
+				if (serverState != S_OPEN){
+					printf("\033[1;35mTermination signal caught (actives = %d) (enqueued = %lu)\033[0m\n", conntab_nactives(server->conns), CONNQ_SIZE(server));
+					EPOLL_CLOSE_LSOCKET(server);
+				}
+				if (serverState == S_SHUTDOWN) break;
+				if (reloadRequested){ reloadRequested = 0; server_reload(server); }
+				continue;
+			} else return -1;
+		}
+		/* Mainloop 2 - Handle ready fds (ONLY them) */
+		now = (server->admission ? stats_now() : 0);
+		for (int i = 0; i < pres; i++){
+			cfd = server->events[i].data.fd;
+			if (cfd == server->evfd){ /* Last connection closed, just consume counter */
+				uint64_t cnt;
+				SYSCALL_EXIT(read(server->evfd, &cnt, sizeof(cnt)), "server_manager_epoll: eventfd read");
+			} else if (cfd == server->sockfd){ /* Accept new connection */
+				int newcfd;
+				SYSCALL_EXIT((newcfd = accept(server->sockfd, NULL, 0)), "server_manager_epoll: accept");
+				if ((server->family != AF_UNIX) && (server_tcpopts(server, newcfd) == -1)) perror("server_manager_epoll: setsockopt"); /* NOT fatal */
+				SYSCALL_EXIT(msg_setformat(newcfd, MSG_AUTO), "server_manager_epoll: msg_setformat"); /* Detected by first request */
+				SYSCALL_EXIT(conntab_open(server->conns, newcfd), "server_manager_epoll: conntab_open");
+				if (server->admission){ SYSCALL_EXIT(admtab_reset(server->admission, newcfd, stats_now()), "server_manager_epoll: admtab_reset"); }
+				memset(&ev, 0, sizeof(ev));
+				ev.events = EPOLLIN | EPOLLONESHOT;
+				ev.data.fd = newcfd;
+				/* With reactors, connection is registered in the epoll instance of its reactor */
+				SYSCALL_EXIT(epoll_ctl(conn_epfd(server->epfd, newcfd), EPOLL_CTL_ADD, newcfd, &ev), "server_manager_epoll: epoll_ctl");
+				server->accepted++;
+			} else { /* Client request (fd is now disabled until re-armed) */
+				SYSCALL_EXIT(server_dispatch(server, cfd, now), "server_manager_epoll: while dispatching fd");
+			}
+		}
+	} /* end of while loop */
+	if (server->engine == E_REACTOR){ /* stopfd stays readable, so ALL reactors are woken up */
+		uint64_t one = 1;
+		SYSCALL_EXIT(write(server->stopfd, &one, sizeof(one)), "server_manager_epoll: while stopping reactors");
+	} else CONNQ_CLOSE(server); /* Unblocks all workers */
+	printf("\033[1;37mThread manager - exiting\033[0m\n");
+	return 0;
+}
+
+
+/**
+ * @brief Receives and handles a single request from client connfd, then
+ * sends back connfd (or cleans up the client if connection has been closed)
+ * and handles ALL new lock owners.
+ * @param arena -- Arena for the received request (reset before returning).
+ * @return 0 on success, -1 on error.
+ */
+static int server_request(server_t* server, wArgs_t* wArgs, int connfd, marena_t* arena, llist_t** newowners){
+	int* cfd = &connfd; /* *cfd == connfd for the current request */
+	message_t* msg;
+	char* currFilePath = NULL;
+	int recv_ret, send_ret;
+	int popret;
+	int newowner = -1; /* New lock owner after an M_UNLOCKF */
+	recv_ret = mrecv_arena(*cfd, &msg, arena);
+	//In this case, cfd is ALWAYS released
+	if (recv_ret == -1){
+		marena_reset(arena);
+		/* Handles cleanup and sending back *cfd to manager */
+		if (*cfd < 0) fd_switch(cfd);
+		SYSCALL_EXIT( server_cleanup_handler(server, cfd, newowners) , "server_worker: while handling client cleanup");
+		return 0;
+	}
+	/* Successfully received message */
+	wArgs->requests++;
+	msg_t type = msg->type;
+	uint64_t start = stats_now();
+	switch(msg->type){
+		case M_OK:
+		case M_ERR:
+		case M_GETF: {
+			/* Invalid messages, we ignore them */
+			FD_SENDBACK(server, cfd);
+			break;
+		}
+		
+		case M_READF: { /* filename */
+			currFilePath = msg->args[0].content;
+			fbody_t* file_content;
+			size_t file_size;
+			READ_REQ_HANDLER(server, fs_read(server->fs, currFilePath, &file_content, &file_size, *cfd),
+				currFilePath, &file_content, &file_size, cfd, "fs_read");
+			break;
+		}
+
+		case M_FETCHF: { /* filename */
+			currFilePath = msg->args[0].content;
+			fbody_t* file_content;
+			size_t file_size;
+			READ_REQ_HANDLER(server, fs_fetch(server->fs, currFilePath, &file_content, &file_size, *cfd),
+				currFilePath, &file_content, &file_size, cfd, "fs_fetch");
+			break;
+		}
+		
+		case M_READNF: { /* fileno */
+			int* N = msg->args[0].content;
+			READNF_REQ_HANDLER(server, *N, cfd, "fs_cursor_init");
+			break;
+		}
+		
+		case M_CLOSEF: { /* filename */
+			currFilePath = msg->args[0].content;
+			int res = 0;
+			SIMPLE_REQ_HANDLER(server, fs_close(server->fs, currFilePath, *cfd), fs_close, cfd, "error while handling request", &res);
+			break;
+		}
+
+		case M_LOCKF: { /* filename, timeout (ms) */
+			currFilePath = msg->args[0].content;
+			int* msec = msg->args[1].content;
+			int res = 0;
+			SIMPLE_REQ_HANDLER(server, fs_lock(server->fs, currFilePath, *cfd, *msec), fs_lock, cfd, "error while handling request", &res);
+			if (res == 1) cfd = NULL; /* Need to wait for lock */
+			break;
+		}
+
+		case M_UNLOCKF: { /* filename */
+			currFilePath = msg->args[0].content;
+			int res = 0;
+			SIMPLE_REQ_HANDLER(server, fs_unlock(server->fs, currFilePath, *cfd, &newowner), fs_unlock, cfd, "error while handling request", &res);
+			break;
+		}
+
+		case M_REMOVEF: { /* filename */
+			currFilePath = msg->args[0].content;
+			int res = 0;
+			SIMPLE_REQ_HANDLER(server, fs_remove(server->fs, currFilePath, *cfd, server->wHandler, server->chan),
+				fs_remove, cfd, "server_worker: error while handling request", &res);
+			break;
+		}
+		
+		case M_OPENF: { /* filename, flags */
+			currFilePath = msg->args[0].content;
+			int* flags = msg->args[1].content;
+			bool locking = (*flags & O_LOCK);
+			int res = 0;
+			if (*flags & O_CREATE){
+				SIMPLE_REQ_HANDLER(server, fs_create(server->fs, currFilePath, *cfd, locking, server->wHandler, server->chan),
+					fs_create, cfd, "server_worker: error while handling request", &res);
+			} else {
+				SIMPLE_REQ_HANDLER(server, fs_open(server->fs, currFilePath, *cfd, locking), fs_open, cfd, "error while handling request", &res);
+			}
+			if (res == 1) cfd = NULL; /* Need to wait for lock */
+			break;
+		}
+		
+		case M_WRITEF: /* filename, content */
+		case M_APPENDF: { /* filename, content */
+			currFilePath = msg->args[0].content;
+			void* content = msg->args[1].content;
+			size_t size = msg->args[1].len;
+			bool wr = (msg->type == M_WRITEF ? true : false);
+			int res = 0;
+			SIMPLE_REQ_HANDLER(server, fs_write(server->fs, currFilePath, content, size, *cfd, wr, server->wHandler, &server_sbHandler, server->chan),
+				fs_write, cfd, "server_worker: error while handling request", &res);
+			break;
+		}
+
+		case M_PUTF: { /* filename, content */
+			currFilePath = msg->args[0].content;
+			void* content = msg->args[1].content;
+			size_t size = msg->args[1].len;
+			int res = 0;
+			SIMPLE_REQ_HANDLER(server, fs_put(server->fs, currFilePath, content, size, *cfd, server->wHandler, &server_sbHandler, server->chan),
+				fs_put, cfd, "server_worker: error while handling request", &res);
+			break;
+		}			
+
+		case M_FETCHNF: /* filename, ... */
+		case M_PUTNF: { /* filename, content, ... */
+			int res = (msg->type == M_FETCHNF ? server_fetchN(server, msg, cfd) : server_putN(server, msg, cfd));
+			if (res == -1){
+				CHECK_FATAL_EXIT(server); /* Checks non-recoverable errors */
+				perror("server_worker: error while handling batched request");
+				int error = errno;
+				message_t* reply;
+				send_ret = msend(*cfd, &reply, M_ERR, NULL, NULL, sizeof(error), &error);
+				HANDLE_SEND_RET(send_ret, cfd);
+			}
+			break;
+		}
+
+		case M_STATS: { /* flags (reserved) */
+			message_t* reply;
+			char* json;
+			size_t len;
+			int send_ret;
+			if (stats_json(&json, &len) == 0){
+				send_ret = msend(*cfd, &reply, M_STATS, NULL, NULL, len, json);
+				free(json);
+			} else {
+				perror("stats_json");
+				int error = errno;
+				send_ret = msend(*cfd, &reply, M_ERR, NULL, NULL, sizeof(error), &error);
+			}
+			HANDLE_SEND_RET(send_ret, cfd);
+			break;
+		}
+		default : {
+			if (*cfd >= 0) fd_switch(cfd);
+			break; /* Unknown message type, best thing to do is close connection */
+		}
+	} /* end of switch */
+	if ((type >= 0) && (type < MTYPES_SIZE)) stats_request(type, start);
+	marena_reset(arena); /* Request content is NOT used anymore */
+	msg = NULL;
+	/*
+	 * At that point, we have that:
+	 *	- cfd == NULL means that client is waiting for lock;
+	 *	- *cfd >= 0 means that connection is still active;
+	 *	- *cfd < 0 means that connection has been closed during handling.
+	*/
+	if (cfd){
+		if (*cfd < 0){
+			fd_switch(cfd); /* => >= 0 */
+			SYSCALL_EXIT( server_cleanup_handler(server, cfd, newowners) , "server_worker: while handling client cleanup");
+		} else { FD_SENDBACK(server, cfd); } /* server_cleanup_handler has ALREADY sent back cfd */
+		cfd = NULL;
+	}
+	/* Now cfd is ALWAYS NULL */
+	/* Handle the new lock owner after an unlock (if any) */
+	if (newowner >= 0){
+		cfd = &newowner;
+		send_ret = msend(*cfd, &msg, M_OK, NULL, NULL);
+		HANDLE_SEND_RET(send_ret, cfd);
+		if (*cfd < 0){ /* Connection closed */
+			fd_switch(cfd);
+			SYSCALL_EXIT( server_cleanup_handler(server, cfd, newowners) , "server_worker: while handling client cleanup");
+		} else { FD_SENDBACK(server, cfd); }
+		cfd = NULL;
+	}
+	/* Handle other(s) new lock owner(s) by client cleanups */
+	while ((*newowners)->size > 0){
+		SYSCALL_RETURN( (popret = llist_pop(*newowners, (void**)&cfd)), -1, "server_worker: while getting next lock owner");
+		if (popret == 1) break;
+		send_ret = msend(*cfd, &msg, M_OK, NULL, NULL);
+		HANDLE_SEND_RET(send_ret, cfd);
+		if (*cfd < 0){ /* Connection closed */
+			fd_switch(cfd);
+			SYSCALL_EXIT( server_cleanup_handler(server, cfd, newowners) , "server_worker: while handling client cleanup");
+		} else { FD_SENDBACK(server, cfd); }
+		free(cfd);
+		cfd = NULL;	
+	}
+	return 0;
+}
+
+
 /**
  * @brief Worker function.
  * @return (void*)0 on success, (void*)1 on error.
  */
 void* server_worker(wArgs_t* wArgs){
-	printf("Thread worker #%d - start\n", wArgs->workerId);
+	printf("Thread worker #%d - start%s\n", wArgs->workerId, (wArgs->dclass == DC_BULK ? " (bulk requests)" : ""));
 	server_t* server = wArgs->server;
 	int qret = 0;
-	int* cfd;
-	message_t* msg;
-	char* currFilePath;
-	int recv_ret, send_ret;
-	int popret;
+	void* items[WORKER_POPBATCH]; /* Batch of items popped from the dispatch queue */
+	int nitems = 0, next = 0; /* len(items), next item to handle */
+	bool removed = false; /* true <=> a WORKER_EXIT has been popped */
+	void* retval = (void*)0;
 	llist_t* newowners = llist_init(); /* For new lock owners unlocked during client cleanup */
 	if (!newowners){
 		printf("\033[1;37mThread worker #%d - exiting\033[0m\n", wArgs->workerId);
 		return (void*)1;
 	}
+	marena_t* arena = marena_init(MARENA_DFL_SIZE); /* For received requests, reset after each one */
+	if (!arena || (stats_register() == -1)){
+		if (arena) marena_destroy(arena);
+		llist_destroy(newowners, free);
+		printf("\033[1;37mThread worker #%d - exiting\033[0m\n", wArgs->workerId);
+		return (void*)1;
+	}
 	while (true){
-		currFilePath = NULL;
-		SYSCALL_EXIT( (qret = tsqueue_pop(server->connQueue, (void**)&cfd, false)) , "server_worker: tsqueue_pop");
-		if (qret > 0) break; /* Queue closed and empty */
-		recv_ret = mrecv(*cfd, &msg, "server_worker: mrecv", "server_worker: mrecv");
-		//In this case, cfd is ALWAYS freed
-		if (recv_ret == -1){
-			/* Handles cleanup and sending back *cfd to manager */
-			if (*cfd < 0) fd_switch(cfd);
-			SYSCALL_EXIT( server_cleanup_handler(server, cfd, &newowners) , "server_worker: while handling client cleanup");
-			fd_switch(cfd); /* < 0 */
-			FD_SENDBACK(server, cfd);
-			free(cfd);
-			cfd = NULL;
+		if (next == nitems){ /* Batch completed */
+			if (removed) break; /* Removed from the pool by server_reload */
+			next = 0;
+			if (server->dqueue == DQ_MPMC){
+				SYSCALL_EXIT( (nitems = mpmcq_pop(server->connRing[wArgs->dclass], items, WORKER_POPBATCH, false)) , "server_worker: mpmcq_pop");
+				if (nitems == 0) break; /* Queue closed and empty */
+			} else {
+				SYSCALL_EXIT( (qret = tsqueue_pop(server->connQueue[wArgs->dclass], &items[0], false)) , "server_worker: tsqueue_pop");
+				if (qret > 0) break; /* Queue closed and empty */
+				nitems = 1;
+			}
+		}
+		if (items[next] == WORKER_EXIT){ /* Any other one in the same batch is given back for another worker */
+			if (removed){ SYSCALL_EXIT(CONNQ_PUSHPTR(server, WORKER_EXIT, wArgs->dclass), "server_worker: while giving back exit item"); }
+			removed = true;
+			next++;
 			continue;
 		}
-		/* Successfully received message */
-		wArgs->requests++;
-		switch(msg->type){
-			case M_OK:
-			case M_ERR:
-			case M_GETF: {
-				/* Invalid messages, we ignore them */
-				FD_SENDBACK(server, cfd);
-				break;
-			}
-			
-			case M_READF: { /* filename */
-				currFilePath = msg->args[0].content;
-				void* file_content;
-				size_t file_size;
-				READ_REQ_HANDLER(server, currFilePath, &file_content, &file_size, cfd, "fs_read");
-				break;
-			}
-			
-			case M_READNF: { /* fileno */
-				int* N = msg->args[0].content;
-				llist_t* results = llist_init();
-				if (!results){ /* FATAL ERROR */
-					fprintf(stderr, "FATAL ERRROR when initializing list for readNFiles\n");
-					msg_destroy(msg, free, free);
-					exit(EXIT_FAILURE);
-				}
-				READNF_REQ_HANDLER(server, *N, cfd, &results, "fs_readN");
-				break;
-			}
-			
-			case M_CLOSEF: { /* filename */
-				currFilePath = msg->args[0].content;
-				int res = 0;
-				SIMPLE_REQ_HANDLER(server, fs_close(server->fs, currFilePath, *cfd), fs_close, cfd, "error while handling request", &res);
-				break;
-			}
-
-			case M_LOCKF: { /* filename */
-				currFilePath = msg->args[0].content;
-				int res = 0;
-				SIMPLE_REQ_HANDLER(server, fs_lock(server->fs, currFilePath, *cfd), fs_lock, cfd, "error while handling request", &res);
-				if (res == 1){ /* Need to wait for lock */
-					free(cfd);
-					cfd = NULL;
-				}
-				break;
-			}
+		int connfd = PTR_TOFD(items[next++]);
+		stats_dequeue(connfd);
+		if (server_request(server, wArgs, connfd, arena, &newowners) == -1){
+			retval = (void*)1;
+			break;
+		}
+	} /* end of while loop */
+	printf("\033[1;37mWorker #%d - exiting\033[0m\n", wArgs->workerId);
+	marena_destroy(arena);
+	SYSCALL_EXIT(llist_destroy(newowners, free), "Worker #%d - while destroying newowners queue\n");
+	return retval;
+}
 
-			case M_UNLOCKF: { /* filename */
-				currFilePath = msg->args[0].content;
-				int res = 0;
-				SIMPLE_REQ_HANDLER(server, fs_unlock(server->fs, currFilePath, *cfd, &newowners), fs_unlock, cfd, "error while handling request", &res);
-				break;
-			}
 
-			case M_REMOVEF: { /* filename */
-				currFilePath = msg->args[0].content;
-				int res = 0;
-				SIMPLE_REQ_HANDLER(server, fs_remove(server->fs, currFilePath, *cfd, &server_wHandler, server->pfd[1]),
-					fs_remove, cfd, "server_worker: error while handling request", &res);
-				break;
-			}
-			
-			case M_OPENF: { /* filename, flags */
-				currFilePath = msg->args[0].content;
-				int* flags = msg->args[1].content;
-				bool locking = (*flags & O_LOCK);
-				int res = 0;
-				if (*flags & O_CREATE){
-					SIMPLE_REQ_HANDLER(server, fs_create(server->fs, currFilePath, *cfd, locking, &server_wHandler, server->pfd[1]),
-						fs_create, cfd, "server_worker: error while handling request", &res);
-				} else {
-					SIMPLE_REQ_HANDLER(server, fs_open(server->fs, currFilePath, *cfd, locking), fs_open, cfd, "error while handling request", &res);
-				}
-				if (res == 1){
-					free(cfd);
-					cfd = NULL;
-				}
+/**
+ * @brief Reactor function (E_REACTOR engine): waits on its own epoll
+ * instance for the client connections assigned to it by the manager and
+ * handles each ready request inline, with NO hop through a dispatch queue.
+ * @note Connections are still registered with EPOLLONESHOT, since a client
+ * waiting for a lock is re-armed by the thread that unlocks the file (that
+ * could be another reactor).
+ * @return (void*)0 on success, (void*)1 on error.
+ */
+void* server_reactor(wArgs_t* wArgs){
+	printf("Thread reactor #%d - start\n", wArgs->workerId);
+	server_t* server = wArgs->server;
+	struct epoll_event events[REACTOR_MAXEVENTS];
+	int pres;
+	bool stop = false;
+	void* retval = (void*)0;
+	deflist_t deferred; /* Requests of own connections deferred for lack of tokens */
+	int cfd, dret;
+	uint64_t now, next;
+	llist_t* newowners = llist_init(); /* For new lock owners unlocked during client cleanup */
+	if (!newowners || (deflist_init(&deferred) == -1)){
+		if (newowners) llist_destroy(newowners, free);
+		printf("\033[1;37mThread reactor #%d - exiting\033[0m\n", wArgs->workerId);
+		return (void*)1;
+	}
+	marena_t* arena = marena_init(MARENA_DFL_SIZE); /* For received requests, reset after each one */
+	if (!arena || (stats_register() == -1)){
+		if (arena) marena_destroy(arena);
+		deflist_destroy(&deferred);
+		llist_destroy(newowners, free);
+		printf("\033[1;37mThread reactor #%d - exiting\033[0m\n", wArgs->workerId);
+		return (void*)1;
+	}
+	while (!stop){
+		/* Handles deferred requests whose clients have now a token (as server_undefer) */
+		now = stats_now();
+		while ((dret = deflist_pop(&deferred, now, &cfd, &next)) == 0){
+			int ret = server_admit(server, &deferred, cfd, now);
+			if ((ret == -1) || ((ret == 0) && (server_request(server, wArgs, cfd, arena, &newowners) == -1))){
+				dret = -1;
 				break;
 			}
-			
-			case M_WRITEF: /* filename, content */
-			case M_APPENDF: { /* filename, content */
-				currFilePath = msg->args[0].content;
-				void* content = msg->args[1].content;
-				size_t size = msg->args[1].len;
-				bool wr = (msg->type == M_WRITEF ? true : false);
-				int res = 0;
-				SIMPLE_REQ_HANDLER(server, fs_write(server->fs, currFilePath, content, size, *cfd, wr, &server_wHandler, &server_sbHandler, server->pfd[1]),
-					fs_write, cfd, "server_worker: error while handling request", &res);
+		}
+		if (dret == -1){
+			perror("server_reactor: while handling deferred requests");
+			retval = (void*)1;
+			break;
+		}
+		/* Termination signals are masked here and handled ONLY by manager */
+		pres = epoll_wait(wArgs->epfd, events, REACTOR_MAXEVENTS, (next > 0 ? (int)NS_TOMS(next - now) : -1));
+		if (pres == -1){
+			if (errno == EINTR) continue;
+			perror("server_reactor: epoll_wait");
+			retval = (void*)1;
+			break;
+		}
+		now = (server->admission ? stats_now() : 0);
+		for (int i = 0; i < pres; i++){
+			cfd = events[i].data.fd;
+			if (cfd == server->stopfd){ stop = true; continue; } /* Ready requests of this round are handled anyway */
+			int ret = server_admit(server, &deferred, cfd, now);
+			if ((ret == -1) || ((ret == 0) && (server_request(server, wArgs, cfd, arena, &newowners) == -1))){
+				retval = (void*)1;
+				stop = true;
 				break;
-			}			
-			default : {
-				if (*cfd >= 0) fd_switch(cfd);
-				break; /* Unknown message type, best thing to do is close connection */
 			}
-		} /* end of switch */
-		msg_destroy(msg, free, free);
-		msg = NULL;
-		/*
-		 * At that point, we have that:
-		 *	- cfd == NULL means that client is waiting for lock;
-		 *	- *cfd >= 0 means that connection is still active;
-		 *	- *cfd < 0 means that connection has been closed during handling.
-		*/
-		if (cfd){
-			if (*cfd < 0){
-				fd_switch(cfd); /* => >= 0 */
-				SYSCALL_EXIT( server_cleanup_handler(server, cfd, &newowners) , "server_worker: while handling client cleanup");
-				fd_switch(cfd);
-			}
-			FD_SENDBACK(server, cfd);
-			free(cfd);
-			cfd = NULL;
-		}
-		/* Now cfd is ALWAYS NULL and freed */
-		/* Handle other(s) new lock owner(s) */
-		while (newowners->size > 0){
-			SYSCALL_RETURN( (popret = llist_pop(newowners, (void**)&cfd)), NULL, "server_worker: while getting next lock owner");
-			if (popret == 1) break;
-			send_ret = msend(*cfd, &msg, M_OK, NULL, NULL);
-			HANDLE_SEND_RET(send_ret, cfd);
-			FD_SENDBACK(server, cfd);
-			free(cfd);
-			cfd = NULL;	
 		}
 	} /* end of while loop */
-	printf("\033[1;37mWorker #%d - exiting\033[0m\n", wArgs->workerId);
-	SYSCALL_EXIT(llist_destroy(newowners, free), "Worker #%d - while destroying newowners queue\n");
-	return (void*)0;
+	printf("\033[1;37mReactor #%d - exiting\033[0m\n", wArgs->workerId);
+	deflist_destroy(&deferred); /* Connections of deferred requests are closed by server_end */
+	marena_destroy(arena);
+	SYSCALL_EXIT(llist_destroy(newowners, free), "Reactor - while destroying newowners queue\n");
+	return retval;
+}
+
+
+/**
+ * @brief Equivalent of server_start for the epoll engine: instead of
+ * opening the pipe and initializing fd_sets, creates the epoll instance
+ * and the eventfd and registers them together with the listen socket.
+ * With the reactor engine, also creates one epoll instance per reactor,
+ * each one listening on stopfd, and spawns reactors instead of workers.
+ * @return 0 on success, -1 on error.
+ */
+int server_start_epoll(server_t* server, wArgs_t** wArgs){
+	struct epoll_event ev;
+	server->wHandler = &server_wHandler_epoll;
+	CLS_CHAN_RETURN( server, (server->epfd = epoll_create1(0)), "server_start: epoll_create1");
+	CLS_CHAN_RETURN( server, (server->evfd = eventfd(0, 0)), "server_start: eventfd");
+	CLS_CHAN_RETURN( server, server_listen(server), "server_start: while opening listen socket");
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = server->sockfd;
+	CLS_CHAN_RETURN( server, epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->sockfd, &ev), "server_start: epoll_ctl");
+	ev.data.fd = server->evfd;
+	CLS_CHAN_RETURN( server, epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->evfd, &ev), "server_start: epoll_ctl");
+	server->chan = server->epfd;
+	if (server->engine == E_REACTOR){
+		CLS_CHAN_RETURN( server, (server->stopfd = eventfd(0, 0)), "server_start: eventfd");
+		ev.data.fd = server->stopfd;
+		for (int i = 0; i < server->wpool->nworkers; i++){
+			CLS_CHAN_RETURN( server, (server->repfds[i] = epoll_create1(0)), "server_start: epoll_create1");
+			CLS_CHAN_RETURN( server, epoll_ctl(server->repfds[i], EPOLL_CTL_ADD, server->stopfd, &ev), "server_start: epoll_ctl");
+			wArgs[i]->epfd = server->repfds[i];
+		}
+		reactorEpfds = server->repfds;
+		nReactors = server->wpool->nworkers;
+		CLS_CHAN_RETURN( server, wpool_runAll(server->wpool, (void*(*)(void*))&server_reactor, (void**)wArgs), "server_start: wpool_runAll");
+		return 0;
+	}
+	CLS_CHAN_RETURN( server, wpool_runAll(server->wpool, (void*(*)(void*))&server_worker, (void**)wArgs), "server_start: wpool_runAll");
+	return 0;
 }
 
 
@@ -808,16 +1871,19 @@ void* server_worker(wArgs_t* wArgs){
  */
 int server_start(server_t* server, wArgs_t** wArgs){
 	if (!server || !wArgs) return -1;
+	server->wargs = wArgs;
+	SYSCALL_RETURN(fs_sweeper_start(server->fs, &server_sweepDone, &server_lockExpired, server), -1, "server_start: fs_sweeper_start");
+	if (server->engine != E_SELECT) return server_start_epoll(server, wArgs);
+	server->wHandler = &server_wHandler;
 	CLS_CHAN_RETURN( server, pipe(server->pfd), "server_start: pipe");
-	CLS_CHAN_RETURN( server, (server->sockfd = socket(AF_UNIX, SOCK_STREAM, 0)), "server_start: socket");
-	CLS_CHAN_RETURN( server, bind(server->sockfd, (const struct sockaddr*)(&server->sa), UNIX_PATH_MAX), "server_start: bind");
-	CLS_CHAN_RETURN( server, listen(server->sockfd, server->sockBacklog), "server_start: listen");
+	CLS_CHAN_RETURN( server, server_listen(server), "server_start: while opening listen socket");
 	CLS_CHAN_RETURN( server, wpool_runAll(server->wpool, (void*(*)(void*))&server_worker, (void**)wArgs), "server_start: wpool_runAll");
 	FD_SET(server->sockfd, &server->saveset);
 	FD_SET(server->pfd[0], &server->saveset);
 	FD_SET(server->sockfd, &server->rdset);
 	FD_SET(server->pfd[0], &server->rdset);
 	server->maxlisten = MAX(server->sockfd, server->pfd[0]); /* We are now listening these two */
+	server->chan = server->pfd[1];
 	return 0;
 }
 
@@ -831,26 +1897,31 @@ int server_start(server_t* server, wArgs_t** wArgs){
 int server_dump(server_t* server, wArgs_t** wArgsArray){
 	int retval = 0;
 	if (!server) return -1;
+	char* thread = (server->engine == E_REACTOR ? "reactor" : "worker");
 	printf("\033[1;36mSERVER DUMP\033[0m\n");
 	printf("%s total connections accepted = %d\n", SERVER_DUMP_CYAN, server->accepted);
 	printf("%s now dumping file storage information and statistics\n", SERVER_DUMP_CYAN);
 	fs_dumpAll(server->fs, stdout);
-	printf("%s now dumping workers information and statistics\n", SERVER_DUMP_CYAN);
+	printf("%s now dumping %ss information and statistics\n", SERVER_DUMP_CYAN, thread);
 	void* wret;
 	int avg_req_per_client = 0;
 	for (int i = 0; i < server->wpool->nworkers; i++){
 		if (wpool_retval(server->wpool, i, &wret) != 0){
-			printf("%s error while fetching thread worker #%d return value\n", SERVER_DUMP_CYAN, i);
+			printf("%s error while fetching thread %s #%d return value\n", SERVER_DUMP_CYAN, thread, i);
 			retval = -1;
 			break;
 		}
-		printf("%s thread worker #%d has received %d requests\n", SERVER_DUMP_CYAN, wArgsArray[i]->workerId, wArgsArray[i]->requests);
+		printf("%s thread %s #%d has received %d requests\n", SERVER_DUMP_CYAN, thread, wArgsArray[i]->workerId, wArgsArray[i]->requests);
 		avg_req_per_client += wArgsArray[i]->requests;
-		printf("%s thread worker #%d return value = %ld\n", SERVER_DUMP_CYAN, wArgsArray[i]->workerId, (long)wret);
+		printf("%s thread %s #%d return value = %ld\n", SERVER_DUMP_CYAN, thread, wArgsArray[i]->workerId, (long)wret);
 		if ((long)wret != 0) retval = 1;
 	}
 	printf("%s total requests received = %d\n", SERVER_DUMP_CYAN, avg_req_per_client);
-	printf("%s each client has sent ~%d requests\n", SERVER_DUMP_CYAN, avg_req_per_client/server->accepted);
+	if (server->bulkWorkers > 0) printf("%s requests dispatched to metadata workers = %ld, to bulk workers (%d) = %ld\n",
+		SERVER_DUMP_CYAN, server->dispatched[DC_META], server->bulkWorkers, server->dispatched[DC_BULK]);
+	if (server->admission) printf("%s admission control: %ld requests admitted, %ld deferrals (%.0f requests/s per client, burst = %.0f)\n",
+		SERVER_DUMP_CYAN, server->admission->admitted, server->admission->deferred, server->admission->rate, server->admission->burst);
+	printf("%s each client has sent ~%d requests\n", SERVER_DUMP_CYAN, (server->accepted > 0 ? avg_req_per_client/server->accepted : 0));
 	printf("\033[1;36mSERVER DUMP\033[0m\n");
 	return retval;
 }
@@ -865,9 +1936,11 @@ int server_dump(server_t* server, wArgs_t** wArgsArray){
 int server_end(server_t* server, wArgs_t** wArgsArray){
 	int retval = 0;
 	SYSCALL_RETURN(wpool_joinAll(server->wpool), -1, "server_end: wpool_joinAll");
+	SYSCALL_RETURN(fs_sweeper_stop(server->fs), -1, "server_end: fs_sweeper_stop"); /* Pending connections are closed below */
 	retval = server_dump(server, wArgsArray);
 	CLOSE_CHANNELS(server); /* Closes pipe and listen socket */
-	CLOSE_ALL_CFDS(server); /* Closed ALL (still active) client fds */
+	if (server->engine != E_SELECT) conntab_closeAll(server->conns);
+	else CLOSE_ALL_CFDS(server); /* Closed ALL (still active) client fds */
 	server->maxlisten = -1; /* No listening connection */
 	return retval;
 }
@@ -886,8 +1959,19 @@ int server_destroy(server_t* server){
 	if (!server) return -1;
 	CLOSE_CHANNELS(server);
 	SYSCALL_EXIT(wpool_destroy(server->wpool), "server_destroy");
-	SYSCALL_EXIT(tsqueue_destroy(server->connQueue, free), "server_destroy");
+	/* Items are NOT heap-allocated (FD_TOPTR) */
+	for (int dc = 0; dc < DC_NCLASSES; dc++){
+		if (server->connRing[dc]){ SYSCALL_EXIT(mpmcq_destroy(server->connRing[dc], dummy), "server_destroy"); }
+		if (server->connQueue[dc]){ SYSCALL_EXIT(tsqueue_destroy(server->connQueue[dc], dummy), "server_destroy"); }
+	}
+	if (server->admission){ SYSCALL_EXIT(admtab_destroy(server->admission), "server_destroy"); }
+	deflist_destroy(&server->deferred);
 	SYSCALL_EXIT(fs_destroy(server->fs), "server_destroy");
+	if (server->conns){ SYSCALL_EXIT(conntab_destroy(server->conns), "server_destroy"); }
+	free(server->repfds);
+	reactorEpfds = NULL;
+	nReactors = 0;
+	stats_destroy();
 	memset(server, 0, sizeof(*server));
 	free(server);
 	return 0;
@@ -899,7 +1983,7 @@ int main(int argc, char* argv[]){
 	config_t config;
 	server_t* server;
 	wArgs_t** wArgsArray; /* Array of worker arguments */
-	struct sigaction sa_term, sa_ign; /* For registering signal handlers */
+	struct sigaction sa_term, sa_ign, sa_reload; /* For registering signal handlers */
 	sigset_t sigmask; /* Sigmask for correct signal handling "dispatching" */
 	sigset_t oldmask;
 	llist_t* optvals; /* For parsing cmdline options */
@@ -916,6 +2000,11 @@ int main(int argc, char* argv[]){
 	SYSCALL_EXIT(sigaction(SIGHUP, &sa_term, NULL), "sigaction[SIGHUP]");
 	SYSCALL_EXIT(sigaction(SIGINT, &sa_term, NULL), "sigaction[SIGINT]");
 	SYSCALL_EXIT(sigaction(SIGQUIT, &sa_term, NULL), "sigaction[SIGQUIT]");
+	
+	/* Configuration reloading */
+	memset(&sa_reload, 0, sizeof(sa_reload));
+	sa_reload.sa_handler = reload_sighandler;
+	SYSCALL_EXIT(sigaction(SIGUSR1, &sa_reload, NULL), "sigaction[SIGUSR1]");
 
 	/* Ignoring SIGPIPE */
 	memset(&sa_ign, 0, sizeof(sa_ign));
@@ -925,6 +2014,7 @@ int main(int argc, char* argv[]){
 	SYSCALL_EXIT(sigaddset(&oldmask, SIGINT), "sigaddset");
 	SYSCALL_EXIT(sigaddset(&oldmask, SIGQUIT), "sigaddset");
 	SYSCALL_EXIT(sigaddset(&oldmask, SIGHUP), "sigaddset");
+	SYSCALL_EXIT(sigaddset(&oldmask, SIGUSR1), "sigaddset");
 	
 	/* Resetting signals */
 	SYSCALL_EXIT(pthread_sigmask(SIG_SETMASK, &oldmask, NULL), "sigmask");
@@ -958,19 +2048,8 @@ int main(int argc, char* argv[]){
 	/* Now configFile is set either to default path or to provided path with '-c' */
 	
 	/* Parsing config file */
-	icl_hash_t* dict = icl_hash_create(PARSEDICT_BUCKETS, NULL, NULL);
-	if (!dict) exit(EXIT_FAILURE);
-	if ( !parseFile(configFile, dict) ){
-		perror("Error on parseFile");
-		icl_hash_destroy(dict, free, free);
-		exit(EXIT_FAILURE);
-	}
-	if (config_parsedict(&config, dict) != 0){
-		perror("Error on parseDict");
-		icl_hash_destroy(dict, free, free);
-		exit(EXIT_FAILURE);
-	}
-	SYSCALL_EXIT(icl_hash_destroy(dict, free, free), "icl_hash_destroy");
+	configPath = configFile;
+	if (server_loadconfig(configFile, &config) == -1) exit(EXIT_FAILURE);
 
 	/* Initializing server */
 	server = server_init(&config, oldmask);
@@ -997,6 +2076,7 @@ int main(int argc, char* argv[]){
 		memset(wArgsArray[i], 0, sizeof(wArgs_t));
 		wArgsArray[i]->server = server;
 		wArgsArray[i]->workerId = i+1; /* Gli identificatori dei workers vanno da 1 a #workers */
+		wArgsArray[i]->dclass = (i >= server->wpool->nworkers - server->bulkWorkers ? DC_BULK : DC_META); /* Gli ultimi BulkWorkers */
 	}
 	
 	/* Starting server and spawning workers */
@@ -1007,7 +2087,9 @@ int main(int argc, char* argv[]){
 	}
 	
 	/* Mainloop and final joining/cleaning */
-	SYSCALL_EXIT(server_manager(server), "server_manager");
+	if (server->engine != E_SELECT){ SYSCALL_EXIT(server_manager_epoll(server), "server_manager_epoll"); }
+	else { SYSCALL_EXIT(server_manager(server), "server_manager"); }
+	wArgsArray = server->wargs; /* Workers can have been added by server_reload */
 	SYSCALL_EXIT((retval = server_end(server, wArgsArray)), "server_end");	
 	DESTROY_WARGS(wArgsArray, server->wpool->nworkers);
 	SYSCALL_EXIT(server_destroy(server), "server_destroy");
@@ -63,6 +63,36 @@ int	wpool_runAll(wpool_t* wpool, void*(*threadFun)(void*), void** args){
 }
 
 
+/**
+ * @brief Adds #n threads to a running pool, ALL with the same function.
+ * @param args -- Pointer to array of n arguments that new threads shall
+ * receive IN ORDER of creation.
+ * @note Threads are NEVER removed from the pool, hence a thread that has
+ * exited (e.g. when shrinking the pool) is joined by wpool_joinAll.
+ * @return 0 on success, -1 on error (pool contains ONLY the threads that
+ * have been successfully created).
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to allocate memory;
+ *	- any error by pthread_create.
+ */
+int wpool_grow(wpool_t* wpool, int n, void*(*threadFun)(void*), void** args){
+	if (!wpool || (n <= 0) || !args){ errno = EINVAL; return -1; }
+	pthread_t* workers = realloc(wpool->workers, (wpool->nworkers + n) * sizeof(pthread_t));
+	if (!workers){ errno = ENOMEM; return -1; }
+	wpool->workers = workers;
+	void** retvals = realloc(wpool->retvals, (wpool->nworkers + n) * sizeof(void*));
+	if (!retvals){ errno = ENOMEM; return -1; }
+	wpool->retvals = retvals;
+	for (int i = 0; i < n; i++){
+		int err = pthread_create(&wpool->workers[wpool->nworkers], NULL, threadFun, args[i]);
+		if (err != 0){ errno = err; return -1; }
+		wpool->retvals[wpool->nworkers++] = NULL;
+	}
+	return 0;
+}
+
+
 /**
  * @brief Joins the index-th thread in the pool, making its return value available
  * in the index-th field in wpool->retvals. 
@@ -121,3 +151,344 @@ int	wpool_destroy(wpool_t* wpool){
 	free(wpool);
 	return 0;
 }
+
+
+/* ************************************ CONNECTIONS TABLE ************************************ */
+
+/**
+ * @brief Initializes an empty connections table with an initial
+ * length of #size entries (DFL_CONNTAB_SIZE if size <= 0).
+ * @return Pointer to conntab_t object on success, NULL on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+conntab_t* conntab_init(int size){
+	if (size <= 0) size = DFL_CONNTAB_SIZE;
+	conntab_t* tab = malloc(sizeof(conntab_t));
+	if (!tab){ errno = ENOMEM; return NULL; }
+	memset(tab, 0, sizeof(conntab_t));
+	tab->conns = calloc(size, sizeof(conn_t*));
+	if (!tab->conns){ free(tab); errno = ENOMEM; return NULL; }
+	tab->size = size;
+	tab->nactives = 0;
+	MTX_INIT(&tab->lock, NULL);
+	return tab;
+}
+
+
+/**
+ * @brief Registers #fd as a new active connection, growing the table
+ * if fd does not fit in it.
+ * @return 0 on success, -1 on error, 1 if fd is already active.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to allocate memory (table is untouched).
+ */
+int conntab_open(conntab_t* tab, int fd){
+	if (!tab || (fd < 0)){ errno = EINVAL; return -1; }
+	int ret = 0;
+	LOCK(&tab->lock);
+	if (fd >= tab->size){
+		int newsize = tab->size;
+		while (newsize <= fd) newsize *= 2;
+		conn_t** p = realloc(tab->conns, newsize * sizeof(conn_t*));
+		if (!p){
+			UNLOCK(&tab->lock);
+			errno = ENOMEM;
+			return -1;
+		}
+		memset(p + tab->size, 0, (newsize - tab->size) * sizeof(conn_t*));
+		tab->conns = p;
+		tab->size = newsize;
+	}
+	if (!tab->conns[fd]){ /* Entries are kept until table destruction and reused with the same fd */
+		tab->conns[fd] = malloc(sizeof(conn_t));
+		if (!tab->conns[fd]){
+			UNLOCK(&tab->lock);
+			errno = ENOMEM;
+			return -1;
+		}
+		memset(tab->conns[fd], 0, sizeof(conn_t));
+		tab->conns[fd]->fd = fd;
+	}
+	if (tab->conns[fd]->active) ret = 1;
+	else {
+		tab->conns[fd]->active = true;
+		tab->nactives++;
+	}
+	UNLOCK(&tab->lock);
+	return ret;
+}
+
+
+/**
+ * @brief Marks connection #fd as closed and closes it.
+ * @note Since fd is closed while holding the table lock, a new connection
+ * that gets the same fd can be registered ONLY after this call.
+ * @return Number of connections still active on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments or fd is not an active connection.
+ */
+int conntab_close(conntab_t* tab, int fd){
+	if (!tab || (fd < 0)){ errno = EINVAL; return -1; }
+	int ret;
+	LOCK(&tab->lock);
+	if ((fd >= tab->size) || !tab->conns[fd] || !tab->conns[fd]->active){
+		UNLOCK(&tab->lock);
+		errno = EINVAL;
+		return -1;
+	}
+	tab->conns[fd]->active = false;
+	tab->nactives--;
+	close(fd);
+	ret = tab->nactives;
+	UNLOCK(&tab->lock);
+	return ret;
+}
+
+
+/**
+ * @brief Checks whether #fd is an active connection.
+ */
+bool conntab_isactive(conntab_t* tab, int fd){
+	if (!tab || (fd < 0)) return false;
+	bool ret;
+	LOCK(&tab->lock);
+	ret = ((fd < tab->size) && tab->conns[fd] && tab->conns[fd]->active);
+	UNLOCK(&tab->lock);
+	return ret;
+}
+
+
+/**
+ * @return Number of currently active connections, -1 on error (tab == NULL).
+ */
+int conntab_nactives(conntab_t* tab){
+	if (!tab){ errno = EINVAL; return -1; }
+	LOCK(&tab->lock);
+	int ret = tab->nactives;
+	UNLOCK(&tab->lock);
+	return ret;
+}
+
+
+/**
+ * @brief Closes ALL (still) active connections.
+ * @return 0 on success, -1 on error (tab == NULL).
+ */
+int conntab_closeAll(conntab_t* tab){
+	if (!tab){ errno = EINVAL; return -1; }
+	LOCK(&tab->lock);
+	for (int i = 0; i < tab->size; i++){
+		if (tab->conns[i] && tab->conns[i]->active){
+			close(i);
+			tab->conns[i]->active = false;
+		}
+	}
+	tab->nactives = 0;
+	UNLOCK(&tab->lock);
+	return 0;
+}
+
+
+/**
+ * @brief Destroys the table and frees all resources, WITHOUT closing
+ * any still active connection (for that, use conntab_closeAll).
+ * @return 0 on success, -1 on error (tab == NULL).
+ */
+int conntab_destroy(conntab_t* tab){
+	if (!tab){ errno = EINVAL; return -1; }
+	for (int i = 0; i < tab->size; i++) free(tab->conns[i]);
+	free(tab->conns);
+	MTX_DESTROY(&tab->lock);
+	free(tab);
+	return 0;
+}
+
+
+/**
+ * @brief Initializes a table of token buckets.
+ * @param rate -- Tokens refilled per second (> 0).
+ * @param burst -- Size of each bucket (>= 1).
+ * @param size -- Initial length of the table (<= 0 for DFL_ADMTAB_SIZE).
+ * @return Pointer to admtab_t object on success, NULL on error.
+ * Possible errors are:
+ *	- EINVAL: invalid rate or burst;
+ *	- ENOMEM: unable to allocate memory.
+ */
+admtab_t* admtab_init(double rate, double burst, int size){
+	if ((rate <= 0.0) || (burst < 1.0)){ errno = EINVAL; return NULL; }
+	if (size <= 0) size = DFL_ADMTAB_SIZE;
+	admtab_t* tab = malloc(sizeof(admtab_t));
+	if (!tab){ errno = ENOMEM; return NULL; }
+	memset(tab, 0, sizeof(admtab_t));
+	tab->buckets = calloc(size, sizeof(tbucket_t));
+	if (!tab->buckets){ free(tab); errno = ENOMEM; return NULL; }
+	tab->size = size;
+	tab->rate = rate;
+	tab->burst = burst;
+	MTX_INIT(&tab->lock, NULL);
+	return tab;
+}
+
+
+/**
+ * @brief Fills the bucket of #fd (e.g. for a newly accepted connection),
+ * growing the table if fd does not fit in it.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to allocate memory (table is untouched).
+ */
+int admtab_reset(admtab_t* tab, int fd, uint64_t now){
+	if (!tab || (fd < 0)){ errno = EINVAL; return -1; }
+	LOCK(&tab->lock);
+	if (fd >= tab->size){
+		int newsize = tab->size;
+		while (newsize <= fd) newsize *= 2;
+		tbucket_t* p = realloc(tab->buckets, newsize * sizeof(tbucket_t));
+		if (!p){
+			UNLOCK(&tab->lock);
+			errno = ENOMEM;
+			return -1;
+		}
+		memset(p + tab->size, 0, (newsize - tab->size) * sizeof(tbucket_t));
+		tab->buckets = p;
+		tab->size = newsize;
+	}
+	tab->buckets[fd].tokens = tab->burst;
+	tab->buckets[fd].last = now;
+	UNLOCK(&tab->lock);
+	return 0;
+}
+
+
+/**
+ * @brief Refills the bucket of #fd and tries to consume a token for a request.
+ * @param wait -- If there is NO token, it is set to the nanoseconds after which
+ * the next one will be available.
+ * @return 0 if request is admitted, 1 if it shall be deferred, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments or fd NOT registered by admtab_reset.
+ */
+int admtab_take(admtab_t* tab, int fd, uint64_t now, uint64_t* wait){
+	if (!tab || (fd < 0) || !wait){ errno = EINVAL; return -1; }
+	int ret = 0;
+	LOCK(&tab->lock);
+	if (fd >= tab->size){
+		UNLOCK(&tab->lock);
+		errno = EINVAL;
+		return -1;
+	}
+	tbucket_t* b = &tab->buckets[fd];
+	if (now > b->last){
+		b->tokens += tab->rate * (double)(now - b->last) / 1e9;
+		if (b->tokens > tab->burst) b->tokens = tab->burst;
+		b->last = now;
+	}
+	if (b->tokens >= 1.0){
+		b->tokens -= 1.0;
+		tab->admitted++;
+	} else {
+		*wait = (uint64_t)((1.0 - b->tokens) * 1e9 / tab->rate) + 1;
+		tab->deferred++;
+		ret = 1;
+	}
+	UNLOCK(&tab->lock);
+	return ret;
+}
+
+
+/**
+ * @brief Destroys the table and frees all resources.
+ * @return 0 on success, -1 on error (tab == NULL).
+ */
+int admtab_destroy(admtab_t* tab){
+	if (!tab){ errno = EINVAL; return -1; }
+	free(tab->buckets);
+	MTX_DESTROY(&tab->lock);
+	free(tab);
+	return 0;
+}
+
+
+/**
+ * @brief Initializes an (empty) list of deferred requests.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: l == NULL;
+ *	- ENOMEM: unable to allocate memory.
+ */
+int deflist_init(deflist_t* l){
+	if (!l){ errno = EINVAL; return -1; }
+	l->items = calloc(DFL_DEFERRED_SIZE, sizeof(deferred_t));
+	if (!l->items){ errno = ENOMEM; return -1; }
+	l->n = 0;
+	l->cap = DFL_DEFERRED_SIZE;
+	return 0;
+}
+
+
+/**
+ * @brief Defers the current request of #fd until time #when in O(log n).
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to allocate memory (list is untouched).
+ */
+int deflist_push(deflist_t* l, int fd, uint64_t when){
+	if (!l || (fd < 0)){ errno = EINVAL; return -1; }
+	if (l->n == l->cap){
+		deferred_t* p = realloc(l->items, 2 * l->cap * sizeof(deferred_t));
+		if (!p){ errno = ENOMEM; return -1; }
+		l->items = p;
+		l->cap *= 2;
+	}
+	/* Sift-up from the new leaf */
+	int i = l->n++;
+	while ((i > 0) && (l->items[(i - 1) / 2].when > when)){
+		l->items[i] = l->items[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	l->items[i].fd = fd;
+	l->items[i].when = when;
+	return 0;
+}
+
+
+/**
+ * @brief Removes the earliest deferred request if its time has come, in
+ * O(log n) (the earliest time is read in O(1)).
+ * @param fd -- On success, it is set to the client connection of the request.
+ * @param next -- If NO request can be removed, it is set to the earliest time
+ * of the remaining ones (0 if list is empty).
+ * @return 0 on success, 1 if NO request can be removed, -1 on error (EINVAL).
+ */
+int deflist_pop(deflist_t* l, uint64_t now, int* fd, uint64_t* next){
+	if (!l || !fd || !next){ errno = EINVAL; return -1; }
+	*next = 0;
+	if (l->n == 0) return 1;
+	if (l->items[0].when > now){ *next = l->items[0].when; return 1; }
+	*fd = l->items[0].fd;
+	/* Sift-down of the last leaf from the root */
+	deferred_t last = l->items[--l->n];
+	int i = 0, child;
+	while ((child = 2 * i + 1) < l->n){
+		if ((child + 1 < l->n) && (l->items[child + 1].when < l->items[child].when)) child++;
+		if (l->items[child].when >= last.when) break;
+		l->items[i] = l->items[child];
+		i = child;
+	}
+	l->items[i] = last;
+	return 0;
+}
+
+
+/**
+ * @brief Frees all resources of the list (remaining requests are dropped).
+ */
+void deflist_destroy(deflist_t* l){
+	if (!l) return;
+	free(l->items);
+	memset(l, 0, sizeof(*l));
+}
@@ -0,0 +1,271 @@
+#include <slab.h>
+
+/* Relaxed atomic accesses to statistics (single writer, see histogram.c) */
+#define SLAB_GET(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define SLAB_SET(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELAXED)
+
+/* Sizes of classes (steps of 16 bytes up to 128, then 4 classes for each power of 2) */
+static const size_t slabSizes[SLAB_NCLASSES] = {16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+	320, 384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048, 2560, 3072, 3584, 4096};
+
+/* Depots (indexed by class) */
+static slab_class_t slabClasses[SLAB_NCLASSES];
+
+/* Registered threads (a list to which items are ONLY prepended, as in stats.c) */
+static slab_cache_t* cacheHead = NULL;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER; /* Serializes registrations */
+
+/* Cache of the calling thread */
+static pthread_key_t cacheKey;
+static pthread_once_t slabOnce = PTHREAD_ONCE_INIT;
+
+
+/* ********************** STATIC OPERATIONS ********************** */
+
+/* Gives back ALL the free objects of a terminated thread to the depots (its statistics are kept) */
+static void slab_flush(void* arg){
+	slab_cache_t* cache = arg;
+	for (int i = 0; i < SLAB_NCLASSES; i++){
+		if (!cache->free[i]) continue;
+		slab_obj_t* tail = cache->free[i];
+		while (tail->next) tail = tail->next;
+		LOCK(&slabClasses[i].lock);
+		tail->next = slabClasses[i].head;
+		slabClasses[i].head = cache->free[i];
+		slabClasses[i].nfree += cache->nfree[i];
+		UNLOCK(&slabClasses[i].lock);
+		cache->free[i] = NULL;
+		SLAB_SET(&cache->nfree[i], 0);
+	}
+}
+
+
+static void slab_init(void){
+	for (int i = 0; i < SLAB_NCLASSES; i++){
+		slabClasses[i].size = slabSizes[i];
+		MTX_INIT(&slabClasses[i].lock, NULL);
+	}
+	pthread_key_create(&cacheKey, slab_flush);
+}
+
+
+/* @return Class of an object of #size bytes (size <= SLAB_MAXSIZE) */
+static int slab_class(size_t size){
+	if (size <= 128) return (size > 0 ? (int)((size - 1) / 16) : 0);
+	int lo = 8, hi = SLAB_NCLASSES - 1; /* slabSizes[hi] >= size */
+	while (lo < hi){
+		int mid = (lo + hi) / 2;
+		if (slabSizes[mid] >= size) hi = mid;
+		else lo = mid + 1;
+	}
+	return lo;
+}
+
+
+/* @return Cache of the calling thread (registered at first call), NULL if it CANNOT be allocated */
+static slab_cache_t* slab_cache(void){
+	pthread_once(&slabOnce, slab_init);
+	slab_cache_t* cache = pthread_getspecific(cacheKey);
+	if (cache) return cache;
+	cache = malloc(sizeof(slab_cache_t));
+	if (!cache) return NULL;
+	memset(cache, 0, sizeof(slab_cache_t));
+	if (pthread_setspecific(cacheKey, cache) != 0){
+		free(cache);
+		return NULL;
+	}
+	LOCK(&cacheLock);
+	cache->next = cacheHead;
+	ATOMIC_SET(&cacheHead, cache); /* Published only after being completely initialized */
+	UNLOCK(&cacheLock);
+	return cache;
+}
+
+
+/**
+ * @brief Takes at most #n free objects of class c from its depot, allocating
+ * a new chunk if it is empty (class lock MUST be held).
+ * @return List of objects (*count is its length), NULL on error (ENOMEM).
+ */
+static slab_obj_t* slab_take(slab_class_t* c, int n, int* count){
+	if (!c->head){ /* Carves a new chunk */
+		size_t nobjs = MAX(SLAB_CHUNK / c->size, SLAB_MINOBJS);
+		char* chunk = malloc(nobjs * c->size);
+		if (!chunk){ errno = ENOMEM; return NULL; }
+		for (size_t i = 0; i < nobjs; i++){
+			slab_obj_t* obj = (slab_obj_t*)(chunk + i * c->size);
+			obj->next = (i + 1 < nobjs ? (slab_obj_t*)(chunk + (i + 1) * c->size) : NULL);
+		}
+		c->head = (slab_obj_t*)chunk;
+		c->nfree += nobjs;
+		c->nchunks++;
+		c->reserved += nobjs * c->size;
+	}
+	slab_obj_t* head = c->head;
+	slab_obj_t* tail = head;
+	*count = 1;
+	while ((*count < n) && tail->next){
+		tail = tail->next;
+		(*count)++;
+	}
+	c->head = tail->next;
+	c->nfree -= *count;
+	tail->next = NULL;
+	return head;
+}
+
+
+/* ********************** MAIN OPERATIONS ********************** */
+
+/**
+ * @brief Allocates an object of #size bytes (NOT initialized).
+ * @return Pointer to object on success, NULL on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+void* slab_alloc(size_t size){
+	if (size > SLAB_MAXSIZE){
+		slab_cache_t* cache = slab_cache();
+		if (cache) SLAB_SET(&cache->bigAllocs, cache->bigAllocs + 1);
+		void* ptr = malloc(size);
+		if (!ptr) errno = ENOMEM;
+		return ptr;
+	}
+	int i = slab_class(size);
+	slab_class_t* c = &slabClasses[i];
+	slab_cache_t* cache = slab_cache();
+	slab_obj_t* obj;
+	if (!cache){ /* Directly from the depot */
+		int count;
+		LOCK(&c->lock);
+		obj = slab_take(c, 1, &count);
+		UNLOCK(&c->lock);
+		return obj;
+	}
+	if (!cache->free[i]){ /* Refills the cache */
+		int count;
+		LOCK(&c->lock);
+		cache->free[i] = slab_take(c, SLAB_BATCH, &count);
+		UNLOCK(&c->lock);
+		if (!cache->free[i]) return NULL;
+		SLAB_SET(&cache->nfree[i], count);
+	}
+	obj = cache->free[i];
+	cache->free[i] = obj->next;
+	SLAB_SET(&cache->nfree[i], cache->nfree[i] - 1);
+	SLAB_SET(&cache->allocs[i], cache->allocs[i] + 1);
+	SLAB_SET(&cache->requested[i], cache->requested[i] + size);
+	return obj;
+}
+
+
+/**
+ * @brief Frees an object allocated by slab_alloc(size) (ptr == NULL has no effect).
+ * @note size MUST be the same passed to slab_alloc.
+ */
+void slab_free(void* ptr, size_t size){
+	if (!ptr) return;
+	if (size > SLAB_MAXSIZE){
+		slab_cache_t* cache = slab_cache();
+		if (cache) SLAB_SET(&cache->bigFrees, cache->bigFrees + 1);
+		free(ptr);
+		return;
+	}
+	int i = slab_class(size);
+	slab_class_t* c = &slabClasses[i];
+	slab_cache_t* cache = slab_cache();
+	slab_obj_t* obj = ptr;
+	if (!cache){ /* Directly to the depot */
+		LOCK(&c->lock);
+		obj->next = c->head;
+		c->head = obj;
+		c->nfree++;
+		UNLOCK(&c->lock);
+		return;
+	}
+	obj->next = cache->free[i];
+	cache->free[i] = obj;
+	SLAB_SET(&cache->nfree[i], cache->nfree[i] + 1);
+	SLAB_SET(&cache->frees[i], cache->frees[i] + 1);
+	SLAB_SET(&cache->requested[i], cache->requested[i] - size);
+	if (cache->nfree[i] > 2 * SLAB_BATCH){ /* Gives back SLAB_BATCH objects to the depot */
+		slab_obj_t* head = cache->free[i];
+		slab_obj_t* tail = head;
+		for (int j = 1; j < SLAB_BATCH; j++) tail = tail->next;
+		cache->free[i] = tail->next;
+		SLAB_SET(&cache->nfree[i], cache->nfree[i] - SLAB_BATCH);
+		LOCK(&c->lock);
+		tail->next = c->head;
+		c->head = head;
+		c->nfree += SLAB_BATCH;
+		UNLOCK(&c->lock);
+	}
+}
+
+
+/**
+ * @brief Copies the string s ('\0' included) in an object of the allocator.
+ * @return Pointer to the copy on success, NULL on error (EINVAL, ENOMEM).
+ */
+char* slab_strdup(const char* s){
+	if (!s){ errno = EINVAL; return NULL; }
+	size_t len = strlen(s) + 1;
+	char* copy = slab_alloc(len);
+	if (copy) memcpy(copy, s, len);
+	return copy;
+}
+
+
+/**
+ * @brief Frees a string copied by slab_strdup (it can be used as a free
+ * function, e.g. for the keys of a hashtable).
+ */
+void slab_strfree(void* s){
+	if (s) slab_free(s, strlen((char*)s) + 1);
+}
+
+
+/**
+ * @brief Dumps the statistics of ALL the classes with at least a chunk
+ * (chunks, reserved bytes, objects in use, bytes requested by them, free
+ * objects and internal fragmentation, i.e. the fraction of the space of
+ * objects in use that has NOT been requested) and of the whole allocator
+ * (fragmentation, i.e. the fraction of reserved bytes NOT requested).
+ * @note This function can be called while other threads are allocating.
+ */
+void slab_dump(FILE* stream){
+	if (!stream) stream = stdout;
+	pthread_once(&slabOnce, slab_init);
+	size_t totReserved = 0;
+	uint64_t totRequested = 0;
+	long bigAllocs = 0, bigFrees = 0;
+	for (slab_cache_t* cache = ATOMIC_GET(&cacheHead); cache; cache = cache->next){
+		bigAllocs += SLAB_GET(&cache->bigAllocs);
+		bigFrees += SLAB_GET(&cache->bigFrees);
+	}
+	for (int i = 0; i < SLAB_NCLASSES; i++){
+		slab_class_t* c = &slabClasses[i];
+		LOCK(&c->lock);
+		int nchunks = c->nchunks;
+		size_t reserved = c->reserved;
+		long nfree = c->nfree;
+		UNLOCK(&c->lock);
+		if (nchunks == 0) continue;
+		long inuse = 0;
+		uint64_t requested = 0;
+		for (slab_cache_t* cache = ATOMIC_GET(&cacheHead); cache; cache = cache->next){
+			inuse += SLAB_GET(&cache->allocs[i]) - SLAB_GET(&cache->frees[i]);
+			requested += SLAB_GET(&cache->requested[i]);
+			nfree += SLAB_GET(&cache->nfree[i]);
+		}
+		size_t used = (inuse > 0 ? (size_t)inuse * c->size : 0);
+		fprintf(stream, "%s class %lu bytes: chunks = %d (%lu bytes), in use = %ld (%lu bytes requested), free = %ld, internal fragmentation = %.2f%%\n",
+			SLABDUMP_CYAN, c->size, nchunks, reserved, inuse, (unsigned long)requested, nfree,
+			(used > 0 ? 100.0 * (1.0 - (double)requested / used) : 0.0));
+		totReserved += reserved;
+		totRequested += requested;
+	}
+	fprintf(stream, "%s reserved = %lu bytes, requested = %lu bytes, fragmentation = %.2f%%\n", SLABDUMP_CYAN, totReserved,
+		(unsigned long)totRequested, (totReserved > 0 ? 100.0 * (1.0 - (double)totRequested / totReserved) : 0.0));
+	fprintf(stream, "%s allocations bigger than %d bytes = %ld (%ld freed)\n", SLABDUMP_CYAN, SLAB_MAXSIZE, bigAllocs, bigFrees);
+}
@@ -0,0 +1,237 @@
+#include <stats.h>
+#include <time.h>
+
+/* Names of message types in JSON output (indexed by msg_t, NULL if NOT a request) */
+static char* reqNames[MTYPES_SIZE] = {NULL, NULL, "open", "read", "readN", NULL, "write", "append",
+	"close", "lock", "unlock", "remove", "put", "fetch", "stats", "fetchN", "putN"};
+
+/* Names of contention points in JSON output (indexed by ST_*) */
+static char* waitNames[ST_NWAITS] = {"rop", "wop", "queue", "replace", "lock"};
+
+/* Registered threads (a list to which items are ONLY prepended, and that is destroyed by stats_destroy) */
+static stats_t* statsHead = NULL;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER; /* Serializes registrations */
+
+/* Statistics of the calling thread */
+static pthread_key_t statsKey;
+static pthread_once_t statsOnce = PTHREAD_ONCE_INIT;
+
+static void stats_keyinit(void){ pthread_key_create(&statsKey, NULL); }
+
+/**
+ * @brief Time (see stats_now) at which each fd has been pushed in the dispatch
+ * queue (0 if never): a two-level table of lazily allocated pages as the per-fd
+ * table in protocol.c, such that NO lock is needed.
+ */
+static uint64_t* dqPages[ST_NPAGES];
+
+
+/* ********************** STATIC OPERATIONS ********************** */
+
+static stats_t* stats_current(void){
+	pthread_once(&statsOnce, stats_keyinit);
+	return pthread_getspecific(statsKey);
+}
+
+
+/**
+ * @brief Gets the dispatch time of fd, allocating its page if create == true.
+ * @return Pointer to the entry on success, NULL if fd is out of range, or its
+ * page is not allocated and create == false, or on error (ENOMEM).
+ */
+static uint64_t* stats_dqslot(int fd, bool create){
+	if ((fd < 0) || (fd >= ST_PAGESIZE * ST_NPAGES)) return NULL;
+	uint64_t** slot = &dqPages[fd / ST_PAGESIZE];
+	uint64_t* page = ATOMIC_GET(slot);
+	if (!page && create){
+		uint64_t* newpage = calloc(ST_PAGESIZE, sizeof(uint64_t));
+		if (!newpage){ errno = ENOMEM; return NULL; }
+		if (ATOMIC_CAS(slot, &page, newpage)) page = newpage;
+		else free(newpage); /* Installed by another thread, page is now set to it */
+	}
+	return (page ? &page[fd % ST_PAGESIZE] : NULL);
+}
+
+
+static void stats_free(stats_t* st){
+	for (int i = 0; i < MTYPES_SIZE; i++){ if (st->reqs[i]) hist_destroy(st->reqs[i]); }
+	for (int i = 0; i < ST_NWAITS; i++){ if (st->waits[i]) hist_destroy(st->waits[i]); }
+	free(st);
+}
+
+
+/* Prints the merge of histogram #index (of reqs if isreq == true, else of waits) of ALL threads */
+static int stats_printMerged(FILE* stream, hist_t* tmp, int index, bool isreq){
+	hist_reset(tmp);
+	for (stats_t* st = ATOMIC_GET(&statsHead); st; st = st->next){
+		hist_merge(tmp, (isreq ? st->reqs[index] : st->waits[index]));
+	}
+	return hist_printJSON(tmp, stream, 1000.0);
+}
+
+
+/* ********************** MAIN OPERATIONS ********************** */
+
+/**
+ * @return Nanoseconds of the monotonic clock.
+ */
+uint64_t stats_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/**
+ * @brief Registers the calling thread, that from now on records its own statistics.
+ * @note Registering an already registered thread has no effect.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- ENOMEM: unable to allocate memory.
+ */
+int stats_register(void){
+	if (stats_current()) return 0;
+	stats_t* st = malloc(sizeof(stats_t));
+	if (!st){ errno = ENOMEM; return -1; }
+	memset(st, 0, sizeof(stats_t));
+	for (int i = 0; i < MTYPES_SIZE; i++){
+		if (!(st->reqs[i] = hist_init())){ stats_free(st); return -1; }
+	}
+	for (int i = 0; i < ST_NWAITS; i++){
+		if (!(st->waits[i] = hist_init())){ stats_free(st); return -1; }
+	}
+	if (pthread_setspecific(statsKey, st) != 0){
+		stats_free(st);
+		errno = ENOMEM;
+		return -1;
+	}
+	LOCK(&statsLock);
+	st->next = statsHead;
+	ATOMIC_SET(&statsHead, st); /* Published only after being completely initialized */
+	UNLOCK(&statsLock);
+	return 0;
+}
+
+
+/**
+ * @brief Records the handling time of a request of type #type started at #start (see stats_now).
+ * @return 0 on success (or if calling thread is NOT registered), -1 on error (invalid type).
+ */
+int stats_request(int type, uint64_t start){
+	if ((type < 0) || (type >= MTYPES_SIZE)){ errno = EINVAL; return -1; }
+	stats_t* st = stats_current();
+	if (st) hist_record(st->reqs[type], stats_now() - start);
+	return 0;
+}
+
+
+/**
+ * @brief Records the time spent at contention point #point starting from #start (see stats_now).
+ * @return 0 on success (or if calling thread is NOT registered), -1 on error (invalid point).
+ */
+int stats_wait(int point, uint64_t start){
+	if ((point < 0) || (point >= ST_NWAITS)){ errno = EINVAL; return -1; }
+	stats_t* st = stats_current();
+	if (st) hist_record(st->waits[point], stats_now() - start);
+	return 0;
+}
+
+
+/**
+ * @brief Marks fd as pushed NOW in the dispatch queue.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid fd;
+ *	- ENOMEM: unable to allocate a page of the table.
+ */
+int stats_enqueue(int fd){
+	uint64_t* slot = stats_dqslot(fd, true);
+	if (!slot){
+		if (errno != ENOMEM) errno = EINVAL;
+		return -1;
+	}
+	ATOMIC_SET(slot, stats_now());
+	return 0;
+}
+
+
+/**
+ * @brief Records (as ST_QUEUEWAIT) the time fd has spent in the dispatch queue
+ * since its last stats_enqueue.
+ * @return 0 on success (or if fd has never been marked), -1 on error (invalid fd).
+ */
+int stats_dequeue(int fd){
+	if ((fd < 0) || (fd >= ST_PAGESIZE * ST_NPAGES)){ errno = EINVAL; return -1; }
+	uint64_t* slot = stats_dqslot(fd, false);
+	uint64_t start = (slot ? ATOMIC_GET(slot) : 0);
+	return (start > 0 ? stats_wait(ST_QUEUEWAIT, start) : 0);
+}
+
+
+/**
+ * @brief Takes a snapshot of the statistics of ALL registered threads, merged
+ * together, as a JSON object (with latencies in microseconds) written in a
+ * heap-allocated buffer #*buf of *size bytes ('\0' included).
+ * @note This function can be called while other threads are recording.
+ * @return 0 on success, -1 on error.
+ * Possible errors are:
+ *	- EINVAL: invalid arguments;
+ *	- ENOMEM: unable to allocate memory.
+ */
+int stats_json(char** buf, size_t* size){
+	if (!buf || !size){ errno = EINVAL; return -1; }
+	hist_t* tmp = hist_init();
+	if (!tmp) return -1;
+	FILE* stream = open_memstream(buf, size);
+	if (!stream){
+		hist_destroy(tmp);
+		errno = ENOMEM;
+		return -1;
+	}
+	int nthreads = 0;
+	for (stats_t* st = ATOMIC_GET(&statsHead); st; st = st->next) nthreads++;
+	fprintf(stream, "{\"threads\": %d, \"unit\": \"us\", \"requests\": {", nthreads);
+	bool first = true;
+	for (int i = 0; i < MTYPES_SIZE; i++){
+		if (!reqNames[i]) continue;
+		fprintf(stream, "%s\"%s\": ", (first ? "" : ", "), reqNames[i]);
+		stats_printMerged(stream, tmp, i, true);
+		first = false;
+	}
+	fprintf(stream, "}, \"waits\": {");
+	for (int i = 0; i < ST_NWAITS; i++){
+		fprintf(stream, "%s\"%s\": ", (i ? ", " : ""), waitNames[i]);
+		stats_printMerged(stream, tmp, i, false);
+	}
+	fprintf(stream, "}}\n");
+	hist_destroy(tmp);
+	if (fclose(stream) == EOF){
+		free(*buf);
+		*buf = NULL;
+		errno = ENOMEM;
+		return -1;
+	}
+	(*size)++; /* '\0' */
+	return 0;
+}
+
+
+/**
+ * @brief Destroys the statistics of ALL registered threads and the table of dispatch times.
+ * @note There MUST NOT be any other thread using statistics.
+ * @return 0 on success.
+ */
+int stats_destroy(void){
+	stats_t* st = statsHead;
+	while (st){
+		stats_t* next = st->next;
+		stats_free(st);
+		st = next;
+	}
+	statsHead = NULL;
+	for (int i = 0; i < ST_NPAGES; i++){
+		free(dqPages[i]);
+		dqPages[i] = NULL;
+	}
+	return 0;
+}
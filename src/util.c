@@ -125,6 +125,64 @@ int writen(long fd, void *buf, size_t size) {
     return 1;
 }
 
+/**
+ * @brief Avoids partial writes of a scatter-gather array, by sending at most
+ * IOV_MAX elements per writev.
+ * @note iov elements are modified for handling partial writes.
+ * @return 1 on success, -1 on error (errno set),
+ * 0 if a writev returns a 0.
+ */
+int writevn(long fd, struct iovec* iov, int iovcnt) {
+    ssize_t r;
+    while (iovcnt > 0) {
+		if (iov->iov_len == 0) { iov++; iovcnt--; continue; }
+		if ((r=writev((int)fd, iov, (iovcnt > IOV_MAX ? IOV_MAX : iovcnt))) == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (r == 0) return 0;
+		while ((iovcnt > 0) && ((size_t)r >= iov->iov_len)) {
+			r -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (r > 0) {
+			iov->iov_base = (char*)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+    }
+    return 1;
+}
+
+/**
+ * @brief Avoids partial reads into a scatter-gather array, by reading at most
+ * IOV_MAX elements per readv.
+ * @note iov elements are modified for handling partial reads.
+ * @return 1 on success, -1 on error (errno set),
+ * 0 if during reading from fd EOF is read.
+ */
+int readvn(long fd, struct iovec* iov, int iovcnt) {
+    ssize_t r;
+    while (iovcnt > 0) {
+		if (iov->iov_len == 0) { iov++; iovcnt--; continue; }
+		if ((r=readv((int)fd, iov, (iovcnt > IOV_MAX ? IOV_MAX : iovcnt))) == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (r == 0) return 0;   // EOF
+		while ((iovcnt > 0) && ((size_t)r >= iov->iov_len)) {
+			r -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (r > 0) {
+			iov->iov_base = (char*)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+    }
+    return 1;
+}
+
 /* ------------------------------------------------------------------------------------ */
 
 bool isNumber(char* str){
@@ -22,8 +22,9 @@ echo -e "${GREEN}SECOND TEST - verifying replacement for storage capacity and re
 #	1. big1 shall expel the first lorem*.txt file encountered for file cap, then it shall be written on storage WITHOUT expelling anything else;
 #	2. big2 shall expel another lorem*.txt file for file cap, then it shall expel ALL lorem*.txt files that are still hosted on storage and even big1 for storage cap;
 #	3. big3 shall do nothing;
-#	4. overflow shall be added as created file but it shall not be written on storage, thus it shall appear with 0 bytes.
-#Finally, we expect to have *4* replacements for file cap (i.e. 4 files evicted by this) and *1* replacement for storage cap (i.e. 9 files evicted by this).
+#	4. overflow shall be rejected as a whole (EFBIG) because it is sent with a single put, thus it shall NOT be stored at all.
+#Finally, we expect to have *4* replacements for file cap (i.e. 4 files evicted by this) and *1* replacement for storage cap (i.e. 9 files evicted by this),
+#and the storage shall host ONLY big2 and big3.
 bin/client -p -f bin/tmp/serverSocket.sk -W test/test2files/big1, test/test2files/big2, test/test2files/big3, test/test2files/overflow -D test/test2files/bigrecvs
 
 wait $SERVER_PID
@@ -0,0 +1,82 @@
+#Set shell coloring for important messages
+GREEN='\033[1;32m' #bold green
+RED='\033[1;31m' #bold red
+RESET_COLOR='\033[0m'
+# get absolute path of current directory for the -r/-c flags (files are saved on the server using their absolute path)
+SCRIPTPATH="$( cd -- "$(dirname "$0")" >/dev/null 2>&1 ; pwd -P )" #.../SOL21Project/test
+
+SOCKET='bin/tmp/serverSocket.sk'
+OUT='bin/tmp/test4' #Server logs, configuration with lower capacity and received files
+FAILED=0
+
+#Starts server with config file $1, logging on $OUT/server$2.log
+start_server(){
+	rm -f ${SOCKET} #Left by a killed server
+	bin/server -c $1 > ${OUT}/server$2.log 2>&1 &
+	SERVER_PID=$!
+	sleep 1
+}
+
+#Checks that server log $1 contains the line $2
+check_log(){
+	if grep -a -q -F "$2" ${OUT}/server$1.log; then echo -e "${GREEN}OK: server$1.log contains '$2'${RESET_COLOR}"
+	else echo -e "${RED}FAILED: server$1.log does NOT contain '$2'${RESET_COLOR}"; FAILED=1; fi
+}
+
+#Checks that directories $1 and $2 have the same files with the same content
+check_diff(){
+	if diff -r $1 $2 > /dev/null 2>&1; then echo -e "${GREEN}OK: $2 restored correctly${RESET_COLOR}"
+	else echo -e "${RED}FAILED: $2 NOT restored correctly${RESET_COLOR}"; FAILED=1; fi
+}
+
+echo -e "${GREEN}Test4 is starting${RESET_COLOR}"
+rm -rf ${OUT} bin/tmp/persist
+mkdir -p ${OUT}
+
+echo -e "${GREEN}FIRST TEST - snapshot restore (with lz4 compression and extent deduplication)${RESET_COLOR}"
+#Write 14 files, then stop the server with SIGHUP: a snapshot of the storage is saved at termination
+start_server config4.txt 1
+bin/client -p -f ${SOCKET} -w test/test2files/minifiles -w test/test1files/rec
+kill -s SIGHUP ${SERVER_PID}
+wait ${SERVER_PID}
+#Restart the server from the snapshot and read back ALL the files
+start_server config4.txt 2
+bin/client -p -f ${SOCKET} -R 0 -d ${OUT}/recv1
+check_diff test/test2files/minifiles ${OUT}/recv1${SCRIPTPATH}/test2files/minifiles
+check_diff test/test1files/rec ${OUT}/recv1${SCRIPTPATH}/test1files/rec
+
+echo -e "${GREEN}SECOND TEST - journal replay after a crash${RESET_COLOR}"
+#Lock and remove a file and write a new one, then kill the server WITHOUT any snapshot: both operations are ONLY in the journal
+bin/client -p -t 100 -f ${SOCKET} -l ${SCRIPTPATH}/test2files/minifiles/lorem1.txt -c ${SCRIPTPATH}/test2files/minifiles/lorem1.txt -W test/test1files/file1
+sleep 1 #Group commit of the journal
+kill -s SIGKILL ${SERVER_PID}
+wait ${SERVER_PID} 2>/dev/null
+start_server config4.txt 3
+bin/client -p -f ${SOCKET} -r ${SCRIPTPATH}/test1files/file1 -d ${OUT}/recv2
+kill -s SIGHUP ${SERVER_PID}
+wait ${SERVER_PID}
+check_log 3 "current fileno = 14"
+check_diff test/test1files/file1 ${OUT}/recv2${SCRIPTPATH}/test1files/file1
+if grep -a -q -F "test2files/minifiles/lorem1.txt" ${OUT}/server3.log; then echo -e "${RED}FAILED: removed file has been restored${RESET_COLOR}"; FAILED=1
+else echo -e "${GREEN}OK: removed file has NOT been restored${RESET_COLOR}"; fi
+
+echo -e "${GREEN}THIRD TEST - restart with lower file capacity${RESET_COLOR}"
+#Restored files in excess are expelled before serving clients, and their removal is logged
+sed -e 's/MaxFileNo = 100/MaxFileNo = 10/' config4.txt > ${OUT}/config4.txt
+start_server ${OUT}/config4.txt 4
+kill -s SIGHUP ${SERVER_PID}
+wait ${SERVER_PID}
+check_log 4 "current fileno = 10"
+check_log 4 "TOTAL number of evicted files = 4"
+start_server config4.txt 5
+kill -s SIGHUP ${SERVER_PID}
+wait ${SERVER_PID}
+check_log 5 "current fileno = 10"
+
+if [ ${FAILED} -ne 0 ]; then
+	echo -e "${RED}Test4 failed${RESET_COLOR}"
+	exit 1
+fi
+echo -e "${GREEN}Test4 ended${RESET_COLOR}"
+
+exit 0
@@ -0,0 +1,72 @@
+#Set shell coloring for important messages
+GREEN='\033[1;32m' #bold green
+RED='\033[1;31m' #bold red
+RESET_COLOR='\033[0m'
+# get absolute path of current directory for the -r flag (files are saved on the server using their absolute path)
+SCRIPTPATH="$( cd -- "$(dirname "$0")" >/dev/null 2>&1 ; pwd -P )" #.../SOL21Project/test
+
+SOCKET='bin/tmp/serverSocket.sk'
+OUT='bin/tmp/test5' #Server logs, configurations, client outputs and received files
+FAILED=0
+
+#Engine configurations: each line is prepended to config5.txt (first occurrence of a key is the one used)
+ENGINES=("EventEngine = select\nDispatchQueue = tsqueue"
+	"EventEngine = epoll\nDispatchQueue = mpmc"
+	"ReactorThreads = 2")
+
+#Absolute paths of all the files in subdir 'test3files/$1', comma-separated
+abs_files(){
+	local list=""
+	for j in {0..9}; do list="${list}${list:+,}${SCRIPTPATH}/test3files/$1/file${j}"; done
+	echo ${list}
+}
+
+#Checks that directories $1 and $2 have the same files with the same content
+check_diff(){
+	if diff -r $1 $2 > /dev/null 2>&1; then echo -e "${GREEN}OK: $2 received correctly${RESET_COLOR}"
+	else echo -e "${RED}FAILED: $2 NOT received correctly${RESET_COLOR}"; FAILED=1; fi
+}
+
+#Checks that server statistics $1 report a positive count of requests of type $2
+check_stats(){
+	if grep -a -q -E "\"$2\": \{\"count\": [1-9]" $1; then echo -e "${GREEN}OK: $2 requests served${RESET_COLOR}"
+	else echo -e "${RED}FAILED: NO $2 request served${RESET_COLOR}"; FAILED=1; fi
+}
+
+echo -e "${GREEN}Test5 is starting${RESET_COLOR}"
+rm -rf ${OUT}
+mkdir -p ${OUT}
+
+for i in ${!ENGINES[@]}; do
+	echo -e "${GREEN}TEST $((i+1)) - $(echo -e ${ENGINES[$i]} | tr '\n' ' ')${RESET_COLOR}"
+	(echo -e "${ENGINES[$i]}"; cat config5.txt) > ${OUT}/config5_${i}.txt
+	rm -f ${SOCKET}
+	bin/server -c ${OUT}/config5_${i}.txt > ${OUT}/server${i}.log 2>&1 &
+	SERVER_PID=$!
+	sleep 1
+
+	#Batched writeFiles and readFiles (one request for ALL the files)
+	bin/client -p -f ${SOCKET} -w test/test3files/Files3 -r $(abs_files Files3) -d ${OUT}/recv${i}_batch > ${OUT}/client${i}_batch.log 2>&1
+	#One request for each file (open/write/close and open/read/close)
+	bin/client -p -t 1 -f ${SOCKET} -w test/test3files/Files4 -r $(abs_files Files4) -d ${OUT}/recv${i}_single > ${OUT}/client${i}_single.log 2>&1
+	#putFile and fetchFile (single M_PUTF / M_FETCHF request for each operation)
+	if bin/bench -f ${SOCKET} -t 1 -c 2 -d 2 -k 50 -m 50,30,10,10 > ${OUT}/bench${i}.log 2>&1 &&
+		awk '$1 ~ /^(read|write|append|lock)$/ && $3 != 0 { bad = 1 } END { exit bad }' ${OUT}/bench${i}.log; then
+		echo -e "${GREEN}OK: benchmark ended with NO error${RESET_COLOR}"
+	else echo -e "${RED}FAILED: benchmark ended with errors${RESET_COLOR}"; FAILED=1; fi
+	bin/client -f ${SOCKET} -s > ${OUT}/stats${i}.log 2>&1
+
+	kill -s SIGINT ${SERVER_PID}
+	wait ${SERVER_PID}
+	check_diff test/test3files/Files3 ${OUT}/recv${i}_batch${SCRIPTPATH}/test3files/Files3
+	check_diff test/test3files/Files4 ${OUT}/recv${i}_single${SCRIPTPATH}/test3files/Files4
+	for type in putN fetchN write read put fetch; do check_stats ${OUT}/stats${i}.log ${type}; done
+done
+
+if [ ${FAILED} -ne 0 ]; then
+	echo -e "${RED}Test5 failed${RESET_COLOR}"
+	exit 1
+fi
+echo -e "${GREEN}Test5 ended${RESET_COLOR}"
+
+exit 0
@@ -0,0 +1,82 @@
+#Set shell coloring for important messages
+GREEN='\033[1;32m' #bold green
+RED='\033[1;31m' #bold red
+RESET_COLOR='\033[0m'
+# get absolute path of current directory (files are saved on the server using their absolute path)
+SCRIPTPATH="$( cd -- "$(dirname "$0")" >/dev/null 2>&1 ; pwd -P )" #.../SOL21Project/test
+
+SOCKET='bin/tmp/serverSocket.sk'
+OUT='bin/tmp/test6' #Server log and configuration file to be reloaded
+FAILED=0
+
+#Total time duration of test and time of configuration reload
+TEST_TIME=10
+RELOAD_TIME=4
+
+#Checks that server log matches the (extended) regular expression $1
+check_log(){
+	if grep -a -q -E "$1" ${OUT}/server.log; then echo -e "${GREEN}OK: server.log contains '$1'${RESET_COLOR}"
+	else echo -e "${RED}FAILED: server.log does NOT contain '$1'${RESET_COLOR}"; FAILED=1; fi
+}
+
+echo -e "${GREEN}Test6 is starting${RESET_COLOR}"
+echo -e "${GREEN}Please wait ${TEST_TIME} seconds...${RESET_COLOR}"
+rm -rf ${OUT}
+mkdir -p ${OUT}
+
+#Starting server on a copy of the configuration file, that is then modified and reloaded
+cp config6.txt ${OUT}/config6.txt
+rm -f ${SOCKET}
+bin/server -c ${OUT}/config6.txt > ${OUT}/server.log 2>&1 &
+SERVER_PID=$!
+sleep 1
+
+#Client factories as in test3 (each client is subject to admission control)
+echo -e "${GREEN}Starting client factories...${RESET_COLOR}"
+pids=()
+for i in {0..3}; do
+	bash -c "test/client_factory.sh ${i}" > /dev/null 2>&1 &
+	pids+=($!)
+	sleep 0.1
+done
+#A client sending one request for each file (with a 1 ms delay) on the same connection exceeds ClientRate
+MINIFILES=$(ls -d ${SCRIPTPATH}/test2files/minifiles/* | tr '\n' ',' | sed 's/,$//')
+bin/client -t 1 -f ${SOCKET} -W ${MINIFILES} -r ${MINIFILES} -d ${OUT}/recv > /dev/null 2>&1 &
+pids+=($!)
+
+#Live reload under load: more workers, lower capacities (files in excess are expelled), more buckets (rehashed by steps)
+sleep ${RELOAD_TIME}
+echo -e "${GREEN}Reloading configuration...${RESET_COLOR}"
+sed -i -e 's/WorkersInPool = 2/WorkersInPool = 6/' -e 's/MaxFileNo = 100/MaxFileNo = 50/' \
+	-e 's/StorageMBSize = 32/StorageMBSize = 16/' -e 's/FileStorageBuckets = 100/FileStorageBuckets = 1000/' ${OUT}/config6.txt
+kill -s SIGUSR1 ${SERVER_PID}
+
+sleep $((TEST_TIME - RELOAD_TIME))
+kill -s SIGINT ${SERVER_PID}
+wait ${SERVER_PID}
+echo -e "${GREEN}Server ended with status $?${RESET_COLOR}"
+
+#Then we kill all client factories and all orphaned clients (if any)
+for i in "${pids[@]}"; do
+	kill -s SIGKILL ${i} 2>/dev/null
+	wait ${i} 2>/dev/null
+done
+kill -s SIGKILL $(pidof client) 2>/dev/null
+
+check_log "server_reload: workers = 6 \(1 for bulk requests\)"
+check_log "server_reload: storage capacity = 16777216 bytes, max fileno = 50"
+check_log "server_reload: file storage rehashed"
+check_log "storage capacity \(bytes\) = 16777216"
+check_log "max fileno = 50$"
+check_log "admission control: [0-9]+ requests admitted, [1-9][0-9]* deferrals"
+fileno=$(grep -a -o -E "current fileno = [0-9]+" ${OUT}/server.log | tail -n 1 | grep -o -E "[0-9]+$")
+if [ -n "${fileno}" ] && [ ${fileno} -le 50 ]; then echo -e "${GREEN}OK: ${fileno} files stored after reload${RESET_COLOR}"
+else echo -e "${RED}FAILED: too many files stored after reload (${fileno})${RESET_COLOR}"; FAILED=1; fi
+
+if [ ${FAILED} -ne 0 ]; then
+	echo -e "${RED}Test6 failed${RESET_COLOR}"
+	exit 1
+fi
+echo -e "${GREEN}Test6 ended${RESET_COLOR}"
+
+exit 0
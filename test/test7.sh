@@ -0,0 +1,57 @@
+#Set shell coloring for important messages
+GREEN='\033[1;32m' #bold green
+RED='\033[1;31m' #bold red
+RESET_COLOR='\033[0m'
+# get absolute path of current directory for the -l/-u flags (files are saved on the server using their absolute path)
+SCRIPTPATH="$( cd -- "$(dirname "$0")" >/dev/null 2>&1 ; pwd -P )" #.../SOL21Project/test
+
+SOCKET='bin/tmp/serverSocket.sk'
+OUT='bin/tmp/test7' #Server and clients logs
+FILE="${SCRIPTPATH}/test1files/file1"
+FAILED=0
+
+#Checks that log file $1 contains the line $2
+check_log(){
+	if grep -a -q -F "$2" ${OUT}/$1.log; then echo -e "${GREEN}OK: $1.log contains '$2'${RESET_COLOR}"
+	else echo -e "${RED}FAILED: $1.log does NOT contain '$2'${RESET_COLOR}"; FAILED=1; fi
+}
+
+echo -e "${GREEN}Test7 is starting${RESET_COLOR}"
+rm -rf ${OUT}
+mkdir -p ${OUT}
+
+rm -f ${SOCKET}
+bin/server -c config1.txt > ${OUT}/server.log 2>&1 &
+SERVER_PID=$!
+sleep 1
+
+bin/client -p -f ${SOCKET} -W test/test1files/file1 > ${OUT}/client.log 2>&1
+
+#Client A locks 'file1' and unlocks it after 2 seconds
+bin/client -p -t 2000 -f ${SOCKET} -l ${FILE} -u ${FILE} > ${OUT}/clientA.log 2>&1 &
+CLIENTA_PID=$!
+sleep 0.5
+
+#Client B waits for the lock at most 300 milliseconds: its request fails
+bin/client -p -f ${SOCKET} -L 300 -l ${FILE} > ${OUT}/clientB.log 2>&1
+if [ $? -eq 0 ]; then echo -e "${GREEN}OK: client B ended after lock timeout${RESET_COLOR}"
+else echo -e "${RED}FAILED: client B ended with error${RESET_COLOR}"; FAILED=1; fi
+
+#Client C waits for the lock at most 5 seconds: it gets the lock when client A releases it
+bin/client -p -f ${SOCKET} -L 5000 -l ${FILE} > ${OUT}/clientC.log 2>&1
+
+wait ${CLIENTA_PID}
+kill -s SIGHUP ${SERVER_PID}
+wait ${SERVER_PID}
+
+check_log clientB "[result = 'Lock waiting time expired']"
+check_log clientC "[result = 'Success']"
+check_log server "expired lock waits = 1"
+
+if [ ${FAILED} -ne 0 ]; then
+	echo -e "${RED}Test7 failed${RESET_COLOR}"
+	exit 1
+fi
+echo -e "${GREEN}Test7 ended${RESET_COLOR}"
+
+exit 0